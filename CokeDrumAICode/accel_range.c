@@ -0,0 +1,127 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <stdlib.h>
+
+#include "accel_range.h"
+
+static const lsm6dso_fs_xl_t rangeSettings[ACCEL_RANGE_COUNT] = {
+	[ACCEL_RANGE_2G] = LSM6DSO_2g,
+	[ACCEL_RANGE_4G] = LSM6DSO_4g,
+	[ACCEL_RANGE_8G] = LSM6DSO_8g,
+	[ACCEL_RANGE_16G] = LSM6DSO_16g
+};
+
+static uint8_t rangeFor(int range_g)
+{
+	uint8_t range = ACCEL_RANGE_2G;
+	while (range < ACCEL_RANGE_16G && (2 << range) < range_g) {
+		range++;
+	}
+	return range;
+}
+
+void AccelRange_Init(accel_range_t *selector, int initial_g, uint16_t clipCounts, float downHeadroom,
+	uint16_t holdBatches)
+{
+	const uint8_t range = rangeFor(initial_g);
+
+	*selector = (accel_range_t) {
+		.range = range,
+		.highestInWindow = range,
+		.clipCounts = clipCounts,
+		// One range down halves the full scale, so its counts are twice ours
+		.downCounts = (uint16_t)(downHeadroom * 32768.0f / 2.0f),
+		.holdBatches = holdBatches
+	};
+}
+
+void AccelRange_Observe(accel_range_t *selector, const int16_t counts[3])
+{
+	bool clipped = false;
+
+	for (int axis = 0; axis < 3; axis++) {
+		const uint16_t magnitude = (uint16_t)abs(counts[axis]);
+		if (magnitude > selector->batchPeak) {
+			selector->batchPeak = magnitude;
+		}
+		clipped |= magnitude >= selector->clipCounts;
+	}
+	if (clipped) {
+		selector->clipped = true;
+		selector->clippedSamples++;
+	}
+}
+
+bool AccelRange_EndBatch(accel_range_t *selector)
+{
+	const uint8_t previous = selector->range;
+
+	if (selector->fixed) {
+		selector->quietBatches = 0;
+	}
+	else if (selector->clipped) {
+		selector->quietBatches = 0;
+		if (selector->range < ACCEL_RANGE_16G) {
+			selector->range++;
+		}
+	}
+	else if (selector->range > ACCEL_RANGE_2G && selector->batchPeak < selector->downCounts) {
+		if (++selector->quietBatches >= selector->holdBatches) {
+			selector->quietBatches = 0;
+			selector->range--;
+		}
+	}
+	else {
+		selector->quietBatches = 0;
+	}
+
+	selector->clipped = false;
+	selector->batchPeak = 0;
+
+	if (selector->range == previous) {
+		return false;
+	}
+	if (selector->range > selector->highestInWindow) {
+		selector->highestInWindow = selector->range;
+	}
+	selector->switches++;
+	return true;
+}
+
+bool AccelRange_Fix(accel_range_t *selector, int range_g)
+{
+	selector->fixed = range_g > 0;
+	selector->quietBatches = 0;
+	if (!selector->fixed) {
+		return false;
+	}
+
+	const uint8_t range = rangeFor(range_g);
+	if (range == selector->range) {
+		return false;
+	}
+	selector->range = range;
+	if (range > selector->highestInWindow) {
+		selector->highestInWindow = range;
+	}
+	selector->switches++;
+	return true;
+}
+
+lsm6dso_fs_xl_t AccelRange_GetSetting(const accel_range_t *selector)
+{
+	return rangeSettings[selector->range];
+}
+
+int AccelRange_GetRange_g(const accel_range_t *selector)
+{
+	return 2 << selector->range;
+}
+
+int AccelRange_TakeWindowRange_g(accel_range_t *selector)
+{
+	int range_g = 2 << selector->highestInWindow;
+	selector->highestInWindow = selector->range;
+	return range_g;
+}
@@ -0,0 +1,87 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lsm6dso_reg.h"
+
+// Every range is a power of two times 2g, so samples from any range are brought to a common
+// unit, the 2g count (0.061 mg), by a shift.  The largest normalized value is 8 * 32768.
+#define ACCEL_RANGE_NORMALIZED_G_PER_LSB 0.000061f
+#define ACCEL_RANGE_NORMALIZED_MG_PER_LSB 0.061f
+
+enum { ACCEL_RANGE_2G = 0, ACCEL_RANGE_4G, ACCEL_RANGE_8G, ACCEL_RANGE_16G, ACCEL_RANGE_COUNT };
+
+/// <summary>
+///     Saturation detector and range selector for the accelerometer.  The caller observes every
+///     sample of a FIFO batch, then asks at the end of the batch whether to switch range.
+/// </summary>
+typedef struct {
+	uint8_t range;              // ACCEL_RANGE_*, the range samples are currently captured at
+	uint8_t highestInWindow;    // Largest range used since AccelRange_TakeWindowRange()
+	bool clipped;               // Some sample in this batch reached the clip level
+	uint16_t batchPeak;         // Largest |count| in this batch
+	uint16_t clipCounts;
+	uint16_t downCounts;        // A batch peak below this would fit in the next range down
+	uint16_t holdBatches;
+	uint16_t quietBatches;      // Consecutive batches that would have fitted a range down
+	bool fixed;                 // Held at range by AccelRange_Fix(), no automatic switching
+	uint32_t switches;
+	uint32_t clippedSamples;
+} accel_range_t;
+
+/// <summary>
+///     Initializes the selector at the range matching initial_g (2, 4, 8 or 16).
+/// </summary>
+/// <param name="clipCounts">|count| treated as clipped</param>
+/// <param name="downHeadroom">fraction of the lower range's full scale a batch must stay under to step down</param>
+/// <param name="holdBatches">consecutive quiet batches before stepping down</param>
+void AccelRange_Init(accel_range_t *selector, int initial_g, uint16_t clipCounts, float downHeadroom,
+	uint16_t holdBatches);
+
+/// <summary>
+///     Checks one raw sample, captured at the current range, for clipping.
+/// </summary>
+void AccelRange_Observe(accel_range_t *selector, const int16_t counts[3]);
+
+/// <summary>
+///     Brings one raw sample captured at the given range to 2g counts.
+/// </summary>
+static inline void AccelRange_Normalize(uint8_t range, const int16_t counts[3], int32_t normalized[3])
+{
+	for (int axis = 0; axis < 3; axis++) {
+		normalized[axis] = (int32_t)counts[axis] * (1 << range);
+	}
+}
+
+/// <summary>
+///     Decides on the range for the next batch and starts a new batch.  Steps up one range
+///     after any clipped sample, and down one after holdBatches consecutive quiet batches.
+/// </summary>
+/// <returns>true if the range changed and the caller must program the sensor</returns>
+bool AccelRange_EndBatch(accel_range_t *selector);
+
+/// <summary>
+///     Holds the range at range_g (2, 4, 8 or 16), or with 0 goes back to automatic ranging
+///     from the current range.
+/// </summary>
+/// <returns>true if the range changed and the caller must program the sensor</returns>
+bool AccelRange_Fix(accel_range_t *selector, int range_g);
+
+/// <summary>
+///     Full scale setting to program for the current range.
+/// </summary>
+lsm6dso_fs_xl_t AccelRange_GetSetting(const accel_range_t *selector);
+
+/// <summary>
+///     Current range in g.
+/// </summary>
+int AccelRange_GetRange_g(const accel_range_t *selector);
+
+/// <summary>
+///     Largest range, in g, used since the previous call, for tagging a window record.
+/// </summary>
+int AccelRange_TakeWindowRange_g(accel_range_t *selector);
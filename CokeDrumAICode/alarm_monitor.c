@@ -0,0 +1,45 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include "alarm_monitor.h"
+
+void AlarmMonitor_Init(alarm_monitor_t *alarm, float low, float high, float hysteresis, uint32_t holdoff_ms)
+{
+	*alarm = (alarm_monitor_t) {
+		.low = low,
+		.high = high,
+		.hysteresis = hysteresis,
+		.holdoff_ms = holdoff_ms
+	};
+}
+
+alarm_change_t AlarmMonitor_Update(alarm_monitor_t *alarm, float value, int64_t now_ms)
+{
+	if (alarm->active) {
+		if (value > alarm->high && value > alarm->peak) {
+			alarm->peak = value;
+		}
+		else if (value < alarm->low && value < alarm->peak) {
+			alarm->peak = value;
+		}
+
+		if (value < alarm->high - alarm->hysteresis && value > alarm->low + alarm->hysteresis) {
+			alarm->active = false;
+			return ALARM_CLEARED;
+		}
+		return ALARM_UNCHANGED;
+	}
+
+	if (value <= alarm->high && value >= alarm->low) {
+		return ALARM_UNCHANGED;
+	}
+	if (alarm->raised > 0 && now_ms - alarm->raisedAt_ms < (int64_t)alarm->holdoff_ms) {
+		return ALARM_UNCHANGED;
+	}
+
+	alarm->active = true;
+	alarm->peak = value;
+	alarm->raisedAt_ms = now_ms;
+	alarm->raised++;
+	return ALARM_RAISED;
+}
@@ -0,0 +1,37 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	ALARM_UNCHANGED = 0,
+	ALARM_RAISED,
+	ALARM_CLEARED
+} alarm_change_t;
+
+/// <summary>
+///     Threshold alarm on one measurement.  It is raised when the value goes above high or
+///     below low and cleared once it is back inside the band by the hysteresis.  A raise within
+///     holdoff_ms of the previous one is held back until the value crosses again after that.
+/// </summary>
+typedef struct {
+	float low;                  // -INFINITY for no lower limit
+	float high;                 // INFINITY for no upper limit
+	float hysteresis;
+	uint32_t holdoff_ms;
+	bool active;
+	float peak;                 // Furthest value outside the band while active
+	int64_t raisedAt_ms;
+	uint32_t raised;
+} alarm_monitor_t;
+
+void AlarmMonitor_Init(alarm_monitor_t *alarm, float low, float high, float hysteresis, uint32_t holdoff_ms);
+
+/// <summary>
+///     Checks a new value against the band.
+/// </summary>
+/// <returns>Whether the alarm was raised or cleared by it</returns>
+alarm_change_t AlarmMonitor_Update(alarm_monitor_t *alarm, float value, int64_t now_ms);
@@ -0,0 +1,446 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+/************************************************************************************************
+   Model file layout (little endian, every section a multiple of 4 bytes):
+
+   Header, 16 bytes
+      char     magic[4]            "CDAI"
+      uint16_t version             1
+      uint16_t inputCount          must be ANOMALY_FEATURE_COUNT
+      uint16_t layerCount          1..ANOMALY_MAX_LAYERS
+      uint16_t reserved
+      float    threshold           score at or above which a window is anomalous
+   float inputOffset[inputCount]   feature quantization: q = round((x - offset) * invScale)
+   float inputInvScale[inputCount]
+   Each layer
+      uint16_t inCount             first layer: inputCount, then the previous outCount
+      uint16_t outCount            last layer: inputCount
+      uint8_t  activation          anomaly_activation_t
+      uint8_t  reserved[3]
+      float    outputScale         int32 accumulator -> int8 output (last layer: -> input units)
+      int8_t   weights[outCount][inCount rounded up to ANOMALY_ROW_ALIGN], zero padded
+      int32_t  bias[outCount]
+*************************************************************************************************/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "anomaly_model.h"
+#include "heap_stats.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ANOMALY_USE_NEON
+#define KERNEL_NAME "NEON"
+#else
+#define KERNEL_NAME "scalar"
+#endif
+
+#define MODEL_MAGIC "CDAI"
+#define MODEL_VERSION 1
+#define MODEL_HEADER_SIZE 16
+#define LAYER_HEADER_SIZE 12
+
+// Columns processed per pass over the rows, sized so the activation slice stays in L1
+#define GEMV_BLOCK_COLS 256
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+// Set by AnomalyModel_SelfTest() if the NEON kernel can't be trusted on this target
+static bool useScalar = false;
+
+static uint16_t readU16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static float readF32(const uint8_t *p)
+{
+	float value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/// <summary>
+///     acc[r] += W[r][c] * x[c] over rows x cols, walked in column blocks.  cols is a multiple
+///     of ANOMALY_ROW_ALIGN.
+/// </summary>
+static void gemvInt8Scalar(const int8_t *w, size_t rowStride, const int8_t *x, size_t rows,
+	size_t cols, int32_t *acc)
+{
+	for (size_t c0 = 0; c0 < cols; c0 += GEMV_BLOCK_COLS) {
+		size_t c1 = (c0 + GEMV_BLOCK_COLS < cols) ? c0 + GEMV_BLOCK_COLS : cols;
+		for (size_t r = 0; r < rows; r++) {
+			const int8_t *row = w + r * rowStride;
+			int32_t sum = 0;
+			for (size_t c = c0; c < c1; c++) {
+				sum += (int32_t)row[c] * (int32_t)x[c];
+			}
+			acc[r] += sum;
+		}
+	}
+}
+
+#ifdef ANOMALY_USE_NEON
+static void gemvInt8Neon(const int8_t *w, size_t rowStride, const int8_t *x, size_t rows,
+	size_t cols, int32_t *acc)
+{
+	for (size_t c0 = 0; c0 < cols; c0 += GEMV_BLOCK_COLS) {
+		size_t c1 = (c0 + GEMV_BLOCK_COLS < cols) ? c0 + GEMV_BLOCK_COLS : cols;
+		for (size_t r = 0; r < rows; r++) {
+			const int8_t *row = w + r * rowStride;
+			int32x4_t sum = vdupq_n_s32(0);
+			for (size_t c = c0; c < c1; c += 16) {
+				int8x16_t wv = vld1q_s8(row + c);
+				int8x16_t xv = vld1q_s8(x + c);
+				// The quantizer keeps activations within +/-127, so the sum of two products
+				// always fits in int16
+				int16x8_t prod = vmull_s8(vget_low_s8(wv), vget_low_s8(xv));
+				prod = vmlal_s8(prod, vget_high_s8(wv), vget_high_s8(xv));
+				sum = vpadalq_s16(sum, prod);
+			}
+			int32x2_t pair = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+			acc[r] += vget_lane_s32(vpadd_s32(pair, pair), 0);
+		}
+	}
+}
+#endif
+
+static void gemvInt8(const int8_t *w, size_t rowStride, const int8_t *x, size_t rows, size_t cols,
+	int32_t *acc)
+{
+#ifdef ANOMALY_USE_NEON
+	if (!useScalar) {
+		gemvInt8Neon(w, rowStride, x, rows, cols, acc);
+		return;
+	}
+#endif
+	gemvInt8Scalar(w, rowStride, x, rows, cols, acc);
+}
+
+static int8_t saturateInt8(float value)
+{
+	long q = lroundf(value);
+	if (q > 127) {
+		return 127;
+	}
+	if (q < -127) {
+		return -127;
+	}
+	return (int8_t)q;
+}
+
+/// <summary>
+///     Walks the model file in the arena and fills in the layer table.
+/// </summary>
+/// <returns>0 if the file is well formed</returns>
+static int parseModel(anomaly_model_t *model)
+{
+	const uint8_t *p = model->arena;
+	const uint8_t *end = model->arena + model->arenaSize;
+
+	if (model->arenaSize < MODEL_HEADER_SIZE || memcmp(p, MODEL_MAGIC, 4) != 0 || readU16(p + 4) != MODEL_VERSION) {
+		Log_Debug("ERROR: anomaly model has a bad header\n");
+		return -1;
+	}
+
+	model->inputCount = readU16(p + 6);
+	model->layerCount = readU16(p + 8);
+	model->threshold = readF32(p + 12);
+	p += MODEL_HEADER_SIZE;
+
+	if (model->inputCount != ANOMALY_FEATURE_COUNT || model->layerCount == 0 || model->layerCount > ANOMALY_MAX_LAYERS) {
+		Log_Debug("ERROR: anomaly model expects %u inputs and %u layers, firmware provides %d features\n",
+			model->inputCount, model->layerCount, ANOMALY_FEATURE_COUNT);
+		return -1;
+	}
+
+	size_t inputTableSize = model->inputCount * sizeof(float);
+	if ((size_t)(end - p) < 2 * inputTableSize) {
+		return -1;
+	}
+	model->inputOffset = (const float *)p;
+	model->inputInvScale = (const float *)(p + inputTableSize);
+	p += 2 * inputTableSize;
+
+	uint16_t expectedIn = model->inputCount;
+	model->maxStride = ALIGN_UP(model->inputCount, ANOMALY_ROW_ALIGN);
+
+	for (int i = 0; i < model->layerCount; i++) {
+		anomaly_layer_t *layer = &model->layers[i];
+
+		if ((size_t)(end - p) < LAYER_HEADER_SIZE) {
+			return -1;
+		}
+		layer->inCount = readU16(p);
+		layer->outCount = readU16(p + 2);
+		layer->activation = p[4];
+		layer->outputScale = readF32(p + 8);
+		layer->rowStride = ALIGN_UP(layer->inCount, ANOMALY_ROW_ALIGN);
+		p += LAYER_HEADER_SIZE;
+
+		size_t weightSize = (size_t)layer->outCount * layer->rowStride;
+		size_t biasSize = (size_t)layer->outCount * sizeof(int32_t);
+		if (layer->inCount != expectedIn || layer->outCount == 0 || (size_t)(end - p) < weightSize + biasSize) {
+			Log_Debug("ERROR: anomaly model layer %d is malformed\n", i);
+			return -1;
+		}
+		layer->weights = (const int8_t *)p;
+		layer->bias = (const int32_t *)(p + weightSize);
+		p += weightSize + biasSize;
+
+		if (ALIGN_UP(layer->outCount, ANOMALY_ROW_ALIGN) > model->maxStride) {
+			model->maxStride = ALIGN_UP(layer->outCount, ANOMALY_ROW_ALIGN);
+		}
+		expectedIn = layer->outCount;
+	}
+
+	// It's an autoencoder, the last layer reconstructs the input
+	if (expectedIn != model->inputCount) {
+		Log_Debug("ERROR: anomaly model output size %u doesn't match its input\n", expectedIn);
+		return -1;
+	}
+
+	return 0;
+}
+
+int AnomalyModel_Load(anomaly_model_t *model, const char *relativePath)
+{
+	memset(model, 0, sizeof(*model));
+
+	int fd = Storage_OpenFileInImagePackage(relativePath);
+	if (fd < 0) {
+		Log_Debug("INFO: no anomaly model at %s: %s (%d)\n", relativePath, strerror(errno), errno);
+		return -1;
+	}
+
+	off_t fileSize = lseek(fd, 0, SEEK_END);
+	if (fileSize <= 0 || lseek(fd, 0, SEEK_SET) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	model->arenaSize = (size_t)fileSize;
+	model->arena = malloc(model->arenaSize);
+	if (model->arena == NULL) {
+		Log_Debug("ERROR: not enough memory for the anomaly model (%zu bytes)\n", model->arenaSize);
+		close(fd);
+		return -1;
+	}
+
+	size_t total = 0;
+	while (total < model->arenaSize) {
+		ssize_t n = read(fd, model->arena + total, model->arenaSize - total);
+		if (n <= 0) {
+			break;
+		}
+		total += (size_t)n;
+	}
+	close(fd);
+
+	if (total != model->arenaSize || parseModel(model) != 0) {
+		AnomalyModel_Unload(model);
+		return -1;
+	}
+
+	// Working buffers, zeroed so the padding columns contribute nothing
+	model->input = calloc(3, model->maxStride);
+	model->accumulators = calloc(model->maxStride, sizeof(int32_t));
+	if (model->input == NULL || model->accumulators == NULL) {
+		AnomalyModel_Unload(model);
+		return -1;
+	}
+	model->activations[0] = model->input + model->maxStride;
+	model->activations[1] = model->activations[0] + model->maxStride;
+
+	model->loaded = true;
+	Log_Debug("INFO: anomaly model loaded, %u layers, %zu bytes of RAM\n", model->layerCount,
+		AnomalyModel_GetMemoryUsage(model));
+	return 0;
+}
+
+void AnomalyModel_Unload(anomaly_model_t *model)
+{
+	free(model->arena);
+	free(model->input);
+	free(model->accumulators);
+	memset(model, 0, sizeof(*model));
+}
+
+void AnomalyModel_ExtractFeatures(const sensor_window_t *window, float features[ANOMALY_FEATURE_COUNT])
+{
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		float *f = &features[ch * ANOMALY_STATS_PER_CHANNEL];
+		f[0] = window->mean[ch];
+		f[1] = window->rms[ch];
+		f[2] = window->variance[ch];
+		f[3] = window->skewness[ch];
+		f[4] = window->kurtosis[ch];
+		f[5] = window->crestFactor[ch];
+		f[6] = window->peakToPeak[ch];
+		f[7] = window->min[ch];
+		f[8] = window->max[ch];
+	}
+}
+
+float AnomalyModel_Score(anomaly_model_t *model, const float features[ANOMALY_FEATURE_COUNT])
+{
+	if (!model->loaded) {
+		return 0.0f;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int8_t *input = model->input;
+	for (int i = 0; i < model->inputCount; i++) {
+		input[i] = saturateInt8((features[i] - model->inputOffset[i]) * model->inputInvScale[i]);
+	}
+
+	const int8_t *in = input;
+	int next = 0;
+	float score = 0.0f;
+
+	for (int l = 0; l < model->layerCount; l++) {
+		const anomaly_layer_t *layer = &model->layers[l];
+		int32_t *acc = model->accumulators;
+
+		memcpy(acc, layer->bias, layer->outCount * sizeof(int32_t));
+		gemvInt8(layer->weights, layer->rowStride, in, layer->outCount, layer->rowStride, acc);
+
+		if (l == model->layerCount - 1) {
+			// Reconstruction error against the quantized input
+			for (int i = 0; i < layer->outCount; i++) {
+				float diff = (float)acc[i] * layer->outputScale - (float)input[i];
+				score += diff * diff;
+			}
+			score /= (float)layer->outCount;
+			break;
+		}
+
+		int8_t *out = model->activations[next];
+		for (int i = 0; i < layer->outCount; i++) {
+			float value = (float)acc[i] * layer->outputScale;
+			if (layer->activation == ANOMALY_ACTIVATION_RELU && value < 0.0f) {
+				value = 0.0f;
+			}
+			out[i] = saturateInt8(value);
+		}
+		// Clear whatever a wider layer left in the padding the next layer will read
+		memset(out + layer->outCount, 0, ALIGN_UP(layer->outCount, ANOMALY_ROW_ALIGN) - layer->outCount);
+
+		in = out;
+		next ^= 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	model->inferences++;
+	model->inferenceNanoseconds += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ull + (uint64_t)(end.tv_nsec - start.tv_nsec);
+
+	return score;
+}
+
+size_t AnomalyModel_GetMemoryUsage(const anomaly_model_t *model)
+{
+	return model->arenaSize + 3 * (size_t)model->maxStride + (size_t)model->maxStride * sizeof(int32_t);
+}
+
+float AnomalyModel_GetInferencesPerSecond(const anomaly_model_t *model)
+{
+	if (model->inferenceNanoseconds == 0) {
+		return 0.0f;
+	}
+	return (float)(model->inferences * 1e9 / (double)model->inferenceNanoseconds);
+}
+
+// More than one column block plus a partial one, and rows of every extreme
+#define SELF_TEST_ROWS 5
+#define SELF_TEST_COLS (2 * GEMV_BLOCK_COLS + 3 * ANOMALY_ROW_ALIGN)
+
+int AnomalyModel_SelfTest(void)
+{
+	static int8_t w[SELF_TEST_ROWS][SELF_TEST_COLS];
+	static int8_t x[SELF_TEST_COLS];
+	int32_t acc[SELF_TEST_ROWS], reference[SELF_TEST_ROWS];
+	uint32_t seed = 0x1234567u;
+
+	// Weights and activations span the symmetric int8 range the quantizer produces.  The rows
+	// of all +127 and all -127 against a +/-127 input drive the int16 pair sums to their limit.
+	for (int c = 0; c < SELF_TEST_COLS; c++) {
+		seed = seed * 1664525u + 1013904223u;
+		x[c] = (c % 7 == 0) ? ((c & 8) ? 127 : -127) : (int8_t)((int32_t)(seed >> 24) % 255 - 127);
+		w[0][c] = 127;
+		w[1][c] = -127;
+		for (int r = 2; r < SELF_TEST_ROWS; r++) {
+			seed = seed * 1664525u + 1013904223u;
+			w[r][c] = (int8_t)((int32_t)(seed >> 24) % 255 - 127);
+		}
+	}
+
+	// Start from a bias so the kernels are checked adding to, not setting, the accumulators
+	for (int r = 0; r < SELF_TEST_ROWS; r++) {
+		acc[r] = reference[r] = 1000 * (r - 2);
+	}
+
+	useScalar = false;
+	gemvInt8(&w[0][0], SELF_TEST_COLS, x, SELF_TEST_ROWS, SELF_TEST_COLS, acc);
+	gemvInt8Scalar(&w[0][0], SELF_TEST_COLS, x, SELF_TEST_ROWS, SELF_TEST_COLS, reference);
+
+	for (int r = 0; r < SELF_TEST_ROWS; r++) {
+		if (acc[r] != reference[r]) {
+			Log_Debug("ERROR: %s anomaly kernel gives %d for row %d where scalar gives %d, using scalar\n",
+				KERNEL_NAME, acc[r], r, reference[r]);
+			useScalar = true;
+			return -1;
+		}
+	}
+
+	Log_Debug("INFO: anomaly scoring uses the %s kernel\n", KERNEL_NAME);
+	return 0;
+}
+
+void AnomalyModel_RunBenchmark(const char *relativePath, size_t inferenceCount)
+{
+	static anomaly_model_t model;
+	heap_stats_t before, after;
+
+	HeapStats_Get(&before);
+	if (AnomalyModel_Load(&model, relativePath) != 0) {
+		Log_Debug("Anomaly benchmark: no model to run\n");
+		return;
+	}
+	HeapStats_Get(&after);
+	const uint64_t loadBytes = after.bytesRequested - before.bytesRequested;
+
+	// Each feature anywhere in the range its quantizer maps to int8
+	float features[ANOMALY_FEATURE_COUNT];
+	uint32_t seed = 12345;
+	volatile float scoreSink = 0.0f;
+	const uint32_t heapCalls = HeapStats_Calls();
+	for (size_t n = 0; n < inferenceCount; n++) {
+		for (int i = 0; i < ANOMALY_FEATURE_COUNT; i++) {
+			seed = seed * 1664525u + 1013904223u;
+			const float unit = (float)(seed >> 8) / 8388608.0f - 1.0f;
+			features[i] = model.inputOffset[i] +
+				((model.inputInvScale[i] > 0.0f) ? unit * 127.0f / model.inputInvScale[i] : 0.0f);
+		}
+		scoreSink = AnomalyModel_Score(&model, features);
+	}
+	(void)scoreSink;
+
+	Log_Debug("Anomaly benchmark: %s kernel, %u inferences, %.0f inferences/s (%.1f us each), peak RAM %llu bytes "
+		"(%zu held), %u heap call(s) while scoring\n",
+		useScalar ? "scalar" : KERNEL_NAME, model.inferences, AnomalyModel_GetInferencesPerSecond(&model),
+		(model.inferences > 0) ? (double)model.inferenceNanoseconds / model.inferences / 1000.0 : 0.0,
+		(unsigned long long)loadBytes, AnomalyModel_GetMemoryUsage(&model), HeapStats_Calls() - heapCalls);
+	AnomalyModel_Unload(&model);
+}
@@ -0,0 +1,108 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_stats.h"
+
+// Statistics taken from each channel of a window record, in this order, to build the model
+// input: mean, rms, variance, skewness, kurtosis, crest factor, peak-to-peak, min, max.
+#define ANOMALY_STATS_PER_CHANNEL 9
+#define ANOMALY_FEATURE_COUNT (SENSOR_CHANNEL_COUNT * ANOMALY_STATS_PER_CHANNEL)
+
+#define ANOMALY_MAX_LAYERS 8
+
+// Weight rows (and activation vectors) are padded with zeros to a multiple of this many bytes
+// in the model file so the SIMD kernel never needs a tail loop.
+#define ANOMALY_ROW_ALIGN 16
+
+typedef enum {
+	ANOMALY_ACTIVATION_NONE = 0,
+	ANOMALY_ACTIVATION_RELU = 1
+} anomaly_activation_t;
+
+/// <summary>
+///     One int8 dense layer.  Pointers refer into the model arena.
+/// </summary>
+typedef struct {
+	uint16_t inCount;
+	uint16_t outCount;
+	uint16_t rowStride;          // inCount rounded up to ANOMALY_ROW_ALIGN
+	uint8_t activation;
+	float outputScale;           // Multiplier from the int32 accumulator to the int8 output
+	const int8_t *weights;       // outCount rows of rowStride bytes
+	const int32_t *bias;         // outCount values
+} anomaly_layer_t;
+
+/// <summary>
+///     A dense int8 autoencoder loaded from the image package.  The anomaly score of a window is
+///     the mean squared reconstruction error in quantized input units.
+/// </summary>
+typedef struct {
+	bool loaded;
+	uint16_t inputCount;
+	uint16_t layerCount;
+	uint16_t maxStride;
+	float threshold;
+	const float *inputOffset;
+	const float *inputInvScale;
+	anomaly_layer_t layers[ANOMALY_MAX_LAYERS];
+	uint8_t *arena;              // The model file, parsed in place
+	size_t arenaSize;
+	int8_t *input;               // Quantized input, kept to score the reconstruction against
+	int8_t *activations[2];      // Ping-pong buffers for the hidden layers, maxStride bytes each
+	int32_t *accumulators;       // maxStride values
+	uint32_t inferences;
+	uint64_t inferenceNanoseconds;
+} anomaly_model_t;
+
+/// <summary>
+///     Loads and validates a model from the image package.
+/// </summary>
+/// <param name="relativePath">Path of the model file inside the image package</param>
+/// <returns>0 on success, or -1 on failure (the model is left unloaded)</returns>
+int AnomalyModel_Load(anomaly_model_t *model, const char *relativePath);
+
+/// <summary>
+///     Releases the memory held by a loaded model.
+/// </summary>
+void AnomalyModel_Unload(anomaly_model_t *model);
+
+/// <summary>
+///     Builds the model input vector from a window record.
+/// </summary>
+void AnomalyModel_ExtractFeatures(const sensor_window_t *window, float features[ANOMALY_FEATURE_COUNT]);
+
+/// <summary>
+///     Runs the model and returns the anomaly score of the feature vector.
+/// </summary>
+float AnomalyModel_Score(anomaly_model_t *model, const float features[ANOMALY_FEATURE_COUNT]);
+
+/// <summary>
+///     Total heap used by the model: the arena plus the working buffers.
+/// </summary>
+size_t AnomalyModel_GetMemoryUsage(const anomaly_model_t *model);
+
+/// <summary>
+///     Inferences per second the model achieves on this CPU, measured over every call so far.
+/// </summary>
+float AnomalyModel_GetInferencesPerSecond(const anomaly_model_t *model);
+
+/// <summary>
+///     Runs the NEON kernel against the scalar one on synthetic weights, bias included.  If any
+///     accumulator differs, scoring falls back to the scalar kernel.  Without NEON there is
+///     only the scalar kernel and this passes.
+/// </summary>
+/// <returns>0 if the kernels match, -1 if scoring fell back to scalar</returns>
+int AnomalyModel_SelfTest(void);
+
+/// <summary>
+///     Loads a second copy of the model, scores inferenceCount synthetic feature vectors spread
+///     over its input range and logs the inferences per second and the peak RAM.  The peak is
+///     the heap taken to load, as scoring allocates nothing, which is checked.
+/// </summary>
+void AnomalyModel_RunBenchmark(const char *relativePath, size_t inferenceCount);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
 #include <azureiot/iothub_client_core_common.h>
 #include <azureiot/iothub_client_options.h>
@@ -11,6 +12,10 @@
 #include "azure_iot_utilities.h"
 #include "build_options.h"
 #include "connection_strings.h"
+#include "hub_quota.h"
+#include "send_window.h"
+#include "telemetry_queue.h"
+#include "twin_report.h"
 
 
 // Refer to https://docs.microsoft.com/en-us/azure/iot-hub/iot-hub-device-sdk-c-intro for more
@@ -65,6 +70,47 @@ static MessageReceivedFnType messageReceivedCb = 0;
 /// </summary>
 static MessageDeliveryConfirmationFnType messageDeliveryConfirmationCb = 0;
 
+/// <summary>
+///     'true' while the client is authenticated with the IoT Hub.  Until then messages are
+///     stored in the telemetry queue and replayed once it is.
+/// </summary>
+static bool hubAuthenticated = false;
+
+/// <summary>
+///     Messages handed to the client and awaiting confirmation, at most TELEMETRY_SEND_WINDOW,
+///     and those waiting their turn.  Each one's slot is its context in the client, so the
+///     client never holds more than the window.
+/// </summary>
+static send_window_t sendWindow;
+static bool sendWindowReady = false;
+
+/// <summary>
+///     When a stored message was last replayed, and the buffer it is read into.
+/// </summary>
+static int64_t lastReplay_ms = 0;
+static uint8_t replayBuffer[TELEMETRY_QUEUE_MAX_PAYLOAD];
+
+/// <summary>
+///     Paces sending to the daily message budget.  Set up with the send window.
+/// </summary>
+static hub_quota_t hubQuota;
+
+/// <summary>
+///     The reserved slot routine telemetry is being packed into, held until it is full or
+///     TELEMETRY_PACK_MAX_HOLD_SECONDS old, and the packing counters.
+/// </summary>
+static send_message_t *packMessage = NULL;
+static size_t packLength = 0;
+static uint16_t packCount = 0;
+static int64_t packStarted_ms = 0;
+static uint32_t packsSent = 0;
+static uint32_t messagesPacked = 0;
+static uint64_t packBytesSent = 0;
+
+_Static_assert(TELEMETRY_PACK_BYTES <= SEND_WINDOW_MAX_PAYLOAD, "A pack must fit in a message slot");
+_Static_assert(sizeof(TELEMETRY_PACK_SCHEMA) <= sizeof(((send_message_t *)0)->schema),
+               "The pack schema must fit in a message slot");
+
 /// <summary>
 ///     The handle to the IoT Hub client used for communication with the hub.
 /// </summary>
@@ -153,6 +199,7 @@ static const char azureIoTCertificatesX[] =
 
 // Forward declarations.
 static void sendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
+static void reportStatusCallback(int result, void *context);
 static IOTHUBMESSAGE_DISPOSITION_RESULT receiveMessageCallback(IOTHUB_MESSAGE_HANDLE message,
                                                                void *context);
 static void twinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payLoad,
@@ -163,6 +210,7 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
 static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
                                         void *userContextCallback);
+static void sealPack(void);
 
 #if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 #define MAXS_SIZE 512
@@ -284,10 +332,14 @@ bool AzureIoT_SetupClient(void)
 }
 
 /// <summary>
-///     Destroys the Azure IoT Hub client.
+///     Destroys the Azure IoT Hub client, storing the telemetry pack being held for replay.
 /// </summary>
 void AzureIoT_DestroyClient(void)
 {
+    // Nothing more goes out, so the pack being held is stored for the next run
+    hubAuthenticated = false;
+    sealPack();
+
     if (iothubClientHandle != NULL) {
         IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
         iothubClientHandle = NULL;
@@ -320,6 +372,400 @@ static void PeriodicLogVarArgs(time_t *lastInvokedTime, time_t periodInSeconds,
     }
 }
 
+static int64_t monotonicMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static send_window_t *getSendWindow(void)
+{
+    if (!sendWindowReady) {
+        const send_window_policy_t policy = { .window = TELEMETRY_SEND_WINDOW,
+                                              .maxRetries = TELEMETRY_SEND_MAX_RETRIES,
+                                              .backpressure = TELEMETRY_SEND_POLICY,
+                                              .weights = { [SEND_LANE_TELEMETRY] = TELEMETRY_LANE_WEIGHT,
+                                                           [SEND_LANE_EVENT] = EVENT_LANE_WEIGHT } };
+        SendWindow_Init(&sendWindow, &policy);
+        HubQuota_Init(&hubQuota, HUB_DAILY_MESSAGE_BUDGET, HUB_QUOTA_BURST_UNITS, monotonicMilliseconds());
+        sendWindowReady = true;
+    }
+    return &sendWindow;
+}
+
+/// <summary>
+///     Whether a new message has to go through the telemetry queue: the hub isn't connected, or
+///     stored messages are still being replayed and it has to wait its turn.  Alarms don't wait
+///     behind the stored backlog.
+/// </summary>
+static bool mustStoreMessage(send_lane_t lane)
+{
+    return iothubClientHandle == NULL || !hubAuthenticated ||
+           (lane != SEND_LANE_ALARM && TelemetryQueue_Count() > 0);
+}
+
+/// <summary>
+///     Stores a message the IoT Hub can't take now, to be replayed once it is connected, with
+///     the UTC time it was committed at (monotonic committedAt_ms).
+/// </summary>
+static void storeMessage(send_lane_t lane, const uint8_t *payload, size_t length,
+                         const char *contentType, const char *schema, int64_t committedAt_ms)
+{
+    const time_t committedAt = time(NULL) - (time_t)((monotonicMilliseconds() - committedAt_ms) / 1000);
+    if (TelemetryQueue_Append(lane, committedAt, payload, length, contentType, schema) == 0) {
+        LogMessage("INFO: message stored for replay, %u waiting\n", TelemetryQueue_Count());
+    } else {
+        LogMessage("WARNING: unable to store the message, it is lost\n");
+    }
+}
+
+/// <summary>
+///     Whether a stored message is in the send window, replays go one at a time.
+/// </summary>
+static bool replayInWindow(void)
+{
+    for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+        if (sendWindow.slots[i].state != SEND_SLOT_FREE && sendWindow.slots[i].storedSequence != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///     Hands waiting messages to the client while the window has room and the daily budget
+///     allows.  Alarms go regardless of the budget.
+/// </summary>
+static void sendWaitingMessages(void)
+{
+    send_message_t *message;
+    while (hubAuthenticated && (message = SendWindow_NextToSend(getSendWindow())) != NULL) {
+        if (!HubQuota_Take(&hubQuota, message->length, message->lane == SEND_LANE_ALARM,
+                           monotonicMilliseconds(), time(NULL))) {
+            return;
+        }
+
+        IOTHUB_MESSAGE_HANDLE messageHandle =
+            IoTHubMessage_CreateFromByteArray(message->payload, message->length);
+        if (messageHandle == 0) {
+            LogMessage("WARNING: unable to create a new IoTHubMessage\n");
+            return;
+        }
+
+        const bool json = (strcmp(message->contentType, "application/json") == 0);
+        IOTHUB_MESSAGE_RESULT result = IoTHubMessage_SetContentTypeSystemProperty(messageHandle, message->contentType);
+        if (result == IOTHUB_MESSAGE_OK) {
+            result = IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, json ? "utf-8" : "binary");
+        }
+        if (result == IOTHUB_MESSAGE_OK && message->schema[0] != '\0') {
+            result = IoTHubMessage_SetProperty(messageHandle, "schema", message->schema);
+        }
+        if (result == IOTHUB_MESSAGE_OK && message->storedSequence != 0) {
+            char sequence[12];
+            snprintf(sequence, sizeof(sequence), "%u", message->storedSequence);
+            result = IoTHubMessage_SetProperty(messageHandle, "seq", sequence);
+        }
+        if (result == IOTHUB_MESSAGE_OK && message->storedSequence != 0 && message->storedCommittedAt != 0) {
+            // Replays go out late, so they carry the time they were taken
+            const time_t committedAt = (time_t)message->storedCommittedAt;
+            struct tm utc;
+            char creationTime[32];
+            if (gmtime_r(&committedAt, &utc) != NULL &&
+                strftime(creationTime, sizeof(creationTime), "%Y-%m-%dT%H:%M:%SZ", &utc) > 0) {
+                result = IoTHubMessage_SetProperty(messageHandle, "iothub-creation-time-utc", creationTime);
+            }
+        }
+        if (result != IOTHUB_MESSAGE_OK) {
+            LogMessage("WARNING: unable to set the message properties\n");
+        }
+
+        const int64_t now_ms = monotonicMilliseconds();
+        if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, sendMessageCallback,
+                                                 message) != IOTHUB_CLIENT_OK) {
+            LogMessage("WARNING: failed to hand over the message to IoTHubClient\n");
+            IoTHubMessage_Destroy(messageHandle);
+            // Counts as a failed delivery; try again on the next call
+            SendWindow_MarkSent(&sendWindow, message, now_ms);
+            if (SendWindow_Confirm(&sendWindow, message, false, now_ms) == SEND_CONFIRM_GAVE_UP) {
+                if (message->storedSequence == 0) {
+                    storeMessage(message->lane, message->payload, message->length, message->contentType,
+                                 message->schema, message->committedAt_ms);
+                }
+                SendWindow_Release(message);
+            }
+            return;
+        }
+
+        SendWindow_MarkSent(&sendWindow, message, now_ms);
+        LogMessage("INFO: IoTHubClient accepted the %u byte message for delivery\n", message->length);
+        IoTHubMessage_Destroy(messageHandle);
+    }
+}
+
+/// <summary>
+///     Moves the next stored message, alarms first, into the send window, at most one every
+///     TELEMETRY_QUEUE_REPLAY_PERIOD_MS, once the window has nothing else waiting and the
+///     previous replay was confirmed.  It carries its "seq" application property so the backend
+///     can drop duplicates, and the time it was committed as "iothub-creation-time-utc".
+/// </summary>
+static void replayStoredMessage(void)
+{
+    if (!hubAuthenticated || SendWindow_HasWaiting(getSendWindow()) || replayInWindow() ||
+        TelemetryQueue_Count() == 0) {
+        return;
+    }
+
+    const int64_t now_ms = monotonicMilliseconds();
+    if (now_ms - lastReplay_ms < TELEMETRY_QUEUE_REPLAY_PERIOD_MS) {
+        return;
+    }
+    lastReplay_ms = now_ms;
+
+    telemetry_queue_message_t stored;
+    if (TelemetryQueue_Peek(&stored, replayBuffer, sizeof(replayBuffer)) != 0) {
+        return;
+    }
+
+    send_message_t *message =
+        SendWindow_Accept(&sendWindow,
+                          (stored.lane < SEND_LANE_COUNT) ? (send_lane_t)stored.lane : SEND_LANE_TELEMETRY,
+                          replayBuffer, stored.length, stored.contentType,
+                          (stored.schema[0] != '\0') ? stored.schema : NULL, now_ms);
+    if (message != NULL) {
+        message->storedSequence = stored.sequence;
+        message->storedCommittedAt = (stored.committedAt > 0) ? (uint32_t)stored.committedAt : 0;
+    }
+}
+
+/// <summary>
+///     Sends a message through the send window, or stores it when the hub isn't connected or
+///     the back-pressure policy spills it.
+/// </summary>
+static void commitNow(send_message_t *message, size_t length, const char *contentType,
+                      const char *schema)
+{
+    const send_lane_t lane = message->lane;
+    if (mustStoreMessage(lane)) {
+        storeMessage(lane, message->payload, length, contentType, schema, monotonicMilliseconds());
+        SendWindow_Cancel(message);
+        return;
+    }
+
+    if (SendWindow_Commit(&sendWindow, message, length, contentType, schema, monotonicMilliseconds()) == NULL) {
+        if (sendWindow.policy.backpressure == SEND_POLICY_SPILL) {
+            storeMessage(lane, message->payload, length, contentType, schema, monotonicMilliseconds());
+        } else {
+            LogMessage("WARNING: send window full, message dropped\n");
+        }
+        SendWindow_Cancel(message);
+    }
+    sendWaitingMessages();
+}
+
+/// <summary>
+///     Sends the pack being held, closing its array if it holds more than one message.
+/// </summary>
+static void sealPack(void)
+{
+    if (packMessage == NULL) {
+        return;
+    }
+    send_message_t *message = packMessage;
+    packMessage = NULL;
+    if (packCount > 1) {
+        message->payload[packLength++] = ']';
+    }
+    packsSent++;
+    messagesPacked += packCount;
+    packBytesSent += packLength;
+    commitNow(message, packLength, "application/json", (packCount > 1) ? TELEMETRY_PACK_SCHEMA : NULL);
+}
+
+/// <summary>
+///     Copies a JSON object into a pack with the time it was committed appended as its "ts"
+///     member, so each record keeps its own time.
+/// </summary>
+/// <returns>The length of the record in the pack</returns>
+static size_t packRecord(uint8_t *pack, const uint8_t *record, size_t length, const char *stamp,
+                         size_t stampLength)
+{
+    // The record may already be where it goes, it only loses its closing brace
+    if (pack != record) {
+        memcpy(pack, record, length - 1);
+    }
+    memcpy(pack + length - 1, stamp, stampLength);
+    return length - 1 + stampLength;
+}
+
+/// <summary>
+///     Packs routine JSON telemetry several to a message, as a JSON array, so each message
+///     fills as much of its billing unit as it can.  Anything else is sent as it comes.
+/// </summary>
+static void commitMessage(send_message_t *message, size_t length, const char *contentType,
+                          const char *schema)
+{
+    bool packable = TELEMETRY_PACK_BYTES > 0 && message->lane == SEND_LANE_TELEMETRY &&
+                    schema == NULL && strcmp(contentType, "application/json") == 0 &&
+                    length >= 2 && message->payload[0] == '{' && message->payload[length - 1] == '}';
+
+    // The record's closing brace becomes its commit time and the closing brace
+    char stamp[40];
+    int stampLength = 0;
+    if (packable) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        stampLength = snprintf(stamp, sizeof(stamp), "%s\"ts\": %lld.%03ld}", (length > 2) ? ", " : "",
+                               (long long)now.tv_sec, now.tv_nsec / 1000000L);
+        packable = stampLength > 0 && (size_t)stampLength < sizeof(stamp) &&
+                   length - 1 + (size_t)stampLength + 2 <= TELEMETRY_PACK_BYTES;
+    }
+    if (!packable) {
+        commitNow(message, length, contentType, schema);
+        return;
+    }
+    const size_t recordLength = length - 1 + (size_t)stampLength;
+
+    // Room for the comma and the closing bracket, and the opening one if it becomes an array now
+    const size_t extra = (packCount == 1) ? 3 : 2;
+    if (packMessage != NULL && packLength + extra + recordLength <= TELEMETRY_PACK_BYTES) {
+        if (packCount == 1) {
+            memmove(packMessage->payload + 1, packMessage->payload, packLength);
+            packMessage->payload[0] = '[';
+            packLength++;
+        }
+        packMessage->payload[packLength++] = ',';
+        packLength += packRecord(packMessage->payload + packLength, message->payload, length, stamp,
+                                 (size_t)stampLength);
+        packCount++;
+        SendWindow_Cancel(message);
+        return;
+    }
+
+    sealPack();
+    if (message == &sendWindow.overflow) {
+        // Holding the overflow buffer would block every other reservation
+        commitNow(message, length, contentType, schema);
+        return;
+    }
+    packMessage = message;
+    packLength = packRecord(message->payload, message->payload, length, stamp, (size_t)stampLength);
+    packCount = 1;
+    packStarted_ms = monotonicMilliseconds();
+}
+
+/// <summary>
+///     The message a buffer from AzureIoT_ReserveMessage() belongs to.
+/// </summary>
+static send_message_t *messageFromBuffer(char *buffer)
+{
+    return (send_message_t *)(buffer - offsetof(send_message_t, payload));
+}
+
+/// <summary>
+///     Copies a message formatted elsewhere into a slot and sends it as commitMessage() does.
+/// </summary>
+static void queueMessage(send_lane_t lane, const uint8_t *payload, size_t length,
+                         const char *contentType, const char *schema)
+{
+    if (mustStoreMessage(lane)) {
+        storeMessage(lane, payload, length, contentType, schema, monotonicMilliseconds());
+        return;
+    }
+    if (length > SEND_WINDOW_MAX_PAYLOAD) {
+        LogMessage("WARNING: %zu byte message is too large to send\n", length);
+        return;
+    }
+
+    send_message_t *message = SendWindow_Reserve(getSendWindow(), lane);
+    if (message == NULL) {
+        LogMessage("WARNING: no message buffer free, message dropped\n");
+        return;
+    }
+    memcpy(message->payload, payload, length);
+    commitMessage(message, length, contentType, schema);
+}
+
+/// <summary>
+///     Logs the send window statistics and reports them as the "sendWindow" reported property.
+/// </summary>
+static void reportSendStats(void)
+{
+    send_window_stats_t stats;
+    AzureIoT_GetSendStats(&stats);
+
+    static const char *const laneNames[SEND_LANE_COUNT] = { "telemetry", "event", "alarm" };
+
+    char json[TWIN_REPORT_LARGE_VALUE_SIZE];
+    int length = snprintf(json, sizeof(json),
+        "{\"inFlight\": %u, \"waiting\": %u, \"maxInFlight\": %u, \"stored\": %u, "
+        "\"ackP50\": %u, \"ackP90\": %u, \"ackP99\": %u, \"ackMax\": %u, \"delivered\": %u, "
+        "\"retries\": %u, \"gaveUp\": %u, \"dropped\": %u, \"coalesced\": %u, \"spilled\": %u, \"lanes\": {",
+        stats.inFlight, stats.waiting, stats.maxInFlight, TelemetryQueue_Count(), stats.latencyP50_ms,
+        stats.latencyP90_ms, stats.latencyP99_ms, stats.latencyMax_ms, stats.delivered, stats.retries,
+        stats.gaveUp, stats.dropped, stats.coalesced, stats.spilled);
+
+    // End to end latency per lane, commit to confirmation
+    for (int lane = 0; lane < SEND_LANE_COUNT && length > 0 && (size_t)length < sizeof(json); lane++) {
+        const send_lane_stats_t *laneStats = &stats.lanes[lane];
+        length += snprintf(json + length, sizeof(json) - (size_t)length,
+            "%s\"%s\": {\"accepted\": %u, \"delivered\": %u, \"waiting\": %u, \"p50\": %u, "
+            "\"p99\": %u, \"max\": %u}",
+            (lane > 0) ? ", " : "", laneNames[lane], laneStats->accepted, laneStats->delivered,
+            laneStats->waiting, laneStats->latencyP50_ms, laneStats->latencyP99_ms, laneStats->latencyMax_ms);
+    }
+    if (length > 0 && (size_t)length < sizeof(json)) {
+        length += snprintf(json + length, sizeof(json) - (size_t)length, "}}");
+    }
+    if (length > 0 && (size_t)length < sizeof(json)) {
+        AzureIoT_TwinReportProperty("sendWindow", json);
+    }
+
+    // Usage against the daily budget, in message units, and how full the packs go out
+    const time_t now = time(NULL);
+    length = snprintf(json, sizeof(json),
+        "{\"budget\": %u, \"usedToday\": %u, \"messagesToday\": %u, \"projected\": %u, "
+        "\"tokens\": %.1f, \"limited\": %u, \"packs\": %u, \"packed\": %u, \"packFill\": %.2f}",
+        hubQuota.dailyBudget, hubQuota.usedToday, hubQuota.messagesToday, HubQuota_Projected(&hubQuota, now),
+        hubQuota.tokens, hubQuota.limited, packsSent, messagesPacked,
+        (packsSent > 0) ? (double)packBytesSent / ((double)packsSent * HUB_QUOTA_UNIT_BYTES) : 0.0);
+    if (length > 0 && (size_t)length < sizeof(json)) {
+        AzureIoT_TwinReportProperty("hubQuota", json);
+    }
+}
+
+/// <summary>
+///     Sends the reported properties changed since the last patch as one patch, at most once
+///     every TWIN_REPORT_FLUSH_PERIOD_MS.
+/// </summary>
+static void flushReportedProperties(void)
+{
+    static int64_t lastFlush_ms = 0;
+    static char patch[4096];
+
+    const int64_t now_ms = monotonicMilliseconds();
+    if (iothubClientHandle == NULL || now_ms - lastFlush_ms < TWIN_REPORT_FLUSH_PERIOD_MS ||
+        !TwinReport_HasChanges()) {
+        return;
+    }
+    lastFlush_ms = now_ms;
+
+    uint32_t patchId;
+    const size_t length = TwinReport_BuildPatch(patch, sizeof(patch), &patchId);
+    if (length == 0) {
+        return;
+    }
+    // The patch ID is the context, so the answer finds it
+    if (IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle, (unsigned char *)patch, length,
+                                                reportStatusCallback,
+                                                (void *)(uintptr_t)patchId) != IOTHUB_CLIENT_OK) {
+        LogMessage("ERROR: failed to set reported state as '%s'.\n", patch);
+        TwinReport_Confirm(patchId, false);
+    } else {
+        LogMessage("INFO: Reported state as '%s'.\n", patch);
+    }
+}
+
 /// <summary>
 ///     Keeps IoT Hub Client alive by exchanging data with the Azure IoT Hub.
 /// </summary>
@@ -333,6 +779,21 @@ void AzureIoT_DoPeriodicTasks(void)
     static time_t lastTimeLogged = 0;
     PeriodicLogVarArgs(&lastTimeLogged, 5, "INFO: %s calls in progress...\n", __func__);
 
+    if (packMessage != NULL &&
+        monotonicMilliseconds() - packStarted_ms >= TELEMETRY_PACK_MAX_HOLD_SECONDS * 1000LL) {
+        sealPack();
+    }
+    replayStoredMessage();
+    sendWaitingMessages();
+    flushReportedProperties();
+
+    static int64_t lastStatsReport_ms = 0;
+    const int64_t now_ms = monotonicMilliseconds();
+    if (hubAuthenticated && now_ms - lastStatsReport_ms >= TELEMETRY_SEND_STATS_PERIOD_SECONDS * 1000LL) {
+        lastStatsReport_ms = now_ms;
+        reportSendStats();
+    }
+
     // DoWork - send some of the buffered events to the IoT Hub, and receive some of the buffered
     // events from the IoT Hub.
     IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
@@ -345,26 +806,84 @@ void AzureIoT_DoPeriodicTasks(void)
 /// <param name="messagePayload">The payload of the message to send.</param>
 void AzureIoT_SendMessage(const char *messagePayload)
 {
-    if (iothubClientHandle == NULL) {
-        LogMessage("WARNING: IoT Hub client not initialized\n");
-        return;
-    }
+    queueMessage(SEND_LANE_TELEMETRY, (const uint8_t *)messagePayload, strlen(messagePayload),
+                 "application/json", NULL);
+}
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(messagePayload);
+/// <summary>
+///     As AzureIoT_SendMessage(), in the given lane.  Alarms are sent ahead of everything else,
+///     stored messages included.
+/// </summary>
+void AzureIoT_SendLaneMessage(send_lane_t lane, const char *messagePayload)
+{
+    queueMessage(lane, (const uint8_t *)messagePayload, strlen(messagePayload), "application/json",
+                 NULL);
+}
 
-    if (messageHandle == 0) {
-        LogMessage("WARNING: unable to create a new IoTHubMessage\n");
-        return;
-    }
+/// <summary>
+///     Creates and enqueues a binary message to be delivered the IoT Hub, tagged with its content
+///     type and a "schema" application property the backend can route and decode on.
+/// </summary>
+void AzureIoT_SendBinaryMessage(const uint8_t *payload, size_t length, const char *contentType,
+                                const char *schema)
+{
+    queueMessage(SEND_LANE_TELEMETRY, payload, length, contentType, schema);
+}
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, sendMessageCallback,
-                                             /*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
-        LogMessage("WARNING: failed to hand over the message to IoTHubClient\n");
-    } else {
-        LogMessage("INFO: IoTHubClient accepted the message for delivery\n");
+/// <summary>
+///     Reserves a message buffer from the send window's pool to format a message straight into.
+/// </summary>
+char *AzureIoT_ReserveMessage(size_t *size)
+{
+    return AzureIoT_ReserveLaneMessage(SEND_LANE_TELEMETRY, size);
+}
+
+/// <summary>
+///     As AzureIoT_ReserveMessage(), for a message in the given lane.
+/// </summary>
+char *AzureIoT_ReserveLaneMessage(send_lane_t lane, size_t *size)
+{
+    send_message_t *message = SendWindow_Reserve(getSendWindow(), lane);
+    if (message == NULL) {
+        LogMessage("WARNING: no message buffer free\n");
+        return NULL;
     }
+    *size = sizeof(message->payload);
+    return (char *)message->payload;
+}
+
+/// <summary>
+///     Sends the JSON message formatted into a reserved buffer.
+/// </summary>
+void AzureIoT_CommitMessage(char *buffer, size_t length)
+{
+    commitMessage(messageFromBuffer(buffer), length, "application/json", NULL);
+}
+
+/// <summary>
+///     Sends the binary message formatted into a reserved buffer.
+/// </summary>
+void AzureIoT_CommitBinaryMessage(char *buffer, size_t length, const char *contentType,
+                                  const char *schema)
+{
+    commitMessage(messageFromBuffer(buffer), length, contentType, schema);
+}
 
-    IoTHubMessage_Destroy(messageHandle);
+/// <summary>
+///     Gives back a reserved buffer without sending anything.
+/// </summary>
+void AzureIoT_CancelMessage(char *buffer)
+{
+    SendWindow_Cancel(messageFromBuffer(buffer));
+}
+
+/// <summary>
+///     Fills in the send window counters, depths and confirmation latency percentiles, and the
+///     end to end latency percentiles per lane.
+/// </summary>
+void AzureIoT_GetSendStats(send_window_stats_t *stats)
+{
+    SendWindow_GetStats(getSendWindow(), stats);
 }
 
 /// <summary>
@@ -385,6 +904,9 @@ static void reportStatusCallback(int result, void *context)
 {
     LogMessage("INFO: Device Twin reported properties update result: HTTP status code %d\n",
                result);
+    if (context != NULL) {
+        TwinReport_Confirm((uint32_t)(uintptr_t)context, result >= 200 && result < 300);
+    }
     if (deviceTwinConfirmationCb)
         deviceTwinConfirmationCb(result);
 }
@@ -472,6 +994,23 @@ void AzureIoT_SetMessageConfirmationCallback(MessageDeliveryConfirmationFnType c
 static void sendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
     LogMessage("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    send_message_t *message = (send_message_t *)context;
+    if (message != NULL) {
+        const bool delivered = (result == IOTHUB_CLIENT_CONFIRMATION_OK);
+        const uint32_t storedSequence = message->storedSequence;
+        if (delivered && storedSequence != 0) {
+            TelemetryQueue_Consume(storedSequence);
+        }
+        // A replay that gives up is still stored and comes round again
+        if (SendWindow_Confirm(&sendWindow, message, delivered, monotonicMilliseconds()) ==
+            SEND_CONFIRM_GAVE_UP) {
+            if (storedSequence == 0) {
+                storeMessage(message->lane, message->payload, message->length, message->contentType,
+                             message->schema, message->committedAt_ms);
+            }
+            SendWindow_Release(message);
+        }
+    }
     if (messageDeliveryConfirmationCb) {
         messageDeliveryConfirmationCb(result == IOTHUB_CLIENT_CONFIRMATION_OK);
     }
@@ -634,6 +1173,7 @@ static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         void *userContextCallback)
 {
     bool authenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    hubAuthenticated = authenticated;
     if (hubConnectionStatusCb) {
         hubConnectionStatusCb(result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
     }
@@ -643,6 +1183,9 @@ static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                    reasonString);
     } else {
         LogMessage("INFO: connection to the IoT Hub has been established (%s).\n", reasonString);
+        if (TelemetryQueue_Count() > 0) {
+            LogMessage("INFO: replaying %u stored message(s)\n", TelemetryQueue_Count());
+        }
     }
 }
 
@@ -666,6 +1209,18 @@ void AzureIoT_Deinitialize(void)
 {
     IoTHub_Deinit();
 }
+/// <summary>
+///     Records the latest value of a reported property.  Changed properties are merged into
+///     one patch per AzureIoT_DoPeriodicTasks() call, at most one every
+///     TWIN_REPORT_FLUSH_PERIOD_MS; a value the hub already has isn't sent again.
+/// </summary>
+void AzureIoT_TwinReportProperty(const char *propertyName, const char *valueJson)
+{
+    if (TwinReport_Set(propertyName, valueJson) != 0) {
+        LogMessage("ERROR: unable to queue reported property '%s'.\n", propertyName);
+    }
+}
+
 /// <summary>
 ///     Creates and enqueues reported properties state using a prepared json string.
 ///     The report is not actually sent immediately, but it is sent on the next 
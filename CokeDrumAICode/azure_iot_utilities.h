@@ -4,9 +4,12 @@
 /// included in the Azure IoT Device SDK for C.
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <azureiot/iothubtransportmqtt.h>
 #include <applibs/networking.h>
 #include "parson.h"
+#include "send_window.h"
 
 /// <summary>
 ///     Sets up the client in order to establish the communication channel to Azure IoT Hub.
@@ -27,10 +30,19 @@
 bool AzureIoT_SetupClient(void);
 
 /// <summary>
-///     Destroys the Azure IoT Hub client.
+///     Destroys the Azure IoT Hub client, storing the telemetry pack being held for replay.
 /// </summary>
 void AzureIoT_DestroyClient(void);
 
+/// <summary>
+///     Queues the latest value of a reported property.  Every property changed between two
+///     calls of AzureIoT_DoPeriodicTasks() goes out in one patch, and a value the hub has
+///     already acknowledged is dropped.
+/// </summary>
+/// <param name="propertyName">The name of the property to report.</param>
+/// <param name="valueJson">The value as JSON text, e.g. 42, "text" or {"value": 1}.</param>
+void AzureIoT_TwinReportProperty(const char *propertyName, const char *valueJson);
+
 /// <summary>
 ///     Creates and enqueues reported properties state using a prepared json string.
 ///     The report is not actually sent immediately, but it is sent on the next 
@@ -52,11 +64,73 @@ void AzureIoT_TwinReportState(const char *propertyName, size_t propertyValue);
 
 /// <summary>
 ///     Creates and enqueues a message to be delivered the IoT Hub. The message is not actually sent
-///     immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
+///     immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().  When
+///     TELEMETRY_PACK_BYTES is set, routine JSON telemetry is packed with the messages around it
+///     into one message of that size, so it may be held for up to TELEMETRY_PACK_MAX_HOLD_SECONDS.
 /// </summary>
 /// <param name="messagePayload">The payload of the message to send.</param>
 void AzureIoT_SendMessage(const char *messagePayload);
 
+/// <summary>
+///     As AzureIoT_SendMessage(), in a given lane.  Alarms go ahead of every other message,
+///     stored ones included; the other lanes share the send window by their weights.
+/// </summary>
+void AzureIoT_SendLaneMessage(send_lane_t lane, const char *messagePayload);
+
+/// <summary>
+///     Creates and enqueues a binary message to be delivered the IoT Hub.  The message is not
+///     actually sent immediately, but it is sent on the next invocation of
+///     AzureIoT_DoPeriodicTasks().
+/// </summary>
+/// <param name="payload">The payload of the message to send.</param>
+/// <param name="length">The length of the payload in bytes.</param>
+/// <param name="contentType">The MIME type of the payload, e.g. "application/cbor".</param>
+/// <param name="schema">Identifies the payload layout, sent as the "schema" application property.</param>
+void AzureIoT_SendBinaryMessage(const uint8_t *payload, size_t length, const char *contentType,
+                                const char *schema);
+
+/// <summary>
+///     Reserves a buffer from the pool of message buffers to format a message straight into,
+///     so sending makes no heap calls and no copy.  Pass it to AzureIoT_CommitMessage() or
+///     AzureIoT_CommitBinaryMessage() to send it, or AzureIoT_CancelMessage() to give it back,
+///     before reserving another.
+/// </summary>
+/// <param name="size">Receives the size of the buffer.</param>
+/// <returns>The buffer, or NULL if none is free.</returns>
+char *AzureIoT_ReserveMessage(size_t *size);
+
+/// <summary>
+///     As AzureIoT_ReserveMessage(), for a message in a given lane.  Only alarms can take the
+///     last free buffer.
+/// </summary>
+char *AzureIoT_ReserveLaneMessage(send_lane_t lane, size_t *size);
+
+/// <summary>
+///     Sends the JSON message of length bytes formatted into a reserved buffer.
+/// </summary>
+void AzureIoT_CommitMessage(char *buffer, size_t length);
+
+/// <summary>
+///     Sends the binary message of length bytes formatted into a reserved buffer, tagged as
+///     AzureIoT_SendBinaryMessage() does.
+/// </summary>
+void AzureIoT_CommitBinaryMessage(char *buffer, size_t length, const char *contentType,
+                                  const char *schema);
+
+/// <summary>
+///     Gives back a reserved buffer without sending anything.
+/// </summary>
+void AzureIoT_CancelMessage(char *buffer);
+
+/// <summary>
+///     Fills in the send window statistics: messages in flight and waiting, delivery
+///     confirmation latency percentiles over the last SEND_WINDOW_LATENCY_SAMPLES messages,
+///     the retry and back-pressure counters, and each lane's end to end latency percentiles
+///     from commit to confirmation.  They are also reported as the "sendWindow"
+///     reported property every TELEMETRY_SEND_STATS_PERIOD_SECONDS.
+/// </summary>
+void AzureIoT_GetSendStats(send_window_stats_t *stats);
+
 /// <summary>
 ///     Keeps IoT Hub Client alive by exchanging data with the Azure IoT Hub.
 /// </summary>
@@ -28,5 +28,164 @@
 #define ACCEL_READ_PERIOD_SECONDS 5  //frequency of reading and posting
 #define ACCEL_READ_PERIOD_NANO_SECONDS 0
 
+// Number of sensor reads reduced into one aggregate (min/max/mean/RMS/...) telemetry record
+#define SENSOR_STATS_WINDOW_SAMPLES 12
+
+// Enable to send every raw sensor read to Azure instead of the windowed aggregate records
+//#define TELEMETRY_PER_SAMPLE
+
+// Per-sample reads are batched, in raw counts column by column, into one message.  A batch is
+// sent at whichever comes first: the sample count, the age of its first read, or the message
+// size (IoT Hub meters messages in 4KB blocks).  It is also sent on a drum phase change.
+#define TELEMETRY_BATCH_MAX_SAMPLES 32
+#define TELEMETRY_BATCH_MAX_AGE_SECONDS 60
+#define TELEMETRY_BATCH_MAX_BYTES 4096
+
+// How telemetry batches are encoded: TELEMETRY_ENCODING_JSON, TELEMETRY_ENCODING_CBOR or
+// TELEMETRY_ENCODING_COMPRESSED (delta coded CBOR).  The CBOR layouts are in telemetry_batch.h.
+#define TELEMETRY_BATCH_ENCODING TELEMETRY_ENCODING_JSON
+
+// Report by exception.  A read (a window record without TELEMETRY_PER_SAMPLE) is only sent
+// once some channel has moved more than its deadband since it was last sent, or has been silent
+// for DEADBAND_MAX_SILENCE_SECONDS.  The accelerometer, gyro and displacement channels are left
+// out.  Each channel's settings can be changed through the device twin as "<key>Deadband" and
+// "<key>MaxSilence", e.g. "pressureDeadband".  Comment out to send every read.
+#define TELEMETRY_DEADBAND
+#define DEADBAND_PRESSURE_HPA 0.5f
+#define DEADBAND_TEMPERATURE_DEGC 0.5f
+#define DEADBAND_STRAIN 0.2f
+#define DEADBAND_DISTANCE_FT 0.1f
+#define DEADBAND_MAX_SILENCE_SECONDS 300
+
+// Mutable storage the application manifests ask for ("MutableStorage": { "SizeKB": 64 }); keep
+// them in step.  It holds the calibration store and the telemetry queue after it.
+#define MUTABLE_STORAGE_BYTES (64 * 1024)
+
+// Store-and-forward log for messages sent while the IoT Hub isn't connected, in mutable storage
+// after the calibration store.  When the connection is back the stored messages are replayed
+// oldest first, one per replay period.
+#define TELEMETRY_QUEUE_BYTES (60 * 1024)
+#define TELEMETRY_QUEUE_REPLAY_PERIOD_MS 500
+
+// Send window: at most TELEMETRY_SEND_WINDOW messages are handed to the IoT Hub client awaiting
+// confirmation, the rest of the SEND_WINDOW_SLOTS wait their turn.  A failed message is retried
+// TELEMETRY_SEND_MAX_RETRIES times, then stored.  With every slot taken TELEMETRY_SEND_POLICY
+// decides: SEND_POLICY_DROP_OLDEST, SEND_POLICY_COALESCE (the new message replaces the waiting
+// one of its kind) or SEND_POLICY_SPILL (to the store-and-forward log).  The window statistics
+// are reported as a twin property every TELEMETRY_SEND_STATS_PERIOD_SECONDS.
+#define TELEMETRY_SEND_WINDOW 4
+#define TELEMETRY_SEND_MAX_RETRIES 2
+#define TELEMETRY_SEND_POLICY SEND_POLICY_SPILL
+#define TELEMETRY_SEND_STATS_PERIOD_SECONDS 300
+
+// IoT Hub daily message quota, in 4KB units.  Sending is paced by a token bucket that refills
+// at the budget spread over the day and holds up to HUB_QUOTA_BURST_UNITS; alarms always go,
+// borrowing ahead.  The day's usage and projected total are reported as the "hubQuota" twin
+// property along with the send window statistics.
+#define HUB_DAILY_MESSAGE_BUDGET 8000
+#define HUB_QUOTA_BURST_UNITS 50
+
+// Routine JSON telemetry can be packed, as an array, into messages of up to TELEMETRY_PACK_BYTES
+// so each fills its 4KB unit; the rest of the unit is left for the message properties.  A pack is
+// sent once the next message won't fit or it is TELEMETRY_PACK_MAX_HOLD_SECONDS old.  Each packed
+// record gets its commit time as a "ts" member, in epoch seconds, and a pack of more than one
+// carries the "schema" application property TELEMETRY_PACK_SCHEMA.  The backend has to unpack
+// the arrays, so it is off (0) until it does; 3840 fills a unit.
+#define TELEMETRY_PACK_BYTES 0
+#define TELEMETRY_PACK_MAX_HOLD_SECONDS 60
+#define TELEMETRY_PACK_SCHEMA "pack"
+
+// Changed device twin reported properties are merged into one patch per event loop pass, at
+// most one patch every TWIN_REPORT_FLUSH_PERIOD_MS
+#define TWIN_REPORT_FLUSH_PERIOD_MS 500
+
+// Send lanes.  Alarms go ahead of every other message, stored ones included, and always have a
+// slot kept for them.  Events (drum phase changes, the button) and routine telemetry share the
+// send window in proportion to these weights.
+#define EVENT_LANE_WEIGHT 4
+#define TELEMETRY_LANE_WEIGHT 1
+
+// Alarms, sent in the alarm lane as soon as they are raised, and as an event when they clear.
+// Shock is the peak acceleration away from 1g over a FIFO drain; strain is on the 0-10 scale
+// of the strain telemetry.  An alarm is raised at most once per holdoff.
+#define ALARM_SHOCK_G 3.0f
+#define ALARM_SHOCK_HYSTERESIS_G 1.0f
+#define ALARM_PRESSURE_MIN_HPA 950.0f
+#define ALARM_PRESSURE_MAX_HPA 1080.0f
+#define ALARM_PRESSURE_HYSTERESIS_HPA 2.0f
+#define ALARM_STRAIN_LIMIT 8.0f
+#define ALARM_STRAIN_HYSTERESIS 0.5f
+#define ALARM_HOLDOFF_SECONDS 10
+
+// Enable to time the per-sample JSON message against the JSON, CBOR and compressed batches at startup
+//#define TELEMETRY_ENCODING_BENCHMARK_SAMPLES 10000
+
+// Enable to time the per-sample float conversion path against the raw count pipeline at startup
+//#define SENSOR_UNITS_BENCHMARK_SAMPLES 10000
+
+// Enable to replay a synthetic trace through the orientation filter at startup, logging its
+// updates per second and tilt error (10 minutes at IMU_ODR_HZ)
+//#define ORIENTATION_BENCHMARK_SAMPLES (600 * IMU_ODR_HZ)
+
+// Gyro output data rate used for the FIFO stream (must match the LSM6DSO_GY_*_104Hz settings in initI2c)
+#define IMU_ODR_HZ 104
+
+// Accelerometer output data rate used for the FIFO stream (must match IMU_XL_ODR in i2c.c).  It is
+// decimated to about 52Hz for tilt and 1Hz for trending.
+#define ACCEL_FIFO_ODR_HZ 1667
+
+// How often the LSM6DSO FIFO is drained.  The FIFO holds about 0.7 seconds of data at these rates.
+#define IMU_FIFO_READ_PERIOD_NANO_SECONDS 100000000
+// Longest drain period the device twin may set ("imuFifoPeriodMs"), with margin before overflow
+#define IMU_FIFO_MAX_READ_PERIOD_MS 400
+
+// Accelerometer auto-ranging between 2, 4, 8 and 16g.  A batch with any axis at or beyond the
+// clip level moves up one range; the range only steps down again once every sample for the
+// hold time would have fitted in the lower range with the given headroom.
+#define ACCEL_RANGE_INITIAL_G 4
+#define ACCEL_RANGE_CLIP_COUNTS 32000
+#define ACCEL_RANGE_DOWN_HEADROOM 0.5f
+#define ACCEL_RANGE_HOLD_BATCHES 50
+
+// How often the fused orientation (quaternion and tilt) is sent to Azure
+#define ORIENTATION_REPORT_PERIOD_SECONDS 10
+
+// Mahony filter gains.  KI sets how quickly the gyro bias estimate follows drift.
+#define ORIENTATION_KP 0.5f
+#define ORIENTATION_KI 0.01f
+
+// Background gyro bias estimation.  Each window of gyro samples with every axis quieter than
+// the still threshold is a bias measurement; those feed the current level and, once the die
+// temperature has moved enough, a bias versus temperature fit.  The forgetting factor is per
+// stationary window, 0.9997 keeps roughly the last hour of stillness.
+#define GYRO_BIAS_WINDOW_SAMPLES IMU_ODR_HZ
+#define GYRO_BIAS_STILL_STDDEV_DPS 0.3f
+#define GYRO_BIAS_MAX_DPS 5.0f
+#define GYRO_BIAS_LEVEL_GAIN 0.1f
+#define GYRO_BIAS_FORGETTING 0.9997f
+#define GYRO_BIAS_MIN_SPREAD_DEGC 2.0f
+
+// Shortest time between saves of the learned calibration to mutable storage.  It is also
+// saved at exit.
+#define CALIBRATION_SAVE_PERIOD_SECONDS 3600
+
+// TFMini frame period (native 100Hz) and the tracker tuning
+#define DISTANCE_FRAME_PERIOD_NANO_SECONDS 10000000
+#define DISTANCE_PROCESS_NOISE 0.5f         // cm^2/s^3, how quickly the wall is allowed to accelerate
+#define DISTANCE_MEASUREMENT_SIGMA_CM 1.0f  // TFMini noise at a strong return
+
+// LPS22HH detection through the LSM6DSO sensor hub: attempts and the pause between them.  The
+// pressure sensor is optional, after the last attempt the application runs without it.
+#define LPS22HH_DETECT_ATTEMPTS 10
+#define LPS22HH_RETRY_DELAY_MS 100
+
+// int8 autoencoder used to score window records, loaded from the image package.  If the file
+// is missing every window is sent.  script/make_anomaly_model.py trains one from recorded
+// window records; the project packages it when it exists.
+#define ANOMALY_MODEL_PATH "models/anomaly.bin"
+
+// Enable to time the anomaly model and log its peak RAM at startup
+//#define ANOMALY_BENCHMARK_INFERENCES 1000
+
 // Enables I2C read/write debug
 //#define ENABLE_READ_WRITE_DEBUG
\ No newline at end of file
@@ -0,0 +1,139 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+/************************************************************************************************
+   Mutable storage layout: two slots of CALIBRATION_SLOT_SIZE bytes, each
+
+      uint32_t magic       "CDCS"
+      uint16_t version     CALIBRATION_STORE_VERSION
+      uint16_t length      sizeof(calibration_record_t)
+      uint32_t sequence    incremented by every save, the newest valid slot wins
+      uint32_t crc         CRC-32 of the 12 bytes above and the record
+      calibration_record_t record
+*************************************************************************************************/
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "calibration_store.h"
+#include "crc32.h"
+
+#define CALIBRATION_MAGIC 0x53434443u    // "CDCS"
+#define CALIBRATION_SLOT_COUNT 2
+#define CALIBRATION_SLOT_SIZE (CALIBRATION_STORE_BYTES / CALIBRATION_SLOT_COUNT)
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t length;
+	uint32_t sequence;
+	uint32_t crc;
+} calibration_header_t;
+
+// Slot holding the newest record and its sequence number, -1 until something was loaded or saved
+static int newestSlot = -1;
+static uint32_t newestSequence = 0;
+
+static uint32_t recordCrc(const calibration_header_t *header, const calibration_record_t *record)
+{
+	uint32_t crc = Crc32_Update(CRC32_INIT, (const uint8_t *)header, offsetof(calibration_header_t, crc));
+	return ~Crc32_Update(crc, (const uint8_t *)record, sizeof(*record));
+}
+
+/// <summary>
+///     Reads and validates one slot.
+/// </summary>
+/// <returns>0 if the slot holds a record of this version with a good CRC</returns>
+static int readSlot(int fd, int slot, calibration_header_t *header, calibration_record_t *record)
+{
+	const off_t offset = (off_t)slot * CALIBRATION_SLOT_SIZE;
+
+	if (pread(fd, header, sizeof(*header), offset) != (ssize_t)sizeof(*header) ||
+		header->magic != CALIBRATION_MAGIC || header->version != CALIBRATION_STORE_VERSION ||
+		header->length != sizeof(*record)) {
+		return -1;
+	}
+	if (pread(fd, record, sizeof(*record), offset + (off_t)sizeof(*header)) != (ssize_t)sizeof(*record)) {
+		return -1;
+	}
+	return (recordCrc(header, record) == header->crc) ? 0 : -1;
+}
+
+int CalibrationStore_Load(calibration_record_t *record)
+{
+	int fd = Storage_OpenMutableFile();
+	if (fd < 0) {
+		Log_Debug("ERROR: Storage_OpenMutableFile: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	calibration_header_t header;
+	calibration_record_t candidate;
+	for (int slot = 0; slot < CALIBRATION_SLOT_COUNT; slot++) {
+		if (readSlot(fd, slot, &header, &candidate) != 0) {
+			continue;
+		}
+		// Sequence numbers are compared modulo 2^32
+		if (newestSlot < 0 || (int32_t)(header.sequence - newestSequence) > 0) {
+			newestSlot = slot;
+			newestSequence = header.sequence;
+			memcpy(record, &candidate, sizeof(*record));
+		}
+	}
+	close(fd);
+
+	if (newestSlot < 0) {
+		Log_Debug("INFO: no stored calibration, starting from scratch\n");
+		return -1;
+	}
+	Log_Debug("INFO: loaded stored calibration, slot %d, sequence %u\n", newestSlot, newestSequence);
+	return 0;
+}
+
+int CalibrationStore_Save(const calibration_record_t *record)
+{
+	if (sizeof(calibration_header_t) + sizeof(*record) > CALIBRATION_SLOT_SIZE) {
+		Log_Debug("ERROR: calibration record (%zu bytes) doesn't fit a slot\n", sizeof(*record));
+		return -1;
+	}
+
+	int fd = Storage_OpenMutableFile();
+	if (fd < 0) {
+		Log_Debug("ERROR: Storage_OpenMutableFile: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	const int slot = (newestSlot == 0) ? 1 : 0;
+	calibration_header_t header = {
+		.magic = CALIBRATION_MAGIC,
+		.version = CALIBRATION_STORE_VERSION,
+		.length = sizeof(*record),
+		.sequence = newestSequence + 1
+	};
+	header.crc = recordCrc(&header, record);
+
+	// The header and record go out in one write; a torn write fails the CRC and the other
+	// slot is still there
+	uint8_t buffer[sizeof(header) + sizeof(*record)];
+	memcpy(buffer, &header, sizeof(header));
+	memcpy(buffer + sizeof(header), record, sizeof(*record));
+
+	int result = 0;
+	if (pwrite(fd, buffer, sizeof(buffer), (off_t)slot * CALIBRATION_SLOT_SIZE) != (ssize_t)sizeof(buffer) || fsync(fd) != 0) {
+		Log_Debug("ERROR: saving calibration: errno=%d (%s)\n", errno, strerror(errno));
+		result = -1;
+	}
+	close(fd);
+
+	if (result == 0) {
+		newestSlot = slot;
+		newestSequence = header.sequence;
+	}
+	return result;
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "gyro_bias.h"
+#include "orientation_filter.h"
+
+// Bump whenever calibration_record_t changes; records of another version are ignored
+#define CALIBRATION_STORE_VERSION 1
+
+// Mutable storage the store takes from the start of the file; anything else kept there goes after it
+#define CALIBRATION_STORE_BYTES 4096
+
+/// <summary>
+///     Everything learned at run time that is worth having at the next start, so acquisition
+///     can begin with the last known-good values and refine them in the background.
+/// </summary>
+typedef struct {
+	gyro_bias_state_t gyroBias;
+	float gyroOffset_counts[3];                        // Offset in use when the record was saved
+	float orientationQ[4];
+	float orientationFeedback[3];
+	float orientationBinFeedback[ORIENTATION_TEMP_BINS][3];
+	uint8_t orientationBinValid[ORIENTATION_TEMP_BINS];
+	uint8_t accelRange_g;
+	uint8_t tfminiPresent;
+	uint8_t reserved[2];
+} calibration_record_t;
+
+/// <summary>
+///     Reads the newest valid record from mutable storage.  The file holds two slots that are
+///     written alternately, each with a sequence number and a CRC, so an interrupted save
+///     leaves the previous record intact.
+/// </summary>
+/// <returns>0 if a record was loaded, or -1 if there is none (or none of this version)</returns>
+int CalibrationStore_Load(calibration_record_t *record);
+
+/// <summary>
+///     Writes the record to the slot not holding the newest record and syncs it.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int CalibrationStore_Save(const calibration_record_t *record);
@@ -0,0 +1,124 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "cbor.h"
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+
+static size_t argumentLength(uint64_t argument)
+{
+	if (argument < 24) {
+		return 1;
+	}
+	if (argument <= UINT8_MAX) {
+		return 2;
+	}
+	if (argument <= UINT16_MAX) {
+		return 3;
+	}
+	if (argument <= UINT32_MAX) {
+		return 5;
+	}
+	return 9;
+}
+
+/// <summary>
+///     Writes an item head: the major type and its argument, big endian in the fewest bytes.
+/// </summary>
+static void putHead(cbor_writer_t *writer, uint8_t majorType, uint64_t argument)
+{
+	const size_t length = argumentLength(argument);
+	if (writer->overflow || writer->length + length > writer->size) {
+		writer->overflow = true;
+		return;
+	}
+
+	uint8_t *out = writer->buffer + writer->length;
+	if (length == 1) {
+		out[0] = (uint8_t)((majorType << 5) | argument);
+	}
+	else {
+		// 24, 25, 26, 27 select a 1, 2, 4 or 8 byte argument
+		static const uint8_t additionalInfo[] = { [2] = 24, [3] = 25, [5] = 26, [9] = 27 };
+		out[0] = (uint8_t)((majorType << 5) | additionalInfo[length]);
+		for (size_t i = length - 1; i > 0; i--) {
+			out[i] = (uint8_t)argument;
+			argument >>= 8;
+		}
+	}
+	writer->length += length;
+}
+
+void Cbor_Init(cbor_writer_t *writer, uint8_t *buffer, size_t size)
+{
+	writer->buffer = buffer;
+	writer->size = size;
+	writer->length = 0;
+	writer->overflow = false;
+}
+
+void Cbor_PutUint(cbor_writer_t *writer, uint64_t value)
+{
+	putHead(writer, CBOR_UNSIGNED, value);
+}
+
+void Cbor_PutInt(cbor_writer_t *writer, int64_t value)
+{
+	// A negative integer n is encoded as -1 - n
+	if (value < 0) {
+		putHead(writer, CBOR_NEGATIVE, (uint64_t)(-1 - value));
+	}
+	else {
+		putHead(writer, CBOR_UNSIGNED, (uint64_t)value);
+	}
+}
+
+void Cbor_PutText(cbor_writer_t *writer, const char *text)
+{
+	const size_t length = strlen(text);
+	putHead(writer, CBOR_TEXT, length);
+	if (writer->overflow || writer->length + length > writer->size) {
+		writer->overflow = true;
+		return;
+	}
+	memcpy(writer->buffer + writer->length, text, length);
+	writer->length += length;
+}
+
+void Cbor_PutBytesHead(cbor_writer_t *writer, size_t length)
+{
+	putHead(writer, CBOR_BYTES, length);
+}
+
+uint8_t *Cbor_Reserve(cbor_writer_t *writer, size_t length)
+{
+	if (writer->overflow || writer->length + length > writer->size) {
+		writer->overflow = true;
+		return NULL;
+	}
+	uint8_t *reserved = writer->buffer + writer->length;
+	writer->length += length;
+	return reserved;
+}
+
+void Cbor_PutArray(cbor_writer_t *writer, size_t count)
+{
+	putHead(writer, CBOR_ARRAY, count);
+}
+
+void Cbor_PutMap(cbor_writer_t *writer, size_t count)
+{
+	putHead(writer, CBOR_MAP, count);
+}
+
+size_t Cbor_IntLength(int64_t value)
+{
+	return argumentLength((value < 0) ? (uint64_t)(-1 - value) : (uint64_t)value);
+}
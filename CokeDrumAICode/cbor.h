@@ -0,0 +1,55 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Writes CBOR (RFC 7049) items into a caller supplied buffer.  Only what telemetry needs:
+///     integers, text, definite length arrays and maps.  Every item uses its shortest
+///     encoding.  Writing past the end sets overflow and drops the rest.
+/// </summary>
+typedef struct {
+	uint8_t *buffer;
+	size_t size;
+	size_t length;
+	bool overflow;
+} cbor_writer_t;
+
+void Cbor_Init(cbor_writer_t *writer, uint8_t *buffer, size_t size);
+
+void Cbor_PutUint(cbor_writer_t *writer, uint64_t value);
+
+void Cbor_PutInt(cbor_writer_t *writer, int64_t value);
+
+void Cbor_PutText(cbor_writer_t *writer, const char *text);
+
+/// <summary>
+///     Writes the head of a byte string of length bytes.  The bytes follow, written through
+///     Cbor_Reserve().
+/// </summary>
+void Cbor_PutBytesHead(cbor_writer_t *writer, size_t length);
+
+/// <summary>
+///     Claims length bytes at the current position for the caller to fill.
+/// </summary>
+/// <returns>Where to write them, or NULL if they do not fit</returns>
+uint8_t *Cbor_Reserve(cbor_writer_t *writer, size_t length);
+
+/// <summary>
+///     Starts an array of count items, which follow.
+/// </summary>
+void Cbor_PutArray(cbor_writer_t *writer, size_t count);
+
+/// <summary>
+///     Starts a map of count key/value pairs, which follow.
+/// </summary>
+void Cbor_PutMap(cbor_writer_t *writer, size_t count);
+
+/// <summary>
+///     Number of bytes Cbor_PutInt() writes for a value.
+/// </summary>
+size_t Cbor_IntLength(int64_t value);
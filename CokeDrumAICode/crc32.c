@@ -0,0 +1,16 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include "crc32.h"
+
+uint32_t Crc32_Update(uint32_t crc, const uint8_t *data, size_t length)
+{
+	// Bitwise, the stores only check a few KB at start up and on each write
+	for (size_t i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+		}
+	}
+	return crc;
+}
@@ -0,0 +1,16 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Starting value; the finished CRC is the complement of the last update
+#define CRC32_INIT 0xFFFFFFFFu
+
+/// <summary>
+///     Runs data through a CRC-32 (the reflected 0xEDB88320 polynomial, as zlib's), so a
+///     record's CRC can be taken over several pieces: ~Crc32_Update(Crc32_Update(CRC32_INIT, a), b).
+/// </summary>
+uint32_t Crc32_Update(uint32_t crc, const uint8_t *data, size_t length);
@@ -0,0 +1,35 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+
+#include "deadband.h"
+
+uint32_t Deadband_Due(deadband_t *filter, const float values[SENSOR_CHANNEL_COUNT], int64_t now_ms)
+{
+	filter->checked++;
+	if (!filter->haveSent) {
+		return (1u << SENSOR_CHANNEL_COUNT) - 1;
+	}
+
+	uint32_t due = 0;
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		const bool moved = filter->deadband[ch] >= 0.0f && fabsf(values[ch] - filter->lastSent[ch]) > filter->deadband[ch];
+		const bool silent = filter->maxSilence_s[ch] > 0 &&
+			now_ms - filter->lastSent_ms[ch] >= (int64_t)filter->maxSilence_s[ch] * 1000;
+		if (moved || silent) {
+			due |= 1u << ch;
+		}
+	}
+	return due;
+}
+
+void Deadband_MarkSent(deadband_t *filter, const float values[SENSOR_CHANNEL_COUNT], int64_t now_ms)
+{
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		filter->lastSent[ch] = values[ch];
+		filter->lastSent_ms[ch] = now_ms;
+	}
+	filter->haveSent = true;
+	filter->sent++;
+}
@@ -0,0 +1,37 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor_stats.h"
+
+/// <summary>
+///     Report-by-exception filter over the sensor channels.  A channel is due once it has moved
+///     more than its deadband from the value last sent, or once maxSilence_s has passed since
+///     it was last sent.  The settings are plain fields so the device twin can write them.
+/// </summary>
+typedef struct {
+	float deadband[SENSOR_CHANNEL_COUNT];       // Engineering units, negative leaves the channel out
+	int maxSilence_s[SENSOR_CHANNEL_COUNT];     // Heartbeat, 0 for none
+	bool haveSent;
+	float lastSent[SENSOR_CHANNEL_COUNT];
+	int64_t lastSent_ms[SENSOR_CHANNEL_COUNT];
+	uint32_t checked;
+	uint32_t sent;
+} deadband_t;
+
+/// <summary>
+///     Which channels are due to be sent.  Nothing has been sent yet makes every channel due.
+/// </summary>
+/// <param name="values">The latest value of every channel in engineering units</param>
+/// <returns>A bit per sensor_channel_t, 0 if the values can be left out</returns>
+uint32_t Deadband_Due(deadband_t *filter, const float values[SENSOR_CHANNEL_COUNT], int64_t now_ms);
+
+/// <summary>
+///     Records that these values were sent.  Every channel goes out together, so every
+///     channel's last sent state moves on.
+/// </summary>
+void Deadband_MarkSent(deadband_t *filter, const float values[SENSOR_CHANNEL_COUNT], int64_t now_ms);
@@ -0,0 +1,191 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "decimator.h"
+
+#define PI_F 3.14159265358979f
+
+// The CIC runs in fixed point with this many fractional bits so the output of a previous
+// (FIR) stage keeps its resolution.  The integrators wrap modulo 2^64, which is harmless as
+// long as the comb output fits, so they never need resetting.
+#define CIC_FRACTION_BITS 8
+
+/// <summary>
+///     Designs a Hamming windowed sinc low pass with its cutoff at the output Nyquist rate and
+///     unity gain at DC.  With 8 taps per unit of ratio, the lower half of the output band is
+///     protected from aliasing by more than 50dB.
+/// </summary>
+static void designLowPass(float *taps, int tapCount, int ratio)
+{
+	const float cutoff = 0.5f / (float)ratio;
+	const int middle = tapCount / 2;
+	float sum = 0.0f;
+
+	for (int k = 0; k < tapCount; k++) {
+		const int n = k - middle;
+		const float sinc = (n == 0) ? 2.0f * cutoff : sinf(2.0f * PI_F * cutoff * (float)n) / (PI_F * (float)n);
+		const float window = 0.54f - 0.46f * cosf(2.0f * PI_F * (float)k / (float)(tapCount - 1));
+		taps[k] = sinc * window;
+		sum += taps[k];
+	}
+	for (int k = 0; k < tapCount; k++) {
+		taps[k] /= sum;
+	}
+}
+
+int Decimator_Init(decimator_bank_t *bank, const decimator_stage_config_t *stages, int stageCount)
+{
+	memset(bank, 0, sizeof(*bank));
+
+	if (stageCount <= 0 || stageCount > DECIMATOR_MAX_STAGES) {
+		return -1;
+	}
+
+	for (int s = 0; s < stageCount; s++) {
+		const decimator_stage_config_t *c = &stages[s];
+		if (c->cicRatio == 0 || (c->cicRatio > 1 && (c->cicOrder == 0 || c->cicOrder > DECIMATOR_MAX_CIC_ORDER)) ||
+			c->firRatio == 0 || c->tapCount == 0 || c->tapCount > DECIMATOR_MAX_TAPS || (c->tapCount & 1) == 0) {
+			return -1;
+		}
+
+		bank->config[s] = *c;
+		bank->cicGain[s] = 1.0f / (powf((float)c->cicRatio, (float)c->cicOrder) * (float)(1 << CIC_FRACTION_BITS));
+		designLowPass(bank->taps[s], c->tapCount, c->firRatio);
+	}
+
+	bank->stageCount = stageCount;
+	return 0;
+}
+
+/// <summary>
+///     Integrates one sample and, once every cicRatio samples, runs the combs.
+/// </summary>
+/// <returns>1 if out holds a new decimated sample</returns>
+static int cicStep(decimator_bank_t *bank, int s, const float in[DECIMATOR_AXES], float out[DECIMATOR_AXES])
+{
+	const decimator_stage_config_t *c = &bank->config[s];
+
+	if (c->cicRatio == 1) {
+		memcpy(out, in, DECIMATOR_AXES * sizeof(float));
+		return 1;
+	}
+
+	uint64_t (*integrators)[DECIMATOR_AXES] = bank->integrators[s];
+	for (int a = 0; a < DECIMATOR_AXES; a++) {
+		uint64_t x = (uint64_t)llrintf(in[a] * (float)(1 << CIC_FRACTION_BITS));
+		for (int k = 0; k < c->cicOrder; k++) {
+			integrators[k][a] += x;
+			x = integrators[k][a];
+		}
+	}
+
+	if (++bank->cicPhase[s] < c->cicRatio) {
+		return 0;
+	}
+	bank->cicPhase[s] = 0;
+
+	uint64_t (*combs)[DECIMATOR_AXES] = bank->combs[s];
+	for (int a = 0; a < DECIMATOR_AXES; a++) {
+		uint64_t y = integrators[c->cicOrder - 1][a];
+		for (int k = 0; k < c->cicOrder; k++) {
+			const uint64_t previous = combs[k][a];
+			combs[k][a] = y;
+			y -= previous;
+		}
+		out[a] = (float)(int64_t)y * bank->cicGain[s];
+	}
+	return 1;
+}
+
+/// <summary>
+///     Shifts one sample into the delay line and, once every firRatio samples, computes an
+///     output.  Only the retained outputs are computed, which is what the polyphase form buys:
+///     tapCount / firRatio multiply-accumulates per input sample.
+/// </summary>
+/// <returns>1 if bank->output[s] holds a new sample</returns>
+static int firStep(decimator_bank_t *bank, int s, const float in[DECIMATOR_AXES])
+{
+	const decimator_stage_config_t *c = &bank->config[s];
+	const int tapCount = c->tapCount;
+
+	// The delay line is stored twice so the newest tapCount samples are always contiguous
+	// from firPosition, newest first
+	bank->firPosition[s] = (bank->firPosition[s] == 0) ? (uint16_t)(tapCount - 1) : (uint16_t)(bank->firPosition[s] - 1);
+	float (*window)[DECIMATOR_AXES] = &bank->delay[s][bank->firPosition[s]];
+	for (int a = 0; a < DECIMATOR_AXES; a++) {
+		window[0][a] = in[a];
+		window[tapCount][a] = in[a];
+	}
+
+	if (++bank->firPhase[s] < c->firRatio) {
+		return 0;
+	}
+	bank->firPhase[s] = 0;
+
+	const float *taps = bank->taps[s];
+	float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f;
+	for (int k = 0; k < tapCount; k++) {
+		acc0 += taps[k] * window[k][0];
+		acc1 += taps[k] * window[k][1];
+		acc2 += taps[k] * window[k][2];
+	}
+	bank->output[s][0] = acc0;
+	bank->output[s][1] = acc1;
+	bank->output[s][2] = acc2;
+	bank->outputCount[s]++;
+	return 1;
+}
+
+uint32_t Decimator_Push(decimator_bank_t *bank, const int32_t sample[DECIMATOR_AXES])
+{
+	float raw[DECIMATOR_AXES];
+	float decimated[DECIMATOR_AXES];
+	const float *in = raw;
+	uint32_t produced = 0;
+
+	for (int a = 0; a < DECIMATOR_AXES; a++) {
+		raw[a] = (float)sample[a];
+	}
+
+	for (int s = 0; s < bank->stageCount; s++) {
+		if (!cicStep(bank, s, in, decimated) || !firStep(bank, s, decimated)) {
+			break;
+		}
+		produced |= 1u << s;
+		in = bank->output[s];
+	}
+
+	return produced;
+}
+
+float Decimator_GetMacsPerInputSample(const decimator_bank_t *bank)
+{
+	float rate = 1.0f;
+	float macs = 0.0f;
+
+	for (int s = 0; s < bank->stageCount; s++) {
+		const decimator_stage_config_t *c = &bank->config[s];
+		rate /= (float)c->cicRatio;
+		macs += rate * (float)c->tapCount / (float)c->firRatio;
+		rate /= (float)c->firRatio;
+	}
+	return macs;
+}
+
+float Decimator_GetAddsPerInputSample(const decimator_bank_t *bank)
+{
+	float rate = 1.0f;
+	float adds = 0.0f;
+
+	for (int s = 0; s < bank->stageCount; s++) {
+		const decimator_stage_config_t *c = &bank->config[s];
+		if (c->cicRatio > 1) {
+			adds += rate * (float)c->cicOrder * (1.0f + 1.0f / (float)c->cicRatio);
+		}
+		rate /= (float)c->cicRatio * (float)c->firRatio;
+	}
+	return adds;
+}
@@ -0,0 +1,64 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#define DECIMATOR_AXES 3
+#define DECIMATOR_MAX_STAGES 4
+#define DECIMATOR_MAX_CIC_ORDER 4
+#define DECIMATOR_MAX_TAPS 64
+
+/// <summary>
+///     One stage of the bank: an optional CIC decimator followed by a polyphase FIR decimator.
+///     The stage's output rate is its input rate / (cicRatio * firRatio).
+/// </summary>
+typedef struct {
+	uint16_t cicRatio;           // 1 skips the CIC section
+	uint8_t cicOrder;
+	uint16_t firRatio;
+	uint16_t tapCount;           // Odd, at most DECIMATOR_MAX_TAPS
+} decimator_stage_config_t;
+
+/// <summary>
+///     A cascade of decimation stages for 3 axis samples.  Each stage feeds the next, so one
+///     input stream produces every stage's rate.  All filter state lives in the arrays below,
+///     indexed by stage, with the axes of a sample next to each other.
+/// </summary>
+typedef struct {
+	int stageCount;
+	decimator_stage_config_t config[DECIMATOR_MAX_STAGES];
+	float cicGain[DECIMATOR_MAX_STAGES];
+	uint16_t cicPhase[DECIMATOR_MAX_STAGES];
+	uint16_t firPhase[DECIMATOR_MAX_STAGES];
+	uint16_t firPosition[DECIMATOR_MAX_STAGES];
+	uint64_t integrators[DECIMATOR_MAX_STAGES][DECIMATOR_MAX_CIC_ORDER][DECIMATOR_AXES];
+	uint64_t combs[DECIMATOR_MAX_STAGES][DECIMATOR_MAX_CIC_ORDER][DECIMATOR_AXES];
+	float taps[DECIMATOR_MAX_STAGES][DECIMATOR_MAX_TAPS];
+	float delay[DECIMATOR_MAX_STAGES][2 * DECIMATOR_MAX_TAPS][DECIMATOR_AXES];
+	float output[DECIMATOR_MAX_STAGES][DECIMATOR_AXES];
+	uint32_t outputCount[DECIMATOR_MAX_STAGES];
+} decimator_bank_t;
+
+/// <summary>
+///     Sets up the bank and designs each stage's anti-aliasing filter.
+/// </summary>
+/// <returns>0 on success, or -1 if a stage configuration is out of range</returns>
+int Decimator_Init(decimator_bank_t *bank, const decimator_stage_config_t *stages, int stageCount);
+
+/// <summary>
+///     Feeds one raw sample (in sensor counts, up to 20 bits) through the bank.
+/// </summary>
+/// <returns>A bit mask of the stages that produced a new sample in bank->output</returns>
+uint32_t Decimator_Push(decimator_bank_t *bank, const int32_t sample[DECIMATOR_AXES]);
+
+/// <summary>
+///     FIR multiply-accumulates spent per input sample and axis.
+/// </summary>
+float Decimator_GetMacsPerInputSample(const decimator_bank_t *bank);
+
+/// <summary>
+///     CIC integrator and comb additions spent per input sample and axis.
+/// </summary>
+float Decimator_GetAddsPerInputSample(const decimator_bank_t *bank);
@@ -20,6 +20,8 @@ typedef struct {
 	GPIO_Id twinGPIO;
 	data_type_t twinType;
 	bool active_high;
+	size_t twinSize;
+	void (*twinChanged)(void);
 } twin_t;
 
 ///<summary>
@@ -21,6 +21,8 @@
 #include "azure_iot_utilities.h"
 #include "parson.h"
 #include "build_options.h"
+#include "i2c.h"
+#include "twin_report.h"
 
 //// OLED
 uint8_t oled_ms1[CLOUD_MSG_SIZE];
@@ -47,15 +49,16 @@ extern int clickSocket1Relay2Fd;
 
 extern volatile sig_atomic_t terminationRequired;
 
-static const char cstrDeviceTwinJsonInteger[] = "{\"%s\": %d}";
-static const char cstrDeviceTwinJsonFloat[] = "{\"%s\": %.2f}";
-static const char cstrDeviceTwinJsonBool[] = "{\"%s\": %s}";
-static const char cstrDeviceTwinJsonString[] = "{\"%s\": \"%s\"}";
+// Values only: the property name goes with them to AzureIoT_TwinReportProperty()
+static const char cstrDeviceTwinJsonInteger[] = "%d";
+static const char cstrDeviceTwinJsonFloat[] = "%.2f";
+static const char cstrDeviceTwinJsonBool[] = "%s";
+static const char cstrDeviceTwinJsonString[] = "\"%s\"";
 #ifdef IOT_CENTRAL_APPLICATION
-static const char cstrDeviceTwinJsonFloatIOTC[] = "{\"%s\": {\"value\": %.2f, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
-static const char cstrDeviceTwinJsonBoolIOTC[] = "{\"%s\": {\"value\": %s, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
-static const char cstrDeviceTwinJsonIntegerIOTC[] = "{\"%s\": {\"value\": %d, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
-static const char cstrDeviceTwinJsonStringIOTC[] = "{\"%s\": {\"value\": %s, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
+static const char cstrDeviceTwinJsonFloatIOTC[] = "{\"value\": %.2f, \"status\" : \"completed\" , \"desiredVersion\" : %d }";
+static const char cstrDeviceTwinJsonBoolIOTC[] = "{\"value\": %s, \"status\" : \"completed\" , \"desiredVersion\" : %d }";
+static const char cstrDeviceTwinJsonIntegerIOTC[] = "{\"value\": %d, \"status\" : \"completed\" , \"desiredVersion\" : %d }";
+static const char cstrDeviceTwinJsonStringIOTC[] = "{\"value\": \"%s\", \"status\" : \"completed\" , \"desiredVersion\" : %d }";
 #endif 
 
 static int desiredVersion = 0;
@@ -66,7 +69,9 @@ static int desiredVersion = 0;
 // .twinFD - The associated File Descriptor for this item.  This is usually a GPIO FD.  NULL if NA.
 // .twinGPIO - The associted GPIO number for this item.  NO_GPIO_ASSOCIATED_WITH_TWIN if NA
 // .twinType - The data type for this item, TYPE_BOOL, TYPE_STRING, TYPE_INT, or TYPE_FLOAT
+// .twinSize - For TYPE_STRING, the size of the char array at .twinVar
 // .active_high - true if GPIO item is active high, false if active low.  This is used to init the GPIO 
+// .twinChanged - Called after a new value is stored and before it is reported back.  NULL if NA.
 twin_t twinArray[] = {
 	{.twinKey = "userLedRed",.twinVar = &userLedRedIsOn,.twinFd = &userLedRedFd,.twinGPIO = MT3620_RDB_LED1_RED,.twinType = TYPE_BOOL,.active_high = false},
 	{.twinKey = "userLedGreen",.twinVar = &userLedGreenIsOn,.twinFd = &userLedGreenFd,.twinGPIO = MT3620_RDB_LED1_GREEN,.twinType = TYPE_BOOL,.active_high = false},
@@ -74,7 +79,32 @@ twin_t twinArray[] = {
 	{.twinKey = "appLed",.twinVar = &appLedIsOn,.twinFd = &appLedFd,.twinGPIO = AVT_LED_APP,.twinType = TYPE_BOOL,.active_high = false},
 	{.twinKey = "wifiLed",.twinVar = &wifiLedIsOn,.twinFd = &wifiLedFd,.twinGPIO = AVT_LED_WIFI,.twinType = TYPE_BOOL,.active_high = false},
 	{.twinKey = "clickBoardRelay1",.twinVar = &clkBoardRelay1IsOn,.twinFd = &clickSocket1Relay1Fd,.twinGPIO = AVT_SK_CM1_CS,.twinType = TYPE_BOOL,.active_high = true},
-	{.twinKey = "clickBoardRelay2",.twinVar = &clkBoardRelay2IsOn,.twinFd = &clickSocket1Relay2Fd,.twinGPIO = AVT_SK_CM1_PWM,.twinType = TYPE_BOOL,.active_high = true}};
+	{.twinKey = "clickBoardRelay2",.twinVar = &clkBoardRelay2IsOn,.twinFd = &clickSocket1Relay2Fd,.twinGPIO = AVT_SK_CM1_PWM,.twinType = TYPE_BOOL,.active_high = true},
+#ifdef TELEMETRY_DEADBAND
+	// Report-by-exception settings, see TELEMETRY_DEADBAND in build_options.h
+	{.twinKey = "pressureDeadband",.twinVar = &telemetryDeadband.deadband[SENSOR_CH_PRESSURE],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "pressureMaxSilence",.twinVar = &telemetryDeadband.maxSilence_s[SENSOR_CH_PRESSURE],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "t1Deadband",.twinVar = &telemetryDeadband.deadband[SENSOR_CH_LSM6DSO_TEMP],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "t1MaxSilence",.twinVar = &telemetryDeadband.maxSilence_s[SENSOR_CH_LSM6DSO_TEMP],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "t2Deadband",.twinVar = &telemetryDeadband.deadband[SENSOR_CH_LPS22HH_TEMP],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "t2MaxSilence",.twinVar = &telemetryDeadband.maxSilence_s[SENSOR_CH_LPS22HH_TEMP],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "s1Deadband",.twinVar = &telemetryDeadband.deadband[SENSOR_CH_STRAIN],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "s1MaxSilence",.twinVar = &telemetryDeadband.maxSilence_s[SENSOR_CH_STRAIN],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+	{.twinKey = "d1Deadband",.twinVar = &telemetryDeadband.deadband[SENSOR_CH_DISTANCE],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "d1MaxSilence",.twinVar = &telemetryDeadband.maxSilence_s[SENSOR_CH_DISTANCE],.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true},
+#endif 
+	// Acquisition settings, applied while running by applyAcquisitionConfig() in i2c.c
+	{.twinKey = "samplePeriodMs",.twinVar = &acquisitionConfig.samplePeriod_ms,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true,.twinChanged = applyAcquisitionConfig},
+	{.twinKey = "windowSamples",.twinVar = &acquisitionConfig.windowSamples,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true,.twinChanged = applyAcquisitionConfig},
+	{.twinKey = "imuFifoPeriodMs",.twinVar = &acquisitionConfig.imuFifoPeriod_ms,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true,.twinChanged = applyAcquisitionConfig},
+	{.twinKey = "accelFullScaleG",.twinVar = &acquisitionConfig.accelFullScale_g,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true,.twinChanged = applyAcquisitionConfig},
+#ifdef TELEMETRY_PER_SAMPLE
+	{.twinKey = "batchSamples",.twinVar = &acquisitionConfig.batchSamples,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true,.twinChanged = applyAcquisitionConfig},
+#endif 
+};
+
+_Static_assert(sizeof(twinArray) / sizeof(twin_t) + TWIN_REPORT_FIXED_PROPERTIES <= TWIN_REPORT_MAX_PROPERTIES,
+	"Raise TWIN_REPORT_MAX_PROPERTIES, every twinArray entry is echoed as a reported property");
 
 // Calculate how many twin_t items are in the array.  We use this to iterate through the structure.
 int twinArraySize = sizeof(twinArray) / sizeof(twin_t);
@@ -86,10 +116,8 @@ void checkAndUpdateDeviceTwin(char* property, void* value, data_type_t type, boo
 {
 	int nJsonLength = -1;
 
-	char *pjsonBuffer = (char *)malloc(JSON_BUFFER_SIZE);
-	if (pjsonBuffer == NULL) {
-		Log_Debug("ERROR: not enough memory to report device twin changes.");
-	}
+	// The report keeps its own copy, so one buffer serves every call without touching the heap
+	static char pjsonBuffer[JSON_BUFFER_SIZE];
 
 	if (property != NULL) {
 
@@ -99,48 +127,167 @@ void checkAndUpdateDeviceTwin(char* property, void* value, data_type_t type, boo
 		case TYPE_BOOL:
 #ifdef IOT_CENTRAL_APPLICATION
 			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonBoolIOTC, property, *(bool*)value ? "true" : "false", desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonBoolIOTC, *(bool*)value ? "true" : "false", desiredVersion);
 			}
 			else
 #endif 
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonBool, property, *(bool*)value ? "true" : "false", desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonBool, *(bool*)value ? "true" : "false");
 
 			break;
 		case TYPE_FLOAT:
 #ifdef IOT_CENTRAL_APPLICATION			
 			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonFloatIOTC, property, *(float*)value, desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonFloatIOTC, *(float*)value, desiredVersion);
 			}
 			else
 #endif 
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonFloat, property, *(float*)value, desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonFloat, *(float*)value);
 			break;
 		case TYPE_INT:
 #ifdef IOT_CENTRAL_APPLICATION		
 			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonIntegerIOTC, property, *(int*)value, desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonIntegerIOTC, *(int*)value, desiredVersion);
 			}
 			else
 #endif
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonInteger, property, *(int*)value, desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonInteger, *(int*)value);
 			break;
 		case TYPE_STRING:
 #ifdef IOT_CENTRAL_APPLICATION			
 			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonStringIOTC, property, (char*)value, desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonStringIOTC, (char*)value, desiredVersion);
 			}
 			else
 #endif 
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonString, property, (char*)value, desiredVersion);
+				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonString, (char*)value);
 			break;
 		}
 
-		if (nJsonLength > 0) {
+		if (nJsonLength > 0 && nJsonLength < JSON_BUFFER_SIZE) {
 			Log_Debug("[MCU] Updating device twin: %s\n", pjsonBuffer);
-			AzureIoT_TwinReportStateJson(pjsonBuffer, (size_t)nJsonLength);
+			AzureIoT_TwinReportProperty(property, pjsonBuffer);
+		}
+	}
+}
+
+// Slots in the desired property index, a power of two at least twice the twinArray entries
+#define TWIN_INDEX_SIZE 64
+
+_Static_assert((TWIN_INDEX_SIZE & (TWIN_INDEX_SIZE - 1)) == 0, "TWIN_INDEX_SIZE must be a power of two");
+_Static_assert(TWIN_INDEX_SIZE >= 2 * (sizeof(twinArray) / sizeof(twin_t)), "TWIN_INDEX_SIZE is too small for twinArray");
+
+// twinArray index + 1 by key hash, 0 for an empty slot
+static uint8_t twinIndex[TWIN_INDEX_SIZE];
+static bool twinIndexBuilt = false;
+
+static uint32_t hashTwinKey(const char *key)
+{
+	uint32_t hash = 2166136261u;
+	for (const char *c = key; *c != '\0'; c++) {
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
+	}
+	return hash;
+}
+
+///<summary>
+///		Indexes twinArray by key, with linear probing.  At most half full, so a lookup usually
+///		takes one probe and one strcmp.
+///</summary>
+static void buildTwinIndex(void)
+{
+	memset(twinIndex, 0, sizeof(twinIndex));
+	for (int i = 0; i < twinArraySize; i++) {
+		uint32_t slot = hashTwinKey(twinArray[i].twinKey) & (TWIN_INDEX_SIZE - 1);
+		while (twinIndex[slot] != 0) {
+			slot = (slot + 1) & (TWIN_INDEX_SIZE - 1);
+		}
+		twinIndex[slot] = (uint8_t)(i + 1);
+	}
+	twinIndexBuilt = true;
+}
+
+static twin_t *findTwin(const char *key)
+{
+	uint32_t slot = hashTwinKey(key) & (TWIN_INDEX_SIZE - 1);
+	while (twinIndex[slot] != 0) {
+		twin_t *twin = &twinArray[twinIndex[slot] - 1];
+		if (strcmp(twin->twinKey, key) == 0) {
+			return twin;
+		}
+		slot = (slot + 1) & (TWIN_INDEX_SIZE - 1);
+	}
+	return NULL;
+}
+
+///<summary>
+///		Applies one desired property to its twinArray variable and echoes it back as reported.
+///</summary>
+///<param name="value">The property's value; IoT Central wraps it as {"value": ...}</param>
+static void applyDesiredProperty(twin_t *twin, JSON_Value *value)
+{
+	int result = 0;
+	bool stored = false;
+
+#ifdef IOT_CENTRAL_APPLICATION
+	value = json_object_get_value(json_value_get_object(value), "value");
+#endif 
+
+	switch (twin->twinType) {
+	case TYPE_BOOL:
+		if (json_value_get_type(value) != JSONBoolean) {
+			break;
 		}
-		free(pjsonBuffer);
+		*(bool*)twin->twinVar = (bool)json_value_get_boolean(value);
+		if (twin->twinFd != NULL) {
+			result = GPIO_SetValue(*twin->twinFd, twin->active_high ? (GPIO_Value)*(bool*)twin->twinVar : !(GPIO_Value)*(bool*)twin->twinVar);
+
+			if (result != 0) {
+				Log_Debug("Fd: %d\n", *twin->twinFd);
+				Log_Debug("FAILURE: Could not set GPIO_%d, %d output value %d: %s (%d).\n", twin->twinGPIO, *twin->twinFd, (GPIO_Value)*(bool*)twin->twinVar, strerror(errno), errno);
+				terminationRequired = true;
+			}
+		}
+		Log_Debug("Received device update. New %s is %s\n", twin->twinKey, *(bool*)twin->twinVar ? "true" : "false");
+		stored = true;
+		break;
+	case TYPE_FLOAT:
+		if (json_value_get_type(value) != JSONNumber) {
+			break;
+		}
+		*(float*)twin->twinVar = (float)json_value_get_number(value);
+		Log_Debug("Received device update. New %s is %0.2f\n", twin->twinKey, *(float*)twin->twinVar);
+		stored = true;
+		break;
+	case TYPE_INT:
+		if (json_value_get_type(value) != JSONNumber) {
+			break;
+		}
+		*(int*)twin->twinVar = (int)json_value_get_number(value);
+		Log_Debug("Received device update. New %s is %d\n", twin->twinKey, *(int*)twin->twinVar);
+		stored = true;
+		break;
+	case TYPE_STRING: {
+		const char *text = json_value_get_string(value);
+		// Quotes and escapes would have to be escaped again in the reported value, so refuse them
+		if (text == NULL || strlen(text) >= twin->twinSize || strpbrk(text, "\"\\") != NULL) {
+			break;
+		}
+		strcpy((char*)twin->twinVar, text);
+		Log_Debug("Received device update. New %s is %s\n", twin->twinKey, (char*)twin->twinVar);
+		stored = true;
+		break;
+	}
 	}
+	if (!stored) {
+		Log_Debug("ERROR: Ignored device update of %s, wrong type or too long.\n", twin->twinKey);
+		return;
+	}
+
+	// The handler may put back a value it can't use, so what is reported is what is in effect
+	if (twin->twinChanged != NULL) {
+		twin->twinChanged();
+	}
+	checkAndUpdateDeviceTwin(twin->twinKey, twin->twinVar, twin->twinType, true);
 }
 
 ///<summary>
@@ -149,7 +296,9 @@ void checkAndUpdateDeviceTwin(char* property, void* value, data_type_t type, boo
 ///<param name="desiredProperties">Address of desired properties JSON_Object</param>
 void deviceTwinChangedHandler(JSON_Object * desiredProperties)
 {
-	int result = 0;
+	if (!twinIndexBuilt) {
+		buildTwinIndex();
+	}
 
 	// Pull the twin version out of the message.  We use this value when we echo the new setting back to IoT Connect.
 	if (json_object_has_value(desiredProperties, "$version") != 0)
@@ -157,80 +306,16 @@ void deviceTwinChangedHandler(JSON_Object * desiredProperties)
 		desiredVersion = (int)json_object_get_number(desiredProperties, "$version");
 	}
 
-#ifdef IOT_CENTRAL_APPLICATION		
-
-	for (int i = 0; i < (sizeof(twinArray) / sizeof(twin_t)); i++) {
-
-		if (json_object_has_value(desiredProperties, twinArray[i].twinKey) != 0)
-		{
-
-			JSON_Object *currentJSONProperties = json_object_dotget_object(desiredProperties, twinArray[i].twinKey);
-
-			switch (twinArray[i].twinType) {
-			case TYPE_BOOL:
-				*(bool*)twinArray[i].twinVar = (bool)json_object_get_boolean(currentJSONProperties, "value");
-				result = GPIO_SetValue(*twinArray[i].twinFd, twinArray[i].active_high ? (GPIO_Value)*(bool*)twinArray[i].twinVar : !(GPIO_Value)*(bool*)twinArray[i].twinVar);
-
-				if (result != 0) {
-					Log_Debug("Fd: %d\n", twinArray[i].twinFd);
-					Log_Debug("FAILURE: Could not set GPIO_%d, %d output value %d: %s (%d).\n", twinArray[i].twinGPIO, twinArray[i].twinFd, (GPIO_Value)*(bool*)twinArray[i].twinVar, strerror(errno), errno);
-					terminationRequired = true;
-				}
-				Log_Debug("Received device update. New %s is %s\n", twinArray[i].twinKey, *(bool*)twinArray[i].twinVar ? "true" : "false");
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_BOOL, true);
-				break;
-			case TYPE_FLOAT:
-				*(float*)twinArray[i].twinVar = (float)json_object_get_number(currentJSONProperties, "value");
-				Log_Debug("Received device update. New %s is %0.2f\n", twinArray[i].twinKey, *(float*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_FLOAT, true);
-				break;
-			case TYPE_INT:
-				*(int*)twinArray[i].twinVar = (int)json_object_get_number(currentJSONProperties, "value");
-				Log_Debug("Received device update. New %s is %d\n", twinArray[i].twinKey, *(int*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_INT, true);
-				break;
-			case TYPE_STRING:
-				Log_Debug("ERROR: TYPE_STRING case not implemented!");
-				break;
-			}
+	// One pass over the patch, looking each key up, rather than searching the patch for every twinArray key
+	const size_t count = json_object_get_count(desiredProperties);
+	for (size_t i = 0; i < count; i++) {
+		const char *key = json_object_get_name(desiredProperties, i);
+		if (key == NULL || key[0] == '$') {
+			continue;
 		}
-	}
-#else // !IOT_CENTRAL_APPLICATION		
-	
-	for (int i = 0; i < (sizeof(twinArray) / sizeof(twin_t)); i++) {
-
-		if (json_object_has_value(desiredProperties, twinArray[i].twinKey) != 0)
-		{
-
-			switch (twinArray[i].twinType) {
-			case TYPE_BOOL:
-				*(bool*)twinArray[i].twinVar = (bool)json_object_get_boolean(desiredProperties, twinArray[i].twinKey);
-				result = GPIO_SetValue(*twinArray[i].twinFd, twinArray[i].active_high ? (GPIO_Value)*(bool*)twinArray[i].twinVar : !(GPIO_Value)*(bool*)twinArray[i].twinVar);
-
-				if (result != 0) {
-					Log_Debug("Fd: %d\n", twinArray[i].twinFd);
-					Log_Debug("FAILURE: Could not set GPIO_%d, %d output value %d: %s (%d).\n", twinArray[i].twinGPIO, twinArray[i].twinFd, (GPIO_Value)*(bool*)twinArray[i].twinVar, strerror(errno), errno);
-					terminationRequired = true;
-				}
-				Log_Debug("Received device update. New %s is %s\n", twinArray[i].twinKey, *(bool*)twinArray[i].twinVar ? "true" : "false");
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_BOOL, true);
-				break;
-			case TYPE_FLOAT:
-				*(float*)twinArray[i].twinVar = (float)json_object_get_number(desiredProperties, twinArray[i].twinKey);
-				Log_Debug("Received device update. New %s is %0.2f\n", twinArray[i].twinKey, *(float*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_FLOAT, true);
-				break;
-			case TYPE_INT:
-				*(int*)twinArray[i].twinVar = (int)json_object_get_number(desiredProperties, twinArray[i].twinKey);
-				Log_Debug("Received device update. New %s is %d\n", twinArray[i].twinKey, *(int*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_INT, true);
-				break;
-			case TYPE_STRING:
-				Log_Debug("ERROR: TYPE_STRING case not implemented!");
-				break;
-			}
+		twin_t *twin = findTwin(key);
+		if (twin != NULL) {
+			applyDesiredProperty(twin, json_object_get_value_at(desiredProperties, i));
 		}
 	}
-#endif 
-
 }
@@ -0,0 +1,141 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "distance_tracker.h"
+
+// Per the TFMini datasheet, returns under 100 are unreliable and 65535 means the receiver
+// saturated.  The measurement noise scales down as the return gets stronger up to this value.
+#define TFMINI_MIN_STRENGTH       100
+#define TFMINI_SATURATED_STRENGTH 65535
+#define TFMINI_REFERENCE_STRENGTH 1000.0f
+
+// Average this many accepted frames before fixing the displacement baseline
+#define BASELINE_FRAMES 50
+
+// Innovations beyond this many standard deviations are treated as outliers
+#define OUTLIER_GATE_SIGMA 4.0f
+
+// A target that stays outside the gate this many frames in a row is a real step (e.g. the beam
+// landed on something else), so drop the lock and re-acquire
+#define MAX_CONSECUTIVE_OUTLIERS 25
+
+// Starting uncertainty for a fresh lock
+#define INITIAL_RATE_VARIANCE 100.0f
+
+void DistanceTracker_Init(distance_tracker_t *tracker, float processNoise, float measurementSigma_cm)
+{
+	memset(tracker, 0, sizeof(*tracker));
+	tracker->processNoise = processNoise;
+	tracker->measurementSigma_cm = measurementSigma_cm;
+}
+
+bool DistanceTracker_Update(distance_tracker_t *tracker, uint16_t distance_cm, uint16_t strength,
+	bool valid, float dt)
+{
+	bool usable = valid && strength >= TFMINI_MIN_STRENGTH && strength != TFMINI_SATURATED_STRENGTH && distance_cm > 0;
+
+	if (!tracker->initialized) {
+		if (!usable) {
+			tracker->rejectedFrames++;
+			return false;
+		}
+		float r = tracker->measurementSigma_cm * tracker->measurementSigma_cm;
+		tracker->distance_cm = distance_cm;
+		tracker->rate_cmps = 0.0f;
+		tracker->p00 = r;
+		tracker->p01 = 0.0f;
+		tracker->p11 = INITIAL_RATE_VARIANCE;
+		tracker->baseline_cm = distance_cm;
+		tracker->baselineFrames = 1;
+		tracker->acceptedFrames++;
+		tracker->initialized = true;
+		return true;
+	}
+
+	// Predict: x = F x, P = F P F' + Q for the constant velocity model
+	const float q = tracker->processNoise;
+	const float dt2 = dt * dt;
+	tracker->distance_cm += tracker->rate_cmps * dt;
+	tracker->p00 += dt * (2.0f * tracker->p01 + dt * tracker->p11) + q * dt2 * dt / 3.0f;
+	tracker->p01 += dt * tracker->p11 + q * dt2 / 2.0f;
+	tracker->p11 += q * dt;
+
+	if (!usable) {
+		tracker->rejectedFrames++;
+		return false;
+	}
+
+	// Weaker returns are noisier, scale the variance with the inverse of the strength
+	float strengthScale = TFMINI_REFERENCE_STRENGTH / (float)strength;
+	if (strengthScale < 1.0f) {
+		strengthScale = 1.0f;
+	}
+	const float r = tracker->measurementSigma_cm * tracker->measurementSigma_cm * strengthScale;
+
+	const float innovation = (float)distance_cm - tracker->distance_cm;
+	const float s = tracker->p00 + r;
+	if (innovation * innovation > OUTLIER_GATE_SIGMA * OUTLIER_GATE_SIGMA * s) {
+		tracker->rejectedFrames++;
+		if (++tracker->consecutiveOutliers >= MAX_CONSECUTIVE_OUTLIERS) {
+			tracker->initialized = false;
+			tracker->consecutiveOutliers = 0;
+		}
+		return false;
+	}
+	tracker->consecutiveOutliers = 0;
+
+	// Update: K = P H' / S with H = [1 0]
+	const float k0 = tracker->p00 / s;
+	const float k1 = tracker->p01 / s;
+	tracker->distance_cm += k0 * innovation;
+	tracker->rate_cmps += k1 * innovation;
+
+	const float p00 = tracker->p00, p01 = tracker->p01;
+	tracker->p00 = (1.0f - k0) * p00;
+	tracker->p01 = (1.0f - k0) * p01;
+	tracker->p11 -= k1 * p01;
+
+	tracker->acceptedFrames++;
+
+	// Running average of the first frames after lock becomes the displacement reference
+	if (tracker->baselineFrames < BASELINE_FRAMES) {
+		tracker->baselineFrames++;
+		tracker->baseline_cm += (tracker->distance_cm - tracker->baseline_cm) / (float)tracker->baselineFrames;
+	}
+
+	return true;
+}
+
+void DistanceTracker_ResetBaseline(distance_tracker_t *tracker)
+{
+	tracker->baseline_cm = tracker->distance_cm;
+	tracker->baselineFrames = tracker->initialized ? 1 : 0;
+}
+
+float DistanceTracker_GetDisplacement_mm(const distance_tracker_t *tracker)
+{
+	if (!tracker->initialized) {
+		return 0.0f;
+	}
+	return (tracker->baseline_cm - tracker->distance_cm) * 10.0f;
+}
+
+float DistanceTracker_GetRate_mmps(const distance_tracker_t *tracker)
+{
+	return -tracker->rate_cmps * 10.0f;
+}
+
+float DistanceTracker_GetConfidence(const distance_tracker_t *tracker)
+{
+	if (!tracker->initialized) {
+		return 0.0f;
+	}
+
+	// 1 when the filtered uncertainty is well below a single good measurement, falling off
+	// as the tracker coasts on predictions through weak or missing returns.
+	const float sigma = sqrtf(tracker->p00);
+	return tracker->measurementSigma_cm / (tracker->measurementSigma_cm + sigma);
+}
@@ -0,0 +1,63 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>
+///     Constant-velocity Kalman tracker for one LIDAR target.  Everything it needs is in this
+///     struct so each tracked target costs a fixed few dozen bytes.
+/// </summary>
+typedef struct {
+	float distance_cm;          // Filtered distance
+	float rate_cmps;            // Filtered rate of change, positive when the wall moves away
+	float p00, p01, p11;        // State covariance
+	float baseline_cm;          // Distance displacement is measured from
+	float processNoise;         // Acceleration noise density, cm^2/s^3
+	float measurementSigma_cm;  // Measurement noise at the reference signal strength
+	uint32_t baselineFrames;
+	uint32_t acceptedFrames;
+	uint32_t rejectedFrames;
+	uint32_t consecutiveOutliers;
+	bool initialized;
+} distance_tracker_t;
+
+/// <summary>
+///     Initializes a tracker with no target lock.
+/// </summary>
+void DistanceTracker_Init(distance_tracker_t *tracker, float processNoise, float measurementSigma_cm);
+
+/// <summary>
+///     Predicts the target forward by dt and, when the frame is usable, corrects it with the
+///     measurement.  Weak or saturated returns and gross outliers only advance the prediction.
+/// </summary>
+/// <param name="distance_cm">Raw TFMini distance</param>
+/// <param name="strength">Raw TFMini signal strength</param>
+/// <param name="valid">TFMini "trigger done" flag for the frame</param>
+/// <param name="dt">Seconds since the previous frame</param>
+/// <returns>true if the measurement was used</returns>
+bool DistanceTracker_Update(distance_tracker_t *tracker, uint16_t distance_cm, uint16_t strength,
+	bool valid, float dt);
+
+/// <summary>
+///     Restarts displacement measurement from the current filtered distance, e.g. at the start
+///     of a drum cycle.
+/// </summary>
+void DistanceTracker_ResetBaseline(distance_tracker_t *tracker);
+
+/// <summary>
+///     Displacement from the baseline in mm, positive towards the sensor (i.e. a bulging wall).
+/// </summary>
+float DistanceTracker_GetDisplacement_mm(const distance_tracker_t *tracker);
+
+/// <summary>
+///     Rate of change of the displacement in mm/s.
+/// </summary>
+float DistanceTracker_GetRate_mmps(const distance_tracker_t *tracker);
+
+/// <summary>
+///     Confidence in the current estimate from 0 (no lock) to 1 (as good as the sensor gets).
+/// </summary>
+float DistanceTracker_GetConfidence(const distance_tracker_t *tracker);
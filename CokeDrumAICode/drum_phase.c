@@ -0,0 +1,245 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "build_options.h"
+#include "drum_phase.h"
+
+// Time constants of the input smoothing.  The drum moves slowly, so a few tens of seconds keeps
+// single reads from flipping the phase while still following a quench within a minute.
+#define INPUT_SMOOTHING_SECONDS 20.0f
+#define SLOPE_SMOOTHING_SECONDS 60.0f
+
+// How quickly the ambient pressure reference may creep back up after a low reading
+#define AMBIENT_PRESSURE_RELAX_HPA_PER_SECOND 0.001f
+
+static const char *const phaseNames[DRUM_PHASE_COUNT] = {
+	[DRUM_PHASE_UNKNOWN] = "unknown",
+	[DRUM_PHASE_FILL] = "fill",
+	[DRUM_PHASE_STEAM_OUT] = "steamOut",
+	[DRUM_PHASE_QUENCH] = "quench",
+	[DRUM_PHASE_DRAIN] = "drain",
+	[DRUM_PHASE_UNHEADING] = "unheading",
+	[DRUM_PHASE_CUTTING] = "cutting",
+	[DRUM_PHASE_HEAT_UP] = "heatUp"
+};
+
+// Until the phase is known the build's default read period and window are used.  Thermal
+// phases change slowly and are reported at the normal rate.  Quench is where the
+// thermal stress is, and unheading and cutting are short mechanical events, so those are
+// sampled faster and summarized over more reads.
+static const drum_phase_profile_t phaseProfiles[DRUM_PHASE_COUNT] = {
+	[DRUM_PHASE_UNKNOWN] = { .samplePeriod_ms = ACCEL_READ_PERIOD_SECONDS * 1000 + ACCEL_READ_PERIOD_NANO_SECONDS / 1000000,
+		.windowSamples = SENSOR_STATS_WINDOW_SAMPLES },
+	[DRUM_PHASE_FILL] = { .samplePeriod_ms = 5000, .windowSamples = 12 },
+	[DRUM_PHASE_STEAM_OUT] = { .samplePeriod_ms = 5000, .windowSamples = 12 },
+	[DRUM_PHASE_QUENCH] = { .samplePeriod_ms = 2000, .windowSamples = 15 },
+	[DRUM_PHASE_DRAIN] = { .samplePeriod_ms = 10000, .windowSamples = 6 },
+	[DRUM_PHASE_UNHEADING] = { .samplePeriod_ms = 1000, .windowSamples = 10 },
+	[DRUM_PHASE_CUTTING] = { .samplePeriod_ms = 1000, .windowSamples = 30 },
+	[DRUM_PHASE_HEAT_UP] = { .samplePeriod_ms = 5000, .windowSamples = 12 }
+};
+
+void DrumPhase_DefaultConfig(drum_phase_config_t *config)
+{
+	config->hotTemperature_degC = 40.0f;
+	config->coldTemperature_degC = 30.0f;
+	config->heatingSlope_degCpm = 0.5f;
+	config->quenchSlope_degCpm = -1.0f;
+	config->pressureRise_hPa = 5.0f;
+	config->steamVibration_g = 0.02f;
+	config->unheadingVibration_g = 0.3f;
+	config->cuttingVibration_g = 0.1f;
+	config->loadedStrain = 10.0f;
+	config->dwellObservations = 3;
+	config->resyncObservations = 12;
+}
+
+void DrumPhase_Init(drum_phase_detector_t *detector, const drum_phase_config_t *config)
+{
+	memset(detector, 0, sizeof(*detector));
+	detector->config = *config;
+	detector->phase = DRUM_PHASE_UNKNOWN;
+	detector->candidate = DRUM_PHASE_UNKNOWN;
+}
+
+/// <summary>
+///     Best guess at the phase from the current readings alone, used to acquire the phase at
+///     startup and to recover if the sequence is lost.
+/// </summary>
+static drum_phase_t classify(const drum_phase_detector_t *d)
+{
+	const drum_phase_config_t *c = &d->config;
+	const bool hot = d->temperature_degC >= c->hotTemperature_degC;
+	const bool pressurized = d->pressure_hPa - d->ambientPressure_hPa >= c->pressureRise_hPa;
+
+	if (d->vibration_g >= c->unheadingVibration_g && !pressurized) {
+		return DRUM_PHASE_UNHEADING;
+	}
+	if (d->vibration_g >= c->cuttingVibration_g && !hot && !pressurized) {
+		return DRUM_PHASE_CUTTING;
+	}
+	if (d->temperatureSlope_degCpm <= c->quenchSlope_degCpm) {
+		return DRUM_PHASE_QUENCH;
+	}
+	if (hot && pressurized) {
+		return (d->vibration_g >= c->steamVibration_g) ? DRUM_PHASE_STEAM_OUT : DRUM_PHASE_FILL;
+	}
+	if (d->temperatureSlope_degCpm >= c->heatingSlope_degCpm && !hot) {
+		return DRUM_PHASE_HEAT_UP;
+	}
+	if (d->temperature_degC <= c->coldTemperature_degC && !pressurized) {
+		return DRUM_PHASE_DRAIN;
+	}
+	return DRUM_PHASE_UNKNOWN;
+}
+
+/// <summary>
+///     The phase the drum would move to next if the readings show it, or the current phase.
+/// </summary>
+static drum_phase_t nextInSequence(const drum_phase_detector_t *d)
+{
+	const drum_phase_config_t *c = &d->config;
+	const bool hot = d->temperature_degC >= c->hotTemperature_degC;
+	const bool pressurized = d->pressure_hPa - d->ambientPressure_hPa >= c->pressureRise_hPa;
+
+	switch (d->phase) {
+	case DRUM_PHASE_FILL:
+		// Feed is switched to the other drum and steam is blown through the coke
+		if (d->vibration_g >= c->steamVibration_g && pressurized) {
+			return DRUM_PHASE_STEAM_OUT;
+		}
+		break;
+	case DRUM_PHASE_STEAM_OUT:
+		if (d->temperatureSlope_degCpm <= c->quenchSlope_degCpm) {
+			return DRUM_PHASE_QUENCH;
+		}
+		break;
+	case DRUM_PHASE_QUENCH:
+		// Cooling has levelled off and the water is let out
+		if (!hot && d->temperatureSlope_degCpm > c->quenchSlope_degCpm / 4.0f) {
+			return DRUM_PHASE_DRAIN;
+		}
+		break;
+	case DRUM_PHASE_DRAIN:
+		if (d->vibration_g >= c->unheadingVibration_g && !pressurized) {
+			return DRUM_PHASE_UNHEADING;
+		}
+		break;
+	case DRUM_PHASE_UNHEADING:
+		if (d->vibration_g >= c->cuttingVibration_g && d->vibration_g < c->unheadingVibration_g) {
+			return DRUM_PHASE_CUTTING;
+		}
+		break;
+	case DRUM_PHASE_CUTTING:
+		// Cutting is finished, the drum is reheaded and warmed with vapors from the other drum
+		if (d->vibration_g < c->steamVibration_g && d->temperatureSlope_degCpm >= c->heatingSlope_degCpm) {
+			return DRUM_PHASE_HEAT_UP;
+		}
+		break;
+	case DRUM_PHASE_HEAT_UP:
+		if (hot && (pressurized || d->strain >= c->loadedStrain)) {
+			return DRUM_PHASE_FILL;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return d->phase;
+}
+
+static float smooth(float current, float sample, float dt, float tau)
+{
+	return current + (sample - current) * dt / (tau + dt);
+}
+
+bool DrumPhase_Update(drum_phase_detector_t *detector, const drum_phase_inputs_t *inputs, float dt,
+	drum_phase_transition_t *transition)
+{
+	drum_phase_detector_t *d = detector;
+
+	if (!d->primed || dt <= 0.0f) {
+		d->temperature_degC = inputs->temperature_degC;
+		d->pressure_hPa = inputs->pressure_hPa;
+		d->ambientPressure_hPa = inputs->pressure_hPa;
+		d->vibration_g = inputs->vibration_g;
+		d->strain = inputs->strain;
+		d->temperatureSlope_degCpm = 0.0f;
+		d->primed = true;
+		return false;
+	}
+
+	const float previousTemperature = d->temperature_degC;
+	d->temperature_degC = smooth(d->temperature_degC, inputs->temperature_degC, dt, INPUT_SMOOTHING_SECONDS);
+	d->temperatureSlope_degCpm = smooth(d->temperatureSlope_degCpm,
+		(d->temperature_degC - previousTemperature) * 60.0f / dt, dt, SLOPE_SMOOTHING_SECONDS);
+	d->pressure_hPa = smooth(d->pressure_hPa, inputs->pressure_hPa, dt, INPUT_SMOOTHING_SECONDS);
+	d->vibration_g = smooth(d->vibration_g, inputs->vibration_g, dt, INPUT_SMOOTHING_SECONDS);
+	d->strain = smooth(d->strain, inputs->strain, dt, INPUT_SMOOTHING_SECONDS);
+
+	// Ambient is the lowest pressure seen, slowly forgotten so weather changes don't accumulate
+	d->ambientPressure_hPa += AMBIENT_PRESSURE_RELAX_HPA_PER_SECOND * dt;
+	if (d->pressure_hPa < d->ambientPressure_hPa) {
+		d->ambientPressure_hPa = d->pressure_hPa;
+	}
+
+	d->secondsInPhase += dt;
+
+	// Follow the cycle when the readings allow it.  Evidence for any other phase has to persist
+	// longer before the detector gives up on the sequence and jumps.
+	drum_phase_t proposed = nextInSequence(d);
+	uint16_t needed = d->config.dwellObservations;
+	if (proposed == d->phase) {
+		proposed = classify(d);
+		if (d->phase != DRUM_PHASE_UNKNOWN) {
+			needed = d->config.resyncObservations;
+		}
+	}
+
+	if (proposed == d->phase || proposed == DRUM_PHASE_UNKNOWN) {
+		d->candidate = d->phase;
+		d->candidateObservations = 0;
+		return false;
+	}
+
+	if (proposed != d->candidate) {
+		d->candidate = proposed;
+		d->candidateObservations = 0;
+	}
+	if (++d->candidateObservations < needed) {
+		return false;
+	}
+
+	transition->from = d->phase;
+	transition->to = proposed;
+	transition->secondsInPreviousPhase = d->secondsInPhase;
+
+	d->phase = proposed;
+	d->candidateObservations = 0;
+	d->secondsInPhase = 0.0f;
+	d->transitions++;
+	return true;
+}
+
+drum_phase_t DrumPhase_GetPhase(const drum_phase_detector_t *detector)
+{
+	return detector->phase;
+}
+
+const char *DrumPhase_GetName(drum_phase_t phase)
+{
+	if ((unsigned)phase >= DRUM_PHASE_COUNT) {
+		return phaseNames[DRUM_PHASE_UNKNOWN];
+	}
+	return phaseNames[phase];
+}
+
+const drum_phase_profile_t *DrumPhase_GetProfile(drum_phase_t phase)
+{
+	if ((unsigned)phase >= DRUM_PHASE_COUNT) {
+		return &phaseProfiles[DRUM_PHASE_UNKNOWN];
+	}
+	return &phaseProfiles[phase];
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The phases of one coke drum cycle, in the order the drum goes through them
+typedef enum {
+	DRUM_PHASE_UNKNOWN = 0,
+	DRUM_PHASE_FILL,
+	DRUM_PHASE_STEAM_OUT,
+	DRUM_PHASE_QUENCH,
+	DRUM_PHASE_DRAIN,
+	DRUM_PHASE_UNHEADING,
+	DRUM_PHASE_CUTTING,
+	DRUM_PHASE_HEAT_UP,
+	DRUM_PHASE_COUNT
+} drum_phase_t;
+
+/// <summary>
+///     How the acquisition loop samples and reports while the drum is in a phase.
+/// </summary>
+typedef struct {
+	uint32_t samplePeriod_ms;    // Period of the sensor read timer
+	uint16_t windowSamples;      // Reads reduced into one telemetry record
+} drum_phase_profile_t;
+
+/// <summary>
+///     Thresholds used to recognize the phases.  Temperatures and pressures are relative to what
+///     the sensors see on the drum skirt, not process conditions.
+/// </summary>
+typedef struct {
+	float hotTemperature_degC;       // At or above this the drum is on stream
+	float coldTemperature_degC;      // At or below this the drum has been quenched
+	float heatingSlope_degCpm;       // Warming faster than this is heat-up
+	float quenchSlope_degCpm;        // Cooling faster than this (negative) is quench
+	float pressureRise_hPa;          // Rise over ambient that means the drum is pressurized
+	float steamVibration_g;          // RMS vibration of steam flowing through the drum
+	float unheadingVibration_g;      // RMS vibration of the heads being removed
+	float cuttingVibration_g;        // RMS vibration of hydraulic cutting
+	float loadedStrain;              // Skirt strain with a full drum
+	uint16_t dwellObservations;      // A new phase must be seen this many reads in a row
+	uint16_t resyncObservations;     // Out of sequence evidence needed to jump phases
+} drum_phase_config_t;
+
+/// <summary>
+///     One set of readings fed to the detector.
+/// </summary>
+typedef struct {
+	float temperature_degC;
+	float pressure_hPa;
+	float vibration_g;               // RMS of the acceleration magnitude about 1g
+	float strain;
+} drum_phase_inputs_t;
+
+/// <summary>
+///     Describes a phase change reported by DrumPhase_Update().
+/// </summary>
+typedef struct {
+	drum_phase_t from;
+	drum_phase_t to;
+	float secondsInPreviousPhase;
+} drum_phase_transition_t;
+
+typedef struct {
+	drum_phase_config_t config;
+	drum_phase_t phase;
+	drum_phase_t candidate;
+	uint16_t candidateObservations;
+	bool primed;
+	float temperature_degC;          // Smoothed inputs
+	float temperatureSlope_degCpm;
+	float pressure_hPa;
+	float ambientPressure_hPa;
+	float vibration_g;
+	float strain;
+	float secondsInPhase;
+	uint32_t transitions;
+} drum_phase_detector_t;
+
+/// <summary>
+///     Fills in the default thresholds.
+/// </summary>
+void DrumPhase_DefaultConfig(drum_phase_config_t *config);
+
+/// <summary>
+///     Starts the detector in DRUM_PHASE_UNKNOWN.
+/// </summary>
+void DrumPhase_Init(drum_phase_detector_t *detector, const drum_phase_config_t *config);
+
+/// <summary>
+///     Folds in one set of readings and advances the state machine.
+/// </summary>
+/// <param name="dt">Seconds since the previous update</param>
+/// <param name="transition">Filled in when the phase changes</param>
+/// <returns>true if the phase changed</returns>
+bool DrumPhase_Update(drum_phase_detector_t *detector, const drum_phase_inputs_t *inputs, float dt,
+	drum_phase_transition_t *transition);
+
+/// <summary>
+///     The phase the drum is currently in.
+/// </summary>
+drum_phase_t DrumPhase_GetPhase(const drum_phase_detector_t *detector);
+
+/// <summary>
+///     Short name of a phase, used as the telemetry tag.
+/// </summary>
+const char *DrumPhase_GetName(drum_phase_t phase);
+
+/// <summary>
+///     Sampling and reporting profile for a phase.
+/// </summary>
+const drum_phase_profile_t *DrumPhase_GetProfile(drum_phase_t phase);
@@ -0,0 +1,175 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "gyro_bias.h"
+
+void GyroBias_Init(gyro_bias_t *estimator, uint16_t windowSamples, float stillStdDev_counts, float maxBias_counts,
+	float levelGain, float forgetting, float minSpread_degC)
+{
+	memset(estimator, 0, sizeof(*estimator));
+	estimator->windowSamples = (windowSamples > 1) ? windowSamples : 2;
+	estimator->stillVariance_counts2 = stillStdDev_counts * stillStdDev_counts;
+	estimator->maxBias_counts = maxBias_counts;
+	estimator->levelGain = levelGain;
+	estimator->forgetting = forgetting;
+	estimator->minSpread_degC = minSpread_degC;
+}
+
+/// <summary>
+///     Refits bias against temperature from the weighted sums.  The slope is only trusted once
+///     the weighted temperature spread reaches minSpread_degC; until then the fit is off and the
+///     level is used.
+/// </summary>
+static void refit(gyro_bias_t *estimator)
+{
+	const float meanT = estimator->swt / estimator->sw;
+	const float varianceT = estimator->swtt / estimator->sw - meanT * meanT;
+
+	estimator->haveFit = varianceT >= estimator->minSpread_degC * estimator->minSpread_degC;
+	if (!estimator->haveFit) {
+		return;
+	}
+
+	for (int axis = 0; axis < 3; axis++) {
+		const float meanB = estimator->swb[axis] / estimator->sw;
+		const float covariance = estimator->swtb[axis] / estimator->sw - meanT * meanB;
+		estimator->slope_countsPerDegC[axis] = covariance / varianceT;
+		estimator->intercept_counts[axis] = meanB - estimator->slope_countsPerDegC[axis] * meanT;
+	}
+}
+
+/// <summary>
+///     Tests the completed window for stillness and, if it was still, folds its mean into the
+///     level and the temperature fit.
+/// </summary>
+/// <returns>true if the window was stationary</returns>
+static bool closeWindow(gyro_bias_t *estimator)
+{
+	const float n = (float)estimator->windowCount;
+	const float temperature_degC = estimator->temperatureSum_degC / n;
+	float mean[3];
+	bool still = true;
+
+	for (int axis = 0; axis < 3; axis++) {
+		mean[axis] = (float)estimator->sum[axis] / n;
+		const float variance = (float)estimator->sumSquares[axis] / n - mean[axis] * mean[axis];
+		still = still && variance <= estimator->stillVariance_counts2 && fabsf(mean[axis]) <= estimator->maxBias_counts;
+	}
+
+	memset(estimator->sum, 0, sizeof(estimator->sum));
+	memset(estimator->sumSquares, 0, sizeof(estimator->sumSquares));
+	estimator->temperatureSum_degC = 0.0f;
+	estimator->windowCount = 0;
+
+	if (!still) {
+		estimator->movingWindows++;
+		return false;
+	}
+	estimator->stillWindows++;
+
+	if (!estimator->haveLevel) {
+		memcpy(estimator->level_counts, mean, sizeof(mean));
+		estimator->referenceTemperature_degC = temperature_degC;
+		estimator->minTemperature_degC = temperature_degC;
+		estimator->maxTemperature_degC = temperature_degC;
+		estimator->haveLevel = true;
+	}
+	else {
+		for (int axis = 0; axis < 3; axis++) {
+			estimator->level_counts[axis] += estimator->levelGain * (mean[axis] - estimator->level_counts[axis]);
+		}
+		estimator->minTemperature_degC = fminf(estimator->minTemperature_degC, temperature_degC);
+		estimator->maxTemperature_degC = fmaxf(estimator->maxTemperature_degC, temperature_degC);
+	}
+
+	// Older windows fade out so the fit follows the sensor as it ages
+	const float t = temperature_degC - estimator->referenceTemperature_degC;
+	const float lambda = estimator->forgetting;
+	estimator->sw = lambda * estimator->sw + 1.0f;
+	estimator->swt = lambda * estimator->swt + t;
+	estimator->swtt = lambda * estimator->swtt + t * t;
+	for (int axis = 0; axis < 3; axis++) {
+		estimator->swb[axis] = lambda * estimator->swb[axis] + mean[axis];
+		estimator->swtb[axis] = lambda * estimator->swtb[axis] + t * mean[axis];
+	}
+	refit(estimator);
+
+	return true;
+}
+
+int GyroBias_AddBatch(gyro_bias_t *estimator, const int16_t (*counts)[3], size_t count, float temperature_degC)
+{
+	int stillWindows = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			const int64_t c = counts[i][axis];
+			estimator->sum[axis] += c;
+			estimator->sumSquares[axis] += c * c;
+		}
+		estimator->temperatureSum_degC += temperature_degC;
+
+		if (++estimator->windowCount == estimator->windowSamples && closeWindow(estimator)) {
+			stillWindows++;
+		}
+	}
+
+	return stillWindows;
+}
+
+void GyroBias_GetOffset(const gyro_bias_t *estimator, float temperature_degC, float offset_counts[3])
+{
+	if (estimator->haveFit) {
+		// Don't extrapolate the slope beyond the temperatures it was fitted on
+		const float clamped = fminf(fmaxf(temperature_degC, estimator->minTemperature_degC), estimator->maxTemperature_degC);
+		const float t = clamped - estimator->referenceTemperature_degC;
+		for (int axis = 0; axis < 3; axis++) {
+			offset_counts[axis] = estimator->intercept_counts[axis] + estimator->slope_countsPerDegC[axis] * t;
+		}
+	}
+	else if (estimator->haveLevel) {
+		memcpy(offset_counts, estimator->level_counts, 3 * sizeof(float));
+	}
+	else {
+		memset(offset_counts, 0, 3 * sizeof(float));
+	}
+}
+
+void GyroBias_GetState(const gyro_bias_t *estimator, gyro_bias_state_t *state)
+{
+	memset(state, 0, sizeof(*state));
+	memcpy(state->level_counts, estimator->level_counts, sizeof(state->level_counts));
+	state->referenceTemperature_degC = estimator->referenceTemperature_degC;
+	state->sw = estimator->sw;
+	state->swt = estimator->swt;
+	state->swtt = estimator->swtt;
+	memcpy(state->swb, estimator->swb, sizeof(state->swb));
+	memcpy(state->swtb, estimator->swtb, sizeof(state->swtb));
+	state->minTemperature_degC = estimator->minTemperature_degC;
+	state->maxTemperature_degC = estimator->maxTemperature_degC;
+	state->stillWindows = estimator->stillWindows;
+	state->haveLevel = estimator->haveLevel;
+}
+
+void GyroBias_SetState(gyro_bias_t *estimator, const gyro_bias_state_t *state)
+{
+	memcpy(estimator->level_counts, state->level_counts, sizeof(estimator->level_counts));
+	estimator->referenceTemperature_degC = state->referenceTemperature_degC;
+	estimator->sw = state->sw;
+	estimator->swt = state->swt;
+	estimator->swtt = state->swtt;
+	memcpy(estimator->swb, state->swb, sizeof(estimator->swb));
+	memcpy(estimator->swtb, state->swtb, sizeof(estimator->swtb));
+	estimator->minTemperature_degC = state->minTemperature_degC;
+	estimator->maxTemperature_degC = state->maxTemperature_degC;
+	estimator->stillWindows = state->stillWindows;
+	estimator->haveLevel = state->haveLevel != 0;
+
+	estimator->haveFit = false;
+	if (estimator->haveLevel && estimator->sw > 0.0f) {
+		refit(estimator);
+	}
+}
@@ -0,0 +1,99 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Background gyro bias estimator.  The gyro stream is cut into windows; a window in which
+///     every axis is quiet and close to zero is taken as stationary, and its mean is a bias
+///     measurement at the window's temperature.  Those measurements feed a per-axis level that
+///     follows the latest stationary interval and an exponentially weighted least squares fit
+///     of bias against die temperature, so the bias can be predicted between stationary
+///     intervals as the drum heats and cools.
+/// </summary>
+typedef struct {
+	// Window being accumulated, in counts
+	int64_t sum[3];
+	int64_t sumSquares[3];
+	float temperatureSum_degC;
+	uint16_t windowCount;
+
+	// Tuning
+	uint16_t windowSamples;
+	float stillVariance_counts2;    // Largest per-axis variance of a stationary window
+	float maxBias_counts;           // Larger means are rotation, not bias
+	float levelGain;                // Weight of a new stationary window in the level
+	float forgetting;               // Per-window decay of the temperature fit's history
+	float minSpread_degC;           // Temperature spread needed before the slope is trusted
+
+	// Latest stationary level
+	float level_counts[3];
+	bool haveLevel;
+
+	// Weighted sums of the fit, temperatures measured from referenceTemperature_degC
+	float referenceTemperature_degC;
+	float sw, swt, swtt;
+	float swb[3], swtb[3];
+	float minTemperature_degC, maxTemperature_degC;
+	float intercept_counts[3];
+	float slope_countsPerDegC[3];
+	bool haveFit;
+
+	uint32_t stillWindows;
+	uint32_t movingWindows;
+} gyro_bias_t;
+
+/// <summary>
+///     What the estimator has learned, without the tuning or the window in progress, for
+///     saving across restarts.
+/// </summary>
+typedef struct {
+	float level_counts[3];
+	float referenceTemperature_degC;
+	float sw, swt, swtt;
+	float swb[3], swtb[3];
+	float minTemperature_degC, maxTemperature_degC;
+	uint32_t stillWindows;
+	uint8_t haveLevel;
+	uint8_t reserved[3];
+} gyro_bias_state_t;
+
+/// <summary>
+///     Initializes an estimator with no bias knowledge.
+/// </summary>
+/// <param name="windowSamples">gyro samples per stationarity test</param>
+/// <param name="stillStdDev_counts">per-axis standard deviation below which a window is stationary</param>
+/// <param name="maxBias_counts">largest plausible bias</param>
+/// <param name="levelGain">0..1, weight of each new stationary window in the current level</param>
+/// <param name="forgetting">0..1, per stationary window retention of the temperature fit history</param>
+/// <param name="minSpread_degC">temperature spread (standard deviation) needed to fit a slope</param>
+void GyroBias_Init(gyro_bias_t *estimator, uint16_t windowSamples, float stillStdDev_counts, float maxBias_counts,
+	float levelGain, float forgetting, float minSpread_degC);
+
+/// <summary>
+///     Adds a batch of raw gyro samples, all taken near the given die temperature.
+/// </summary>
+/// <returns>the number of stationary windows the batch completed</returns>
+int GyroBias_AddBatch(gyro_bias_t *estimator, const int16_t (*counts)[3], size_t count, float temperature_degC);
+
+/// <summary>
+///     Predicted bias at a die temperature, in counts.  Uses the temperature fit once the
+///     temperature has moved enough to fit a slope, clamped to the temperatures seen, and the
+///     latest stationary level before that.  Zero until the first stationary window.
+/// </summary>
+void GyroBias_GetOffset(const gyro_bias_t *estimator, float temperature_degC, float offset_counts[3]);
+
+/// <summary>
+///     Copies out what the estimator has learned.
+/// </summary>
+void GyroBias_GetState(const gyro_bias_t *estimator, gyro_bias_state_t *state);
+
+/// <summary>
+///     Resumes from a saved state, e.g. the last known-good one from before a restart.  The
+///     estimator keeps refining it as new stationary windows arrive.
+/// </summary>
+void GyroBias_SetState(gyro_bias_t *estimator, const gyro_bias_state_t *state);
@@ -0,0 +1,60 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+
+#include "heap_stats.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void __real_free(void *pointer);
+
+static heap_stats_t heapStats;
+
+// The SDK runs callbacks on the main thread, but curl and pthread are linked in; relaxed atomics
+// keep the counts right whoever calls
+void *__wrap_malloc(size_t size)
+{
+	__atomic_fetch_add(&heapStats.mallocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&heapStats.bytesRequested, size, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	__atomic_fetch_add(&heapStats.callocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&heapStats.bytesRequested, (uint64_t)count * size, __ATOMIC_RELAXED);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+	__atomic_fetch_add(&heapStats.reallocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&heapStats.bytesRequested, size, __ATOMIC_RELAXED);
+	return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void *pointer)
+{
+	if (pointer != NULL) {
+		__atomic_fetch_add(&heapStats.frees, 1, __ATOMIC_RELAXED);
+	}
+	__real_free(pointer);
+}
+
+void HeapStats_Get(heap_stats_t *stats)
+{
+	stats->mallocs = __atomic_load_n(&heapStats.mallocs, __ATOMIC_RELAXED);
+	stats->callocs = __atomic_load_n(&heapStats.callocs, __ATOMIC_RELAXED);
+	stats->reallocs = __atomic_load_n(&heapStats.reallocs, __ATOMIC_RELAXED);
+	stats->frees = __atomic_load_n(&heapStats.frees, __ATOMIC_RELAXED);
+	stats->bytesRequested = __atomic_load_n(&heapStats.bytesRequested, __ATOMIC_RELAXED);
+}
+
+uint32_t HeapStats_Calls(void)
+{
+	heap_stats_t stats;
+	HeapStats_Get(&stats);
+	return stats.mallocs + stats.callocs + stats.reallocs + stats.frees;
+}
@@ -0,0 +1,27 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+///     Heap calls made by the application.  malloc, calloc, realloc and free are wrapped at link
+///     time (-Wl,--wrap in the project's linker options), so this sees the application's own
+///     code and what is built into it such as parson, but not the shared libraries (applibs,
+///     the Azure IoT SDK, curl).
+/// </summary>
+typedef struct {
+	uint32_t mallocs;
+	uint32_t callocs;
+	uint32_t reallocs;
+	uint32_t frees;
+	uint64_t bytesRequested;
+} heap_stats_t;
+
+void HeapStats_Get(heap_stats_t *stats);
+
+/// <summary>
+///     All heap calls so far.  Take it before and after a path to check the path makes none.
+/// </summary>
+uint32_t HeapStats_Calls(void);
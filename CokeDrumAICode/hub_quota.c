@@ -0,0 +1,72 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include "hub_quota.h"
+
+#define SECONDS_PER_DAY 86400
+
+// Shortest part of the day the projection extrapolates from
+#define PROJECTION_MIN_SECONDS 600
+
+void HubQuota_Init(hub_quota_t *quota, uint32_t dailyBudget, uint32_t burst, int64_t now_ms)
+{
+	*quota = (hub_quota_t) {
+		.dailyBudget = dailyBudget,
+		.burst = (burst > 0) ? burst : 1,
+		.tokens = (float)((burst > 0) ? burst : 1),
+		.refilledAt_ms = now_ms,
+		.day = -1
+	};
+}
+
+uint32_t HubQuota_Units(size_t bytes)
+{
+	return (bytes == 0) ? 1 : (uint32_t)((bytes + HUB_QUOTA_UNIT_BYTES - 1) / HUB_QUOTA_UNIT_BYTES);
+}
+
+static void refill(hub_quota_t *quota, int64_t now_ms)
+{
+	const int64_t elapsed_ms = now_ms - quota->refilledAt_ms;
+	if (elapsed_ms <= 0) {
+		return;
+	}
+	quota->refilledAt_ms = now_ms;
+	quota->tokens += (float)elapsed_ms * (float)quota->dailyBudget / (SECONDS_PER_DAY * 1000.0f);
+	if (quota->tokens > (float)quota->burst) {
+		quota->tokens = (float)quota->burst;
+	}
+}
+
+bool HubQuota_Take(hub_quota_t *quota, size_t bytes, bool force, int64_t now_ms, time_t utc)
+{
+	refill(quota, now_ms);
+
+	const uint32_t units = HubQuota_Units(bytes);
+	if (!force && quota->tokens < (float)units) {
+		quota->limited++;
+		return false;
+	}
+	quota->tokens -= (float)units;
+
+	const int64_t day = (int64_t)utc / SECONDS_PER_DAY;
+	if (day != quota->day) {
+		quota->day = day;
+		quota->usedToday = 0;
+		quota->messagesToday = 0;
+	}
+	quota->usedToday += units;
+	quota->messagesToday++;
+	return true;
+}
+
+uint32_t HubQuota_Projected(const hub_quota_t *quota, time_t utc)
+{
+	if ((int64_t)utc / SECONDS_PER_DAY != quota->day) {
+		return 0;
+	}
+	int64_t secondsIntoDay = (int64_t)utc % SECONDS_PER_DAY;
+	if (secondsIntoDay < PROJECTION_MIN_SECONDS) {
+		secondsIntoDay = PROJECTION_MIN_SECONDS;
+	}
+	return (uint32_t)((int64_t)quota->usedToday * SECONDS_PER_DAY / secondsIntoDay);
+}
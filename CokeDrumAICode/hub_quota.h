@@ -0,0 +1,50 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// IoT Hub meters device to cloud messages in units of this many bytes
+#define HUB_QUOTA_UNIT_BYTES 4096
+
+/// <summary>
+///     Token bucket over IoT Hub message units.  It refills at the daily budget spread evenly
+///     over the day and holds at most burst units, so a day's sending can't run past the
+///     budget however bursty it is.  Usage is also counted per UTC day, when the hub's quota
+///     resets, to project the day's total.
+/// </summary>
+typedef struct {
+	uint32_t dailyBudget;       // Units per day
+	uint32_t burst;
+	float tokens;
+	int64_t refilledAt_ms;
+	int64_t day;                // UTC day the counters are for
+	uint32_t usedToday;         // Units
+	uint32_t messagesToday;
+	uint32_t limited;           // Sends held back for want of a token
+} hub_quota_t;
+
+void HubQuota_Init(hub_quota_t *quota, uint32_t dailyBudget, uint32_t burst, int64_t now_ms);
+
+/// <summary>
+///     Message units a message of this many bytes is billed as.
+/// </summary>
+uint32_t HubQuota_Units(size_t bytes);
+
+/// <summary>
+///     Takes the units for a message if the bucket holds them.  A forced take always succeeds
+///     and may leave the bucket in debt, to be paid back before anything else goes.
+/// </summary>
+/// <param name="utc">Wall clock time, for the day the units are counted against</param>
+/// <returns>true if the message can be sent now</returns>
+bool HubQuota_Take(hub_quota_t *quota, size_t bytes, bool force, int64_t now_ms, time_t utc);
+
+/// <summary>
+///     Units the day will have used by midnight UTC at the rate so far.  The first ten minutes
+///     of a day are projected as if ten minutes had passed.
+/// </summary>
+uint32_t HubQuota_Projected(const hub_quota_t *quota, time_t utc);
@@ -53,6 +53,23 @@
 #include "i2c.h"
 #include "lsm6dso_reg.h"
 #include "lps22hh_reg.h"
+#include "sensor_stats.h"
+#include "orientation_filter.h"
+#include "distance_tracker.h"
+#include "anomaly_model.h"
+#include "drum_phase.h"
+#include "decimator.h"
+#include "sensor_units.h"
+#include "imu_kernels.h"
+#include "accel_range.h"
+#include "gyro_bias.h"
+#include "calibration_store.h"
+#include "startup.h"
+#include "telemetry_batch.h"
+#include "heap_stats.h"
+#include "alarm_monitor.h"
+#include "deadband.h"
+#include "waveform_capture.h"
 
 
 //softpwm stuff
@@ -67,7 +84,6 @@ struct sigaction action;
 /* Private variables ---------------------------------------------------------*/
 static axis3bit16_t data_raw_acceleration;
 static axis3bit16_t data_raw_angular_rate;
-static axis3bit16_t raw_angular_rate_calibration;
 static axis1bit32_t data_raw_pressure;
 static axis1bit16_t data_raw_temperature;
 static float acceleration_mg[3];
@@ -76,6 +92,171 @@ static float lsm6dsoTemperature_degC;
 static float pressure_hPa;
 static float lps22hhTemperature_degC;
 
+// The latest read of every channel in raw counts.  Samples stay in counts through the window
+// statistics and are only converted to engineering units, with sensorChannelScales, for the
+// display, the phase detector and the outgoing telemetry.
+static int32_t rawSample[SENSOR_CHANNEL_COUNT];
+
+// Fraction bits kept on the accelerometer counts, the decimated trend has sub-count resolution.
+// Accelerometer counts are normalized to the 2g range whatever range they were captured at.
+#define ACCEL_COUNT_FRACTION_BITS 4
+
+static const sensor_scale_t sensorChannelScales[SENSOR_CHANNEL_COUNT] = {
+	[SENSOR_CH_ACCEL_X] = { .scale = ACCEL_RANGE_NORMALIZED_MG_PER_LSB / (1 << ACCEL_COUNT_FRACTION_BITS) },
+	[SENSOR_CH_ACCEL_Y] = { .scale = ACCEL_RANGE_NORMALIZED_MG_PER_LSB / (1 << ACCEL_COUNT_FRACTION_BITS) },
+	[SENSOR_CH_ACCEL_Z] = { .scale = ACCEL_RANGE_NORMALIZED_MG_PER_LSB / (1 << ACCEL_COUNT_FRACTION_BITS) },
+	[SENSOR_CH_GYRO_X] = SENSOR_SCALE_LSM6DSO_FS2000_DPS,
+	[SENSOR_CH_GYRO_Y] = SENSOR_SCALE_LSM6DSO_FS2000_DPS,
+	[SENSOR_CH_GYRO_Z] = SENSOR_SCALE_LSM6DSO_FS2000_DPS,
+	[SENSOR_CH_PRESSURE] = SENSOR_SCALE_LPS22HH_HPA,
+	[SENSOR_CH_LSM6DSO_TEMP] = SENSOR_SCALE_LSM6DSO_TEMP_DEGC,
+	[SENSOR_CH_LPS22HH_TEMP] = SENSOR_SCALE_LPS22HH_TEMP_DEGC,
+	[SENSOR_CH_STRAIN] = { .scale = 0.01f },                  // hundredths
+	[SENSOR_CH_DISTANCE] = { .scale = 0.01f },                // hundredths of a foot
+	[SENSOR_CH_DISPLACEMENT] = { .scale = 0.001f },           // um -> mm
+	[SENSOR_CH_DISPLACEMENT_RATE] = { .scale = 0.001f },      // um/s -> mm/s
+	[SENSOR_CH_DISTANCE_CONFIDENCE] = { .scale = 0.001f }     // per mille
+};
+
+// Running statistics for the telemetry window currently being accumulated
+static sensor_stats_t windowStats;
+static uint16_t windowTargetSamples = SENSOR_STATS_WINDOW_SAMPLES;
+
+#ifdef TELEMETRY_DEADBAND
+// Report-by-exception settings, also written by the device twin, and the last sent state
+deadband_t telemetryDeadband = {
+	.deadband = {
+		[SENSOR_CH_ACCEL_X] = -1.0f,
+		[SENSOR_CH_ACCEL_Y] = -1.0f,
+		[SENSOR_CH_ACCEL_Z] = -1.0f,
+		[SENSOR_CH_GYRO_X] = -1.0f,
+		[SENSOR_CH_GYRO_Y] = -1.0f,
+		[SENSOR_CH_GYRO_Z] = -1.0f,
+		[SENSOR_CH_PRESSURE] = DEADBAND_PRESSURE_HPA,
+		[SENSOR_CH_LSM6DSO_TEMP] = DEADBAND_TEMPERATURE_DEGC,
+		[SENSOR_CH_LPS22HH_TEMP] = DEADBAND_TEMPERATURE_DEGC,
+		[SENSOR_CH_STRAIN] = DEADBAND_STRAIN,
+		[SENSOR_CH_DISTANCE] = DEADBAND_DISTANCE_FT,
+		[SENSOR_CH_DISPLACEMENT] = -1.0f,
+		[SENSOR_CH_DISPLACEMENT_RATE] = -1.0f,
+		[SENSOR_CH_DISTANCE_CONFIDENCE] = -1.0f
+	},
+	.maxSilence_s = {
+		[SENSOR_CH_PRESSURE] = DEADBAND_MAX_SILENCE_SECONDS,
+		[SENSOR_CH_LSM6DSO_TEMP] = DEADBAND_MAX_SILENCE_SECONDS,
+		[SENSOR_CH_LPS22HH_TEMP] = DEADBAND_MAX_SILENCE_SECONDS,
+		[SENSOR_CH_STRAIN] = DEADBAND_MAX_SILENCE_SECONDS,
+		[SENSOR_CH_DISTANCE] = DEADBAND_MAX_SILENCE_SECONDS
+	}
+};
+#endif 
+
+#ifdef TELEMETRY_PER_SAMPLE
+// Per-sample reads are sent several to a message, column by column
+static telemetry_batch_t telemetryBatch;
+static const telemetry_batch_policy_t telemetryBatchPolicy = {
+	.maxSamples = TELEMETRY_BATCH_MAX_SAMPLES,
+	.maxAge_ms = TELEMETRY_BATCH_MAX_AGE_SECONDS * 1000,
+	.maxBytes = TELEMETRY_BATCH_MAX_BYTES,
+	.encoding = TELEMETRY_BATCH_ENCODING
+};
+#endif 
+
+// Largest number of accel/gyro pairs handed to the fusion filter in one call
+#define IMU_FIFO_MAX_BATCH 64
+#define DEG_TO_RAD 0.01745329252f
+
+// The accelerometer runs at ACCEL_FIFO_ODR_HZ so vibration can be analysed; the gyro stays at
+// IMU_ODR_HZ.  It is never stopped: the sensor hub is triggered by its data ready instead.
+#define IMU_XL_ODR LSM6DSO_XL_ODR_1667Hz
+// Gyro counts (2000dps full scale) to dps and rad/s
+#define FS2000_DPS_PER_LSB 0.070f
+#define FS2000_RPS_PER_LSB (FS2000_DPS_PER_LSB * DEG_TO_RAD)
+// Size of one FIFO word, the tag followed by three 16 bit values
+#define FIFO_WORD_SIZE 7
+
+static int imuFifoTimerFd = -1;
+static orientation_filter_t orientation;
+
+// Gyro counts to rad/s: the learned bias offset, the full scale gain and any cross-axis terms
+static imu_calibration_t gyroCalibration;
+
+// Learns the gyro bias, and its temperature dependence, whenever the drum is still.  The die
+// temperature comes from the FIFO temperature words.
+static gyro_bias_t gyroBias;
+static float gyroTemperature_degC;
+static bool haveGyroTemperature = false;
+
+// What was learned is saved to mutable storage now and then and restored at the next start,
+// which also times how long it takes to get the first calibrated sample
+static calibration_record_t storedCalibration;
+static bool calibrationRestored = false;
+static struct timespec startupTime;
+static bool firstSampleLogged = false;
+static struct timespec lastCalibrationSave;
+static uint32_t savedStillWindows;
+
+// The full rate accelerometer stream (for spectra) is decimated once into a tilt rate stream
+// for the orientation filter and a trend rate stream for the telemetry window
+enum { ACCEL_STAGE_TILT = 0, ACCEL_STAGE_TREND, ACCEL_STAGE_COUNT };
+static const decimator_stage_config_t accelDecimation[ACCEL_STAGE_COUNT] = {
+	[ACCEL_STAGE_TILT] = { .cicRatio = 8, .cicOrder = 3, .firRatio = 4, .tapCount = 33 },   // 1667Hz -> 52Hz
+	[ACCEL_STAGE_TREND] = { .cicRatio = 13, .cicOrder = 3, .firRatio = 4, .tapCount = 33 }  // 52Hz -> 1Hz
+};
+static decimator_bank_t accelDecimator;
+static float accelTrend_counts[3];
+static bool haveAccelTrend = false;
+
+// Accelerometer full scale, raised when the stream clips and lowered again when it is quiet.
+// Words already in the FIFO when the range is switched may have been captured at either
+// range, so that many words after a switch are not trusted.
+static accel_range_t accelRange;
+static uint16_t unknownRangeWords;
+
+static int distanceTimerFd = -1;
+static distance_tracker_t distanceTracker;
+
+// Scores each window record so only anomalous windows are sent in full
+static anomaly_model_t anomalyModel;
+
+// Drum cycle phase, and the vibration the FIFO has seen since the phase detector last ran
+static drum_phase_detector_t drumPhase;
+static float vibrationSumSquares_g2;
+static uint32_t vibrationSamples;
+
+// Heap calls seen while handling samples, which should stay at zero
+static uint32_t samplePathHeapCalls;
+
+// Threshold alarms, sent ahead of all other telemetry
+static alarm_monitor_t shockAlarm;
+static alarm_monitor_t pressureAlarm;
+static alarm_monitor_t strainAlarm;
+
+// On-demand burst of the full rate accelerometer stream, started and fetched by direct methods.
+// Its frames are on the heap only until every chunk is fetched or the hold time runs out.
+static waveform_capture_t waveformCapture;
+static int64_t captureReady_ms;
+
+// Acquisition settings from the device twin, and the last good ones to put back an invalid
+// change.  Sample and window settings of 0 follow the drum phase profile.
+#define ACQUISITION_CONFIG_DEFAULT { .samplePeriod_ms = 0, .windowSamples = 0, \
+	.imuFifoPeriod_ms = IMU_FIFO_READ_PERIOD_NANO_SECONDS / 1000000, .accelFullScale_g = 0, \
+	.batchSamples = TELEMETRY_BATCH_MAX_SAMPLES }
+#define ACQUISITION_MIN_SAMPLE_PERIOD_MS 100
+#define ACQUISITION_MAX_SAMPLE_PERIOD_MS 3600000
+#define ACQUISITION_MIN_FIFO_PERIOD_MS 10
+acquisition_config_t acquisitionConfig = ACQUISITION_CONFIG_DEFAULT;
+static acquisition_config_t appliedConfig = ACQUISITION_CONFIG_DEFAULT;
+static int armedSamplePeriod_ms;
+
+// Parts of a settings change not yet in effect.  The time from the twin change until the last
+// of them is the switch latency.
+enum { SWITCH_SAMPLE_TIMER = 1u << 0, SWITCH_FIFO_TIMER = 1u << 1, SWITCH_ACCEL_RANGE = 1u << 2 };
+static uint32_t pendingSwitches;
+static int64_t switchRequested_ms;
+static int64_t lastSwitchLatency_ms = -1;
+static uint32_t configChanges;
+
 static uint8_t whoamI, rst;
 static int accelTimerFd = -1;
 const uint8_t lsm6dsOAddress = LSM6DSO_ADDRESS;     // Addr = 0x6A
@@ -86,6 +267,11 @@ static int socket2_CS;
 static int my_adc;
 static bool has_TFMini = false;
 
+// The indicator sequence blink() starts, stepped by its own timer; blinkStep is -1 when idle
+#define BLINK_STEP_COUNT 6
+static int blinkTimerFd = -1;
+static int blinkStep = -1;
+
 //Extern variables
 int i2cFd = -1;
 extern int epollFd;
@@ -96,6 +282,22 @@ uint8_t lsm6dso_status = 1;
 uint8_t lps22hh_status = 1;
 uint8_t RTCore_status = 1;
 //Private functions
+void blink(void);
+
+// Startup graph, in the order tasks run when several are due together: the sensors before the
+// display, and the model once acquisition is going
+enum {
+	STARTUP_TASK_CALIBRATION = 0,
+	STARTUP_TASK_BUS,
+	STARTUP_TASK_LSM6DSO,
+	STARTUP_TASK_TFMINI,
+	STARTUP_TASK_ACQUISITION,
+	STARTUP_TASK_LPS22HH,
+	STARTUP_TASK_OLED,
+	STARTUP_TASK_MODEL,
+	STARTUP_TASK_COUNT
+};
+#define STARTUP_AFTER(task) (1u << (task))
 
 // Routines to read/write to the LSM6DSO device
 static int32_t platform_write(int* fD, uint8_t reg, uint8_t* bufp, uint16_t len);
@@ -105,6 +307,148 @@ static int32_t platform_read(int* fD, uint8_t reg, uint8_t* bufp, uint16_t len);
 static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 
+// The LPS22HH registers from STATUS through TEMP_OUT_H, which the sensor hub reads continuously
+#define LPS22HH_OUTPUT_BYTES (LPS22HH_TEMP_OUT_H - LPS22HH_STATUS + 1)
+// Sensor hub status polls while a single LPS22HH access runs, one accelerometer data ready
+// period at IMU_XL_ODR apart, and how many to make before giving up (about 30 ms)
+#define SENSOR_HUB_POLL_NS 600000
+#define SENSOR_HUB_MAX_POLLS 50
+static int32_t readLps22hhOutputs(uint8_t outputs[LPS22HH_OUTPUT_BYTES]);
+
+static int64_t monotonicMilliseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/// <summary>
+///     Sensor read period: the twin setting, or the current drum phase profile's.
+/// </summary>
+static int samplePeriodInEffect_ms(void)
+{
+	return (acquisitionConfig.samplePeriod_ms > 0) ? acquisitionConfig.samplePeriod_ms :
+		(int)DrumPhase_GetProfile(DrumPhase_GetPhase(&drumPhase))->samplePeriod_ms;
+}
+
+/// <summary>
+///     Sizes the telemetry window and re-arms the sensor read timer if its period has changed.
+///     A window already past a smaller size is sent with the next read, so no read is lost.
+/// </summary>
+/// <returns>true if the timer was re-armed</returns>
+static bool armSampling(void)
+{
+	windowTargetSamples = (acquisitionConfig.windowSamples > 0) ? (uint16_t)acquisitionConfig.windowSamples :
+		DrumPhase_GetProfile(DrumPhase_GetPhase(&drumPhase))->windowSamples;
+
+	const int period_ms = samplePeriodInEffect_ms();
+	if (accelTimerFd < 0 || period_ms == armedSamplePeriod_ms) {
+		return false;
+	}
+	struct timespec samplePeriod = { .tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000 };
+	if (SetTimerFdToPeriod(accelTimerFd, &samplePeriod) != 0) {
+		return false;
+	}
+	armedSamplePeriod_ms = period_ms;
+	return true;
+}
+
+/// <summary>
+///     Reports the acquisition settings in effect and how long the last change took.
+/// </summary>
+static void reportAcquisitionConfig(void)
+{
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	char json[256];
+	int length = snprintf(json, sizeof(json),
+		"{\"samplePeriodMs\": %d, \"windowSamples\": %u, \"imuFifoPeriodMs\": %d, \"accelFullScaleG\": %d, "
+		"\"accelRangeAuto\": %s, \"changes\": %u, \"switchLatencyMs\": %lld}",
+		armedSamplePeriod_ms, windowTargetSamples, acquisitionConfig.imuFifoPeriod_ms, AccelRange_GetRange_g(&accelRange),
+		accelRange.fixed ? "false" : "true", configChanges, (long long)lastSwitchLatency_ms);
+	if (length > 0 && (size_t)length < sizeof(json)) {
+		AzureIoT_TwinReportProperty("acquisition", json);
+	}
+#endif 
+}
+
+/// <summary>
+///     Marks part of a settings change as in effect, and measures the switch once it all is.
+/// </summary>
+static void switchDone(uint32_t which)
+{
+	if ((pendingSwitches & which) == 0) {
+		return;
+	}
+	pendingSwitches &= ~which;
+	if (pendingSwitches == 0) {
+		lastSwitchLatency_ms = monotonicMilliseconds() - switchRequested_ms;
+		Log_Debug("[Info] Acquisition settings in effect after %lld ms\n", (long long)lastSwitchLatency_ms);
+		reportAcquisitionConfig();
+	}
+}
+
+/// <summary>
+///     Puts back a setting outside [min, max], other than an allowed 0.
+/// </summary>
+static void checkSetting(const char *name, int *value, int previous, int min, int max, bool zeroAllowed)
+{
+	if ((*value == 0 && zeroAllowed) || (*value >= min && *value <= max)) {
+		return;
+	}
+	Log_Debug("ERROR: %s %d is outside %d..%d, keeping %d\n", name, *value, min, max, previous);
+	*value = previous;
+}
+
+void applyAcquisitionConfig(void)
+{
+	acquisition_config_t *config = &acquisitionConfig;
+
+	checkSetting("samplePeriodMs", &config->samplePeriod_ms, appliedConfig.samplePeriod_ms,
+		ACQUISITION_MIN_SAMPLE_PERIOD_MS, ACQUISITION_MAX_SAMPLE_PERIOD_MS, true);
+	checkSetting("windowSamples", &config->windowSamples, appliedConfig.windowSamples, 1, UINT16_MAX, true);
+	checkSetting("imuFifoPeriodMs", &config->imuFifoPeriod_ms, appliedConfig.imuFifoPeriod_ms,
+		ACQUISITION_MIN_FIFO_PERIOD_MS, IMU_FIFO_MAX_READ_PERIOD_MS, false);
+	checkSetting("batchSamples", &config->batchSamples, appliedConfig.batchSamples, 1, TELEMETRY_BATCH_CAPACITY, false);
+	const int fullScale_g = config->accelFullScale_g;
+	if (fullScale_g != 0 && fullScale_g != 2 && fullScale_g != 4 && fullScale_g != 8 && fullScale_g != 16) {
+		Log_Debug("ERROR: accelFullScaleG %d is not 0, 2, 4, 8 or 16, keeping %d\n", fullScale_g, appliedConfig.accelFullScale_g);
+		config->accelFullScale_g = appliedConfig.accelFullScale_g;
+	}
+	if (memcmp(config, &appliedConfig, sizeof(appliedConfig)) == 0) {
+		return;
+	}
+
+	// Timers are re-armed here; the range is switched between FIFO batches, where the words
+	// captured around the switch are already accounted for
+	uint32_t switches = 0;
+	if (armSampling()) {
+		switches |= SWITCH_SAMPLE_TIMER;
+	}
+	if (config->imuFifoPeriod_ms != appliedConfig.imuFifoPeriod_ms && imuFifoTimerFd >= 0) {
+		struct timespec fifoPeriod = { .tv_sec = 0,.tv_nsec = (long)config->imuFifoPeriod_ms * 1000000 };
+		if (SetTimerFdToPeriod(imuFifoTimerFd, &fifoPeriod) == 0) {
+			switches |= SWITCH_FIFO_TIMER;
+		}
+	}
+	if (config->accelFullScale_g != appliedConfig.accelFullScale_g) {
+		switches |= SWITCH_ACCEL_RANGE;
+	}
+#ifdef TELEMETRY_PER_SAMPLE
+	// The batch holds TELEMETRY_BATCH_CAPACITY reads whatever its count, so a batch already
+	// past a smaller count is just sent after the next read
+	telemetryBatch.policy.maxSamples = (uint16_t)config->batchSamples;
+#endif 
+
+	appliedConfig = *config;
+	configChanges++;
+	switchRequested_ms = monotonicMilliseconds();
+	pendingSwitches |= switches;
+	if (pendingSwitches == 0) {
+		lastSwitchLatency_ms = 0;
+		reportAcquisitionConfig();
+	}
+}
+
 /// <summary>
 ///     Sleep for delayTime ms
 /// </summary>
@@ -115,13 +459,229 @@ void HAL_Delay(int delayTime) {
 	nanosleep(&ts, NULL);
 }
 
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION)) && !defined(TELEMETRY_PER_SAMPLE)
+/// <summary>
+///     Reduces the accumulated window to one aggregate record, sends it to Azure and starts
+///     the next window.
+/// </summary>
+/// <param name="phase">Drum phase the window was collected in</param>
+static void sendWindowTelemetry(drum_phase_t phase)
+{
+	const char *phaseName = DrumPhase_GetName(phase);
+	const int accelRange_g = AccelRange_TakeWindowRange_g(&accelRange);
+	sensor_window_t window;
+	size_t size;
+	char *windowJsonBuffer;
+
+	if (SensorStats_Finalize(&windowStats, &window) && (windowJsonBuffer = AzureIoT_ReserveMessage(&size)) != NULL) {
+		SensorUnits_ScaleWindow(&window, sensorChannelScales);
+
+		// Without a model every window is forwarded.  With one, normal windows are reduced to
+		// their score and only anomalous ones carry the full record.
+		bool forward = true;
+		float score = 0.0f;
+		if (anomalyModel.loaded) {
+			float features[ANOMALY_FEATURE_COUNT];
+			AnomalyModel_ExtractFeatures(&window, features);
+			score = AnomalyModel_Score(&anomalyModel, features);
+			forward = score >= anomalyModel.threshold;
+			Log_Debug("[Info] Anomaly score %.3f (threshold %.3f), %.0f inferences/s\n", score,
+				anomalyModel.threshold, AnomalyModel_GetInferencesPerSecond(&anomalyModel));
+		}
+
+#ifdef TELEMETRY_DEADBAND
+		// An anomalous window always goes, otherwise only once a channel's mean has moved past
+		// its deadband or been silent too long
+		const int64_t now_ms = monotonicMilliseconds();
+		if (!(anomalyModel.loaded && forward) && Deadband_Due(&telemetryDeadband, window.mean, now_ms) == 0) {
+			Log_Debug("[Info] Window within its deadbands, not sent (%u of %u sent)\n",
+				telemetryDeadband.sent, telemetryDeadband.checked);
+			AzureIoT_CancelMessage(windowJsonBuffer);
+			SensorStats_Reset(&windowStats);
+			return;
+		}
+#endif 
+
+		// The record is formatted straight into a message buffer
+		if (!forward) {
+			int length = snprintf(windowJsonBuffer, size, "{\"n\": %u, \"phase\": \"%s\", \"xlFs\": %d, \"score\": %.4g}",
+				(unsigned)window.count, phaseName, accelRange_g, score);
+			if (length > 0 && (size_t)length < size) {
+				AzureIoT_CommitMessage(windowJsonBuffer, (size_t)length);
+			}
+			else {
+				Log_Debug("ERROR: window score does not fit in %zu bytes\n", size);
+				AzureIoT_CancelMessage(windowJsonBuffer);
+			}
+		}
+		else {
+			int length = SensorStats_FormatJson(&window, windowJsonBuffer, size);
+			if (length > 0) {
+				// Replace the closing brace with the phase tag, the largest accelerometer range
+				// used in the window and the score
+				length--;
+				int added = anomalyModel.loaded ?
+					snprintf(windowJsonBuffer + length, size - (size_t)length,
+						", \"phase\": \"%s\", \"xlFs\": %d, \"score\": %.4g}", phaseName, accelRange_g, score) :
+					snprintf(windowJsonBuffer + length, size - (size_t)length,
+						", \"phase\": \"%s\", \"xlFs\": %d}", phaseName, accelRange_g);
+				if (added < 0 || (size_t)(length + added) >= size) {
+					length = -1;
+				}
+				else {
+					length += added;
+				}
+			}
+			if (length > 0) {
+				Log_Debug("\n[Info] Sending window telemetry: %s\n", windowJsonBuffer);
+				AzureIoT_CommitMessage(windowJsonBuffer, (size_t)length);
+#ifdef TELEMETRY_DEADBAND
+				// Only a full record carries the means the next windows are compared with
+				Deadband_MarkSent(&telemetryDeadband, window.mean, now_ms);
+#endif 
+			}
+			else {
+				Log_Debug("ERROR: window telemetry does not fit in %zu bytes\n", size);
+				AzureIoT_CancelMessage(windowJsonBuffer);
+			}
+		}
+	}
+
+	SensorStats_Reset(&windowStats);
+}
+#endif 
+
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION)) && defined(TELEMETRY_PER_SAMPLE)
+/// <summary>
+///     Sends the per-sample reads batched so far as one message.
+/// </summary>
+/// <param name="phase">Drum phase the reads were taken in</param>
+static void sendTelemetryBatch(drum_phase_t phase, telemetry_flush_reason_t reason)
+{
+	const telemetry_batch_tags_t tags = { .phase = DrumPhase_GetName(phase), .accelRange_g = AccelRange_TakeWindowRange_g(&accelRange) };
+	size_t size;
+
+	// The batch is encoded straight into a message buffer
+	char *batchBuffer = AzureIoT_ReserveMessage(&size);
+	if (batchBuffer == NULL) {
+		return;
+	}
+	int length = TelemetryBatch_Flush(&telemetryBatch, &tags, reason, batchBuffer,
+		(size < TELEMETRY_BATCH_MAX_BYTES) ? size : TELEMETRY_BATCH_MAX_BYTES);
+	if (length <= 0) {
+		AzureIoT_CancelMessage(batchBuffer);
+		return;
+	}
+
+	if (telemetryBatchPolicy.encoding == TELEMETRY_ENCODING_JSON) {
+		Log_Debug("\n[Info] Sending telemetry batch: %s\n", batchBuffer);
+		AzureIoT_CommitMessage(batchBuffer, (size_t)length);
+	}
+	else {
+		char schema[16];
+		snprintf(schema, sizeof(schema), "cd-batch-%d", TelemetryBatch_GetSchemaId(&telemetryBatch));
+		Log_Debug("\n[Info] Sending %d byte %s telemetry batch\n", length, schema);
+		AzureIoT_CommitBinaryMessage(batchBuffer, (size_t)length, TELEMETRY_CBOR_CONTENT_TYPE, schema);
+	}
+	TelemetryBatch_LogCounters(&telemetryBatch);
+}
+#endif 
+
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+/// <summary>
+///     Checks a value against its alarm.  A raised alarm is sent straight away in the alarm
+///     lane, ahead of batched telemetry and any stored backlog; clearing it is sent as an event.
+/// </summary>
+static void checkAlarm(alarm_monitor_t *alarm, const char *name, float value)
+{
+	const alarm_change_t change = AlarmMonitor_Update(alarm, value, monotonicMilliseconds());
+	if (change == ALARM_UNCHANGED) {
+		return;
+	}
+
+	const char *state = (change == ALARM_RAISED) ? "raised" : "cleared";
+	Log_Debug("[Alarm] %s %s at %.2f\n", name, state, value);
+
+	size_t size;
+	char *alarmJson = AzureIoT_ReserveLaneMessage((change == ALARM_RAISED) ? SEND_LANE_ALARM : SEND_LANE_EVENT, &size);
+	if (alarmJson != NULL) {
+		int length = snprintf(alarmJson, size,
+			"{\"alarm\": \"%s\", \"state\": \"%s\", \"value\": %.2f, \"peak\": %.2f, \"count\": %u}",
+			name, state, value, alarm->peak, alarm->raised);
+		if (length > 0 && (size_t)length < size) {
+			AzureIoT_CommitMessage(alarmJson, (size_t)length);
+		}
+		else {
+			Log_Debug("ERROR: alarm does not fit in %zu bytes\n", size);
+			AzureIoT_CancelMessage(alarmJson);
+		}
+	}
+}
+
+/// <summary>
+///     Runs the drum phase detector on the latest reads.  On a phase change the window collected
+///     in the old phase is closed, the change is sent straight away as an event, and the new
+///     phase's sampling profile is applied.
+/// </summary>
+static void updateDrumPhase(float strain)
+{
+	static struct timespec lastUpdate;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	float dt = (lastUpdate.tv_sec == 0 && lastUpdate.tv_nsec == 0) ? 0.0f :
+		(float)(now.tv_sec - lastUpdate.tv_sec) + (float)(now.tv_nsec - lastUpdate.tv_nsec) / 1e9f;
+	lastUpdate = now;
+
+	drum_phase_inputs_t inputs = {
+		.temperature_degC = lps22hhTemperature_degC,
+		.pressure_hPa = pressure_hPa,
+		.vibration_g = (vibrationSamples > 0) ? sqrtf(vibrationSumSquares_g2 / (float)vibrationSamples) : 0.0f,
+		.strain = strain };
+	vibrationSumSquares_g2 = 0.0f;
+	vibrationSamples = 0;
+
+	drum_phase_transition_t transition;
+	if (!DrumPhase_Update(&drumPhase, &inputs, dt, &transition)) {
+		return;
+	}
+
+	Log_Debug("[Info] Drum phase %s -> %s after %.0f s\n", DrumPhase_GetName(transition.from),
+		DrumPhase_GetName(transition.to), transition.secondsInPreviousPhase);
+
+#ifdef TELEMETRY_PER_SAMPLE
+	sendTelemetryBatch(transition.from, TELEMETRY_FLUSH_FORCED);
+#else
+	sendWindowTelemetry(transition.from);
+#endif 
+
+	size_t size;
+	char *eventJson = AzureIoT_ReserveLaneMessage(SEND_LANE_EVENT, &size);
+	if (eventJson != NULL) {
+		int length = snprintf(eventJson, size,
+			"{\"event\": \"phaseChange\", \"from\": \"%s\", \"to\": \"%s\", \"previousPhaseSeconds\": %.0f}",
+			DrumPhase_GetName(transition.from), DrumPhase_GetName(transition.to), transition.secondsInPreviousPhase);
+		if (length > 0 && (size_t)length < size) {
+			AzureIoT_CommitMessage(eventJson, (size_t)length);
+		}
+		else {
+			Log_Debug("ERROR: phase change event does not fit in %zu bytes\n", size);
+			AzureIoT_CancelMessage(eventJson);
+		}
+	}
+
+	// The new phase's sampling, unless the device twin has set its own
+	armSampling();
+	reportAcquisitionConfig();
+}
+#endif 
+
 /// <summary>
 ///     Print latest data from on-board sensors.
 /// </summary>
 void AccelTimerEventHandler(EventData* eventData)
 {
 	uint8_t reg;
-	lps22hh_reg_t lps22hhReg;
 
 #if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 	static bool firstPass = true;
@@ -132,72 +692,103 @@ void AccelTimerEventHandler(EventData* eventData)
 		terminationRequired = true;
 		return;
 	}
+	switchDone(SWITCH_SAMPLE_TIMER);
+	const uint32_t heapCallsAtStart = HeapStats_Calls();
 
-	// Read the sensors on the lsm6dso device
+	// Read the sensors on the lsm6dso device, keeping raw counts.  Until a device has come up
+	// its channels keep their last (initially zero) values.
 
 	//Read output only if new xl value is available
-	lsm6dso_xl_flag_data_ready_get(&dev_ctx, &reg);
+	reg = 0;
+	if (Startup_IsReady(STARTUP_TASK_LSM6DSO)) {
+		lsm6dso_xl_flag_data_ready_get(&dev_ctx, &reg);
+	}
 	if (reg)
 	{
 		// Read acceleration field data
 		memset(data_raw_acceleration.u8bit, 0x00, 3 * sizeof(int16_t));
 		lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
 
-		acceleration_mg[0] = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[0]);
-		acceleration_mg[1] = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[1]);
-		acceleration_mg[2] = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[2]);
+		int32_t normalized[3];
+		AccelRange_Normalize(accelRange.range, data_raw_acceleration.i16bit, normalized);
+		for (int axis = 0; axis < 3; axis++) {
+			rawSample[SENSOR_CH_ACCEL_X + axis] = normalized[axis] * (1 << ACCEL_COUNT_FRACTION_BITS);
+		}
+	}
 
-		Log_Debug("\nLSM6DSO: Acceleration [mg]  : %.4lf, %.4lf, %.4lf\n",
-			acceleration_mg[0], acceleration_mg[1], acceleration_mg[2]);
+	// Prefer the anti-aliased trend stream over a single instantaneous read
+	if (haveAccelTrend) {
+		for (int axis = 0; axis < 3; axis++) {
+			rawSample[SENSOR_CH_ACCEL_X + axis] = (int32_t)lrintf(accelTrend_counts[axis] * (1 << ACCEL_COUNT_FRACTION_BITS));
+		}
 	}
 
-	lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
+	if (Startup_IsReady(STARTUP_TASK_LSM6DSO)) {
+		lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
+	}
 	if (reg)
 	{
 		// Read angular rate field data
 		memset(data_raw_angular_rate.u8bit, 0x00, 3 * sizeof(int16_t));
 		lsm6dso_angular_rate_raw_get(&dev_ctx, data_raw_angular_rate.u8bit);
 
-		// Before we store the mdps values subtract the calibration data we captured at startup.
-		angular_rate_dps[0] = (lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[0] - raw_angular_rate_calibration.i16bit[0])) / 1000.0;
-		angular_rate_dps[1] = (lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[1] - raw_angular_rate_calibration.i16bit[1])) / 1000.0;
-		angular_rate_dps[2] = (lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[2] - raw_angular_rate_calibration.i16bit[2])) / 1000.0;
-
-		Log_Debug("LSM6DSO: Angular rate [dps] : %4.2f, %4.2f, %4.2f\r\n",
-			angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2]);
+		// Subtract the bias learned in the background
+		for (int axis = 0; axis < 3; axis++) {
+			rawSample[SENSOR_CH_GYRO_X + axis] = data_raw_angular_rate.i16bit[axis] - (int32_t)lrintf(gyroCalibration.offset[axis]);
+		}
 	}
 
-	lsm6dso_temp_flag_data_ready_get(&dev_ctx, &reg);
+	if (Startup_IsReady(STARTUP_TASK_LSM6DSO)) {
+		lsm6dso_temp_flag_data_ready_get(&dev_ctx, &reg);
+	}
 	if (reg)
 	{
 		// Read temperature data
 		memset(data_raw_temperature.u8bit, 0x00, sizeof(int16_t));
 		lsm6dso_temperature_raw_get(&dev_ctx, data_raw_temperature.u8bit);
-		lsm6dsoTemperature_degC = lsm6dso_from_lsb_to_celsius(data_raw_temperature.i16bit);
-
-		Log_Debug("LSM6DSO: Temperature  [degC]: %.2f\r\n", lsm6dsoTemperature_degC);
+		rawSample[SENSOR_CH_LSM6DSO_TEMP] = data_raw_temperature.i16bit;
 	}
 
-	// Read the sensors on the lsm6dso device
-
-	lps22hh_read_reg(&pressure_ctx, LPS22HH_STATUS, (uint8_t*)&lps22hhReg, 1);
-
-	//Read output only if new value is available
+	// Read the sensors on the lps22hh device
+
+	// The sensor hub keeps its copy of the LPS22HH status and output registers up to date, so
+	// reading them doesn't touch the accelerometer stream.  It reads them at the accelerometer
+	// rate, far faster than the LPS22HH's 10Hz, so the data ready flags it copies are almost
+	// always already cleared; BDU and the burst read keep the outputs consistent instead.  Only
+	// the all-zero copy from before the first hub cycle is left out.
+	uint8_t lps22hhOutputs[LPS22HH_OUTPUT_BYTES] = { 0 };
+	bool haveLps22hhOutputs = false;
+	if (Startup_IsReady(STARTUP_TASK_LPS22HH) && readLps22hhOutputs(lps22hhOutputs) == 0) {
+		for (unsigned i = LPS22HH_PRESS_OUT_XL - LPS22HH_STATUS; i < LPS22HH_OUTPUT_BYTES; i++) {
+			haveLps22hhOutputs |= (lps22hhOutputs[i] != 0);
+		}
+	}
 
-	if ((lps22hhReg.status.p_da == 1) && (lps22hhReg.status.t_da == 1))
+	if (haveLps22hhOutputs)
 	{
 		memset(data_raw_pressure.u8bit, 0x00, sizeof(int32_t));
-		lps22hh_pressure_raw_get(&pressure_ctx, data_raw_pressure.u8bit);
-
-		pressure_hPa = lps22hh_from_lsb_to_hpa(data_raw_pressure.i32bit);
+		memcpy(data_raw_pressure.u8bit, &lps22hhOutputs[LPS22HH_PRESS_OUT_XL - LPS22HH_STATUS], 3);
+		rawSample[SENSOR_CH_PRESSURE] = data_raw_pressure.i32bit;
 
-		memset(data_raw_temperature.u8bit, 0x00, sizeof(int16_t));
-		lps22hh_temperature_raw_get(&pressure_ctx, data_raw_temperature.u8bit);
-		lps22hhTemperature_degC = lps22hh_from_lsb_to_celsius(data_raw_temperature.i16bit);
+		memcpy(data_raw_temperature.u8bit, &lps22hhOutputs[LPS22HH_TEMP_OUT_L - LPS22HH_STATUS], 2);
+		rawSample[SENSOR_CH_LPS22HH_TEMP] = data_raw_temperature.i16bit;
+	}
 
-		Log_Debug("LPS22HH: Pressure     [hPa] : %.2f\r\n", pressure_hPa);
-		Log_Debug("LPS22HH: Temperature  [degC]: %.2f\r\n", lps22hhTemperature_degC);
+	// Engineering units for the display, the logs and the phase detector, in one pass
+	float engineering[SENSOR_CHANNEL_COUNT];
+	SensorUnits_ConvertRow(rawSample, engineering, sensorChannelScales);
+	for (int axis = 0; axis < 3; axis++) {
+		acceleration_mg[axis] = engineering[SENSOR_CH_ACCEL_X + axis];
+		angular_rate_dps[axis] = engineering[SENSOR_CH_GYRO_X + axis];
 	}
+	lsm6dsoTemperature_degC = engineering[SENSOR_CH_LSM6DSO_TEMP];
+	pressure_hPa = engineering[SENSOR_CH_PRESSURE];
+	lps22hhTemperature_degC = engineering[SENSOR_CH_LPS22HH_TEMP];
+
+	Log_Debug("\nLSM6DSO: Acceleration [mg] %.1f %.1f %.1f, Angular rate [dps] %.2f %.2f %.2f, Temperature [degC] %.2f\n",
+		acceleration_mg[0], acceleration_mg[1], acceleration_mg[2],
+		angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2], lsm6dsoTemperature_degC);
+	Log_Debug("LPS22HH: Pressure [hPa] %.2f, Temperature [degC] %.2f\n", pressure_hPa, lps22hhTemperature_degC);
 
 	//// OLED
 	OLED_sensor_data_display.acceleration_mg[0] = acceleration_mg[0];
@@ -209,8 +800,9 @@ void AccelTimerEventHandler(EventData* eventData)
 	OLED_sensor_data_display.lsm6dsoTemperature_degC = lsm6dsoTemperature_degC;
 	OLED_sensor_data_display.lps22hhpressure_hPa = pressure_hPa;
 	OLED_sensor_data_display.lps22hhTemperature_degC = lps22hhTemperature_degC;
-	altitude = 44330 * (1 - powf((pressure_hPa / 1013.25), 1 / 5.255));  // pressure altitude in meters
-	update_oled();
+	if (Startup_IsReady(STARTUP_TASK_OLED)) {
+		update_oled();
+	}
 
 	oled_state++;
 
@@ -226,13 +818,10 @@ void AccelTimerEventHandler(EventData* eventData)
 	// will skew the data.
 	if (!firstPass) {
 
-		// Allocate memory for a telemetry message to Azure
-		char* pjsonBuffer = (char*)malloc(JSON_BUFFER_SIZE);
-		if (pjsonBuffer == NULL) {
-			Log_Debug("ERROR: not enough memory to send telemetry");
-		}
-
 		float the_distance = readDistance(); //read my TFMini
+		if (the_distance >= 0) {
+			blink();
+		}
 		uint32_t outSampleValue;
 		
 		ADC_Poll(my_adc, 0, &outSampleValue);
@@ -243,49 +832,436 @@ void AccelTimerEventHandler(EventData* eventData)
 		}
 		else {
 			the_strain = 10 * (int)outSampleValue / 3.5;
+			checkAlarm(&strainAlarm, "strain", the_strain);
 		}
-		// construct the telemetry message
-		snprintf(pjsonBuffer, JSON_BUFFER_SIZE, "{\"gX\":\"%.4lf\", \"gY\":\"%.4lf\", \"gZ\":\"%.4lf\", \"pressure\": \"%.2f\", \"aX\": \"%4.2f\", \"aY\": \"%4.2f\", \"aZ\": \"%4.2f\", \"d1\": \"%4.2f\", \"s1\": \"%4.2f\"}",
-			acceleration_mg[0], acceleration_mg[1], acceleration_mg[2], pressure_hPa, angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2], the_distance, the_strain);
+		if (Startup_IsReady(STARTUP_TASK_LPS22HH) && rawSample[SENSOR_CH_PRESSURE] != 0) {
+			checkAlarm(&pressureAlarm, "pressure", pressure_hPa);
+		}
+
+		updateDrumPhase(the_strain);
+
+		rawSample[SENSOR_CH_STRAIN] = (int32_t)lrintf(the_strain * 100.0f);
+		rawSample[SENSOR_CH_DISTANCE] = (int32_t)lrintf(the_distance * 100.0f);
+		rawSample[SENSOR_CH_DISPLACEMENT] = (int32_t)lrintf(DistanceTracker_GetDisplacement_mm(&distanceTracker) * 1000.0f);
+		rawSample[SENSOR_CH_DISPLACEMENT_RATE] = (int32_t)lrintf(DistanceTracker_GetRate_mmps(&distanceTracker) * 1000.0f);
+		rawSample[SENSOR_CH_DISTANCE_CONFIDENCE] = (int32_t)lrintf(DistanceTracker_GetConfidence(&distanceTracker) * 1000.0f);
+
+#ifdef TELEMETRY_PER_SAMPLE
+		// A read whose channels are all within their deadbands is left out of the batch
+		bool report = true;
+#ifdef TELEMETRY_DEADBAND
+		SensorUnits_ConvertRow(rawSample, engineering, sensorChannelScales);
+		const int64_t now_ms = monotonicMilliseconds();
+		report = Deadband_Due(&telemetryDeadband, engineering, now_ms) != 0;
+#endif 
 
-		Log_Debug("\n[Info] Sending telemetry: %s\n", pjsonBuffer);
-		AzureIoT_SendMessage(pjsonBuffer);
+		// Add this read to the batch, sending the batch first if the read would take it over
+		// the size budget and afterwards if it has reached its sample count or age
+		telemetry_flush_reason_t reason;
+		if (report && !TelemetryBatch_Fits(&telemetryBatch, rawSample)) {
+			sendTelemetryBatch(DrumPhase_GetPhase(&drumPhase), TELEMETRY_FLUSH_SIZE);
+		}
+		if (report && TelemetryBatch_Add(&telemetryBatch, rawSample) == 0) {
+#ifdef TELEMETRY_DEADBAND
+			Deadband_MarkSent(&telemetryDeadband, engineering, now_ms);
+#endif 
+		}
+		if (TelemetryBatch_IsDue(&telemetryBatch, &reason)) {
+			sendTelemetryBatch(DrumPhase_GetPhase(&drumPhase), reason);
+		}
+#else
+		// Fold this read into the current window and send one aggregate record when it fills
+		SensorStats_AddRawBatch(&windowStats, (const int32_t (*)[SENSOR_CHANNEL_COUNT])&rawSample, 1);
 
-		free(pjsonBuffer);
+		if (windowStats.count >= windowTargetSamples) {
+			sendWindowTelemetry(DrumPhase_GetPhase(&drumPhase));
+		}
+#endif 
+	}
+	else {
+		SensorStats_Reset(&windowStats);
 	}
 
 	firstPass = false;
 
 #endif 
+
+	// Messages are formatted into pooled buffers, so in steady state a sample makes no heap
+	// calls; count any that creep in
+	const uint32_t heapCalls = HeapStats_Calls() - heapCallsAtStart;
+	if (heapCalls != 0) {
+		samplePathHeapCalls += heapCalls;
+		Log_Debug("WARNING: %u heap call(s) while handling a sample\n", heapCalls);
+	}
 }
-int The_PWM(void) {
-	SOFTPWM_Start(pwm1);
-	SOFTPWM_SetPeriod(pwm1, 400000, 400000 * .1);
-	sleep(1);
-	SOFTPWM_SetPeriod(pwm1, 400000, 400000 * .1);
-	sleep(1);
-	SOFTPWM_Stop(pwm1);
+/// <summary>
+///     Saves the gyro bias, orientation and ranging state to the calibration store.
+/// </summary>
+static void saveCalibration(void)
+{
+	calibration_record_t record;
+	memset(&record, 0, sizeof(record));
+
+	GyroBias_GetState(&gyroBias, &record.gyroBias);
+	memcpy(record.gyroOffset_counts, gyroCalibration.offset, sizeof(record.gyroOffset_counts));
+	memcpy(record.orientationQ, orientation.q, sizeof(record.orientationQ));
+	memcpy(record.orientationFeedback, orientation.integralFeedback, sizeof(record.orientationFeedback));
+	memcpy(record.orientationBinFeedback, orientation.binFeedback, sizeof(record.orientationBinFeedback));
+	for (int bin = 0; bin < ORIENTATION_TEMP_BINS; bin++) {
+		record.orientationBinValid[bin] = orientation.binValid[bin];
+	}
+	record.accelRange_g = (uint8_t)AccelRange_GetRange_g(&accelRange);
+	record.tfminiPresent = has_TFMini;
+
+	if (CalibrationStore_Save(&record) == 0) {
+		savedStillWindows = gyroBias.stillWindows;
+		clock_gettime(CLOCK_MONOTONIC, &lastCalibrationSave);
+	}
 }
 
-void blink(void) {
-	The_PWM();
-	GPIO_SetValue(socket2_CS, GPIO_Value_Low);
-	sleep(1);
-	GPIO_SetValue(socket2_CS, GPIO_Value_High);
-	sleep(1);
-	GPIO_SetValue(socket2_CS, GPIO_Value_Low);
-	sleep(1);
-	GPIO_SetValue(socket2_CS, GPIO_Value_High);
+/// <summary>
+///     Resumes the orientation filter from a stored record.
+/// </summary>
+static void restoreOrientation(const calibration_record_t *record)
+{
+	memcpy(orientation.q, record->orientationQ, sizeof(orientation.q));
+	memcpy(orientation.integralFeedback, record->orientationFeedback, sizeof(orientation.integralFeedback));
+	memcpy(orientation.binFeedback, record->orientationBinFeedback, sizeof(orientation.binFeedback));
+	for (int bin = 0; bin < ORIENTATION_TEMP_BINS; bin++) {
+		orientation.binValid[bin] = record->orientationBinValid[bin] != 0;
+	}
+}
+
+/// <summary>
+///     Calibrates one batch of raw gyro FIFO words to rad/s with the batch kernels, runs the
+///     orientation filter over it and keeps track of how long that takes so we can report
+///     its throughput.
+/// </summary>
+static void fuseImuBatch(const int16_t (*gyro_counts)[3], const float *const accel_g[3], size_t count,
+	uint64_t *fusionNanoseconds)
+{
+	static float gyro_rps[3][IMU_FIFO_MAX_BATCH];
+	static const float *const gyroAxes[3] = { gyro_rps[0], gyro_rps[1], gyro_rps[2] };
+	struct timespec start, end;
+
+	// Learn from the batch first so it is corrected with the freshest estimate
+	if (haveGyroTemperature) {
+		GyroBias_AddBatch(&gyroBias, gyro_counts, count, gyroTemperature_degC);
+		GyroBias_GetOffset(&gyroBias, gyroTemperature_degC, gyroCalibration.offset);
+	}
+
+	if (!firstSampleLogged && (calibrationRestored || gyroBias.haveLevel)) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		Log_Debug("[Info] Time to first calibrated sample: %.0f ms (%s)\n",
+			(double)(now.tv_sec - startupTime.tv_sec) * 1000.0 + (double)(now.tv_nsec - startupTime.tv_nsec) / 1e6,
+			calibrationRestored ? "stored calibration" : "learned this run");
+		firstSampleLogged = true;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ImuKernels_ConvertToFloat(gyro_counts, count, &gyroCalibration, gyro_rps[0], gyro_rps[1], gyro_rps[2]);
+	Orientation_UpdateBatch(&orientation, gyroAxes, accel_g, count, 1.0f / IMU_ODR_HZ);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*fusionNanoseconds += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ull + (uint64_t)(end.tv_nsec - start.tv_nsec);
+}
+
+/// <summary>
+///     Drains the LSM6DSO FIFO at full IMU rate and feeds the samples to the orientation filter.
+///     Periodically sends the fused attitude to Azure.
+/// </summary>
+void ImuFifoTimerEventHandler(EventData* eventData)
+{
+	static int16_t gyroBatch[IMU_FIFO_MAX_BATCH][3];
+	static float accelBatch[3][IMU_FIFO_MAX_BATCH];
+	static const float *const accelAxes[3] = { accelBatch[0], accelBatch[1], accelBatch[2] };
+	static float lastAccel_g[3];
+	static int32_t lastAccel_counts[3];
+	static bool haveAccel = false;
+	static uint32_t samplesSinceReport = 0;
+	static uint64_t fusionNanoseconds = 0;
+	static uint32_t accelSamplesSinceReport = 0;
+	static uint64_t decimationNanoseconds = 0;
+	struct timespec start, end;
+	float shockPeak_g = -1.0f;
+	bool captureDone = false;
+
+	if (ConsumeTimerFdEvent(imuFifoTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+	switchDone(SWITCH_FIFO_TIMER);
+
+	uint16_t fifoLevel = 0;
+	if (lsm6dso_fifo_data_level_get(&dev_ctx, &fifoLevel) != 0) {
+		return;
+	}
+
+	size_t batchCount = 0;
+	for (uint16_t i = 0; i < fifoLevel; i++) {
+		uint8_t fifoBytes[FIFO_WORD_SIZE];
+		axis3bit16_t fifoWord;
+
+		// Tag and data in one transaction, the FIFO output registers are consecutive
+		if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_FIFO_DATA_OUT_TAG, fifoBytes, FIFO_WORD_SIZE) != 0) {
+			break;
+		}
+		lsm6dso_fifo_tag_t tag = (lsm6dso_fifo_tag_t)(fifoBytes[0] >> 3);
+		memcpy(fifoWord.u8bit, &fifoBytes[1], 3 * sizeof(int16_t));
+
+		switch (tag) {
+		case LSM6DSO_XL_NC_TAG: {
+			// Words captured around a range switch are replaced by the previous sample, which
+			// keeps the decimator's time base without mixing ranges
+			int32_t accel_counts[3];
+			if (i < unknownRangeWords) {
+				memcpy(accel_counts, lastAccel_counts, sizeof(accel_counts));
+			}
+			else {
+				AccelRange_Observe(&accelRange, fifoWord.i16bit);
+				AccelRange_Normalize(accelRange.range, fifoWord.i16bit, accel_counts);
+				memcpy(lastAccel_counts, accel_counts, sizeof(accel_counts));
+			}
+			captureDone |= WaveformCapture_Push(&waveformCapture, accel_counts);
+
+			// Vibration is measured on the full rate stream.  Normalized counts at 16g need 64
+			// bits for the squared magnitude.
+			int64_t x = accel_counts[0], y = accel_counts[1], z = accel_counts[2];
+			int64_t magnitudeSquared = x * x + y * y + z * z;
+			float deviation_g = sqrtf((float)magnitudeSquared) * ACCEL_RANGE_NORMALIZED_G_PER_LSB - 1.0f;
+			vibrationSumSquares_g2 += deviation_g * deviation_g;
+			vibrationSamples++;
+			if (fabsf(deviation_g) > shockPeak_g) {
+				shockPeak_g = fabsf(deviation_g);
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			uint32_t produced = Decimator_Push(&accelDecimator, accel_counts);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			decimationNanoseconds += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ull + (uint64_t)(end.tv_nsec - start.tv_nsec);
+			accelSamplesSinceReport++;
+
+			if (produced & (1u << ACCEL_STAGE_TILT)) {
+				for (int axis = 0; axis < 3; axis++) {
+					lastAccel_g[axis] = accelDecimator.output[ACCEL_STAGE_TILT][axis] * ACCEL_RANGE_NORMALIZED_G_PER_LSB;
+				}
+				haveAccel = true;
+			}
+			if (produced & (1u << ACCEL_STAGE_TREND)) {
+				for (int axis = 0; axis < 3; axis++) {
+					accelTrend_counts[axis] = accelDecimator.output[ACCEL_STAGE_TREND][axis];
+				}
+				haveAccelTrend = true;
+			}
+			break;
+		}
+		case LSM6DSO_GYRO_NC_TAG:
+			// Pair each gyro word with the latest anti-aliased tilt rate accel sample
+			if (!haveAccel) {
+				break;
+			}
+			for (int axis = 0; axis < 3; axis++) {
+				gyroBatch[batchCount][axis] = fifoWord.i16bit[axis];
+				accelBatch[axis][batchCount] = lastAccel_g[axis];
+			}
+			if (++batchCount == IMU_FIFO_MAX_BATCH) {
+				fuseImuBatch(gyroBatch, accelAxes, batchCount, &fusionNanoseconds);
+				samplesSinceReport += batchCount;
+				batchCount = 0;
+			}
+			break;
+		case LSM6DSO_TEMPERATURE_TAG:
+			gyroTemperature_degC = lsm6dso_from_lsb_to_celsius(fifoWord.i16bit[0]);
+			haveGyroTemperature = true;
+			Orientation_SetTemperature(&orientation, gyroTemperature_degC);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (batchCount > 0) {
+		fuseImuBatch(gyroBatch, accelAxes, batchCount, &fusionNanoseconds);
+		samplesSinceReport += batchCount;
+	}
+
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	// Shocks are caught on the full rate stream, before any decimation
+	if (shockPeak_g >= 0.0f) {
+		checkAlarm(&shockAlarm, "shock", shockPeak_g);
+	}
+#endif
+
+	// Tell whoever asked for the capture that it can be fetched
+	if (captureDone) {
+		captureReady_ms = monotonicMilliseconds();
+		Log_Debug("[Info] Capture %u ready, %u frames at %.1f Hz\n", waveformCapture.id, waveformCapture.frameCount,
+			WaveformCapture_GetOdr(&waveformCapture));
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+		size_t size;
+		char *eventJson = AzureIoT_ReserveLaneMessage(SEND_LANE_EVENT, &size);
+		if (eventJson != NULL) {
+			int length = snprintf(eventJson, size,
+				"{\"event\": \"captureReady\", \"capture\": %u, \"frames\": %u, \"odr\": %.1f, \"chunks\": %u}",
+				waveformCapture.id, waveformCapture.frameCount, WaveformCapture_GetOdr(&waveformCapture),
+				WaveformCapture_ChunkCount(&waveformCapture));
+			if (length > 0 && (size_t)length < size) {
+				AzureIoT_CommitMessage(eventJson, (size_t)length);
+			}
+			else {
+				Log_Debug("ERROR: capture ready event does not fit in %zu bytes\n", size);
+				AzureIoT_CancelMessage(eventJson);
+			}
+		}
+#endif
+	}
+	// Give the memory back if nobody came for the rest of it
+	else if (waveformCapture.state == WAVEFORM_CAPTURE_READY &&
+		monotonicMilliseconds() - captureReady_ms >= WAVEFORM_CAPTURE_HOLD_SECONDS * 1000LL) {
+		Log_Debug("[Info] Capture %u released unfetched after %d s\n", waveformCapture.id, WAVEFORM_CAPTURE_HOLD_SECONDS);
+		WaveformCapture_Release(&waveformCapture);
+	}
+
+	// Switch range between batches.  Whatever reached the FIFO before the new setting took
+	// effect is counted so the next drain can skip it; if the count can't be read the whole
+	// next batch is distrusted.
+	unknownRangeWords = 0;
+	bool rangeSwitched = AccelRange_EndBatch(&accelRange);
+	if (pendingSwitches & SWITCH_ACCEL_RANGE) {
+		rangeSwitched |= AccelRange_Fix(&accelRange, acquisitionConfig.accelFullScale_g);
+		switchDone(SWITCH_ACCEL_RANGE);
+	}
+	if (rangeSwitched) {
+		lsm6dso_xl_full_scale_set(&dev_ctx, AccelRange_GetSetting(&accelRange));
+		if (lsm6dso_fifo_data_level_get(&dev_ctx, &unknownRangeWords) != 0) {
+			unknownRangeWords = UINT16_MAX;
+		}
+		Log_Debug("[Info] Accelerometer range now %dg (%u clipped samples, %u switches)\n",
+			AccelRange_GetRange_g(&accelRange), accelRange.clippedSamples, accelRange.switches);
+	}
+
+	if (samplesSinceReport >= ORIENTATION_REPORT_PERIOD_SECONDS * IMU_ODR_HZ) {
+		float tilt, roll, pitch, bias_dps[3];
+		Orientation_GetTilt(&orientation, &tilt, &roll, &pitch);
+		Orientation_GetGyroBias(&orientation, bias_dps);
+
+		// Filter throughput if it had the CPU to itself, useful to size the IMU rate
+		double updatesPerSecond = (fusionNanoseconds > 0) ? samplesSinceReport * 1e9 / (double)fusionNanoseconds : 0.0;
+		Log_Debug("Orientation: tilt %.2f roll %.2f pitch %.2f, bias [dps] %.3f %.3f %.3f, %.0f updates/s\n",
+			tilt, roll, pitch, bias_dps[0], bias_dps[1], bias_dps[2], updatesPerSecond);
+
+		Log_Debug("Gyro bias: offset [dps] %.3f %.3f %.3f at %.1fC, slope [mdps/C] %.2f %.2f %.2f%s, %u of %u windows still\n",
+			gyroCalibration.offset[0] * FS2000_DPS_PER_LSB, gyroCalibration.offset[1] * FS2000_DPS_PER_LSB,
+			gyroCalibration.offset[2] * FS2000_DPS_PER_LSB, gyroTemperature_degC,
+			gyroBias.slope_countsPerDegC[0] * FS2000_DPS_PER_LSB * 1000.0f, gyroBias.slope_countsPerDegC[1] * FS2000_DPS_PER_LSB * 1000.0f,
+			gyroBias.slope_countsPerDegC[2] * FS2000_DPS_PER_LSB * 1000.0f, gyroBias.haveFit ? "" : " (not fitted)",
+			gyroBias.stillWindows, gyroBias.stillWindows + gyroBias.movingWindows);
+
+		double decimatedPerSecond = (decimationNanoseconds > 0) ? accelSamplesSinceReport * 1e9 / (double)decimationNanoseconds : 0.0;
+		Log_Debug("Decimator: %u accel samples, %.2f MACs/sample/axis, %.0f samples/s\n", accelSamplesSinceReport,
+			Decimator_GetMacsPerInputSample(&accelDecimator), decimatedPerSecond);
+
+		heap_stats_t heap;
+		HeapStats_Get(&heap);
+		Log_Debug("Heap: %u malloc, %u calloc, %u realloc, %u free, %u call(s) in the sample path\n",
+			heap.mallocs, heap.callocs, heap.reallocs, heap.frees, samplePathHeapCalls);
+
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+		size_t size;
+		char *orientationJson = AzureIoT_ReserveMessage(&size);
+		if (orientationJson != NULL) {
+			int length = snprintf(orientationJson, size,
+				"{\"qw\": %.5f, \"qx\": %.5f, \"qy\": %.5f, \"qz\": %.5f, \"tilt\": %.3f, \"roll\": %.3f, \"pitch\": %.3f}",
+				orientation.q[0], orientation.q[1], orientation.q[2], orientation.q[3], tilt, roll, pitch);
+			if (length > 0 && (size_t)length < size) {
+				AzureIoT_CommitMessage(orientationJson, (size_t)length);
+			}
+			else {
+				Log_Debug("ERROR: orientation does not fit in %zu bytes\n", size);
+				AzureIoT_CancelMessage(orientationJson);
+			}
+		}
+#endif 
+		// Save when there is something new, but not so often it wears the flash
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (gyroBias.stillWindows != savedStillWindows &&
+			now.tv_sec - lastCalibrationSave.tv_sec >= CALIBRATION_SAVE_PERIOD_SECONDS) {
+			saveCalibration();
+		}
+
+		samplesSinceReport = 0;
+		fusionNanoseconds = 0;
+		accelSamplesSinceReport = 0;
+		decimationNanoseconds = 0;
+	}
 }
-float readDistance() {
-	//Routine to output the distance to the console
 
-	if (!has_TFMini) return -1;
+/// <summary>
+///     Plays one step of the indicator sequence: the PWM output for two seconds, then the
+///     socket 2 CS line toggled once a second.  Each step arms the blink timer for the next,
+///     so nothing waits for the sequence.
+/// </summary>
+static void runBlinkStep(void)
+{
+	switch (blinkStep) {
+	case 0:
+		SOFTPWM_Start(pwm1);
+		SOFTPWM_SetPeriod(pwm1, 400000, 400000 * .1);
+		break;
+	case 1:
+		SOFTPWM_SetPeriod(pwm1, 400000, 400000 * .1);
+		break;
+	case 2:
+		SOFTPWM_Stop(pwm1);
+		GPIO_SetValue(socket2_CS, GPIO_Value_Low);
+		break;
+	case 3:
+	case 5:
+		GPIO_SetValue(socket2_CS, GPIO_Value_High);
+		break;
+	case 4:
+		GPIO_SetValue(socket2_CS, GPIO_Value_Low);
+		break;
+	default:
+		break;
+	}
 
-	uint16_t distance = 0; //distance
-	uint16_t strength = 0; // signal strength
-	uint8_t rangeType = 0; //range scale
+	if (++blinkStep < BLINK_STEP_COUNT) {
+		struct timespec blinkStepPeriod = { .tv_sec = 1,.tv_nsec = 0 };
+		SetTimerFdToSingleExpiry(blinkTimerFd, &blinkStepPeriod);
+	}
+	else {
+		blinkStep = -1;
+	}
+}
 
+void BlinkTimerEventHandler(EventData* eventData)
+{
+	if (ConsumeTimerFdEvent(blinkTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+	runBlinkStep();
+}
+
+/// <summary>
+///     Starts the indicator sequence unless it is already playing.  Returns straight away.
+/// </summary>
+void blink(void) {
+	if (blinkStep >= 0 || blinkTimerFd < 0 || pwm1 == NULL) {
+		return;
+	}
+	blinkStep = 0;
+	runBlinkStep();
+}
+/// <summary>
+///     Reads one frame from the TFMini over I2C.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int readDistanceFrame(uint16_t *distance, uint16_t *strength, bool *valid)
+{
 	I2C_DeviceAddress myLIDAR = 0x10;
 	uint8_t incoming[7]; //an array of bytes to hold the returned data from the TFMini.
 
@@ -297,48 +1273,96 @@ float readDistance() {
 		Log_Debug("ERROR: seanWriteI2C: errno=%d (%s)\n", errno, strerror(errno));
 		return -1;
 	}
-	else {
-		Log_Debug("Success:  Read Distance!\n");
 
-		for (int x = 0; x < 7; x++)
-		{
-			if (x == 0)
-			{
-				//Trigger done
-				if (incoming[x] == 0x00)
-				{
-					Log_Debug("Problem:  Distance data not valid-");//for debugging
+	*valid = (incoming[0] == 0x01); //Trigger done
+	*distance = incoming[2] | (incoming[3] << 8); //"Dist_L" and "Dist_H"
+	*strength = incoming[4] | (incoming[5] << 8); //signal strength
+	// incoming[6] is the range scale, which the tracker doesn't need
+	return 0;
+}
+
+/// <summary>
+///     Reads every TFMini frame at the LIDAR's native rate and runs it through the tracker.
+/// </summary>
+void DistanceTimerEventHandler(EventData* eventData)
+{
+	static struct timespec lastFrame = { 0, 0 };
 
-				}
-				else if (incoming[x] == 0x01)
-				{
-					Log_Debug("Data valid:     ");
-				}
-			}
-			else if (x == 2)
-				distance = incoming[x]; //LSB of the distance value "Dist_L"
-			else if (x == 3)
-				distance |= incoming[x] << 8; //MSB of the distance value "Dist_H"
-			else if (x == 4)
-				strength = incoming[x]; //LSB of signal strength value
-			else if (x == 5)
-				strength |= incoming[x] << 8; //MSB of signal strength value
-			else if (x == 6)
-				rangeType = incoming[x]; //range scale
-		}
-		float the_return = distance / (12 * 2.54);
-		Log_Debug("Distance=%f Feet\n", the_return);
-		blink();
-		return the_return;
+	if (ConsumeTimerFdEvent(distanceTimerFd) != 0) {
+		terminationRequired = true;
+		return;
+	}
+
+	uint16_t distance, strength;
+	bool valid;
+	if (readDistanceFrame(&distance, &strength, &valid) != 0) {
+		return;
 	}
-	return -1;  //if we get this far, it failed.
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	float dt = (lastFrame.tv_sec == 0 && lastFrame.tv_nsec == 0) ? DISTANCE_FRAME_PERIOD_NANO_SECONDS / 1e9f :
+		(float)(now.tv_sec - lastFrame.tv_sec) + (float)(now.tv_nsec - lastFrame.tv_nsec) / 1e9f;
+	lastFrame = now;
+
+	DistanceTracker_Update(&distanceTracker, distance, strength, valid, dt);
+}
+
+float readDistance() {
+	//Return the tracked distance in feet
+
+	if (!has_TFMini || !distanceTracker.initialized) return -1;
+
+	float the_return = distanceTracker.distance_cm / (12 * 2.54);
+	Log_Debug("Distance=%f Feet, displacement=%.1f mm, rate=%.2f mm/s, confidence=%.2f\n", the_return,
+		DistanceTracker_GetDisplacement_mm(&distanceTracker), DistanceTracker_GetRate_mmps(&distanceTracker),
+		DistanceTracker_GetConfidence(&distanceTracker));
+	return the_return;
 }
 
 /// <summary>
-///     Initializes the I2C interface.
+///     Startup task: loads the stored calibration and sets up the estimators from it.  This is
+///     all software, so it is ready before the devices it serves.
 /// </summary>
-/// <returns>0 on success, or -1 on failure</returns>
-int initI2c(void) {
+static int startCalibration(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &lastCalibrationSave);
+
+	// The last known-good calibration lets acquisition start straight away
+	calibrationRestored = (CalibrationStore_Load(&storedCalibration) == 0);
+
+	AccelRange_Init(&accelRange, calibrationRestored ? storedCalibration.accelRange_g : ACCEL_RANGE_INITIAL_G, ACCEL_RANGE_CLIP_COUNTS, ACCEL_RANGE_DOWN_HEADROOM,
+		ACCEL_RANGE_HOLD_BATCHES);
+
+	// The gyro offset is learned in the background from stationary intervals, so startup doesn't
+	// wait for (or assume) a stationary device
+	GyroBias_Init(&gyroBias, GYRO_BIAS_WINDOW_SAMPLES, GYRO_BIAS_STILL_STDDEV_DPS / FS2000_DPS_PER_LSB,
+		GYRO_BIAS_MAX_DPS / FS2000_DPS_PER_LSB, GYRO_BIAS_LEVEL_GAIN, GYRO_BIAS_FORGETTING, GYRO_BIAS_MIN_SPREAD_DEGC);
+	ImuKernels_SetIdentity(&gyroCalibration, FS2000_RPS_PER_LSB);
+	if (calibrationRestored) {
+		GyroBias_SetState(&gyroBias, &storedCalibration.gyroBias);
+		memcpy(gyroCalibration.offset, storedCalibration.gyroOffset_counts, sizeof(gyroCalibration.offset));
+		savedStillWindows = gyroBias.stillWindows;
+	}
+	ImuKernels_SelfTest();
+
+	Orientation_Init(&orientation, ORIENTATION_KP, ORIENTATION_KI);
+	if (calibrationRestored) {
+		restoreOrientation(&storedCalibration);
+	}
+	Decimator_Init(&accelDecimator, accelDecimation, ACCEL_STAGE_COUNT);
+	Log_Debug("Decimator: %.2f MACs and %.2f adds per accel sample and axis\n",
+		Decimator_GetMacsPerInputSample(&accelDecimator), Decimator_GetAddsPerInputSample(&accelDecimator));
+
+	return STARTUP_STEP_DONE;
+}
+
+/// <summary>
+///     Startup task: opens the ADC, the indicator outputs and the I2C master every device
+///     hangs off, and starts the indicator sequence.
+/// </summary>
+static int startBus(void)
+{
 	// Begin MT3620 I2C init 
 	socket2_CS = GPIO_OpenAsOutput(MT3620_GPIO35, GPIO_OutputMode_OpenSource, GPIO_Value_Low);//make sure you have this enabled in your app_mainfest.json file in the capabilities section
 	my_adc = ADC_Open(0);
@@ -352,73 +1376,72 @@ int initI2c(void) {
 	if (NULL == pwm1)
 	{
 		Log_Debug("PWM init error\n");
-		return;
 	}
 
+	// Created disarmed, blink() arms it
+	struct timespec blinkDisarmed = { .tv_sec = 0,.tv_nsec = 0 };
+	static EventData blinkEventData = { .eventHandler = &BlinkTimerEventHandler };
+	blinkTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &blinkDisarmed, &blinkEventData, EPOLLIN);
 	blink();
+
 	i2cFd = I2CMaster_Open(MT3620_RDB_HEADER4_ISU2_I2C);
 	if (i2cFd < 0) {
 		Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
+		return STARTUP_STEP_FAILED;
 	}
 
-	int result = I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_STANDARD);
+	// Fast mode is needed to keep up with the accelerometer FIFO at ACCEL_FIFO_ODR_HZ
+	int result = I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_FAST);
 	if (result != 0) {
 		Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
+		return STARTUP_STEP_FAILED;
 	}
 	else Log_Debug("SUCCESS: I2CMaster_SetBusSpeed set.\n");
 
 	result = I2CMaster_SetTimeout(i2cFd, 10000);
 	if (result != 0) {
 		Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
-	}
-	// Start OLED
-	if (oled_init())
-	{
-		Log_Debug("OLED not found!\n");
-	}
-	else
-	{
-		Log_Debug("OLED found!\n");
-		update_oled();
+		return STARTUP_STEP_FAILED;
 	}
-	// Initialize TFMini
-	uint8_t my_reset_value = 0x06;
-	I2C_DeviceAddress my_TFMini = 0x10;
+	return STARTUP_STEP_DONE;
+}
 
-	result = I2CMaster_Write(i2cFd, my_TFMini, &my_reset_value, 1);
-	if (result < 0) {
-		Log_Debug("WARNING: TFMini Soft Reset Fail: errno=%d (%s)\n", errno, strerror(errno));
-		has_TFMini = false;
-	}
-	else {
-		has_TFMini = true;
-		Log_Debug("TFMini Found!\n");
-	}
-	// Initialize lsm6dso mems driver interface
-	dev_ctx.write_reg = platform_write;
-	dev_ctx.read_reg = platform_read;
-	dev_ctx.handle = &i2cFd;
+/// <summary>
+///     Startup task: resets and configures the LSM6DSO and starts draining its FIFO.  The
+///     reset is polled from the startup timer rather than in a loop.
+/// </summary>
+static int startLsm6dso(void)
+{
+	static bool resetting = false;
 
-	// Check device ID
+	if (!resetting) {
+		// Initialize lsm6dso mems driver interface
+		dev_ctx.write_reg = platform_write;
+		dev_ctx.read_reg = platform_read;
+		dev_ctx.handle = &i2cFd;
 
-	lsm6dso_device_id_get(&dev_ctx, &whoamI);
-	Log_Debug("Sean's Search ID: %d\n", whoamI);
-	if (whoamI != LSM6DSO_ID) {
-		Log_Debug("LSM6DSO not found!\n");
-		return -1;
-	}
-	else {
-		Log_Debug("LSM6DSO Found!\n");
+		// Check device ID
+
+		lsm6dso_device_id_get(&dev_ctx, &whoamI);
+		Log_Debug("Sean's Search ID: %d\n", whoamI);
+		if (whoamI != LSM6DSO_ID) {
+			Log_Debug("LSM6DSO not found!\n");
+			return STARTUP_STEP_FAILED;
+		}
+		else {
+			Log_Debug("LSM6DSO Found!\n");
+		}
+
+		// Restore default configuration
+		lsm6dso_reset_set(&dev_ctx, PROPERTY_ENABLE);
+		resetting = true;
+		return 1;
 	}
 
-	// Restore default configuration
-	lsm6dso_reset_set(&dev_ctx, PROPERTY_ENABLE);
-	do {
-		lsm6dso_reset_get(&dev_ctx, &rst);
-	} while (rst);
+	lsm6dso_reset_get(&dev_ctx, &rst);
+	if (rst) {
+		return 1;
+	}
 
 	// Disable I3C interface
 	lsm6dso_i3c_disable_set(&dev_ctx, LSM6DSO_I3C_DISABLE);
@@ -426,30 +1449,55 @@ int initI2c(void) {
 	// Enable Block Data Update
 	lsm6dso_block_data_update_set(&dev_ctx, PROPERTY_ENABLE);
 
-	// Set Output Data Rate
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_12Hz5);
-	lsm6dso_gy_data_rate_set(&dev_ctx, LSM6DSO_GY_ODR_12Hz5);
+	// Set Output Data Rate.  The accelerometer runs fast for vibration analysis and is
+	// decimated in software, the gyro runs at IMU_ODR_HZ for the orientation filter.
+	lsm6dso_xl_data_rate_set(&dev_ctx, IMU_XL_ODR);
+	lsm6dso_gy_data_rate_set(&dev_ctx, LSM6DSO_GY_ODR_104Hz);
 
 	// Set full scale
-	lsm6dso_xl_full_scale_set(&dev_ctx, LSM6DSO_4g);
+	lsm6dso_xl_full_scale_set(&dev_ctx, AccelRange_GetSetting(&accelRange));
 	lsm6dso_gy_full_scale_set(&dev_ctx, LSM6DSO_2000dps);
 
 	// Configure filtering chain(No aux interface)
-   // Accelerometer - LPF1 + LPF2 path	
-	lsm6dso_xl_hp_path_on_out_set(&dev_ctx, LSM6DSO_LP_ODR_DIV_100);
+   // Accelerometer - LPF1 + LPF2 path at ODR/4, the anti-aliasing for the full rate stream.
+   // The lower rate streams are filtered by accelDecimator.
+	lsm6dso_xl_hp_path_on_out_set(&dev_ctx, LSM6DSO_HP_PATH_DISABLE_ON_OUT);
 	lsm6dso_xl_filter_lp2_set(&dev_ctx, PROPERTY_ENABLE);
 
-	// lps22hh specific init
+	// Stream accel and gyro at full rate, plus the die temperature for the gyro bias tracking,
+	// through the FIFO.  ImuFifoTimerEventHandler drains it.
+	lsm6dso_fifo_xl_batch_set(&dev_ctx, LSM6DSO_XL_BATCHED_AT_1667Hz);
+	lsm6dso_fifo_gy_batch_set(&dev_ctx, LSM6DSO_GY_BATCHED_AT_104Hz);
+	lsm6dso_fifo_temp_batch_set(&dev_ctx, LSM6DSO_TEMP_BATCHED_AT_1Hz6);
+	lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_STREAM_MODE);
+
+	WaveformCapture_Init(&waveformCapture, ACCEL_FIFO_ODR_HZ);
+
+	// Drain the IMU FIFO often enough that it never overflows
+	struct timespec imuFifoReadPeriod = { .tv_sec = 0,.tv_nsec = (long)acquisitionConfig.imuFifoPeriod_ms * 1000000 };
+	static EventData imuFifoEventData = { .eventHandler = &ImuFifoTimerEventHandler };
+	imuFifoTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &imuFifoReadPeriod, &imuFifoEventData, EPOLLIN);
+	if (imuFifoTimerFd < 0) {
+		return STARTUP_STEP_FAILED;
+	}
+	return STARTUP_STEP_DONE;
+}
 
-	// Initialize lps22hh mems driver interface
-	pressure_ctx.read_reg = lsm6dso_read_lps22hh_cx;
-	pressure_ctx.write_reg = lsm6dso_write_lps22hh_cx;
-	pressure_ctx.handle = &i2cFd;
+/// <summary>
+///     Startup task: finds the LPS22HH behind the LSM6DSO sensor hub, retrying from the
+///     startup timer, then resets and configures it.
+/// </summary>
+static int startLps22hh(void)
+{
+	static int attempts = 0;
+	static bool resetting = false;
 
-	bool lps22hhDetected = false;
-	int failCount = 10;
+	if (!resetting) {
+		// Initialize lps22hh mems driver interface
+		pressure_ctx.read_reg = lsm6dso_read_lps22hh_cx;
+		pressure_ctx.write_reg = lsm6dso_write_lps22hh_cx;
+		pressure_ctx.handle = &i2cFd;
 
-	while (!lps22hhDetected) {
 		// Enable pull up on master I2C interface.
 		lsm6dso_sh_pin_mode_set(&dev_ctx, LSM6DSO_INTERNAL_PULL_UP);
 
@@ -457,87 +1505,292 @@ int initI2c(void) {
 		lps22hh_device_id_get(&pressure_ctx, &whoamI);
 		if (whoamI != LPS22HH_ID) {
 			Log_Debug("LPS22HH not found!\n");
+
+			// Try again after a pause, without holding up anything else
+			if (++attempts > LPS22HH_DETECT_ATTEMPTS) {
+				Log_Debug("Failed to read LSM22HH device ID, running without pressure\n");
+				return STARTUP_STEP_FAILED;
+			}
+			return LPS22HH_RETRY_DELAY_MS;
 		}
-		else {
-			lps22hhDetected = true;
-			Log_Debug("LPS22HH Found!\n");
-		}
+		Log_Debug("LPS22HH Found!\n");
 
 		// Restore the default configuration
 		lps22hh_reset_set(&pressure_ctx, PROPERTY_ENABLE);
-		do {
-			lps22hh_reset_get(&pressure_ctx, &rst);
-		} while (rst);
+		resetting = true;
+		return 1;
+	}
 
-		// Enable Block Data Update
-		lps22hh_block_data_update_set(&pressure_ctx, PROPERTY_ENABLE);
+	lps22hh_reset_get(&pressure_ctx, &rst);
+	if (rst) {
+		return 1;
+	}
 
-		//Set Output Data Rate
-		lps22hh_data_rate_set(&pressure_ctx, LPS22HH_10_Hz_LOW_NOISE);
+	// Enable Block Data Update
+	lps22hh_block_data_update_set(&pressure_ctx, PROPERTY_ENABLE);
+
+	//Set Output Data Rate
+	lps22hh_data_rate_set(&pressure_ctx, LPS22HH_10_Hz_LOW_NOISE);
+
+	// From here on slave 0 reads the status and output registers on every sensor hub cycle,
+	// triggered by the accelerometer data ready, and the master stays on.  There are no more
+	// single accesses, so the accelerometer never has to be stopped.
+	lsm6dso_sh_cfg_read_t outputs = { .slv_add = (LPS22HH_I2C_ADD_L & 0xFEU) >> 1, .slv_subadd = LPS22HH_STATUS,
+		.slv_len = LPS22HH_OUTPUT_BYTES };
+	lsm6dso_sh_slv0_cfg_read(&dev_ctx, &outputs);
+	lsm6dso_sh_slave_connected_set(&dev_ctx, LSM6DSO_SLV_0);
+	lsm6dso_sh_syncro_mode_set(&dev_ctx, LSM6DSO_XL_GY_DRDY);
+	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE);
+	return STARTUP_STEP_DONE;
+}
 
-		// If we failed to detect the lps22hh device, then pause before trying again.
-		if (!lps22hhDetected) {
-			HAL_Delay(100);
+/// <summary>
+///     Startup task: finds the TFMini and starts tracking it at its native frame rate.  If it
+///     was there last time and still answers, it is left running rather than reset.
+/// </summary>
+static int startTfmini(void)
+{
+	uint16_t probeDistance, probeStrength;
+	bool probeValid;
+	if (calibrationRestored && storedCalibration.tfminiPresent &&
+		readDistanceFrame(&probeDistance, &probeStrength, &probeValid) == 0) {
+		has_TFMini = true;
+		Log_Debug("TFMini Found!\n");
+	}
+	else {
+		uint8_t my_reset_value = 0x06;
+		I2C_DeviceAddress my_TFMini = 0x10;
+
+		int result = I2CMaster_Write(i2cFd, my_TFMini, &my_reset_value, 1);
+		if (result < 0) {
+			Log_Debug("WARNING: TFMini Soft Reset Fail: errno=%d (%s)\n", errno, strerror(errno));
+			has_TFMini = false;
+			return STARTUP_STEP_FAILED;
 		}
+		has_TFMini = true;
+		Log_Debug("TFMini Found!\n");
+	}
 
-		if (failCount-- == 0) {
-			Log_Debug("Failed to read LSM22HH device ID, exiting\n");
-			return -1;
-		}
+	DistanceTracker_Init(&distanceTracker, DISTANCE_PROCESS_NOISE, DISTANCE_MEASUREMENT_SIGMA_CM);
+	struct timespec distanceFramePeriod = { .tv_sec = 0,.tv_nsec = DISTANCE_FRAME_PERIOD_NANO_SECONDS };
+	static EventData distanceEventData = { .eventHandler = &DistanceTimerEventHandler };
+	distanceTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &distanceFramePeriod, &distanceEventData, EPOLLIN);
+	if (distanceTimerFd < 0) {
+		return STARTUP_STEP_FAILED;
 	}
+	return STARTUP_STEP_DONE;
+}
+
+/// <summary>
+///     Startup task: starts the periodic read of whichever sensors are ready.
+/// </summary>
+static int startAcquisition(void)
+{
+	drum_phase_config_t drumPhaseConfig;
+	DrumPhase_DefaultConfig(&drumPhaseConfig);
+	DrumPhase_Init(&drumPhase, &drumPhaseConfig);
+	AlarmMonitor_Init(&shockAlarm, -INFINITY, ALARM_SHOCK_G, ALARM_SHOCK_HYSTERESIS_G, ALARM_HOLDOFF_SECONDS * 1000);
+	AlarmMonitor_Init(&pressureAlarm, ALARM_PRESSURE_MIN_HPA, ALARM_PRESSURE_MAX_HPA, ALARM_PRESSURE_HYSTERESIS_HPA,
+		ALARM_HOLDOFF_SECONDS * 1000);
+	AlarmMonitor_Init(&strainAlarm, -INFINITY, ALARM_STRAIN_LIMIT, ALARM_STRAIN_HYSTERESIS, ALARM_HOLDOFF_SECONDS * 1000);
+#ifdef TELEMETRY_PER_SAMPLE
+	TelemetryBatch_Init(&telemetryBatch, &telemetryBatchPolicy, sensorChannelScales);
+	telemetryBatch.policy.maxSamples = (uint16_t)acquisitionConfig.batchSamples;
+#endif 
 
-	// Read the raw angular rate data from the device to use as offsets.  We're making the assumption that the device
-	// is stationary.
+	// Init the epoll interface to periodically run the AccelTimerEventHandler routine where we read the sensors
 
-	uint8_t reg;
+	// The period is ACCEL_READ_PERIOD_SECONDS from build_options.h until the drum phase or the
+	// device twin sets another
+	armedSamplePeriod_ms = samplePeriodInEffect_ms();
+	struct timespec accelReadPeriod = { .tv_sec = armedSamplePeriod_ms / 1000,.tv_nsec = (armedSamplePeriod_ms % 1000) * 1000000 };
+	// event handler data structures. Only the event handler field needs to be populated.
+	static EventData accelEventData = { .eventHandler = &AccelTimerEventHandler };
+	accelTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &accelReadPeriod, &accelEventData, EPOLLIN);
+	if (accelTimerFd < 0) {
+		return STARTUP_STEP_FAILED;
+	}
+	armSampling();
+	return STARTUP_STEP_DONE;
+}
 
+/// <summary>
+///     Startup task: brings up the OLED.  It is last on the bus so the sensors go first.
+/// </summary>
+static int startOled(void)
+{
+	if (oled_init())
+	{
+		Log_Debug("OLED not found!\n");
+		return STARTUP_STEP_FAILED;
+	}
+	Log_Debug("OLED found!\n");
+	update_oled();
+	return STARTUP_STEP_DONE;
+}
 
-	Log_Debug("LSM6DSO: Calibrating angular rate . . .\n");
-	Log_Debug("LSM6DSO: Please make sure the device is stationary.\n");
+/// <summary>
+///     Startup task: loads the anomaly model and runs the optional benchmarks, once
+///     acquisition is already running.
+/// </summary>
+static int startModel(void)
+{
+#ifdef SENSOR_UNITS_BENCHMARK_SAMPLES
+	SensorUnits_RunBenchmark(SENSOR_UNITS_BENCHMARK_SAMPLES);
+#endif 
+#ifdef TELEMETRY_ENCODING_BENCHMARK_SAMPLES
+	TelemetryBatch_RunBenchmark(TELEMETRY_ENCODING_BENCHMARK_SAMPLES, sensorChannelScales);
+#endif 
+#ifdef ORIENTATION_BENCHMARK_SAMPLES
+	orientation_benchmark_t orientationBenchmark;
+	Orientation_RunBenchmark(ORIENTATION_BENCHMARK_SAMPLES, IMU_ODR_HZ, ORIENTATION_KP, ORIENTATION_KI, &orientationBenchmark);
+	Log_Debug("Orientation benchmark: %zu samples, %.0f updates/s, tilt error %.3f deg RMS, %.3f deg max, "
+		"gyro bias %.2f, %.2f, %.2f dps (trace %.2f, %.2f, %.2f)\n",
+		orientationBenchmark.samples, orientationBenchmark.updatesPerSecond, orientationBenchmark.tiltRmsError_deg,
+		orientationBenchmark.tiltMaxError_deg, orientationBenchmark.bias_dps[0], orientationBenchmark.bias_dps[1],
+		orientationBenchmark.bias_dps[2], orientationBenchmark.trueBias_dps[0], orientationBenchmark.trueBias_dps[1],
+		orientationBenchmark.trueBias_dps[2]);
+#endif 
 
-	do {
-		// Read the calibration values
-		lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
-		if (reg)
-		{
-			// Read angular rate field data to use for calibration offsets
-			memset(data_raw_angular_rate.u8bit, 0x00, 3 * sizeof(int16_t));
-			lsm6dso_angular_rate_raw_get(&dev_ctx, raw_angular_rate_calibration.u8bit);
-		}
+	AnomalyModel_SelfTest();
+#ifdef ANOMALY_BENCHMARK_INFERENCES
+	AnomalyModel_RunBenchmark(ANOMALY_MODEL_PATH, ANOMALY_BENCHMARK_INFERENCES);
+#endif 
+
+	// The model is optional, without it every window record is sent
+	if (AnomalyModel_Load(&anomalyModel, ANOMALY_MODEL_PATH) != 0) {
+		Log_Debug("INFO: anomaly scoring disabled, sending every window\n");
+	}
+	return STARTUP_STEP_DONE;
+}
 
-		// Read the angular data rate again and verify that after applying the calibration, we have 0 angular rate in all directions
+static startup_task_t startupTasks[STARTUP_TASK_COUNT] = {
+	[STARTUP_TASK_CALIBRATION] = { "calibration", &startCalibration, 0, false },
+	[STARTUP_TASK_BUS] = { "i2c", &startBus, 0, true },
+	[STARTUP_TASK_LSM6DSO] = { "lsm6dso", &startLsm6dso, STARTUP_AFTER(STARTUP_TASK_BUS) | STARTUP_AFTER(STARTUP_TASK_CALIBRATION), true },
+	[STARTUP_TASK_TFMINI] = { "tfmini", &startTfmini, STARTUP_AFTER(STARTUP_TASK_BUS) | STARTUP_AFTER(STARTUP_TASK_CALIBRATION), false },
+	[STARTUP_TASK_ACQUISITION] = { "acquisition", &startAcquisition, STARTUP_AFTER(STARTUP_TASK_BUS) | STARTUP_AFTER(STARTUP_TASK_CALIBRATION), true },
+	[STARTUP_TASK_LPS22HH] = { "lps22hh", &startLps22hh, STARTUP_AFTER(STARTUP_TASK_LSM6DSO), false },
+	[STARTUP_TASK_OLED] = { "oled", &startOled, STARTUP_AFTER(STARTUP_TASK_BUS), false },
+	[STARTUP_TASK_MODEL] = { "model", &startModel, STARTUP_AFTER(STARTUP_TASK_ACQUISITION), false }
+};
+
+static void startupComplete(bool ok)
+{
+	if (!ok) {
+		Log_Debug("ERROR: a required device didn't start, exiting\n");
+		terminationRequired = true;
+	}
+}
 
-		lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
-		if (reg)
-		{
-			// Read angular rate field data
-			memset(data_raw_angular_rate.u8bit, 0x00, 3 * sizeof(int16_t));
-			lsm6dso_angular_rate_raw_get(&dev_ctx, data_raw_angular_rate.u8bit);
+/// <summary>
+///     Copies a short JSON response for a direct method into the heap, where the SDK frees it.
+/// </summary>
+static int methodResponse(int status, const char *json, char **response, size_t *responseSize)
+{
+	*responseSize = strlen(json);
+	*response = malloc(*responseSize);
+	if (*response == NULL) {
+		*responseSize = 0;
+		return 500;
+	}
+	memcpy(*response, json, *responseSize);
+	return status;
+}
 
-			// Before we store the mdps values subtract the calibration data we captured at startup.
-			angular_rate_dps[0] = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[0] - raw_angular_rate_calibration.i16bit[0]);
-			angular_rate_dps[1] = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[1] - raw_angular_rate_calibration.i16bit[1]);
-			angular_rate_dps[2] = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[2] - raw_angular_rate_calibration.i16bit[2]);
+int acquisitionDirectMethodHandler(const char *methodName, const char *payload, size_t payloadSize,
+	char **response, size_t *responseSize)
+{
+	// The arguments are a small JSON object, which the SDK doesn't terminate
+	char request[128];
+	if (payloadSize >= sizeof(request)) {
+		return methodResponse(400, "\"Payload too long\"", response, responseSize);
+	}
+	memcpy(request, payload, payloadSize);
+	request[payloadSize] = '\0';
+	JSON_Value *root = json_parse_string(request);
+	JSON_Object *args = json_value_get_object(root);
+
+	if (strcmp(methodName, "captureBurst") == 0) {
+		const float duration_s = (float)json_object_get_number(args, "duration");
+		const float odr_hz = (float)json_object_get_number(args, "odr");
+		json_value_free(root);
+
+		if (imuFifoTimerFd < 0) {
+			return methodResponse(503, "\"The accelerometer stream isn't running\"", response, responseSize);
+		}
+		if (waveformCapture.state == WAVEFORM_CAPTURE_RUNNING) {
+			return methodResponse(409, "\"A capture is already running\"", response, responseSize);
+		}
+		if (!(duration_s > 0.0f)) {
+			return methodResponse(400, "\"duration must be a positive number of seconds\"", response, responseSize);
+		}
+		if (WaveformCapture_Start(&waveformCapture, duration_s, odr_hz, time(NULL)) != 0) {
+			return methodResponse(503, "\"Not enough memory for the capture\"", response, responseSize);
 		}
 
-		// If the angular values after applying the offset are not zero, then do it again!
-	} while (angular_rate_dps[0] == angular_rate_dps[1] == angular_rate_dps[2] == 0.0);
-
-	Log_Debug("LSM6DSO: Calibrating angular rate complete!\n");
+		// What will actually be captured, after rounding the rate and fitting the buffer
+		const float captureOdr_hz = WaveformCapture_GetOdr(&waveformCapture);
+		char json[192];
+		snprintf(json, sizeof(json), "{\"capture\": %u, \"frames\": %u, \"odr\": %.1f, \"duration\": %.3f, \"chunks\": %u}",
+			waveformCapture.id, waveformCapture.targetFrames, captureOdr_hz, (float)waveformCapture.targetFrames / captureOdr_hz,
+			(waveformCapture.targetFrames + WAVEFORM_CHUNK_FRAMES - 1) / WAVEFORM_CHUNK_FRAMES);
+		Log_Debug("[Info] Capture started: %s\n", json);
+		return methodResponse(202, json, response, responseSize);
+	}
 
+	if (strcmp(methodName, "fetchCapture") == 0) {
+		const int chunk = (int)json_object_get_number(args, "chunk");
+		const bool checkId = json_object_has_value_of_type(args, "capture", JSONNumber) != 0;
+		const uint32_t id = checkId ? (uint32_t)json_object_get_number(args, "capture") : 0;
+		json_value_free(root);
 
-	// Init the epoll interface to periodically run the AccelTimerEventHandler routine where we read the sensors
+		if (waveformCapture.state == WAVEFORM_CAPTURE_RUNNING) {
+			return methodResponse(409, "\"The capture is still running\"", response, responseSize);
+		}
+		if (waveformCapture.state != WAVEFORM_CAPTURE_READY) {
+			// Fetched in full or held too long
+			if (waveformCapture.id != 0) {
+				return methodResponse(410, "\"That capture has been released\"", response, responseSize);
+			}
+			return methodResponse(409, "\"No capture has been taken\"", response, responseSize);
+		}
+		if (checkId && id != waveformCapture.id) {
+			return methodResponse(410, "\"That capture has been replaced\"", response, responseSize);
+		}
 
-	// Define the period in the build_options.h file
-	struct timespec accelReadPeriod = { .tv_sec = ACCEL_READ_PERIOD_SECONDS,.tv_nsec = ACCEL_READ_PERIOD_NANO_SECONDS };
-	// event handler data structures. Only the event handler field needs to be populated.
-	static EventData accelEventData = { .eventHandler = &AccelTimerEventHandler };
-	accelTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &accelReadPeriod, &accelEventData, EPOLLIN);
-	if (accelTimerFd < 0) {
-		return -1;
+		// The chunk is formatted straight into the response
+		char *chunkJson = malloc(WAVEFORM_CHUNK_MAX_BYTES);
+		if (chunkJson == NULL) {
+			return methodResponse(500, "\"Out of memory\"", response, responseSize);
+		}
+		int length = (chunk >= 0) ? WaveformCapture_FormatChunk(&waveformCapture, (uint32_t)chunk, chunkJson, WAVEFORM_CHUNK_MAX_BYTES) : -1;
+		if (length < 0) {
+			free(chunkJson);
+			return methodResponse(404, "\"No such chunk\"", response, responseSize);
+		}
+		if (WaveformCapture_MarkFetched(&waveformCapture, (uint32_t)chunk)) {
+			Log_Debug("[Info] Capture %u fetched, releasing it\n", waveformCapture.id);
+			WaveformCapture_Release(&waveformCapture);
+		}
+		*response = chunkJson;
+		*responseSize = (size_t)length;
+		return 200;
 	}
 
-	return 0;
+	json_value_free(root);
+	Log_Debug("INFO: No method '%s' found\n", methodName);
+	return methodResponse(404, "\"No method found\"", response, responseSize);
+}
+
+/// <summary>
+///     Starts bringing up the I2C devices.  Returns once the startup graph is running; each
+///     device becomes ready on its own and the sensor reads start with the first of them.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int initI2c(void) {
+	clock_gettime(CLOCK_MONOTONIC, &startupTime);
+	return Startup_Begin(startupTasks, STARTUP_TASK_COUNT, epollFd, &startupComplete);
 }
 
 /// <summary>
@@ -545,8 +1798,19 @@ int initI2c(void) {
 /// </summary>
 void closeI2c(void) {
 
+	// Keep what was learned for the next start
+	if (imuFifoTimerFd >= 0 && gyroBias.stillWindows != savedStillWindows) {
+		saveCalibration();
+	}
+
+	Startup_Close();
+	CloseFdAndPrintError(blinkTimerFd, "blinkTimer");
 	CloseFdAndPrintError(i2cFd, "i2c");
 	CloseFdAndPrintError(accelTimerFd, "accelTimer");
+	CloseFdAndPrintError(imuFifoTimerFd, "imuFifoTimer");
+	CloseFdAndPrintError(distanceTimerFd, "distanceTimer");
+	AnomalyModel_Unload(&anomalyModel);
+	WaveformCapture_Release(&waveformCapture);
 }
 
 /// <summary>
@@ -651,6 +1915,35 @@ static int32_t platform_read(int* fD, uint8_t reg, uint8_t* bufp,
 
 	return 0;
 }
+/// <summary>
+///     Runs the access configured on slave 0 once, on the next accelerometer data ready.  The
+///     accelerometer keeps running at IMU_XL_ODR throughout, so the FIFO stream has no gap;
+///     at that rate a cycle comes round within a millisecond, so the status is polled at the
+///     data ready period rather than in coarse sleeps.
+/// </summary>
+static int32_t runSensorHubCycle(void)
+{
+	static const struct timespec pollInterval = { .tv_sec = 0, .tv_nsec = SENSOR_HUB_POLL_NS };
+	lsm6dso_status_master_t master_status;
+	int32_t ret;
+
+	// Clear any end of operation left from before
+	lsm6dso_sh_status_get(&dev_ctx, &master_status);
+
+	ret = lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE);
+	int polls = 0;
+	do {
+		nanosleep(&pollInterval, NULL);
+		lsm6dso_sh_status_get(&dev_ctx, &master_status);
+	} while (!master_status.sens_hub_endop && ++polls < SENSOR_HUB_MAX_POLLS);
+	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
+
+	if (ret == 0 && !master_status.sens_hub_endop) {
+		ret = -1;
+	}
+	return ret;
+}
+
 /*
  * @brief  Write lsm2mdl device register (used by configuration functions)
  *
@@ -664,45 +1957,17 @@ static int32_t platform_read(int* fD, uint8_t reg, uint8_t* bufp,
 static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data,
 	uint16_t len)
 {
-	axis3bit16_t data_raw_acceleration;
 	int32_t ret;
-	uint8_t drdy;
-	lsm6dso_status_master_t master_status;
 	lsm6dso_sh_cfg_write_t sh_cfg_write;
 
 	// Configure Sensor Hub to write to the LPS22HH, and send the write data
 	sh_cfg_write.slv0_add = (LPS22HH_I2C_ADD_L & 0xFEU) >> 1; // 7bit I2C address
-	sh_cfg_write.slv0_subadd = reg,
-		sh_cfg_write.slv0_data = *data,
-		ret = lsm6dso_sh_cfg_write(&dev_ctx, &sh_cfg_write);
-
-	/* Disable accelerometer. */
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
-
-	/* Enable I2C Master. */
-	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE);
-
-	/* Enable accelerometer to trigger Sensor Hub operation. */
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_104Hz);
-
-	/* Wait Sensor Hub operation flag set. */
-	lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
-	do
-	{
-		HAL_Delay(20);
-		lsm6dso_xl_flag_data_ready_get(&dev_ctx, &drdy);
-	} while (!drdy);
-
-	do
-	{
-		HAL_Delay(20);
-		lsm6dso_sh_status_get(&dev_ctx, &master_status);
-	} while (!master_status.sens_hub_endop);
-
-	/* Disable I2C master and XL (trigger). */
-	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
-
+	sh_cfg_write.slv0_subadd = reg;
+	sh_cfg_write.slv0_data = *data;
+	ret = lsm6dso_sh_cfg_write(&dev_ctx, &sh_cfg_write);
+	if (ret == 0) {
+		ret = runSensorHubCycle();
+	}
 	return ret;
 }
 
@@ -719,69 +1984,53 @@ static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data,
 static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len)
 {
 	lsm6dso_sh_cfg_read_t sh_cfg_read;
-	axis3bit16_t data_raw_acceleration;
-	int32_t ret;
-	uint8_t drdy;
-	lsm6dso_status_master_t master_status;
+	int32_t ret = 0;
 
-	/* Disable accelerometer. */
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
-
-	// For each byte we need to read from the lps22hh
-	for (int i = 0; i < len; i++) {
-
-		/* Configure Sensor Hub to read LPS22HH. */
+	// Slave 0 reads at most 7 registers per cycle
+	for (uint16_t done = 0; done < len && ret == 0; done += sh_cfg_read.slv_len) {
 		sh_cfg_read.slv_add = (LPS22HH_I2C_ADD_L & 0xFEU) >> 1; /* 7bit I2C address */
-		sh_cfg_read.slv_subadd = reg + i;
-		sh_cfg_read.slv_len = 1;
+		sh_cfg_read.slv_subadd = (uint8_t)(reg + done);
+		sh_cfg_read.slv_len = (uint8_t)((len - done < 7) ? len - done : 7);
 
-		// Call the command to read the data from the sensor hub.
-		// This data will be read from the device connected to the 
-		// sensor hub, and saved into a register for us to read.
+		// This data will be read from the device connected to the sensor hub, and saved
+		// into the sensor hub output registers for us to read.
 		ret = lsm6dso_sh_slv0_cfg_read(&dev_ctx, &sh_cfg_read);
 		lsm6dso_sh_slave_connected_set(&dev_ctx, LSM6DSO_SLV_0);
+		if (ret == 0) {
+			ret = runSensorHubCycle();
+		}
 
-		/* Enable I2C Master and I2C master. */
-		lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE);
-
-		/* Enable accelerometer to trigger Sensor Hub operation. */
-		lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_104Hz);
-
-		/* Wait Sensor Hub operation flag set. */
-		lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
-		do {
-			HAL_Delay(20);
-			lsm6dso_xl_flag_data_ready_get(&dev_ctx, &drdy);
-		} while (!drdy);
-
-		do {
-			HAL_Delay(20);
-			lsm6dso_sh_status_get(&dev_ctx, &master_status);
-		} while (!master_status.sens_hub_endop);
-
-		/* Disable I2C master and XL(trigger). */
-		lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
-		lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
-
-		// Read the data from the device.  The call below reads
-		// all 18 sensor hub data.  We just need the data from 
-		// sensor hub 1, so copy that into our data array.
+		// Slave 0's data starts at SENSOR_HUB_1
 		uint8_t buffer[18];
-		lsm6dso_sh_read_data_raw_get(&dev_ctx, buffer);
-		data[i] = buffer[1];
+		if (ret == 0) {
+			ret = lsm6dso_sh_read_data_raw_get(&dev_ctx, (lsm6dso_emb_sh_read_t*)buffer);
+		}
+		if (ret == 0) {
+			memcpy(&data[done], buffer, sh_cfg_read.slv_len);
+		}
+	}
 
 #ifdef ENABLE_READ_WRITE_DEBUG
-		Log_Debug("Read %d bytes: ", len);
-		for (int i = 0; i < len; i++) {
-			Log_Debug("[%0x] ", data[i]);
-		}
-		Log_Debug("\n", len);
-#endif 
+	Log_Debug("Read %d bytes: ", len);
+	for (int i = 0; i < len; i++) {
+		Log_Debug("[%0x] ", data[i]);
 	}
+	Log_Debug("\n", len);
+#endif 
 
-	/* Re-enable accelerometer */
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_104Hz);
+	return ret;
+}
 
+/// <summary>
+///     Reads the LPS22HH status and output registers as of the last sensor hub cycle.
+/// </summary>
+static int32_t readLps22hhOutputs(uint8_t outputs[LPS22HH_OUTPUT_BYTES])
+{
+	uint8_t buffer[18];
+	int32_t ret = lsm6dso_sh_read_data_raw_get(&dev_ctx, (lsm6dso_emb_sh_read_t*)buffer);
+	if (ret == 0) {
+		memcpy(outputs, buffer, LPS22HH_OUTPUT_BYTES);
+	}
 	return ret;
 }
 
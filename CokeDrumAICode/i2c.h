@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include "epoll_timerfd_utilities.h"
+#include "deadband.h"
 //// OLED
 #include "oled.h"
 
@@ -10,4 +11,32 @@
 float readDistance(void);
 int initI2c(void);
 void closeI2c(void);
-extern int i2cFd;
\ No newline at end of file
+extern int i2cFd;
+extern deadband_t telemetryDeadband;
+
+// Acquisition settings the device twin can change while running
+typedef struct {
+	int samplePeriod_ms;        // Sensor read period, 0 to follow the drum phase profile
+	int windowSamples;          // Reads per window record, 0 to follow the drum phase profile
+	int imuFifoPeriod_ms;       // How often the IMU FIFO is drained
+	int accelFullScale_g;       // 2, 4, 8 or 16, or 0 for automatic ranging
+	int batchSamples;           // Reads per message with TELEMETRY_PER_SAMPLE
+} acquisition_config_t;
+
+extern acquisition_config_t acquisitionConfig;
+
+///<summary>
+///		Checks acquisitionConfig after a twin change, putting back any invalid setting, and
+///		switches the running pipeline over to it.
+///</summary>
+void applyAcquisitionConfig(void);
+
+///<summary>
+///		Direct methods for on-demand diagnostics, see AzureIoT_SetDirectMethodCallback().
+///		captureBurst {"duration": seconds, "odr": Hz} captures the full rate accelerometer
+///		stream, at the rate rounded to a power of two divider of it, and sends a captureReady
+///		event when done.  fetchCapture {"chunk": n, "capture": id} returns one chunk of it; the
+///		capture id is optional and guards against a capture started in between.
+///</summary>
+int acquisitionDirectMethodHandler(const char *methodName, const char *payload, size_t payloadSize,
+	char **response, size_t *responseSize);
\ No newline at end of file
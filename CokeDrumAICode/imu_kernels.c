@@ -0,0 +1,305 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+
+#include "imu_kernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMU_KERNELS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define IMU_KERNELS_SSE2
+#endif
+
+// Set by ImuKernels_SelfTest() if the SIMD variant can't be trusted on this target
+static bool useReference = false;
+
+void ImuKernels_SetIdentity(imu_calibration_t *calibration, float gain)
+{
+	memset(calibration, 0, sizeof(*calibration));
+	calibration->matrix[0][0] = gain;
+	calibration->matrix[1][1] = gain;
+	calibration->matrix[2][2] = gain;
+}
+
+// Every variant evaluates each output as (m0 * a + m1 * b) + m2 * c with separately rounded
+// multiplies and adds, so they agree to within the compiler's freedom to fuse the scalar ones.
+
+void ImuKernels_ConvertToFloatReference(const int16_t (*counts)[3], size_t count,
+	const imu_calibration_t *calibration, float *x, float *y, float *z)
+{
+	const float (*m)[3] = calibration->matrix;
+	const float *o = calibration->offset;
+
+	for (size_t i = 0; i < count; i++) {
+		const float a = (float)counts[i][0] - o[0];
+		const float b = (float)counts[i][1] - o[1];
+		const float c = (float)counts[i][2] - o[2];
+		x[i] = (m[0][0] * a + m[0][1] * b) + m[0][2] * c;
+		y[i] = (m[1][0] * a + m[1][1] * b) + m[1][2] * c;
+		z[i] = (m[2][0] * a + m[2][1] * b) + m[2][2] * c;
+	}
+}
+
+static int32_t roundToQ(float value)
+{
+	// Round half away from zero, the same way the SIMD variants do it
+	return (int32_t)(value + copysignf(0.5f, value));
+}
+
+void ImuKernels_ConvertToQReference(const int16_t (*counts)[3], size_t count,
+	const imu_calibration_t *calibration, int fractionBits, int32_t *x, int32_t *y, int32_t *z)
+{
+	const float (*m)[3] = calibration->matrix;
+	const float *o = calibration->offset;
+	const float q = (float)(1 << fractionBits);
+
+	for (size_t i = 0; i < count; i++) {
+		const float a = (float)counts[i][0] - o[0];
+		const float b = (float)counts[i][1] - o[1];
+		const float c = (float)counts[i][2] - o[2];
+		x[i] = roundToQ(((m[0][0] * a + m[0][1] * b) + m[0][2] * c) * q);
+		y[i] = roundToQ(((m[1][0] * a + m[1][1] * b) + m[1][2] * c) * q);
+		z[i] = roundToQ(((m[2][0] * a + m[2][1] * b) + m[2][2] * c) * q);
+	}
+}
+
+#if defined(IMU_KERNELS_NEON)
+
+#define SIMD_WIDTH 8
+#define VARIANT_NAME "NEON"
+
+/// <summary>
+///     Calibrates one half (4 samples) of a de-interleaved block.
+/// </summary>
+static inline void neonCalibrate4(int16x4_t ra, int16x4_t rb, int16x4_t rc, const imu_calibration_t *cal,
+	float32x4_t *x, float32x4_t *y, float32x4_t *z)
+{
+	const float32x4_t a = vsubq_f32(vcvtq_f32_s32(vmovl_s16(ra)), vdupq_n_f32(cal->offset[0]));
+	const float32x4_t b = vsubq_f32(vcvtq_f32_s32(vmovl_s16(rb)), vdupq_n_f32(cal->offset[1]));
+	const float32x4_t c = vsubq_f32(vcvtq_f32_s32(vmovl_s16(rc)), vdupq_n_f32(cal->offset[2]));
+	const float (*m)[3] = cal->matrix;
+
+	*x = vaddq_f32(vaddq_f32(vmulq_n_f32(a, m[0][0]), vmulq_n_f32(b, m[0][1])), vmulq_n_f32(c, m[0][2]));
+	*y = vaddq_f32(vaddq_f32(vmulq_n_f32(a, m[1][0]), vmulq_n_f32(b, m[1][1])), vmulq_n_f32(c, m[1][2]));
+	*z = vaddq_f32(vaddq_f32(vmulq_n_f32(a, m[2][0]), vmulq_n_f32(b, m[2][1])), vmulq_n_f32(c, m[2][2]));
+}
+
+static inline int32x4_t neonRoundToQ(float32x4_t value, float32x4_t q)
+{
+	const float32x4_t scaled = vmulq_f32(value, q);
+	const uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(scaled), vdupq_n_u32(0x80000000u));
+	const float32x4_t half = vreinterpretq_f32_u32(vorrq_u32(sign, vreinterpretq_u32_f32(vdupq_n_f32(0.5f))));
+	return vcvtq_s32_f32(vaddq_f32(scaled, half));
+}
+
+static size_t convertToFloatSimd(const int16_t (*counts)[3], size_t count, const imu_calibration_t *cal,
+	float *x, float *y, float *z)
+{
+	size_t i = 0;
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		// vld3 de-interleaves the xyz triples into one register per axis
+		const int16x8x3_t raw = vld3q_s16(&counts[i][0]);
+		float32x4_t vx, vy, vz;
+
+		neonCalibrate4(vget_low_s16(raw.val[0]), vget_low_s16(raw.val[1]), vget_low_s16(raw.val[2]), cal, &vx, &vy, &vz);
+		vst1q_f32(&x[i], vx);
+		vst1q_f32(&y[i], vy);
+		vst1q_f32(&z[i], vz);
+		neonCalibrate4(vget_high_s16(raw.val[0]), vget_high_s16(raw.val[1]), vget_high_s16(raw.val[2]), cal, &vx, &vy, &vz);
+		vst1q_f32(&x[i + 4], vx);
+		vst1q_f32(&y[i + 4], vy);
+		vst1q_f32(&z[i + 4], vz);
+	}
+	return i;
+}
+
+static size_t convertToQSimd(const int16_t (*counts)[3], size_t count, const imu_calibration_t *cal,
+	int fractionBits, int32_t *x, int32_t *y, int32_t *z)
+{
+	const float32x4_t q = vdupq_n_f32((float)(1 << fractionBits));
+	size_t i = 0;
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		const int16x8x3_t raw = vld3q_s16(&counts[i][0]);
+		float32x4_t vx, vy, vz;
+
+		neonCalibrate4(vget_low_s16(raw.val[0]), vget_low_s16(raw.val[1]), vget_low_s16(raw.val[2]), cal, &vx, &vy, &vz);
+		vst1q_s32(&x[i], neonRoundToQ(vx, q));
+		vst1q_s32(&y[i], neonRoundToQ(vy, q));
+		vst1q_s32(&z[i], neonRoundToQ(vz, q));
+		neonCalibrate4(vget_high_s16(raw.val[0]), vget_high_s16(raw.val[1]), vget_high_s16(raw.val[2]), cal, &vx, &vy, &vz);
+		vst1q_s32(&x[i + 4], neonRoundToQ(vx, q));
+		vst1q_s32(&y[i + 4], neonRoundToQ(vy, q));
+		vst1q_s32(&z[i + 4], neonRoundToQ(vz, q));
+	}
+	return i;
+}
+
+#elif defined(IMU_KERNELS_SSE2)
+
+#define SIMD_WIDTH 4
+#define VARIANT_NAME "SSE2"
+
+/// <summary>
+///     Gathers one axis of 4 triples and calibrates them.
+/// </summary>
+static inline void sseCalibrate4(const int16_t (*counts)[3], const imu_calibration_t *cal,
+	__m128 *x, __m128 *y, __m128 *z)
+{
+	const __m128 a = _mm_sub_ps(_mm_cvtepi32_ps(_mm_setr_epi32(counts[0][0], counts[1][0], counts[2][0], counts[3][0])),
+		_mm_set1_ps(cal->offset[0]));
+	const __m128 b = _mm_sub_ps(_mm_cvtepi32_ps(_mm_setr_epi32(counts[0][1], counts[1][1], counts[2][1], counts[3][1])),
+		_mm_set1_ps(cal->offset[1]));
+	const __m128 c = _mm_sub_ps(_mm_cvtepi32_ps(_mm_setr_epi32(counts[0][2], counts[1][2], counts[2][2], counts[3][2])),
+		_mm_set1_ps(cal->offset[2]));
+	const float (*m)[3] = cal->matrix;
+
+	*x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_set1_ps(m[0][0])), _mm_mul_ps(b, _mm_set1_ps(m[0][1]))), _mm_mul_ps(c, _mm_set1_ps(m[0][2])));
+	*y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_set1_ps(m[1][0])), _mm_mul_ps(b, _mm_set1_ps(m[1][1]))), _mm_mul_ps(c, _mm_set1_ps(m[1][2])));
+	*z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_set1_ps(m[2][0])), _mm_mul_ps(b, _mm_set1_ps(m[2][1]))), _mm_mul_ps(c, _mm_set1_ps(m[2][2])));
+}
+
+static inline __m128i sseRoundToQ(__m128 value, __m128 q)
+{
+	const __m128 scaled = _mm_mul_ps(value, q);
+	const __m128 sign = _mm_and_ps(scaled, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u)));
+	const __m128 half = _mm_or_ps(sign, _mm_set1_ps(0.5f));
+	return _mm_cvttps_epi32(_mm_add_ps(scaled, half));
+}
+
+static size_t convertToFloatSimd(const int16_t (*counts)[3], size_t count, const imu_calibration_t *cal,
+	float *x, float *y, float *z)
+{
+	size_t i = 0;
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		__m128 vx, vy, vz;
+		sseCalibrate4(&counts[i], cal, &vx, &vy, &vz);
+		_mm_storeu_ps(&x[i], vx);
+		_mm_storeu_ps(&y[i], vy);
+		_mm_storeu_ps(&z[i], vz);
+	}
+	return i;
+}
+
+static size_t convertToQSimd(const int16_t (*counts)[3], size_t count, const imu_calibration_t *cal,
+	int fractionBits, int32_t *x, int32_t *y, int32_t *z)
+{
+	const __m128 q = _mm_set1_ps((float)(1 << fractionBits));
+	size_t i = 0;
+	for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+		__m128 vx, vy, vz;
+		sseCalibrate4(&counts[i], cal, &vx, &vy, &vz);
+		_mm_storeu_si128((__m128i *)&x[i], sseRoundToQ(vx, q));
+		_mm_storeu_si128((__m128i *)&y[i], sseRoundToQ(vy, q));
+		_mm_storeu_si128((__m128i *)&z[i], sseRoundToQ(vz, q));
+	}
+	return i;
+}
+
+#else
+
+#define VARIANT_NAME "scalar"
+
+static size_t convertToFloatSimd(const int16_t (*counts)[3], size_t count, const imu_calibration_t *cal,
+	float *x, float *y, float *z)
+{
+	return 0;
+}
+
+static size_t convertToQSimd(const int16_t (*counts)[3], size_t count, const imu_calibration_t *cal,
+	int fractionBits, int32_t *x, int32_t *y, int32_t *z)
+{
+	return 0;
+}
+
+#endif
+
+void ImuKernels_ConvertToFloat(const int16_t (*counts)[3], size_t count, const imu_calibration_t *calibration,
+	float *x, float *y, float *z)
+{
+	size_t done = useReference ? 0 : convertToFloatSimd(counts, count, calibration, x, y, z);
+
+	// The tail that doesn't fill a vector
+	ImuKernels_ConvertToFloatReference(&counts[done], count - done, calibration, &x[done], &y[done], &z[done]);
+}
+
+void ImuKernels_ConvertToQ(const int16_t (*counts)[3], size_t count, const imu_calibration_t *calibration,
+	int fractionBits, int32_t *x, int32_t *y, int32_t *z)
+{
+	size_t done = useReference ? 0 : convertToQSimd(counts, count, calibration, fractionBits, x, y, z);
+
+	ImuKernels_ConvertToQReference(&counts[done], count - done, calibration, fractionBits, &x[done], &y[done], &z[done]);
+}
+
+const char *ImuKernels_GetVariantName(void)
+{
+	return useReference ? "scalar" : VARIANT_NAME;
+}
+
+#define SELF_TEST_SAMPLES 67   // Not a multiple of any vector width, so the tail is covered
+#define SELF_TEST_Q_BITS 8
+
+int ImuKernels_SelfTest(void)
+{
+	static int16_t counts[SELF_TEST_SAMPLES][3];
+	static float simd[3][SELF_TEST_SAMPLES], reference[3][SELF_TEST_SAMPLES];
+	static int32_t simdQ[3][SELF_TEST_SAMPLES], referenceQ[3][SELF_TEST_SAMPLES];
+	imu_calibration_t cal;
+	uint32_t seed = 0x1234567u;
+
+	// Full scale counts including the extremes, a gyro-like gain and some cross-axis terms
+	for (int i = 0; i < SELF_TEST_SAMPLES; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			seed = seed * 1664525u + 1013904223u;
+			counts[i][axis] = (int16_t)(seed >> 16);
+		}
+	}
+	counts[0][0] = INT16_MIN;
+	counts[1][1] = INT16_MAX;
+	ImuKernels_SetIdentity(&cal, 0.00122173f);
+	cal.offset[0] = -12.5f;
+	cal.offset[1] = 3.25f;
+	cal.offset[2] = 40.0f;
+	cal.matrix[0][1] = 0.00001f;
+	cal.matrix[1][2] = -0.00002f;
+	cal.matrix[2][0] = 0.000015f;
+
+	useReference = false;
+	ImuKernels_ConvertToFloat(counts, SELF_TEST_SAMPLES, &cal, simd[0], simd[1], simd[2]);
+	ImuKernels_ConvertToFloatReference(counts, SELF_TEST_SAMPLES, &cal, reference[0], reference[1], reference[2]);
+	ImuKernels_ConvertToQ(counts, SELF_TEST_SAMPLES, &cal, SELF_TEST_Q_BITS, simdQ[0], simdQ[1], simdQ[2]);
+	ImuKernels_ConvertToQReference(counts, SELF_TEST_SAMPLES, &cal, SELF_TEST_Q_BITS, referenceQ[0], referenceQ[1], referenceQ[2]);
+
+	// Floats may differ in the last bit if the compiler fused the scalar multiply-adds, which
+	// can move a fixed point result across a rounding boundary by one step
+	float worstError = 0.0f;
+	int32_t worstQError = 0;
+	int bitExact = 1;
+	for (int axis = 0; axis < 3; axis++) {
+		for (int i = 0; i < SELF_TEST_SAMPLES; i++) {
+			float error = fabsf(simd[axis][i] - reference[axis][i]) / fmaxf(fabsf(reference[axis][i]), 1e-3f);
+			int32_t qError = abs(simdQ[axis][i] - referenceQ[axis][i]);
+			worstError = fmaxf(worstError, error);
+			worstQError = (qError > worstQError) ? qError : worstQError;
+			bitExact &= (simd[axis][i] == reference[axis][i]) && qError == 0;
+		}
+	}
+
+	if (worstError > 1e-6f || worstQError > 1) {
+		Log_Debug("ERROR: %s IMU kernels differ from the reference (%g relative, %d LSB), using scalar\n",
+			VARIANT_NAME, worstError, (int)worstQError);
+		useReference = true;
+		return -1;
+	}
+
+	Log_Debug("INFO: %s IMU kernels match the reference %s\n", VARIANT_NAME, bitExact ? "bit for bit" : "within rounding");
+	return 0;
+}
@@ -0,0 +1,58 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Calibration of a 3 axis sensor: value = matrix * (counts - offset).  The matrix holds the
+///     per-axis gain (sensitivity and unit conversion) on its diagonal and the cross-axis
+///     (misalignment) terms off it.
+/// </summary>
+typedef struct {
+	float offset[3];
+	float matrix[3][3];
+} imu_calibration_t;
+
+/// <summary>
+///     Sets a calibration with no offset, no cross-axis terms and the same gain on every axis.
+/// </summary>
+void ImuKernels_SetIdentity(imu_calibration_t *calibration, float gain);
+
+/// <summary>
+///     Converts interleaved int16 xyz triples to calibrated floats, one array per axis.
+/// </summary>
+/// <param name="counts">count triples as read from the sensor or FIFO</param>
+/// <param name="x">count outputs for the x axis, likewise y and z</param>
+void ImuKernels_ConvertToFloat(const int16_t (*counts)[3], size_t count, const imu_calibration_t *calibration,
+	float *x, float *y, float *z);
+
+/// <summary>
+///     Converts interleaved int16 xyz triples to calibrated fixed point values with fractionBits
+///     fraction bits, rounded to nearest, one array per axis.  The caller picks fractionBits so
+///     the result fits in 31 bits.
+/// </summary>
+void ImuKernels_ConvertToQ(const int16_t (*counts)[3], size_t count, const imu_calibration_t *calibration,
+	int fractionBits, int32_t *x, int32_t *y, int32_t *z);
+
+/// <summary>
+///     Scalar reference versions of the conversions, which the SIMD versions are checked against.
+/// </summary>
+void ImuKernels_ConvertToFloatReference(const int16_t (*counts)[3], size_t count,
+	const imu_calibration_t *calibration, float *x, float *y, float *z);
+void ImuKernels_ConvertToQReference(const int16_t (*counts)[3], size_t count,
+	const imu_calibration_t *calibration, int fractionBits, int32_t *x, int32_t *y, int32_t *z);
+
+/// <summary>
+///     Name of the variant ImuKernels_ConvertToFloat() and ImuKernels_ConvertToQ() use.
+/// </summary>
+const char *ImuKernels_GetVariantName(void);
+
+/// <summary>
+///     Runs the SIMD variant against the scalar reference on a synthetic batch.  If they
+///     disagree by more than rounding the library falls back to the reference.
+/// </summary>
+/// <returns>0 if the variants match, -1 if the library fell back to the reference</returns>
+int ImuKernels_SelfTest(void);
@@ -304,6 +304,22 @@ static void TerminationHandler(int signalNumber)
     terminationRequired = true;
 }
 
+/// <summary>
+///     Sends a button message formatted into a reserved buffer, or gives the buffer back if
+///     it didn't fit.
+/// </summary>
+static void sendButtonMessage(char *buffer, int length, size_t size)
+{
+	if (length > 0 && (size_t)length < size) {
+		Log_Debug("\n[Info] Sending telemetry %s\n", buffer);
+		AzureIoT_CommitMessage(buffer, (size_t)length);
+	}
+	else {
+		Log_Debug("ERROR: button message does not fit in %zu bytes\n", size);
+		AzureIoT_CancelMessage(buffer);
+	}
+}
+
 /// <summary>
 ///     Handle button timer event: if the button is pressed, report the event to the IoT Hub.
 /// </summary>
@@ -372,32 +388,28 @@ static void ButtonTimerEventHandler(EventData *eventData)
 	// If either button was pressed, then enter the code to send the telemetry message
 	if (sendTelemetryButtonA || sendTelemetryButtonB) {
 
-		char *pjsonBuffer = (char *)malloc(JSON_BUFFER_SIZE);
-		if (pjsonBuffer == NULL) {
-			Log_Debug("ERROR: not enough memory to send telemetry");
-		}
+		// Each message is formatted straight into a message buffer.  Button presses are events,
+		// so they take the event lane with the other state changes rather than queue behind telemetry.
+		size_t size;
+		char *pjsonBuffer;
 
-		if (sendTelemetryButtonA) {
+		if (sendTelemetryButtonA && (pjsonBuffer = AzureIoT_ReserveLaneMessage(SEND_LANE_EVENT, &size)) != NULL) {
 			// construct the telemetry message  for Button A
-			snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrButtonTelemetryJson, "buttonA", newButtonAState);
-			Log_Debug("\n[Info] Sending telemetry %s\n", pjsonBuffer);
-			AzureIoT_SendMessage(pjsonBuffer);
+			int length = snprintf(pjsonBuffer, size, cstrButtonTelemetryJson, "buttonA", newButtonAState);
+			sendButtonMessage(pjsonBuffer, length, size);
+		}
 
+		if (sendTelemetryButtonA && (pjsonBuffer = AzureIoT_ReserveLaneMessage(SEND_LANE_EVENT, &size)) != NULL) {
 			//Sean's test of sending data to Azure
-			snprintf(pjsonBuffer, JSON_BUFFER_SIZE, "{\"%s\":\"%d\"}", "speeder", 55);
-		
-			Log_Debug("\n[Info] Sending speeder %s\n", pjsonBuffer);
-			AzureIoT_SendMessage(pjsonBuffer);
+			int length = snprintf(pjsonBuffer, size, "{\"%s\":\"%d\"}", "speeder", 55);
+			sendButtonMessage(pjsonBuffer, length, size);
 		}
 
-		if (sendTelemetryButtonB) {
+		if (sendTelemetryButtonB && (pjsonBuffer = AzureIoT_ReserveLaneMessage(SEND_LANE_EVENT, &size)) != NULL) {
 			// construct the telemetry message for Button B
-			snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrButtonTelemetryJson, "buttonB", newButtonBState);
-			Log_Debug("\n[Info] Sending telemetry %s\n", pjsonBuffer);
-			AzureIoT_SendMessage(pjsonBuffer);
+			int length = snprintf(pjsonBuffer, size, cstrButtonTelemetryJson, "buttonB", newButtonBState);
+			sendButtonMessage(pjsonBuffer, length, size);
 		}
-
-		free(pjsonBuffer);
 	}
 
 }
@@ -469,6 +481,9 @@ static int InitPeripheralsAndHandlers(void)
 	// Tell the system about the callback function that gets called when we receive a device twin update message from Azure
 	AzureIoT_SetDeviceTwinUpdateCallback(&deviceTwinChangedHandler);
 
+	// Waveform capture and retrieval for diagnostics, on request
+	AzureIoT_SetDirectMethodCallback(&acquisitionDirectMethodHandler);
+
     return 0;
 }
 
@@ -581,6 +596,9 @@ int main(int argc, char *argv[])
 #endif
     }
 
+#if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+	AzureIoT_DestroyClient();
+#endif
     ClosePeripheralsAndHandlers();
     Log_Debug("Application exiting.\n");
     return 0;
@@ -492,6 +492,9 @@ void update_environ(float temp1, float temp2, float atm)
 	// Draw the units of atm
 	sd1306_draw_string(sizeof(str_atm) * 6 + (get_str_size(string_data) + 1) * 6, OLED_LINE_3_Y, "hPa", FONT_SIZE_LINE, white_pixel);
 
+	// Pressure altitude in meters, only worked out when this screen is shown
+	altitude = 44330 * (1 - powf((atm / 1013.25f), 1 / 5.255f));
+
 	// Convert altitude value to string
 	ftoa(altitude*3.2808399, string_data, 2);
 
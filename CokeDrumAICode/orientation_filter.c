@@ -0,0 +1,241 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "orientation_filter.h"
+
+#define RAD_TO_DEG 57.29577951f
+
+// Only trust the accelerometer as a gravity reference when the drum isn't being shaken
+#define ACCEL_NORM_MIN 0.85f
+#define ACCEL_NORM_MAX 1.15f
+
+void Orientation_Init(orientation_filter_t *filter, float kp, float ki)
+{
+	memset(filter, 0, sizeof(*filter));
+	filter->q[0] = 1.0f;
+	filter->kp = kp;
+	filter->ki = ki;
+	filter->currentBin = -1;
+}
+
+void Orientation_SetTemperature(orientation_filter_t *filter, float temperature_degC)
+{
+	int bin = (int)floorf((temperature_degC - ORIENTATION_TEMP_BIN_MIN_DEGC) / ORIENTATION_TEMP_BIN_WIDTH_DEGC);
+	if (bin < 0) {
+		bin = 0;
+	}
+	else if (bin >= ORIENTATION_TEMP_BINS) {
+		bin = ORIENTATION_TEMP_BINS - 1;
+	}
+
+	if (bin == filter->currentBin) {
+		return;
+	}
+
+	// Remember what we learned at the old temperature
+	if (filter->currentBin >= 0) {
+		memcpy(filter->binFeedback[filter->currentBin], filter->integralFeedback, sizeof(filter->integralFeedback));
+		filter->binValid[filter->currentBin] = true;
+	}
+
+	// If we've been at this temperature before, start from that estimate instead of
+	// waiting for the integrator to walk over to it.
+	if (filter->binValid[bin]) {
+		memcpy(filter->integralFeedback, filter->binFeedback[bin], sizeof(filter->integralFeedback));
+	}
+
+	filter->currentBin = bin;
+}
+
+void Orientation_UpdateBatch(orientation_filter_t *filter, const float *const gyro_rps[3],
+	const float *const accel_g[3], size_t count, float dt)
+{
+	float q0 = filter->q[0], q1 = filter->q[1], q2 = filter->q[2], q3 = filter->q[3];
+	const float twoKp = 2.0f * filter->kp;
+	const float twoKiDt = 2.0f * filter->ki * dt;
+	const float halfDt = 0.5f * dt;
+
+	for (size_t i = 0; i < count; i++) {
+		float gx = gyro_rps[0][i], gy = gyro_rps[1][i], gz = gyro_rps[2][i];
+		float ax = accel_g[0][i], ay = accel_g[1][i], az = accel_g[2][i];
+
+		float norm = sqrtf(ax * ax + ay * ay + az * az);
+
+		if (norm > ACCEL_NORM_MIN && norm < ACCEL_NORM_MAX) {
+			ax /= norm;
+			ay /= norm;
+			az /= norm;
+
+			// Gravity direction predicted by the current attitude
+			float vx = q1 * q3 - q0 * q2;
+			float vy = q0 * q1 + q2 * q3;
+			float vz = q0 * q0 - 0.5f + q3 * q3;
+
+			// Error is the cross product between measured and predicted gravity
+			float ex = ay * vz - az * vy;
+			float ey = az * vx - ax * vz;
+			float ez = ax * vy - ay * vx;
+
+			if (filter->ki > 0.0f) {
+				filter->integralFeedback[0] += twoKiDt * ex;
+				filter->integralFeedback[1] += twoKiDt * ey;
+				filter->integralFeedback[2] += twoKiDt * ez;
+			}
+
+			gx += twoKp * ex;
+			gy += twoKp * ey;
+			gz += twoKp * ez;
+		}
+
+		gx += filter->integralFeedback[0];
+		gy += filter->integralFeedback[1];
+		gz += filter->integralFeedback[2];
+
+		// Integrate the rate of change of the quaternion
+		gx *= halfDt;
+		gy *= halfDt;
+		gz *= halfDt;
+		float qa = q0, qb = q1, qc = q2;
+		q0 += -qb * gx - qc * gy - q3 * gz;
+		q1 += qa * gx + qc * gz - q3 * gy;
+		q2 += qa * gy - qb * gz + q3 * gx;
+		q3 += qa * gz + qb * gy - qc * gx;
+
+		float recipNorm = 1.0f / sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+		q0 *= recipNorm;
+		q1 *= recipNorm;
+		q2 *= recipNorm;
+		q3 *= recipNorm;
+	}
+
+	filter->q[0] = q0;
+	filter->q[1] = q1;
+	filter->q[2] = q2;
+	filter->q[3] = q3;
+	filter->updates += (uint32_t)count;
+}
+
+void Orientation_GetTilt(const orientation_filter_t *filter, float *tilt_deg, float *roll_deg,
+	float *pitch_deg)
+{
+	const float q0 = filter->q[0], q1 = filter->q[1], q2 = filter->q[2], q3 = filter->q[3];
+
+	// Z component of the world vertical expressed in the sensor frame
+	float vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+	if (vz > 1.0f) {
+		vz = 1.0f;
+	}
+	else if (vz < -1.0f) {
+		vz = -1.0f;
+	}
+
+	float sinPitch = 2.0f * (q0 * q2 - q3 * q1);
+	if (sinPitch > 1.0f) {
+		sinPitch = 1.0f;
+	}
+	else if (sinPitch < -1.0f) {
+		sinPitch = -1.0f;
+	}
+
+	*tilt_deg = acosf(vz) * RAD_TO_DEG;
+	*roll_deg = atan2f(2.0f * (q0 * q1 + q2 * q3), 1.0f - 2.0f * (q1 * q1 + q2 * q2)) * RAD_TO_DEG;
+	*pitch_deg = asinf(sinPitch) * RAD_TO_DEG;
+}
+
+void Orientation_GetGyroBias(const orientation_filter_t *filter, float bias_dps[3])
+{
+	for (int axis = 0; axis < 3; axis++) {
+		bias_dps[axis] = -filter->integralFeedback[axis] * RAD_TO_DEG;
+	}
+}
+
+#define BENCHMARK_BATCH 64
+#define BENCHMARK_SETTLE_SECONDS 30.0f
+#define BENCHMARK_ROCK_DEG 10.0f
+#define BENCHMARK_ROCK_HZ 0.2f
+#define BENCHMARK_GYRO_NOISE_DPS 0.1f
+#define BENCHMARK_ACCEL_NOISE_G 0.02f
+
+/// <summary>
+///     Roughly normal noise of unit deviation, the sum of four uniforms, from a fixed seed so
+///     every run replays the same trace.
+/// </summary>
+static float benchmarkNoise(uint32_t *seed)
+{
+	float sum = 0.0f;
+	for (int i = 0; i < 4; i++) {
+		*seed = *seed * 1664525u + 1013904223u;
+		sum += (float)(*seed >> 8) / 16777216.0f;
+	}
+	return (sum - 2.0f) * 1.7320508f;
+}
+
+void Orientation_RunBenchmark(size_t sampleCount, float odr_hz, float kp, float ki, orientation_benchmark_t *result)
+{
+	static float gyro[3][BENCHMARK_BATCH];
+	static float accel[3][BENCHMARK_BATCH];
+	static float roll_rad[BENCHMARK_BATCH];
+	const float *const gyroAxes[3] = { gyro[0], gyro[1], gyro[2] };
+	const float *const accelAxes[3] = { accel[0], accel[1], accel[2] };
+	static const float trueBias_dps[3] = { 0.8f, -0.5f, 0.3f };
+	const float dt = 1.0f / odr_hz;
+	const float amplitude_rad = BENCHMARK_ROCK_DEG / RAD_TO_DEG;
+	const float omega_rps = 6.2831853f * BENCHMARK_ROCK_HZ;
+
+	orientation_filter_t filter;
+	Orientation_Init(&filter, kp, ki);
+
+	uint32_t seed = 12345;
+	uint64_t nanoseconds = 0;
+	double squaredError = 0.0;
+	size_t scored = 0;
+	float maxError_deg = 0.0f;
+
+	for (size_t done = 0; done < sampleCount; done += BENCHMARK_BATCH) {
+		const size_t n = (sampleCount - done < BENCHMARK_BATCH) ? sampleCount - done : BENCHMARK_BATCH;
+
+		// The drum rocks about X: roll(t) = A sin(wt), so the X rate is its derivative and
+		// gravity in the sensor frame is (0, sin(roll), cos(roll))
+		for (size_t i = 0; i < n; i++) {
+			const float t = (float)(done + i) * dt;
+			roll_rad[i] = amplitude_rad * sinf(omega_rps * t);
+			const float rollRate_rps = amplitude_rad * omega_rps * cosf(omega_rps * t);
+			for (int axis = 0; axis < 3; axis++) {
+				gyro[axis][i] = ((axis == 0) ? rollRate_rps : 0.0f) +
+					(trueBias_dps[axis] + BENCHMARK_GYRO_NOISE_DPS * benchmarkNoise(&seed)) / RAD_TO_DEG;
+			}
+			accel[0][i] = BENCHMARK_ACCEL_NOISE_G * benchmarkNoise(&seed);
+			accel[1][i] = sinf(roll_rad[i]) + BENCHMARK_ACCEL_NOISE_G * benchmarkNoise(&seed);
+			accel[2][i] = cosf(roll_rad[i]) + BENCHMARK_ACCEL_NOISE_G * benchmarkNoise(&seed);
+		}
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		Orientation_UpdateBatch(&filter, gyroAxes, accelAxes, n, dt);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		nanoseconds += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ull + (uint64_t)(end.tv_nsec - start.tv_nsec);
+
+		// Tilt is only checked at the end of each batch, as the acquisition loop reads it
+		if ((float)(done + n) * dt >= BENCHMARK_SETTLE_SECONDS) {
+			float tilt_deg, roll_deg, pitch_deg;
+			Orientation_GetTilt(&filter, &tilt_deg, &roll_deg, &pitch_deg);
+			const float error_deg = fabsf(tilt_deg - fabsf(roll_rad[n - 1]) * RAD_TO_DEG);
+			squaredError += (double)error_deg * error_deg;
+			scored++;
+			if (error_deg > maxError_deg) {
+				maxError_deg = error_deg;
+			}
+		}
+	}
+
+	result->samples = sampleCount;
+	result->updatesPerSecond = (nanoseconds > 0) ? (double)sampleCount * 1e9 / (double)nanoseconds : 0.0;
+	result->tiltRmsError_deg = (scored > 0) ? (float)sqrt(squaredError / (double)scored) : 0.0f;
+	result->tiltMaxError_deg = maxError_deg;
+	Orientation_GetGyroBias(&filter, result->bias_dps);
+	memcpy(result->trueBias_dps, trueBias_dps, sizeof(trueBias_dps));
+}
@@ -0,0 +1,82 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The gyro bias estimate is remembered per temperature bin so it can be restored immediately
+// when the drum skin heats up or cools down through a range we've already seen.
+#define ORIENTATION_TEMP_BIN_MIN_DEGC   -20.0f
+#define ORIENTATION_TEMP_BIN_WIDTH_DEGC 2.0f
+#define ORIENTATION_TEMP_BINS           60
+
+/// <summary>
+///     Mahony complementary filter state.  The integral feedback term is the online gyro bias
+///     estimate.
+/// </summary>
+typedef struct {
+	float q[4];                      // Attitude quaternion w, x, y, z
+	float kp;                        // Proportional gain on the accelerometer error
+	float ki;                        // Integral gain, i.e. how fast the gyro bias is learned
+	float integralFeedback[3];       // rad/s, the negative of the gyro bias
+	float binFeedback[ORIENTATION_TEMP_BINS][3];
+	bool binValid[ORIENTATION_TEMP_BINS];
+	int currentBin;
+	uint32_t updates;
+} orientation_filter_t;
+
+/// <summary>
+///     Initializes the filter to the level attitude with no bias estimate.
+/// </summary>
+void Orientation_Init(orientation_filter_t *filter, float kp, float ki);
+
+/// <summary>
+///     Tells the filter the current gyro die temperature.  When it moves into another bin the
+///     bias learned for the old bin is saved and the one for the new bin, if any, is restored.
+/// </summary>
+void Orientation_SetTemperature(orientation_filter_t *filter, float temperature_degC);
+
+/// <summary>
+///     Runs the filter over a batch of IMU samples taken at a fixed rate.
+/// </summary>
+/// <param name="gyro_rps">x, y and z arrays of count angular rate samples in rad/s</param>
+/// <param name="accel_g">x, y and z arrays of count acceleration samples in g</param>
+/// <param name="count">Number of samples in the batch</param>
+/// <param name="dt">Sample period in seconds</param>
+void Orientation_UpdateBatch(orientation_filter_t *filter, const float *const gyro_rps[3],
+	const float *const accel_g[3], size_t count, float dt);
+
+/// <summary>
+///     Returns the drum tilt (angle between the sensor Z axis and vertical) plus roll and pitch.
+/// </summary>
+void Orientation_GetTilt(const orientation_filter_t *filter, float *tilt_deg, float *roll_deg,
+	float *pitch_deg);
+
+/// <summary>
+///     Returns the current gyro bias estimate in degrees per second.
+/// </summary>
+void Orientation_GetGyroBias(const orientation_filter_t *filter, float bias_dps[3]);
+
+/// <summary>
+///     What Orientation_RunBenchmark() measured.
+/// </summary>
+typedef struct {
+	size_t samples;
+	double updatesPerSecond;
+	float tiltRmsError_deg;          // Against the trace, once the filter has settled
+	float tiltMaxError_deg;
+	float bias_dps[3];               // Learned by the end of the trace
+	float trueBias_dps[3];           // Put into the trace.  Gravity says nothing about Z, so its bias isn't learned.
+} orientation_benchmark_t;
+
+/// <summary>
+///     Replays a synthetic trace through Orientation_UpdateBatch() in FIFO sized batches and
+///     times it: the drum rocking about X, a fixed gyro bias and noise on both sensors.  Only
+///     the filter's own time is counted.  It needs nothing but the C library, so it can be
+///     built and run on a development machine too.
+/// </summary>
+/// <param name="odr_hz">Sample rate of the trace</param>
+void Orientation_RunBenchmark(size_t sampleCount, float odr_hz, float kp, float ki, orientation_benchmark_t *result);
@@ -0,0 +1,248 @@
+# Copyright (c) Sean J. Miller
+# Licensed under the MIT License.
+
+"""Trains the window record autoencoder and writes it as models/anomaly.bin.
+
+The device scores every window record with the int8 autoencoder in anomaly_model.c.  This
+script learns one from window records recorded while the drum ran normally.  To collect them,
+run the application without a model, so it sends every full window record.  Then export the
+message bodies from the hub as JSON lines, one record per line.  Lines that wrap the record in a
+"body" member, as IoT Hub message routing to storage does, are unwrapped.
+
+    python make_anomaly_model.py windows.jsonl [more.jsonl ...] --out ../models/anomaly.bin
+
+Windows at or above the threshold are sent in full; the rest are reduced to their score.  The
+threshold is the --percentile of the training scores times --margin.  The script prints the
+resulting fraction of normal windows that would still be sent.
+
+The file layout is documented at the top of anomaly_model.c.  Quantization follows the kernel
+there: inputs are scaled to int8 around their training mean, weights are symmetric int8 per
+layer, and each layer's outputScale takes the int32 accumulator to the next layer's int8 units.
+For the last layer it takes it to the quantized input units.  Scores printed here are worked out
+the way the device works them out, so they match its log.
+
+Needs Python 3 and numpy.
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+import numpy as np
+
+MODEL_MAGIC = b"CDAI"
+MODEL_VERSION = 1
+ROW_ALIGN = 16                     # ANOMALY_ROW_ALIGN
+MAX_LAYERS = 8                     # ANOMALY_MAX_LAYERS
+ACTIVATION_NONE = 0
+ACTIVATION_RELU = 1
+
+# Per channel, in the order AnomalyModel_ExtractFeatures() takes them
+STATS = ["mean", "rms", "var", "skew", "kurt", "crest", "p2p", "min", "max"]
+
+SOURCE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+
+def channel_keys():
+    """The JSON key of each channel, read from sensorChannelKeys in sensor_stats.c."""
+    with open(os.path.join(SOURCE_DIR, "sensor_stats.c"), encoding="utf-8") as source:
+        text = source.read()
+    table = re.search(r"sensorChannelKeys\[SENSOR_CHANNEL_COUNT\]\s*=\s*\{(.*?)\};", text, re.S)
+    if table is None:
+        sys.exit("sensorChannelKeys not found in sensor_stats.c")
+    return re.findall(r'=\s*"(\w+)"', table.group(1))
+
+
+def load_windows(paths, keys):
+    names = ["%s_%s" % (key, stat) for key in keys for stat in STATS]
+    rows = []
+    skipped = 0
+    for path in paths:
+        with open(path, encoding="utf-8") as lines:
+            for line in lines:
+                line = line.strip()
+                if not line:
+                    continue
+                record = json.loads(line)
+                if isinstance(record.get("body"), dict):
+                    record = record["body"]
+                # Score-only and other messages don't carry the full record
+                if not all(name in record for name in names):
+                    skipped += 1
+                    continue
+                rows.append([float(record[name]) for name in names])
+    if not rows:
+        sys.exit("no full window records found")
+    print("%d window records, %d other messages skipped" % (len(rows), skipped))
+    return np.array(rows, dtype=np.float64)
+
+
+def round_half_away(x):
+    """lroundf()"""
+    return np.sign(x) * np.floor(np.abs(x) + 0.5)
+
+
+def saturate_int8(x):
+    return np.clip(round_half_away(x), -127, 127)
+
+
+def train(x, sizes, epochs, rate, seed):
+    """Float autoencoder on x (inputs already in int8 units / 127), ReLU between layers."""
+    rng = np.random.default_rng(seed)
+    weights = [rng.normal(0.0, np.sqrt(2.0 / n_in), (n_out, n_in)) for n_in, n_out in zip(sizes, sizes[1:])]
+    biases = [np.zeros(n_out) for n_out in sizes[1:]]
+    moments = [[np.zeros_like(p), np.zeros_like(p)] for p in weights + biases]
+    step = 0
+    batch = 64
+
+    for epoch in range(epochs):
+        order = rng.permutation(len(x))
+        for start in range(0, len(x), batch):
+            xb = x[order[start:start + batch]]
+            outputs = [xb]
+            for layer, (w, b) in enumerate(zip(weights, biases)):
+                z = outputs[-1] @ w.T + b
+                outputs.append(z if layer == len(weights) - 1 else np.maximum(z, 0.0))
+
+            grad = 2.0 * (outputs[-1] - xb) / xb.shape[1] / len(xb)
+            grads_w, grads_b = [None] * len(weights), [None] * len(weights)
+            for layer in reversed(range(len(weights))):
+                if layer != len(weights) - 1:
+                    grad = grad * (outputs[layer + 1] > 0.0)
+                grads_w[layer] = grad.T @ outputs[layer]
+                grads_b[layer] = grad.sum(axis=0)
+                grad = grad @ weights[layer]
+
+            # Adam
+            step += 1
+            for p, g, m in zip(weights + biases, grads_w + grads_b, moments):
+                m[0] = 0.9 * m[0] + 0.1 * g
+                m[1] = 0.999 * m[1] + 0.001 * g * g
+                p -= rate * (m[0] / (1 - 0.9 ** step)) / (np.sqrt(m[1] / (1 - 0.999 ** step)) + 1e-8)
+
+        if epoch % 20 == 0 or epoch == epochs - 1:
+            loss = np.mean((forward_float(x, weights, biases) - x) ** 2)
+            print("epoch %d, loss %.6f" % (epoch, loss))
+    return weights, biases
+
+
+def forward_float(x, weights, biases):
+    for layer, (w, b) in enumerate(zip(weights, biases)):
+        x = x @ w.T + b
+        if layer != len(weights) - 1:
+            x = np.maximum(x, 0.0)
+    return x
+
+
+def quantize(q_train, weights, biases):
+    """int8 layers as the device runs them: (weights, bias, outputScale, activation) each."""
+    layers = []
+    x = q_train                    # int8 units of the layer's input
+    in_scale = 127.0               # int8 units per float unit, the float net was trained on q / 127
+    for layer, (w, b) in enumerate(zip(weights, biases)):
+        last = layer == len(weights) - 1
+        weight_scale = 127.0 / max(np.max(np.abs(w)), 1e-12)
+        w_q = round_half_away(w * weight_scale)
+        b_q = np.clip(round_half_away(b * weight_scale * in_scale), -2**31, 2**31 - 1)
+        acc = x @ w_q.T + b_q
+
+        if last:
+            # Straight to quantized input units
+            out_scale = 127.0
+        else:
+            # Headroom for the largest activation seen, bar outliers
+            peak = np.percentile(np.maximum(acc / (weight_scale * in_scale), 0.0), 99.9)
+            out_scale = 127.0 / max(peak, 1e-6)
+        output_scale = np.float32(out_scale / (weight_scale * in_scale))
+        activation = ACTIVATION_NONE if last else ACTIVATION_RELU
+        layers.append((w_q.astype(np.int8), b_q.astype(np.int32), output_scale, activation))
+
+        if not last:
+            x = saturate_int8(np.maximum(acc.astype(np.float32) * output_scale, 0.0))
+            in_scale = out_scale
+    return layers
+
+
+def quantize_inputs(features, offset, inv_scale):
+    return saturate_int8((features.astype(np.float32) - offset) * inv_scale)
+
+
+def score(q, layers):
+    """AnomalyModel_Score() on quantized inputs."""
+    x = q
+    for w_q, b_q, output_scale, activation in layers[:-1]:
+        acc = x @ w_q.astype(np.int64).T + b_q
+        value = acc.astype(np.float32) * output_scale
+        if activation == ACTIVATION_RELU:
+            value = np.maximum(value, 0.0)
+        x = saturate_int8(value)
+    w_q, b_q, output_scale, _ = layers[-1]
+    acc = x @ w_q.astype(np.int64).T + b_q
+    diff = acc.astype(np.float32) * output_scale - q.astype(np.float32)
+    return np.mean(diff * diff, axis=1)
+
+
+def write_model(path, offset, inv_scale, layers, threshold):
+    n = len(offset)
+    with open(path, "wb") as out:
+        out.write(struct.pack("<4sHHHHf", MODEL_MAGIC, MODEL_VERSION, n, len(layers), 0, threshold))
+        out.write(offset.astype("<f4").tobytes())
+        out.write(inv_scale.astype("<f4").tobytes())
+        for w_q, b_q, output_scale, activation in layers:
+            out_count, in_count = w_q.shape
+            stride = (in_count + ROW_ALIGN - 1) // ROW_ALIGN * ROW_ALIGN
+            padded = np.zeros((out_count, stride), dtype=np.int8)
+            padded[:, :in_count] = w_q
+            out.write(struct.pack("<HHB3xf", in_count, out_count, activation, float(output_scale)))
+            out.write(padded.tobytes())
+            out.write(b_q.astype("<i4").tobytes())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("records", nargs="+", help="JSON lines files of window records")
+    parser.add_argument("--out", default=os.path.join(SOURCE_DIR, "models", "anomaly.bin"))
+    parser.add_argument("--hidden", default="32,8,32", help="hidden layer sizes, comma separated")
+    parser.add_argument("--epochs", type=int, default=200)
+    parser.add_argument("--rate", type=float, default=1e-3, help="Adam learning rate")
+    parser.add_argument("--percentile", type=float, default=99.5,
+                        help="training score percentile the threshold starts from")
+    parser.add_argument("--margin", type=float, default=1.5, help="threshold multiplier on the percentile")
+    parser.add_argument("--sigmas", type=float, default=4.0,
+                        help="standard deviations of a feature that fill the int8 range")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    keys = channel_keys()
+    features = load_windows(args.records, keys)
+    hidden = [int(size) for size in args.hidden.split(",") if size]
+    sizes = [features.shape[1]] + hidden + [features.shape[1]]
+    if len(sizes) - 1 > MAX_LAYERS:
+        sys.exit("at most %d layers" % MAX_LAYERS)
+
+    # A constant feature (a sensor that isn't fitted) gets a zero scale and drops out
+    offset = features.mean(axis=0).astype(np.float32)
+    std = features.std(axis=0)
+    inv_scale = np.where(std > 1e-9, 127.0 / (args.sigmas * np.maximum(std, 1e-9)), 0.0).astype(np.float32)
+    q = quantize_inputs(features, offset, inv_scale)
+
+    weights, biases = train(q / 127.0, sizes, args.epochs, args.rate, args.seed)
+    layers = quantize(q, weights, biases)
+
+    scores = score(q, layers)
+    threshold = float(np.percentile(scores, args.percentile) * args.margin)
+    print("scores: median %.3f, p99 %.3f, max %.3f; threshold %.3f sends %.2f%% of these windows"
+          % (np.median(scores), np.percentile(scores, 99), scores.max(), threshold,
+             100.0 * np.mean(scores >= threshold)))
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.out)), exist_ok=True)
+    write_model(args.out, offset, inv_scale, layers, threshold)
+    weight_bytes = sum(w.shape[0] * ((w.shape[1] + ROW_ALIGN - 1) // ROW_ALIGN * ROW_ALIGN) for w, _, _, _ in layers)
+    print("wrote %s, %d bytes (%d of weights)" % (args.out, os.path.getsize(args.out), weight_bytes))
+
+
+if __name__ == "__main__":
+    main()
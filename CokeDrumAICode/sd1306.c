@@ -49,6 +49,29 @@ int32_t sd1306_send_command(uint8_t addr, uint8_t cmd)
 	return retval;
 }
 
+/**
+  * @brief  Send a stream of commands to sd1306 in one I2C transaction.
+  * @param  addr: address of device
+  * @param  cmds: commands to send
+  * @param  len: number of command bytes, at most 63
+  * @retval retval: negative if was unsuccefully, positive if was succefully
+  */
+int32_t sd1306_send_commands(uint8_t addr, const uint8_t *cmds, uint8_t len)
+{
+	uint8_t data_to_send[64];
+
+	if (len > sizeof(data_to_send) - 1)
+	{
+		return -1;
+	}
+
+	// With the continuation bit clear every following byte is a command
+	data_to_send[0] = 0x00;
+	memcpy(&data_to_send[1], cmds, len);
+
+	return I2CMaster_Write(i2cFd, addr, data_to_send, len + 1u);
+}
+
 /**
   * @brief  Send data to sd1306 RAM.
   * @param  addr: address of device
@@ -81,82 +104,59 @@ int32_t sd1306_write_data(uint8_t addr, uint8_t *data)
   */
 uint8_t sd1306_init(void)
 {
+	// Everything after the display off command, sent as one command stream
+	static const uint8_t init_commands[] =
+	{
+		// Set display oscillator freqeuncy and divide ratio
+		0xd5, 0x50,
+		// Set multiplex ratio
+		0xa8, 0x3f,
+		// Set display start line
+		0xd3, 0x00,
+		// Set the lower and higher comulmn address
+		0x00, 0x10,
+		// Set page address
+		0xb0,
+		// Charge pump
+		0x8d, 0x14,
+		// Memory mode
+		0x20, 0x00,
+		// Set segment from left to right
+		0xa0 | 0x01,
+		// Set OLED upside up
+		0xc8,
+		// Set common signal pad configuration
+		0xda, 0x12,
+		// Set Contrast and contrast data
+		0x81, 0x00,
+		// Set discharge precharge periods
+		0xd9, 0xf1,
+		// Set common mode pad output voltage
+		0xdb, 0x40,
+		// Set Enire display
+		0xa4,
+		// Set Normal display
+		0xa6,
+		// Stop scroll
+		0x2e,
+		// OLED turn on
+		0xaf,
+		// Set column address, start column, last column
+		0x21, 0x00, 127,
+		// Set page address, start page, last page
+		0x22, 0x00, 0x07
+	};
+
 	// OLED turn off and check if OLED is connected
 	if (sd1306_send_command(sd1306_ADDR, 0xae) < 0)
 	{
 		return 1;
 	}
-	// Set display oscillator freqeuncy and divide ratio
-	sd1306_send_command(sd1306_ADDR, 0xd5);
-	sd1306_send_command(sd1306_ADDR, 0x50);
-
-	// Set multiplex ratio
-	sd1306_send_command(sd1306_ADDR, 0xa8);
-	sd1306_send_command(sd1306_ADDR, 0x3f);
-	// Set display start line
-	sd1306_send_command(sd1306_ADDR, 0xd3);
-	sd1306_send_command(sd1306_ADDR, 0x00);
-	// Set the lower comulmn address
-	sd1306_send_command(sd1306_ADDR, 0x00);
-	// Set the higher comulmn address
-	sd1306_send_command(sd1306_ADDR, 0x10);
-	
-	// Set page address
-	sd1306_send_command(sd1306_ADDR, 0xb0);
 
-	// Charge pump
-	sd1306_send_command(sd1306_ADDR, 0x8d);
-	sd1306_send_command(sd1306_ADDR, 0x14);
-	
-	// Memory mode
-	sd1306_send_command(sd1306_ADDR, 0x20);
-	sd1306_send_command(sd1306_ADDR, 0x00);
-
-	// Set segment from left to right
-	sd1306_send_command(sd1306_ADDR, 0xa0 | 0x01);
-	// Set OLED upside up
-	sd1306_send_command(sd1306_ADDR, 0xc8);
-	// Set common signal pad configuration
-	sd1306_send_command(sd1306_ADDR, 0xda);
-	sd1306_send_command(sd1306_ADDR, 0x12);
-
-	// Set Contrast
-	sd1306_send_command(sd1306_ADDR, 0x81);
-	// Contrast data
-	sd1306_send_command(sd1306_ADDR, 0x00);
-
-	// Set discharge precharge periods
-	sd1306_send_command(sd1306_ADDR, 0xd9);
-	sd1306_send_command(sd1306_ADDR, 0xf1);
-
-	// Set common mode pad output voltage 
-	sd1306_send_command(sd1306_ADDR, 0xdb);
-	sd1306_send_command(sd1306_ADDR, 0x40);
-
-	// Set Enire display
-	sd1306_send_command(sd1306_ADDR, 0xa4);
-	
-	// Set Normal display
-	sd1306_send_command(sd1306_ADDR, 0xa6);
-	// Stop scroll
-	sd1306_send_command(sd1306_ADDR, 0x2e);
-
-	// OLED turn on
-	sd1306_send_command(sd1306_ADDR, 0xaf);
-
-	// Set column address
-	sd1306_send_command(sd1306_ADDR, 0x21);
-	// Start Column
-	sd1306_send_command(sd1306_ADDR, 0x00);
-	// Last column
-	sd1306_send_command(sd1306_ADDR, 127);
-
-	// Set page address
-	sd1306_send_command(sd1306_ADDR, 0x22);
-	// Start Page
-	sd1306_send_command(sd1306_ADDR, 0x00);
-	// Last Page
-	sd1306_send_command(sd1306_ADDR, 0x07);
+	if (sd1306_send_commands(sd1306_ADDR, init_commands, sizeof(init_commands)) < 0)
+	{
+		return 1;
+	}
 	upside_down();
 	return 0;
 }
@@ -0,0 +1,375 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "send_window.h"
+
+/// <summary>
+///     FNV-1a over the lane, the content type, the schema and, for a JSON object, the first
+///     member name.
+/// </summary>
+static uint32_t messageKind(send_lane_t lane, const uint8_t *payload, size_t length, const char *contentType, const char *schema)
+{
+	uint32_t hash = (2166136261u ^ (uint8_t)lane) * 16777619u;
+	const char *parts[] = { contentType, (schema != NULL) ? schema : "" };
+
+	for (size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); p++) {
+		for (const char *c = parts[p]; ; c++) {
+			hash = (hash ^ (uint8_t)*c) * 16777619u;
+			if (*c == '\0') {
+				break;
+			}
+		}
+	}
+
+	// {"name": ... hashes the name
+	size_t i = 0;
+	while (i < length && payload[i] != '"') {
+		i++;
+	}
+	for (i++; i < length && payload[i] != '"'; i++) {
+		hash = (hash ^ payload[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void countStates(const send_window_t *window, uint8_t *waiting, uint8_t *inFlight)
+{
+	*waiting = 0;
+	*inFlight = 0;
+	for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+		if (window->slots[i].state == SEND_SLOT_WAITING) {
+			(*waiting)++;
+		}
+		else if (window->slots[i].state == SEND_SLOT_IN_FLIGHT) {
+			(*inFlight)++;
+		}
+	}
+}
+
+static send_message_t *oldestWaiting(send_window_t *window, send_lane_t lane)
+{
+	send_message_t *oldest = NULL;
+	for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+		send_message_t *slot = &window->slots[i];
+		// Orders are compared modulo 2^32
+		if (slot->state == SEND_SLOT_WAITING && slot->lane == lane &&
+			(oldest == NULL || (int32_t)(slot->order - oldest->order) < 0)) {
+			oldest = slot;
+		}
+	}
+	return oldest;
+}
+
+/// <summary>
+///     Nearest rank percentiles of the last SEND_WINDOW_LATENCY_SAMPLES of total samples.
+/// </summary>
+static void percentiles(const uint32_t *samples, uint32_t total, uint32_t *p50, uint32_t *p90, uint32_t *p99, uint32_t *max)
+{
+	// Insertion sort a copy, there are only SEND_WINDOW_LATENCY_SAMPLES of them
+	uint32_t sorted[SEND_WINDOW_LATENCY_SAMPLES];
+	const uint32_t n = (total < SEND_WINDOW_LATENCY_SAMPLES) ? total : SEND_WINDOW_LATENCY_SAMPLES;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t j = i;
+		while (j > 0 && sorted[j - 1] > samples[i]) {
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = samples[i];
+	}
+
+	if (n == 0) {
+		*p50 = *p99 = *max = 0;
+		if (p90 != NULL) {
+			*p90 = 0;
+		}
+		return;
+	}
+	// Nearest rank
+	*p50 = sorted[(n * 50 + 99) / 100 - 1];
+	if (p90 != NULL) {
+		*p90 = sorted[(n * 90 + 99) / 100 - 1];
+	}
+	*p99 = sorted[(n * 99 + 99) / 100 - 1];
+	*max = sorted[n - 1];
+}
+
+void SendWindow_Init(send_window_t *window, const send_window_policy_t *policy)
+{
+	memset(window, 0, sizeof(*window));
+	window->policy = *policy;
+	if (window->policy.window == 0 || window->policy.window > SEND_WINDOW_SLOTS) {
+		window->policy.window = SEND_WINDOW_SLOTS;
+	}
+}
+
+send_message_t *SendWindow_Reserve(send_window_t *window, send_lane_t lane)
+{
+	send_message_t *slot = NULL;
+	int freeSlots = 0;
+	for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+		if (window->slots[i].state == SEND_SLOT_FREE) {
+			slot = (slot == NULL) ? &window->slots[i] : slot;
+			freeSlots++;
+		}
+	}
+	if (slot != NULL && (lane == SEND_LANE_ALARM || freeSlots > SEND_WINDOW_ALARM_SLOTS)) {
+		slot->state = SEND_SLOT_RESERVED;
+		slot->lane = lane;
+		slot->storedSequence = 0;
+		slot->storedCommittedAt = 0;
+		return slot;
+	}
+
+	if (window->overflow.state != SEND_SLOT_FREE) {
+		return NULL;
+	}
+	window->overflow.state = SEND_SLOT_RESERVED;
+	window->overflow.lane = lane;
+	window->overflow.storedSequence = 0;
+	window->overflow.storedCommittedAt = 0;
+	window->stats.overflows++;
+	return &window->overflow;
+}
+
+/// <summary>
+///     Finds the slot an overflow message goes into under the back-pressure policy: the newest
+///     waiting message of its kind when coalescing, otherwise the oldest waiting message of the
+///     lowest lane up to its own.  A waiting replay is never coalesced into, or its stored record
+///     would be consumed on the confirmation of a different message.
+/// </summary>
+/// <returns>The slot, or NULL if the message is refused</returns>
+static send_message_t *makeRoom(send_window_t *window, send_lane_t lane, uint32_t kind, bool *coalesced)
+{
+	send_message_t *message = NULL;
+	*coalesced = false;
+
+	switch (window->policy.backpressure) {
+	case SEND_POLICY_SPILL:
+		window->stats.spilled++;
+		return NULL;
+	case SEND_POLICY_COALESCE:
+		for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+			send_message_t *slot = &window->slots[i];
+			if (slot->state == SEND_SLOT_WAITING && slot->kind == kind && slot->storedSequence == 0 &&
+				(message == NULL || (int32_t)(slot->order - message->order) > 0)) {
+				message = slot;
+			}
+		}
+		if (message != NULL) {
+			*coalesced = true;
+			window->stats.coalesced++;
+			return message;
+		}
+		// Fall through
+	case SEND_POLICY_DROP_OLDEST:
+	default:
+		// If everything is in flight, or waiting in a higher lane, the new message is the one to go
+		window->stats.dropped++;
+		for (send_lane_t below = SEND_LANE_TELEMETRY; below <= lane; below++) {
+			message = oldestWaiting(window, below);
+			if (message != NULL) {
+				break;
+			}
+		}
+		return message;
+	}
+}
+
+send_message_t *SendWindow_Commit(send_window_t *window, send_message_t *message, size_t length,
+	const char *contentType, const char *schema, int64_t now_ms)
+{
+	if (length > SEND_WINDOW_MAX_PAYLOAD) {
+		window->stats.dropped++;
+		return NULL;
+	}
+
+	const send_lane_t lane = message->lane;
+	const uint32_t kind = messageKind(lane, message->payload, length, contentType, schema);
+	if (message == &window->overflow) {
+		bool coalesced;
+		send_message_t *slot = makeRoom(window, lane, kind, &coalesced);
+		if (slot == NULL) {
+			return NULL;
+		}
+		memcpy(slot->payload, message->payload, length);
+		message->state = SEND_SLOT_FREE;
+		message = slot;
+
+		if (coalesced) {
+			// Replaced in place, it keeps its turn and its commit time
+			message->length = (uint16_t)length;
+			message->retries = 0;
+			window->stats.accepted++;
+			window->stats.lanes[lane].accepted++;
+			return message;
+		}
+	}
+
+	message->state = SEND_SLOT_WAITING;
+	message->lane = lane;
+	message->retries = 0;
+	message->length = (uint16_t)length;
+	message->order = window->nextOrder++;
+	message->kind = kind;
+	message->storedSequence = 0;
+	message->storedCommittedAt = 0;
+	message->committedAt_ms = now_ms;
+	message->sentAt_ms = 0;
+	memset(message->contentType, 0, sizeof(message->contentType));
+	strncpy(message->contentType, contentType, sizeof(message->contentType) - 1);
+	memset(message->schema, 0, sizeof(message->schema));
+	if (schema != NULL) {
+		strncpy(message->schema, schema, sizeof(message->schema) - 1);
+	}
+	window->stats.accepted++;
+	window->stats.lanes[lane].accepted++;
+	return message;
+}
+
+void SendWindow_Cancel(send_message_t *message)
+{
+	message->state = SEND_SLOT_FREE;
+}
+
+send_message_t *SendWindow_Accept(send_window_t *window, send_lane_t lane, const uint8_t *payload, size_t length,
+	const char *contentType, const char *schema, int64_t now_ms)
+{
+	if (length > SEND_WINDOW_MAX_PAYLOAD) {
+		window->stats.dropped++;
+		return NULL;
+	}
+
+	send_message_t *message = SendWindow_Reserve(window, lane);
+	if (message == NULL) {
+		window->stats.dropped++;
+		return NULL;
+	}
+	memcpy(message->payload, payload, length);
+
+	send_message_t *queued = SendWindow_Commit(window, message, length, contentType, schema, now_ms);
+	if (queued == NULL) {
+		SendWindow_Cancel(message);
+	}
+	return queued;
+}
+
+send_message_t *SendWindow_NextToSend(send_window_t *window)
+{
+	send_message_t *alarm = oldestWaiting(window, SEND_LANE_ALARM);
+	if (alarm != NULL) {
+		return alarm;
+	}
+
+	// Alarms in flight don't take from the window the other lanes share
+	uint8_t inFlight = 0;
+	for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+		if (window->slots[i].state == SEND_SLOT_IN_FLIGHT && window->slots[i].lane != SEND_LANE_ALARM) {
+			inFlight++;
+		}
+	}
+	if (inFlight >= window->policy.window) {
+		return NULL;
+	}
+
+	// Smooth weighted round robin: every lane with something waiting earns its weight, the
+	// richest goes and pays the total back.  Lanes take turns in proportion to their weights
+	// without one lane's burst going out in a block.
+	send_message_t *oldest[SEND_LANE_ALARM];
+	int32_t total = 0;
+	int best = -1;
+	for (int lane = 0; lane < SEND_LANE_ALARM; lane++) {
+		oldest[lane] = oldestWaiting(window, (send_lane_t)lane);
+		if (oldest[lane] == NULL) {
+			continue;
+		}
+		const int32_t weight = (window->policy.weights[lane] > 0) ? window->policy.weights[lane] : 1;
+		window->laneCredit[lane] += weight;
+		total += weight;
+		if (best < 0 || window->laneCredit[lane] > window->laneCredit[best]) {
+			best = lane;
+		}
+	}
+	if (best < 0) {
+		return NULL;
+	}
+	window->laneCredit[best] -= total;
+	return oldest[best];
+}
+
+void SendWindow_MarkSent(send_window_t *window, send_message_t *message, int64_t now_ms)
+{
+	message->state = SEND_SLOT_IN_FLIGHT;
+	message->sentAt_ms = now_ms;
+
+	uint8_t waiting, inFlight;
+	countStates(window, &waiting, &inFlight);
+	if (inFlight > window->stats.maxInFlight) {
+		window->stats.maxInFlight = inFlight;
+	}
+}
+
+send_confirm_t SendWindow_Confirm(send_window_t *window, send_message_t *message, bool delivered, int64_t now_ms)
+{
+	if (delivered) {
+		const int64_t latency_ms = now_ms - message->sentAt_ms;
+		window->latencies_ms[window->latencyCount++ % SEND_WINDOW_LATENCY_SAMPLES] =
+			(latency_ms > 0) ? (uint32_t)latency_ms : 0;
+
+		const send_lane_t lane = message->lane;
+		const int64_t endToEnd_ms = now_ms - message->committedAt_ms;
+		window->laneLatencies_ms[lane][window->laneLatencyCount[lane]++ % SEND_WINDOW_LATENCY_SAMPLES] =
+			(endToEnd_ms > 0) ? (uint32_t)endToEnd_ms : 0;
+		window->stats.lanes[lane].delivered++;
+		window->stats.delivered++;
+		message->state = SEND_SLOT_FREE;
+		return SEND_CONFIRM_DONE;
+	}
+
+	if (message->retries < window->policy.maxRetries) {
+		message->retries++;
+		message->state = SEND_SLOT_WAITING;
+		window->stats.retries++;
+		return SEND_CONFIRM_RETRY;
+	}
+
+	// It keeps its slot, still counted in flight, until the caller has dealt with it
+	window->stats.gaveUp++;
+	return SEND_CONFIRM_GAVE_UP;
+}
+
+void SendWindow_Release(send_message_t *message)
+{
+	message->state = SEND_SLOT_FREE;
+}
+
+bool SendWindow_HasWaiting(const send_window_t *window)
+{
+	for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+		if (window->slots[i].state == SEND_SLOT_WAITING) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void SendWindow_GetStats(const send_window_t *window, send_window_stats_t *stats)
+{
+	*stats = window->stats;
+	countStates(window, &stats->waiting, &stats->inFlight);
+	percentiles(window->latencies_ms, window->latencyCount, &stats->latencyP50_ms, &stats->latencyP90_ms,
+		&stats->latencyP99_ms, &stats->latencyMax_ms);
+
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++) {
+		send_lane_stats_t *laneStats = &stats->lanes[lane];
+		laneStats->waiting = 0;
+		for (int i = 0; i < SEND_WINDOW_SLOTS; i++) {
+			if (window->slots[i].state == SEND_SLOT_WAITING && window->slots[i].lane == (send_lane_t)lane) {
+				laneStats->waiting++;
+			}
+		}
+		percentiles(window->laneLatencies_ms[lane], window->laneLatencyCount[lane], &laneStats->latencyP50_ms, NULL,
+			&laneStats->latencyP99_ms, &laneStats->latencyMax_ms);
+	}
+}
@@ -0,0 +1,192 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Messages held at once, handed to the IoT Hub client or waiting their turn.  The slots are
+// the only message buffers: producers format straight into one (SendWindow_Reserve()), so a
+// send makes no heap calls of its own.
+#define SEND_WINDOW_SLOTS 8
+
+// Largest payload a slot holds, the same as a telemetry batch or a stored message
+#define SEND_WINDOW_MAX_PAYLOAD 4096
+
+// Most recent confirmations the latency percentiles are taken over
+#define SEND_WINDOW_LATENCY_SAMPLES 64
+
+// Slots only the alarm lane may reserve, so an alarm always finds room
+#define SEND_WINDOW_ALARM_SLOTS 1
+
+/// <summary>
+///     Lanes messages are scheduled in.  Alarms go before anything else and aren't held back by
+///     the window; the other lanes share it by weight.  Telemetry is 0 so a message stored before
+///     there were lanes replays as telemetry.
+/// </summary>
+typedef enum {
+	SEND_LANE_TELEMETRY = 0,       // Windows, batches and reports
+	SEND_LANE_EVENT,               // State changes such as the drum phase
+	SEND_LANE_ALARM,               // Shock, pressure excursions, fatigue crossings
+	SEND_LANE_COUNT
+} send_lane_t;
+
+/// <summary>
+///     What happens to a new message when every slot is taken.
+/// </summary>
+typedef enum {
+	SEND_POLICY_DROP_OLDEST = 0,   // The oldest waiting message makes room
+	SEND_POLICY_COALESCE,          // It replaces the waiting message of its kind, else as DROP_OLDEST
+	SEND_POLICY_SPILL              // It is refused, for the caller to store
+} send_policy_t;
+
+typedef enum {
+	SEND_SLOT_FREE = 0,
+	SEND_SLOT_RESERVED,            // Being formatted into
+	SEND_SLOT_WAITING,
+	SEND_SLOT_IN_FLIGHT
+} send_slot_state_t;
+
+// Result of a delivery confirmation
+typedef enum {
+	SEND_CONFIRM_DONE = 0,         // Delivered, the slot is free again
+	SEND_CONFIRM_RETRY,            // Failed, waiting to be sent again
+	SEND_CONFIRM_GAVE_UP           // Failed too often, call SendWindow_Release() once it is handled
+} send_confirm_t;
+
+typedef struct {
+	uint8_t window;                // Most messages in flight at once, up to SEND_WINDOW_SLOTS
+	uint8_t maxRetries;
+	send_policy_t backpressure;
+	uint8_t weights[SEND_LANE_COUNT]; // Share of the window per lane, the alarm lane's is unused
+} send_window_policy_t;
+
+/// <summary>
+///     One message and what is known about its delivery.  Its address is the context handed to
+///     the IoT Hub client, so the confirmation finds it.
+/// </summary>
+typedef struct {
+	send_slot_state_t state;
+	send_lane_t lane;
+	uint8_t retries;
+	uint16_t length;
+	uint32_t order;                // Accepted order, the oldest waiting message goes first
+	uint32_t kind;                 // Hash of what it is, for SEND_POLICY_COALESCE
+	uint32_t storedSequence;       // Telemetry queue sequence of a replayed message, 0 otherwise
+	uint32_t storedCommittedAt;    // UTC epoch seconds a replayed message was first committed, 0 if unknown
+	int64_t committedAt_ms;        // End to end latency is measured from here
+	int64_t sentAt_ms;
+	char contentType[20];
+	char schema[12];
+	uint8_t payload[SEND_WINDOW_MAX_PAYLOAD];
+} send_message_t;
+
+typedef struct {
+	uint32_t accepted;
+	uint32_t delivered;
+	uint8_t waiting;
+	uint32_t latencyP50_ms;        // Commit to confirmation, including the wait for a turn
+	uint32_t latencyP99_ms;
+	uint32_t latencyMax_ms;
+} send_lane_stats_t;
+
+typedef struct {
+	uint32_t accepted;
+	uint32_t delivered;
+	uint32_t retries;
+	uint32_t gaveUp;
+	uint32_t dropped;
+	uint32_t coalesced;
+	uint32_t spilled;
+	uint32_t overflows;            // Reservations made with every slot taken
+	uint8_t inFlight;
+	uint8_t waiting;
+	uint8_t maxInFlight;
+	uint32_t latencyP50_ms;
+	uint32_t latencyP90_ms;
+	uint32_t latencyP99_ms;
+	uint32_t latencyMax_ms;
+	send_lane_stats_t lanes[SEND_LANE_COUNT];
+} send_window_stats_t;
+
+typedef struct {
+	send_window_policy_t policy;
+	send_message_t slots[SEND_WINDOW_SLOTS];
+	send_message_t overflow;       // Reserved when the slots are taken, never sent itself
+	uint32_t nextOrder;
+	uint32_t latencies_ms[SEND_WINDOW_LATENCY_SAMPLES];
+	uint32_t latencyCount;
+	uint32_t laneLatencies_ms[SEND_LANE_COUNT][SEND_WINDOW_LATENCY_SAMPLES];
+	uint32_t laneLatencyCount[SEND_LANE_COUNT];
+	int32_t laneCredit[SEND_LANE_COUNT];  // Smooth weighted round robin between the lanes
+	send_window_stats_t stats;
+} send_window_t;
+
+void SendWindow_Init(send_window_t *window, const send_window_policy_t *policy);
+
+/// <summary>
+///     Reserves a slot to format a message into, up to SEND_WINDOW_MAX_PAYLOAD bytes of
+///     payload.  With every slot taken the overflow buffer is handed out and the back-pressure
+///     policy is applied when it is committed.  Only the alarm lane gets the last
+///     SEND_WINDOW_ALARM_SLOTS free slots.
+/// </summary>
+/// <returns>The reserved message, or NULL if the overflow buffer is already reserved</returns>
+send_message_t *SendWindow_Reserve(send_window_t *window, send_lane_t lane);
+
+/// <summary>
+///     Queues a reserved message to be sent.  The kind a message coalesces with is its content
+///     type, schema and, for a JSON object, its first member name.
+/// </summary>
+/// <param name="schema">The "schema" application property, or NULL for none.</param>
+/// <returns>The waiting message, or NULL if it was refused (counted as spilled under
+/// SEND_POLICY_SPILL, dropped otherwise).  A refused message stays reserved, so it can still
+/// be stored, until SendWindow_Cancel().</returns>
+send_message_t *SendWindow_Commit(send_window_t *window, send_message_t *message, size_t length,
+	const char *contentType, const char *schema, int64_t now_ms);
+
+/// <summary>
+///     Gives back a reserved message without sending it.
+/// </summary>
+void SendWindow_Cancel(send_message_t *message);
+
+/// <summary>
+///     Reserves, copies in and commits a message that is already formatted elsewhere.
+/// </summary>
+/// <returns>As SendWindow_Commit(), but a refused message is given back</returns>
+send_message_t *SendWindow_Accept(send_window_t *window, send_lane_t lane, const uint8_t *payload, size_t length,
+	const char *contentType, const char *schema, int64_t now_ms);
+
+/// <summary>
+///     The next message to hand to the client: the oldest waiting alarm, else, if the window
+///     has room for another in flight, the oldest waiting message of the lane whose turn it is.
+/// </summary>
+send_message_t *SendWindow_NextToSend(send_window_t *window);
+
+/// <summary>
+///     Records that the message was handed to the IoT Hub client.
+/// </summary>
+void SendWindow_MarkSent(send_window_t *window, send_message_t *message, int64_t now_ms);
+
+/// <summary>
+///     Records the delivery confirmation of a message in flight.  A failed message waits to be
+///     sent again until it has been retried policy.maxRetries times.
+/// </summary>
+send_confirm_t SendWindow_Confirm(send_window_t *window, send_message_t *message, bool delivered, int64_t now_ms);
+
+/// <summary>
+///     Frees the slot of a message the window gave up on.
+/// </summary>
+void SendWindow_Release(send_message_t *message);
+
+/// <summary>
+///     Whether any message is waiting to be sent.
+/// </summary>
+bool SendWindow_HasWaiting(const send_window_t *window);
+
+/// <summary>
+///     Counters, the current depths, the confirmation latency percentiles and, per lane, the
+///     end to end latency percentiles.
+/// </summary>
+void SendWindow_GetStats(const send_window_t *window, send_window_stats_t *stats);
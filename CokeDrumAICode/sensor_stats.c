@@ -0,0 +1,145 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sensor_stats.h"
+
+// The keys match the ones used by the original per-sample telemetry (which reported the
+// accelerometer as "g" and the gyro as "a") so the existing IoT Central charts keep working.
+const char *const sensorChannelKeys[SENSOR_CHANNEL_COUNT] = {
+	[SENSOR_CH_ACCEL_X] = "gX",
+	[SENSOR_CH_ACCEL_Y] = "gY",
+	[SENSOR_CH_ACCEL_Z] = "gZ",
+	[SENSOR_CH_GYRO_X] = "aX",
+	[SENSOR_CH_GYRO_Y] = "aY",
+	[SENSOR_CH_GYRO_Z] = "aZ",
+	[SENSOR_CH_PRESSURE] = "pressure",
+	[SENSOR_CH_LSM6DSO_TEMP] = "t1",
+	[SENSOR_CH_LPS22HH_TEMP] = "t2",
+	[SENSOR_CH_STRAIN] = "s1",
+	[SENSOR_CH_DISTANCE] = "d1",
+	[SENSOR_CH_DISPLACEMENT] = "disp",
+	[SENSOR_CH_DISPLACEMENT_RATE] = "dispRate",
+	[SENSOR_CH_DISTANCE_CONFIDENCE] = "dConf"
+};
+
+void SensorStats_Reset(sensor_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		stats->min[ch] = INFINITY;
+		stats->max[ch] = -INFINITY;
+	}
+}
+
+/// <summary>
+///     Folds one sample row into the running moments.
+/// </summary>
+static inline void addSample(sensor_stats_t *stats, const float x[SENSOR_CHANNEL_COUNT])
+{
+	// Every channel shares the same sample count, so the per-sample coefficients are
+	// computed once and the channel loop below is branch free and vectorizes.
+	stats->count++;
+	const float n = (float)stats->count;
+	const float nMinus1 = n - 1.0f;
+	const float m4Coeff = n * n - 3.0f * n + 3.0f;
+	const float m3Coeff = n - 2.0f;
+
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		const float delta = x[ch] - stats->mean[ch];
+		const float deltaN = delta / n;
+		const float deltaN2 = deltaN * deltaN;
+		const float term1 = delta * deltaN * nMinus1;
+
+		stats->mean[ch] += deltaN;
+		stats->m4[ch] += term1 * deltaN2 * m4Coeff + 6.0f * deltaN2 * stats->m2[ch] - 4.0f * deltaN * stats->m3[ch];
+		stats->m3[ch] += term1 * deltaN * m3Coeff - 3.0f * deltaN * stats->m2[ch];
+		stats->m2[ch] += term1;
+		stats->min[ch] = fminf(stats->min[ch], x[ch]);
+		stats->max[ch] = fmaxf(stats->max[ch], x[ch]);
+	}
+}
+
+void SensorStats_AddBatch(sensor_stats_t *stats, const float (*samples)[SENSOR_CHANNEL_COUNT],
+	size_t sampleCount)
+{
+	for (size_t i = 0; i < sampleCount; i++) {
+		addSample(stats, samples[i]);
+	}
+}
+
+void SensorStats_AddRawBatch(sensor_stats_t *stats, const int32_t (*samples)[SENSOR_CHANNEL_COUNT],
+	size_t sampleCount)
+{
+	float x[SENSOR_CHANNEL_COUNT];
+
+	for (size_t i = 0; i < sampleCount; i++) {
+		for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+			x[ch] = (float)samples[i][ch];
+		}
+		addSample(stats, x);
+	}
+}
+
+bool SensorStats_Finalize(const sensor_stats_t *stats, sensor_window_t *window)
+{
+	if (stats->count == 0) {
+		return false;
+	}
+
+	const float n = (float)stats->count;
+	window->count = stats->count;
+
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		const float m2 = stats->m2[ch];
+		const float variance = m2 / n;
+		const float rms = sqrtf(variance + stats->mean[ch] * stats->mean[ch]);
+		const float peak = fmaxf(fabsf(stats->min[ch]), fabsf(stats->max[ch]));
+
+		window->min[ch] = stats->min[ch];
+		window->max[ch] = stats->max[ch];
+		window->mean[ch] = stats->mean[ch];
+		window->variance[ch] = variance;
+		window->rms[ch] = rms;
+		window->peakToPeak[ch] = stats->max[ch] - stats->min[ch];
+		window->crestFactor[ch] = (rms > 0.0f) ? peak / rms : 0.0f;
+
+		// A flat channel has no defined shape, report 0 rather than NaN
+		if (m2 > 0.0f) {
+			window->skewness[ch] = sqrtf(n) * stats->m3[ch] / (m2 * sqrtf(m2));
+			window->kurtosis[ch] = n * stats->m4[ch] / (m2 * m2);
+		}
+		else {
+			window->skewness[ch] = 0.0f;
+			window->kurtosis[ch] = 0.0f;
+		}
+	}
+
+	return true;
+}
+
+int SensorStats_FormatJson(const sensor_window_t *window, char *buffer, size_t bufferSize)
+{
+	int length = snprintf(buffer, bufferSize, "{\"n\": %u", (unsigned)window->count);
+
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT && length >= 0 && (size_t)length < bufferSize; ch++) {
+		const char *key = sensorChannelKeys[ch];
+		length += snprintf(buffer + length, bufferSize - (size_t)length,
+			", \"%s_min\": %.6g, \"%s_max\": %.6g, \"%s_mean\": %.6g, \"%s_rms\": %.6g, \"%s_var\": %.6g"
+			", \"%s_skew\": %.4g, \"%s_kurt\": %.4g, \"%s_crest\": %.4g, \"%s_p2p\": %.6g",
+			key, window->min[ch], key, window->max[ch], key, window->mean[ch], key, window->rms[ch],
+			key, window->variance[ch], key, window->skewness[ch], key, window->kurtosis[ch],
+			key, window->crestFactor[ch], key, window->peakToPeak[ch]);
+	}
+
+	if (length < 0 || (size_t)length + 2 > bufferSize) {
+		return -1;
+	}
+
+	buffer[length++] = '}';
+	buffer[length] = '\0';
+	return length;
+}
@@ -0,0 +1,97 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Every channel that the acquisition loop reduces into a window record.  The order
+// here is the column order of a sample row passed to SensorStats_AddBatch().
+typedef enum {
+	SENSOR_CH_ACCEL_X = 0,
+	SENSOR_CH_ACCEL_Y,
+	SENSOR_CH_ACCEL_Z,
+	SENSOR_CH_GYRO_X,
+	SENSOR_CH_GYRO_Y,
+	SENSOR_CH_GYRO_Z,
+	SENSOR_CH_PRESSURE,
+	SENSOR_CH_LSM6DSO_TEMP,
+	SENSOR_CH_LPS22HH_TEMP,
+	SENSOR_CH_STRAIN,
+	SENSOR_CH_DISTANCE,
+	SENSOR_CH_DISPLACEMENT,
+	SENSOR_CH_DISPLACEMENT_RATE,
+	SENSOR_CH_DISTANCE_CONFIDENCE,
+	SENSOR_CHANNEL_COUNT
+} sensor_channel_t;
+
+/// <summary>
+///     Running moments for every channel, kept as a struct of arrays so a single loop over
+///     the channel index updates all of them for each sample.
+/// </summary>
+typedef struct {
+	uint32_t count;
+	float min[SENSOR_CHANNEL_COUNT];
+	float max[SENSOR_CHANNEL_COUNT];
+	float mean[SENSOR_CHANNEL_COUNT];
+	float m2[SENSOR_CHANNEL_COUNT];
+	float m3[SENSOR_CHANNEL_COUNT];
+	float m4[SENSOR_CHANNEL_COUNT];
+} sensor_stats_t;
+
+/// <summary>
+///     The aggregate record produced for one window.
+/// </summary>
+typedef struct {
+	uint32_t count;
+	float min[SENSOR_CHANNEL_COUNT];
+	float max[SENSOR_CHANNEL_COUNT];
+	float mean[SENSOR_CHANNEL_COUNT];
+	float rms[SENSOR_CHANNEL_COUNT];
+	float variance[SENSOR_CHANNEL_COUNT];
+	float skewness[SENSOR_CHANNEL_COUNT];
+	float kurtosis[SENSOR_CHANNEL_COUNT];
+	float crestFactor[SENSOR_CHANNEL_COUNT];
+	float peakToPeak[SENSOR_CHANNEL_COUNT];
+} sensor_window_t;
+
+/// <summary>
+///     Telemetry key used for a channel.
+/// </summary>
+extern const char *const sensorChannelKeys[SENSOR_CHANNEL_COUNT];
+
+/// <summary>
+///     Clears the running moments so a new window can start.
+/// </summary>
+void SensorStats_Reset(sensor_stats_t *stats);
+
+/// <summary>
+///     Folds a batch of samples into the running moments using the single pass
+///     Welford/Pebay update.
+/// </summary>
+/// <param name="samples">sampleCount rows of SENSOR_CHANNEL_COUNT values</param>
+/// <param name="sampleCount">Number of rows in samples</param>
+void SensorStats_AddBatch(sensor_stats_t *stats, const float (*samples)[SENSOR_CHANNEL_COUNT],
+	size_t sampleCount);
+
+/// <summary>
+///     Same as SensorStats_AddBatch() for rows of raw sensor counts.  The resulting window is
+///     in counts too, SensorUnits_ScaleWindow() converts it to engineering units.
+/// </summary>
+void SensorStats_AddRawBatch(sensor_stats_t *stats, const int32_t (*samples)[SENSOR_CHANNEL_COUNT],
+	size_t sampleCount);
+
+/// <summary>
+///     Computes the window record from the running moments.
+/// </summary>
+/// <returns>false if no samples have been added since the last reset</returns>
+bool SensorStats_Finalize(const sensor_stats_t *stats, sensor_window_t *window);
+
+/// <summary>
+///     Formats a window record as a flat JSON telemetry message, one "<key>_<stat>" field per
+///     channel statistic.
+/// </summary>
+/// <returns>The length of the string written, or -1 if it did not fit</returns>
+int SensorStats_FormatJson(const sensor_window_t *window, char *buffer, size_t bufferSize);
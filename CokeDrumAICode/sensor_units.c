@@ -0,0 +1,162 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+
+#include "build_options.h"
+#include "lsm6dso_reg.h"
+#include "lps22hh_reg.h"
+#include "sensor_units.h"
+
+void SensorUnits_ConvertInt16(const int16_t *counts, float *values, size_t count, sensor_scale_t scale)
+{
+	for (size_t i = 0; i < count; i++) {
+		values[i] = (float)counts[i] * scale.scale + scale.offset;
+	}
+}
+
+void SensorUnits_ConvertInt32(const int32_t *counts, float *values, size_t count, sensor_scale_t scale)
+{
+	for (size_t i = 0; i < count; i++) {
+		values[i] = (float)counts[i] * scale.scale + scale.offset;
+	}
+}
+
+void SensorUnits_ConvertRow(const int32_t counts[SENSOR_CHANNEL_COUNT], float values[SENSOR_CHANNEL_COUNT],
+	const sensor_scale_t scales[SENSOR_CHANNEL_COUNT])
+{
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		values[ch] = (float)counts[ch] * scales[ch].scale + scales[ch].offset;
+	}
+}
+
+void SensorUnits_ScaleWindow(sensor_window_t *window, const sensor_scale_t scales[SENSOR_CHANNEL_COUNT])
+{
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		const float a = scales[ch].scale;
+		const float b = scales[ch].offset;
+		const float lo = window->min[ch] * a + b;
+		const float hi = window->max[ch] * a + b;
+
+		// A negative scale swaps the extremes and mirrors the distribution
+		window->min[ch] = fminf(lo, hi);
+		window->max[ch] = fmaxf(lo, hi);
+		window->mean[ch] = window->mean[ch] * a + b;
+		window->variance[ch] *= a * a;
+		window->peakToPeak[ch] *= fabsf(a);
+		window->skewness[ch] = copysignf(window->skewness[ch], window->skewness[ch] * a);
+
+		const float rms = sqrtf(window->variance[ch] + window->mean[ch] * window->mean[ch]);
+		const float peak = fmaxf(fabsf(window->min[ch]), fabsf(window->max[ch]));
+		window->rms[ch] = rms;
+		window->crestFactor[ch] = (rms > 0.0f) ? peak / rms : 0.0f;
+	}
+}
+
+#ifdef SENSOR_UNITS_BENCHMARK_SAMPLES
+#define BENCHMARK_CHUNK 64
+
+static uint64_t elapsedNanoseconds(const struct timespec *start, const struct timespec *end)
+{
+	return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000ull + (uint64_t)(end->tv_nsec - start->tv_nsec);
+}
+
+void SensorUnits_RunBenchmark(size_t sampleCount)
+{
+	static const sensor_scale_t scales[SENSOR_CHANNEL_COUNT] = {
+		[SENSOR_CH_ACCEL_X] = SENSOR_SCALE_LSM6DSO_FS4_MG,
+		[SENSOR_CH_ACCEL_Y] = SENSOR_SCALE_LSM6DSO_FS4_MG,
+		[SENSOR_CH_ACCEL_Z] = SENSOR_SCALE_LSM6DSO_FS4_MG,
+		[SENSOR_CH_GYRO_X] = SENSOR_SCALE_LSM6DSO_FS2000_DPS,
+		[SENSOR_CH_GYRO_Y] = SENSOR_SCALE_LSM6DSO_FS2000_DPS,
+		[SENSOR_CH_GYRO_Z] = SENSOR_SCALE_LSM6DSO_FS2000_DPS,
+		[SENSOR_CH_PRESSURE] = SENSOR_SCALE_LPS22HH_HPA,
+		[SENSOR_CH_LSM6DSO_TEMP] = SENSOR_SCALE_LSM6DSO_TEMP_DEGC,
+		[SENSOR_CH_LPS22HH_TEMP] = SENSOR_SCALE_LPS22HH_TEMP_DEGC,
+		[SENSOR_CH_STRAIN] = { .scale = 1.0f },
+		[SENSOR_CH_DISTANCE] = { .scale = 1.0f },
+		[SENSOR_CH_DISPLACEMENT] = { .scale = 1.0f },
+		[SENSOR_CH_DISPLACEMENT_RATE] = { .scale = 1.0f },
+		[SENSOR_CH_DISTANCE_CONFIDENCE] = { .scale = 1.0f }
+	};
+	static int32_t raw[BENCHMARK_CHUNK][SENSOR_CHANNEL_COUNT];
+	static float converted[BENCHMARK_CHUNK][SENSOR_CHANNEL_COUNT];
+	static sensor_stats_t floatStats, rawStats;
+	sensor_window_t floatWindow, rawWindow;
+	struct timespec start, end;
+	uint64_t floatNanoseconds = 0, rawNanoseconds = 0;
+	uint32_t seed = 12345;
+	volatile float altitudeSink = 0.0f;
+
+	SensorStats_Reset(&floatStats);
+	SensorStats_Reset(&rawStats);
+
+	for (size_t done = 0; done < sampleCount; done += BENCHMARK_CHUNK) {
+		size_t n = (sampleCount - done < BENCHMARK_CHUNK) ? sampleCount - done : BENCHMARK_CHUNK;
+
+		// Plausible counts around a level board at room temperature and pressure
+		for (size_t i = 0; i < n; i++) {
+			for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+				seed = seed * 1664525u + 1013904223u;
+				raw[i][ch] = (int32_t)(seed >> 24) - 128;
+			}
+			raw[i][SENSOR_CH_ACCEL_Z] += 8197;
+			raw[i][SENSOR_CH_PRESSURE] += 4150000;
+			raw[i][SENSOR_CH_LPS22HH_TEMP] += 2200;
+		}
+
+		// The per-sample float path the acquisition loop used: driver conversions, a double
+		// divide for the gyro and the altitude for every read
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < n; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				converted[i][SENSOR_CH_ACCEL_X + axis] = lsm6dso_from_fs4_to_mg((int16_t)raw[i][SENSOR_CH_ACCEL_X + axis]);
+				converted[i][SENSOR_CH_GYRO_X + axis] = lsm6dso_from_fs2000_to_mdps((int16_t)raw[i][SENSOR_CH_GYRO_X + axis]) / 1000.0;
+			}
+			converted[i][SENSOR_CH_PRESSURE] = lps22hh_from_lsb_to_hpa((uint32_t)raw[i][SENSOR_CH_PRESSURE]);
+			converted[i][SENSOR_CH_LSM6DSO_TEMP] = lsm6dso_from_lsb_to_celsius((int16_t)raw[i][SENSOR_CH_LSM6DSO_TEMP]);
+			converted[i][SENSOR_CH_LPS22HH_TEMP] = lps22hh_from_lsb_to_celsius((int16_t)raw[i][SENSOR_CH_LPS22HH_TEMP]);
+			for (int ch = SENSOR_CH_STRAIN; ch < SENSOR_CHANNEL_COUNT; ch++) {
+				converted[i][ch] = (float)raw[i][ch];
+			}
+			altitudeSink = 44330 * (1 - powf((converted[i][SENSOR_CH_PRESSURE] / 1013.25), 1 / 5.255));
+		}
+		SensorStats_AddBatch(&floatStats, (const float (*)[SENSOR_CHANNEL_COUNT])converted, n);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		floatNanoseconds += elapsedNanoseconds(&start, &end);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		SensorStats_AddRawBatch(&rawStats, (const int32_t (*)[SENSOR_CHANNEL_COUNT])raw, n);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		rawNanoseconds += elapsedNanoseconds(&start, &end);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	SensorStats_Finalize(&floatStats, &floatWindow);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	floatNanoseconds += elapsedNanoseconds(&start, &end);
+
+	// The raw pipeline converts once, at the edge
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	SensorStats_Finalize(&rawStats, &rawWindow);
+	SensorUnits_ScaleWindow(&rawWindow, scales);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rawNanoseconds += elapsedNanoseconds(&start, &end);
+
+	float worstMeanError = 0.0f;
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		float error = fabsf(rawWindow.mean[ch] - floatWindow.mean[ch]) / fmaxf(fabsf(floatWindow.mean[ch]), 1e-6f);
+		worstMeanError = fmaxf(worstMeanError, error);
+	}
+
+	Log_Debug("Conversion benchmark, %zu samples: float path %.1f ns/sample, raw count path %.1f ns/sample, "
+		"worst relative mean difference %.2g (altitude %.1f)\n", sampleCount,
+		(double)floatNanoseconds / (double)sampleCount, (double)rawNanoseconds / (double)sampleCount,
+		worstMeanError, altitudeSink);
+}
+#endif
@@ -0,0 +1,53 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_stats.h"
+
+/// <summary>
+///     Describes how a channel's raw counts map to engineering units:
+///     value = counts * scale + offset.
+/// </summary>
+typedef struct {
+	float scale;
+	float offset;
+} sensor_scale_t;
+
+// Sensor full scale and output formats as configured in initI2c
+#define SENSOR_SCALE_LSM6DSO_FS4_MG      { .scale = 0.122f, .offset = 0.0f }
+#define SENSOR_SCALE_LSM6DSO_FS2000_DPS  { .scale = 0.070f, .offset = 0.0f }
+#define SENSOR_SCALE_LSM6DSO_TEMP_DEGC   { .scale = 1.0f / 256.0f, .offset = 25.0f }
+#define SENSOR_SCALE_LPS22HH_HPA         { .scale = 1.0f / 4096.0f, .offset = 0.0f }
+#define SENSOR_SCALE_LPS22HH_TEMP_DEGC   { .scale = 0.01f, .offset = 0.0f }
+
+/// <summary>
+///     Converts a batch of int16 counts that share one scale.
+/// </summary>
+void SensorUnits_ConvertInt16(const int16_t *counts, float *values, size_t count, sensor_scale_t scale);
+
+/// <summary>
+///     Converts a batch of int32 counts that share one scale.
+/// </summary>
+void SensorUnits_ConvertInt32(const int32_t *counts, float *values, size_t count, sensor_scale_t scale);
+
+/// <summary>
+///     Converts one sample row, each channel with its own scale.
+/// </summary>
+void SensorUnits_ConvertRow(const int32_t counts[SENSOR_CHANNEL_COUNT], float values[SENSOR_CHANNEL_COUNT],
+	const sensor_scale_t scales[SENSOR_CHANNEL_COUNT]);
+
+/// <summary>
+///     Converts a window record computed on raw counts into engineering units.  The moments
+///     transform exactly, so the result is the same as accumulating converted samples.
+/// </summary>
+void SensorUnits_ScaleWindow(sensor_window_t *window, const sensor_scale_t scales[SENSOR_CHANNEL_COUNT]);
+
+/// <summary>
+///     Times the per-sample float conversion path against the raw count pipeline over a batch
+///     of synthetic samples and logs the result.  Only built with SENSOR_UNITS_BENCHMARK_SAMPLES.
+/// </summary>
+void SensorUnits_RunBenchmark(size_t sampleCount);
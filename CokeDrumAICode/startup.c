@@ -0,0 +1,202 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "startup.h"
+
+static startup_task_t *graph = NULL;
+static int taskCount = 0;
+static struct timespec beginTime;
+static int startupTimerFd = -1;
+static void (*completionHandler)(bool ok) = NULL;
+static bool complete = false;
+
+static void StartupTimerEventHandler(EventData *eventData);
+static EventData startupEventData = { .eventHandler = &StartupTimerEventHandler };
+
+static float millisecondsSince(const struct timespec *from, const struct timespec *to)
+{
+	return (float)(to->tv_sec - from->tv_sec) * 1000.0f + (float)(to->tv_nsec - from->tv_nsec) / 1e6f;
+}
+
+static bool isBefore(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/// <summary>
+///     Moves pending tasks whose dependencies have settled to running (or skipped).
+/// </summary>
+/// <returns>true if any task changed state</returns>
+static bool releaseTasks(const struct timespec *now)
+{
+	bool changed = false;
+
+	for (int t = 0; t < taskCount; t++) {
+		startup_task_t *task = &graph[t];
+		if (task->state != STARTUP_PENDING) {
+			continue;
+		}
+
+		bool waiting = false, blocked = false;
+		for (int d = 0; d < taskCount; d++) {
+			if ((task->dependsOn & (1u << d)) == 0) {
+				continue;
+			}
+			waiting |= graph[d].state == STARTUP_PENDING || graph[d].state == STARTUP_RUNNING;
+			blocked |= graph[d].state == STARTUP_FAILED || graph[d].state == STARTUP_SKIPPED;
+		}
+
+		if (blocked) {
+			task->state = STARTUP_SKIPPED;
+			task->started_ms = task->finished_ms = millisecondsSince(&beginTime, now);
+			Log_Debug("[Startup] %7.1f ms %s skipped, a dependency failed\n", task->finished_ms, task->name);
+			changed = true;
+		}
+		else if (!waiting) {
+			task->state = STARTUP_RUNNING;
+			task->wakeAt = *now;
+			task->started_ms = millisecondsSince(&beginTime, now);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+/// <summary>
+///     Runs every task that is due, repeating while tasks finish so their dependents start
+///     without waiting for the timer, then arms the timer for the next task that is waiting.
+/// </summary>
+static void runDueTasks(void)
+{
+	struct timespec now;
+	bool changed;
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		changed = releaseTasks(&now);
+
+		for (int t = 0; t < taskCount; t++) {
+			startup_task_t *task = &graph[t];
+			if (task->state != STARTUP_RUNNING || isBefore(&now, &task->wakeAt)) {
+				continue;
+			}
+
+			int result = task->step();
+			task->steps++;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			if (result == STARTUP_STEP_DONE || result == STARTUP_STEP_FAILED) {
+				task->state = (result == STARTUP_STEP_DONE) ? STARTUP_READY : STARTUP_FAILED;
+				task->finished_ms = millisecondsSince(&beginTime, &now);
+				Log_Debug("[Startup] %7.1f ms %s %s\n", task->finished_ms, task->name,
+					(result == STARTUP_STEP_DONE) ? "ready" : "failed");
+				changed = true;
+			}
+			else {
+				task->wakeAt = now;
+				task->wakeAt.tv_sec += result / 1000;
+				task->wakeAt.tv_nsec += (long)(result % 1000) * 1000000L;
+				if (task->wakeAt.tv_nsec >= 1000000000L) {
+					task->wakeAt.tv_sec++;
+					task->wakeAt.tv_nsec -= 1000000000L;
+				}
+			}
+		}
+	} while (changed);
+
+	// Sleep until the earliest waiting task is due
+	const struct timespec *earliest = NULL;
+	bool ok = true;
+	for (int t = 0; t < taskCount; t++) {
+		if (graph[t].state == STARTUP_RUNNING && (earliest == NULL || isBefore(&graph[t].wakeAt, earliest))) {
+			earliest = &graph[t].wakeAt;
+		}
+		ok &= !graph[t].required || graph[t].state == STARTUP_READY;
+	}
+
+	if (earliest != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		struct timespec delay = { .tv_sec = earliest->tv_sec - now.tv_sec, .tv_nsec = earliest->tv_nsec - now.tv_nsec };
+		if (delay.tv_nsec < 0) {
+			delay.tv_sec--;
+			delay.tv_nsec += 1000000000L;
+		}
+		// A zero expiry would disarm the timer
+		if (delay.tv_sec < 0 || (delay.tv_sec == 0 && delay.tv_nsec < 1000)) {
+			delay.tv_sec = 0;
+			delay.tv_nsec = 1000;
+		}
+		SetTimerFdToSingleExpiry(startupTimerFd, &delay);
+		return;
+	}
+
+	if (!complete) {
+		complete = true;
+		Startup_LogTimeline();
+		if (completionHandler != NULL) {
+			completionHandler(ok);
+		}
+	}
+}
+
+static void StartupTimerEventHandler(EventData *eventData)
+{
+	if (ConsumeTimerFdEvent(startupTimerFd) != 0) {
+		return;
+	}
+	runDueTasks();
+}
+
+int Startup_Begin(startup_task_t *tasks, int count, int epollFd, void (*onComplete)(bool ok))
+{
+	graph = tasks;
+	taskCount = count;
+	completionHandler = onComplete;
+	complete = false;
+	clock_gettime(CLOCK_MONOTONIC, &beginTime);
+
+	// Created disarmed, runDueTasks() arms it whenever a task is waiting
+	struct timespec disarmed = { 0, 0 };
+	startupTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &startupEventData, EPOLLIN);
+	if (startupTimerFd < 0) {
+		return -1;
+	}
+
+	runDueTasks();
+	return 0;
+}
+
+bool Startup_IsReady(int task)
+{
+	return graph != NULL && task >= 0 && task < taskCount && graph[task].state == STARTUP_READY;
+}
+
+void Startup_LogTimeline(void)
+{
+	static const char *const stateNames[] = {
+		[STARTUP_PENDING] = "pending",
+		[STARTUP_RUNNING] = "running",
+		[STARTUP_READY] = "ready",
+		[STARTUP_FAILED] = "failed",
+		[STARTUP_SKIPPED] = "skipped"
+	};
+
+	Log_Debug("[Startup] Timeline (ms since start):\n");
+	for (int t = 0; t < taskCount; t++) {
+		const startup_task_t *task = &graph[t];
+		Log_Debug("[Startup]   %-12s %7.1f -> %7.1f  %-7s %u steps\n", task->name, task->started_ms, task->finished_ms,
+			stateNames[task->state], task->steps);
+	}
+}
+
+void Startup_Close(void)
+{
+	CloseFdAndPrintError(startupTimerFd, "startupTimer");
+	startupTimerFd = -1;
+}
@@ -0,0 +1,63 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// What a startup step returns: done, failed, or a positive number of milliseconds after
+// which it wants to be called again (instead of sleeping)
+#define STARTUP_STEP_DONE 0
+#define STARTUP_STEP_FAILED -1
+
+typedef int (*startup_step_t)(void);
+
+typedef enum {
+	STARTUP_PENDING = 0,     // Waiting for its dependencies
+	STARTUP_RUNNING,
+	STARTUP_READY,
+	STARTUP_FAILED,
+	STARTUP_SKIPPED          // A dependency failed
+} startup_state_t;
+
+/// <summary>
+///     One node of the startup graph.  The caller fills in the first four fields.
+/// </summary>
+typedef struct {
+	const char *name;
+	startup_step_t step;
+	uint32_t dependsOn;      // Bit mask of the indices of the tasks that must be ready first
+	bool required;           // The application can't run without it
+	startup_state_t state;
+	struct timespec wakeAt;
+	float started_ms;        // Since Startup_Begin
+	float finished_ms;
+	uint16_t steps;
+} startup_task_t;
+
+/// <summary>
+///     Starts running a graph of startup tasks from the epoll loop.  Every task whose
+///     dependencies are ready runs; a task that has to wait for the hardware returns a delay
+///     and the others carry on in the meantime, so independent devices come up concurrently.
+/// </summary>
+/// <param name="tasks">The graph, which must stay in memory until startup completes</param>
+/// <param name="onComplete">Called once every task has finished, ok is false if a required one failed</param>
+/// <returns>0 on success, or -1 if the scheduling timer couldn't be created</returns>
+int Startup_Begin(startup_task_t *tasks, int count, int epollFd, void (*onComplete)(bool ok));
+
+/// <summary>
+///     Whether a task has finished successfully.
+/// </summary>
+bool Startup_IsReady(int task);
+
+/// <summary>
+///     Logs when each task started and became ready, relative to Startup_Begin.
+/// </summary>
+void Startup_LogTimeline(void);
+
+/// <summary>
+///     Releases the scheduling timer.
+/// </summary>
+void Startup_Close(void);
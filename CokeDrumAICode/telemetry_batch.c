@@ -0,0 +1,486 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+
+#include "build_options.h"
+#include "cbor.h"
+#include "telemetry_batch.h"
+
+// "{\"n\": 64, \"t0\": 4294967295.999, \"dt\": [], \"phase\": \"\", \"xlFs\": 16, " and the closing
+// brace, rounded up
+#define TELEMETRY_BATCH_BASE_BYTES 96
+
+/// <summary>
+///     Number of characters printf("%d") produces for a value.
+/// </summary>
+static size_t formattedLength(int64_t value)
+{
+	size_t length = (value < 0) ? 2 : 1;
+	uint64_t magnitude = (value < 0) ? (uint64_t)(-value) : (uint64_t)value;
+	while (magnitude >= 10) {
+		magnitude /= 10;
+		length++;
+	}
+	return length;
+}
+
+/// <summary>
+///     Encoded size of one row in bits.  For JSON that includes a separator after every value.
+///     The compressed size depends on the rows before, so its coders are advanced.
+/// </summary>
+static size_t rowBits(const telemetry_batch_t *batch, ts_dod_state_t *timeCoder, ts_delta_state_t *columnCoders,
+	uint32_t offset_ms, const int32_t row[SENSOR_CHANNEL_COUNT])
+{
+	size_t length;
+
+	switch (batch->policy.encoding) {
+	case TELEMETRY_ENCODING_COMPRESSED:
+		length = TsCodec_PutTimestamp(timeCoder, NULL, offset_ms);
+		for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+			length += TsCodec_PutFixed(&columnCoders[ch], NULL, row[ch]);
+		}
+		return length;
+	case TELEMETRY_ENCODING_CBOR:
+		length = Cbor_IntLength(offset_ms);
+		for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+			length += Cbor_IntLength(row[ch]);
+		}
+		return length * 8;
+	default:
+		length = formattedLength(offset_ms) + 1;
+		for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+			length += formattedLength(row[ch]) + 1;
+		}
+		return length * 8;
+	}
+}
+
+static uint64_t elapsedNanoseconds(const struct timespec *start, const struct timespec *end)
+{
+	return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000ull + (uint64_t)(end->tv_nsec - start->tv_nsec);
+}
+
+static uint32_t millisecondsSince(const struct timespec *from, const struct timespec *to)
+{
+	int64_t ms = (int64_t)(to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+	return (ms < 0) ? 0u : (uint32_t)ms;
+}
+
+void TelemetryBatch_Init(telemetry_batch_t *batch, const telemetry_batch_policy_t *policy,
+	const sensor_scale_t scales[SENSOR_CHANNEL_COUNT])
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->policy = *policy;
+	batch->scales = scales;
+	if (batch->policy.maxSamples == 0 || batch->policy.maxSamples > TELEMETRY_BATCH_CAPACITY) {
+		batch->policy.maxSamples = TELEMETRY_BATCH_CAPACITY;
+	}
+
+	// The scales don't change, so they are formatted once.  Only non-zero offsets are sent.
+	char *header = batch->scaleHeader;
+	const size_t headerSize = sizeof(batch->scaleHeader);
+	int length = snprintf(header, headerSize, "\"scale\": {");
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT && length >= 0 && (size_t)length < headerSize; ch++) {
+		length += snprintf(header + length, headerSize - (size_t)length, "%s\"%s\": %.9g", (ch > 0) ? ", " : "",
+			sensorChannelKeys[ch], scales[ch].scale);
+	}
+	bool firstOffset = true;
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT && length >= 0 && (size_t)length < headerSize; ch++) {
+		if (scales[ch].offset == 0.0f) {
+			continue;
+		}
+		length += snprintf(header + length, headerSize - (size_t)length, "%s\"%s\": %.9g",
+			firstOffset ? "}, \"offset\": {" : ", ", sensorChannelKeys[ch], scales[ch].offset);
+		firstOffset = false;
+	}
+	if (length >= 0 && (size_t)length < headerSize) {
+		length += snprintf(header + length, headerSize - (size_t)length, "}");
+	}
+	if (length < 0 || (size_t)length >= headerSize) {
+		Log_Debug("ERROR: telemetry batch scale header does not fit in %zu bytes\n", headerSize);
+		header[0] = '\0';
+		length = 0;
+	}
+
+	if (batch->policy.encoding == TELEMETRY_ENCODING_CBOR) {
+		// Map head, the six header pairs with the longest t0 and array heads, and a two byte key
+		// and three byte array head per channel
+		batch->fixedBytes = 1 + 2 + 3 + 10 + 4 + 3 + TELEMETRY_BATCH_TAGS_RESERVE + 2 + SENSOR_CHANNEL_COUNT * 5;
+		return;
+	}
+	if (batch->policy.encoding == TELEMETRY_ENCODING_COMPRESSED) {
+		// Map head, the five header pairs with the longest t0, and the block's key and head
+		batch->fixedBytes = 1 + 2 + 3 + 10 + 3 + TELEMETRY_BATCH_TAGS_RESERVE + 2 + 4;
+		return;
+	}
+
+	// Each channel adds ", \"<key>\": []" around its array
+	batch->fixedBytes = TELEMETRY_BATCH_BASE_BYTES + TELEMETRY_BATCH_TAGS_RESERVE + (size_t)length;
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		batch->fixedBytes += strlen(sensorChannelKeys[ch]) + 8;
+	}
+}
+
+bool TelemetryBatch_Fits(const telemetry_batch_t *batch, const int32_t row[SENSOR_CHANNEL_COUNT])
+{
+	if (batch->count == 0) {
+		return true;
+	}
+
+	// Size the row on copies of the coders, it may not be added
+	ts_dod_state_t timeCoder = batch->timeCoder;
+	ts_delta_state_t columnCoders[SENSOR_CHANNEL_COUNT];
+	memcpy(columnCoders, batch->columnCoders, sizeof(columnCoders));
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const size_t bits = batch->rowBits +
+		rowBits(batch, &timeCoder, columnCoders, millisecondsSince(&batch->firstMonotonic, &now), row);
+	return batch->fixedBytes + (bits + 7) / 8 <= batch->policy.maxBytes;
+}
+
+int TelemetryBatch_Add(telemetry_batch_t *batch, const int32_t row[SENSOR_CHANNEL_COUNT])
+{
+	if (batch->count >= TELEMETRY_BATCH_CAPACITY) {
+		return -1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (batch->count == 0) {
+		batch->firstMonotonic = now;
+		clock_gettime(CLOCK_REALTIME, &batch->firstTime);
+	}
+
+	const uint16_t i = batch->count++;
+	batch->offset_ms[i] = millisecondsSince(&batch->firstMonotonic, &now);
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		batch->columns[ch][i] = row[ch];
+	}
+	batch->rowBits += rowBits(batch, &batch->timeCoder, batch->columnCoders, batch->offset_ms[i], row);
+	return 0;
+}
+
+bool TelemetryBatch_IsDue(const telemetry_batch_t *batch, telemetry_flush_reason_t *reason)
+{
+	if (batch->count == 0) {
+		return false;
+	}
+	if (batch->count >= batch->policy.maxSamples) {
+		*reason = TELEMETRY_FLUSH_SAMPLES;
+		return true;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (batch->policy.maxAge_ms > 0 && millisecondsSince(&batch->firstMonotonic, &now) >= batch->policy.maxAge_ms) {
+		*reason = TELEMETRY_FLUSH_AGE;
+		return true;
+	}
+	return false;
+}
+
+/// <summary>
+///     Appends ", \"<key>\": [v0,v1,...]" for one column.
+/// </summary>
+static int appendColumn(char *buffer, size_t bufferSize, int length, const char *key, const int32_t *values,
+	uint16_t count)
+{
+	length += snprintf(buffer + length, bufferSize - (size_t)length, ", \"%s\": [", key);
+	for (uint16_t i = 0; i < count && length >= 0 && (size_t)length < bufferSize; i++) {
+		length += snprintf(buffer + length, bufferSize - (size_t)length, (i > 0) ? ",%ld" : "%ld", (long)values[i]);
+	}
+	if (length >= 0 && (size_t)length < bufferSize) {
+		length += snprintf(buffer + length, bufferSize - (size_t)length, "]");
+	}
+	return length;
+}
+
+static int formatJson(const telemetry_batch_t *batch, const telemetry_batch_tags_t *tags, char *buffer, size_t bufferSize)
+{
+	int length = snprintf(buffer, bufferSize, "{\"n\": %u, \"t0\": %lld.%03ld, \"dt\": [", (unsigned)batch->count,
+		(long long)batch->firstTime.tv_sec, batch->firstTime.tv_nsec / 1000000);
+	for (uint16_t i = 0; i < batch->count && length >= 0 && (size_t)length < bufferSize; i++) {
+		length += snprintf(buffer + length, bufferSize - (size_t)length, (i > 0) ? ",%lu" : "%lu",
+			(unsigned long)batch->offset_ms[i]);
+	}
+	if (length >= 0 && (size_t)length < bufferSize) {
+		length += snprintf(buffer + length, bufferSize - (size_t)length, "], \"phase\": \"%s\", \"xlFs\": %d, %s",
+			tags->phase, tags->accelRange_g, batch->scaleHeader);
+	}
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT && length >= 0 && (size_t)length < bufferSize; ch++) {
+		length = appendColumn(buffer, bufferSize, length, sensorChannelKeys[ch], batch->columns[ch], batch->count);
+	}
+
+	if (length < 0 || (size_t)length + 2 > bufferSize) {
+		return -1;
+	}
+	buffer[length++] = '}';
+	buffer[length] = '\0';
+	return length;
+}
+
+static int encodeCbor(const telemetry_batch_t *batch, const telemetry_batch_tags_t *tags, uint8_t *buffer, size_t bufferSize)
+{
+	cbor_writer_t writer;
+	Cbor_Init(&writer, buffer, bufferSize);
+
+	Cbor_PutMap(&writer, 6 + SENSOR_CHANNEL_COUNT);
+	Cbor_PutUint(&writer, 0);
+	Cbor_PutUint(&writer, TELEMETRY_CBOR_SCHEMA_ID);
+	Cbor_PutUint(&writer, 1);
+	Cbor_PutUint(&writer, batch->count);
+	Cbor_PutUint(&writer, 2);
+	Cbor_PutUint(&writer, (uint64_t)batch->firstTime.tv_sec * 1000u + (uint64_t)(batch->firstTime.tv_nsec / 1000000));
+	Cbor_PutUint(&writer, 3);
+	Cbor_PutArray(&writer, batch->count);
+	for (uint16_t i = 0; i < batch->count; i++) {
+		Cbor_PutUint(&writer, batch->offset_ms[i]);
+	}
+	Cbor_PutUint(&writer, 4);
+	Cbor_PutText(&writer, tags->phase);
+	Cbor_PutUint(&writer, 5);
+	Cbor_PutUint(&writer, (uint64_t)tags->accelRange_g);
+
+	for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+		Cbor_PutUint(&writer, 16u + (unsigned)ch);
+		Cbor_PutArray(&writer, batch->count);
+		for (uint16_t i = 0; i < batch->count; i++) {
+			Cbor_PutInt(&writer, batch->columns[ch][i]);
+		}
+	}
+
+	return writer.overflow ? -1 : (int)writer.length;
+}
+
+static int encodeCompressed(const telemetry_batch_t *batch, const telemetry_batch_tags_t *tags, uint8_t *buffer,
+	size_t bufferSize)
+{
+	cbor_writer_t writer;
+	Cbor_Init(&writer, buffer, bufferSize);
+
+	Cbor_PutMap(&writer, 6);
+	Cbor_PutUint(&writer, 0);
+	Cbor_PutUint(&writer, TELEMETRY_CBOR_COMPRESSED_SCHEMA_ID);
+	Cbor_PutUint(&writer, 1);
+	Cbor_PutUint(&writer, batch->count);
+	Cbor_PutUint(&writer, 2);
+	Cbor_PutUint(&writer, (uint64_t)batch->firstTime.tv_sec * 1000u + (uint64_t)(batch->firstTime.tv_nsec / 1000000));
+	Cbor_PutUint(&writer, 4);
+	Cbor_PutText(&writer, tags->phase);
+	Cbor_PutUint(&writer, 5);
+	Cbor_PutUint(&writer, (uint64_t)tags->accelRange_g);
+
+	// The coders have been sizing the block as rows arrived
+	const size_t blockLength = (batch->rowBits + 7) / 8;
+	Cbor_PutUint(&writer, 6);
+	Cbor_PutBytesHead(&writer, blockLength);
+	uint8_t *block = Cbor_Reserve(&writer, blockLength);
+	if (block == NULL || TsCodec_EncodeBlock(block, blockLength, batch->offset_ms, &batch->columns[0][0],
+		TELEMETRY_BATCH_CAPACITY, SENSOR_CHANNEL_COUNT, batch->count) != (int)blockLength) {
+		return -1;
+	}
+
+	return writer.overflow ? -1 : (int)writer.length;
+}
+
+int TelemetryBatch_Flush(telemetry_batch_t *batch, const telemetry_batch_tags_t *tags, telemetry_flush_reason_t reason,
+	void *buffer, size_t bufferSize)
+{
+	if (batch->count == 0) {
+		return 0;
+	}
+
+	struct timespec start, end;
+	int length;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch (batch->policy.encoding) {
+	case TELEMETRY_ENCODING_COMPRESSED:
+		length = encodeCompressed(batch, tags, (uint8_t *)buffer, bufferSize);
+		break;
+	case TELEMETRY_ENCODING_CBOR:
+		length = encodeCbor(batch, tags, (uint8_t *)buffer, bufferSize);
+		break;
+	default:
+		length = formatJson(batch, tags, (char *)buffer, bufferSize);
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	const uint16_t samples = batch->count;
+	batch->count = 0;
+	batch->rowBits = 0;
+	memset(&batch->timeCoder, 0, sizeof(batch->timeCoder));
+	memset(batch->columnCoders, 0, sizeof(batch->columnCoders));
+
+	if (length < 0) {
+		Log_Debug("ERROR: telemetry batch of %u samples does not fit in %zu bytes\n", (unsigned)samples, bufferSize);
+		return -1;
+	}
+
+	batch->counters.messages++;
+	batch->counters.samples += samples;
+	batch->counters.bytes += (uint64_t)length;
+	batch->counters.rawBytes += (uint64_t)samples * (1 + SENSOR_CHANNEL_COUNT) * sizeof(int32_t);
+	batch->counters.encodeNanoseconds += elapsedNanoseconds(&start, &end);
+	batch->counters.flushes[reason]++;
+	return length;
+}
+
+int TelemetryBatch_GetSchemaId(const telemetry_batch_t *batch)
+{
+	switch (batch->policy.encoding) {
+	case TELEMETRY_ENCODING_COMPRESSED:
+		return TELEMETRY_CBOR_COMPRESSED_SCHEMA_ID;
+	case TELEMETRY_ENCODING_CBOR:
+		return TELEMETRY_CBOR_SCHEMA_ID;
+	default:
+		return 0;
+	}
+}
+
+void TelemetryBatch_LogCounters(const telemetry_batch_t *batch)
+{
+	const telemetry_batch_counters_t *c = &batch->counters;
+	if (c->messages == 0) {
+		return;
+	}
+	Log_Debug("[Info] Telemetry batches: %u messages, %u samples (%.1f per message), %.0f bytes per message, "
+		"%.1f bytes per sample (%.1f:1 against 32 bit values), encoded in %.0f ns per sample; "
+		"sent on count %u, age %u, size %u, forced %u\n",
+		c->messages, c->samples, (float)c->samples / (float)c->messages, (double)c->bytes / c->messages,
+		(double)c->bytes / c->samples, (double)c->rawBytes / (double)c->bytes, (double)c->encodeNanoseconds / c->samples,
+		c->flushes[TELEMETRY_FLUSH_SAMPLES], c->flushes[TELEMETRY_FLUSH_AGE],
+		c->flushes[TELEMETRY_FLUSH_SIZE], c->flushes[TELEMETRY_FLUSH_FORCED]);
+}
+
+#ifdef TELEMETRY_ENCODING_BENCHMARK_SAMPLES
+/// <summary>
+///     Uniform noise in [-amplitude, amplitude] for the synthetic trace.
+/// </summary>
+static int32_t benchmarkNoise(uint32_t *seed, int32_t amplitude)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return (int32_t)((*seed >> 8) % (uint32_t)(2 * amplitude + 1)) - amplitude;
+}
+
+void TelemetryBatch_RunBenchmark(size_t sampleCount, const sensor_scale_t scales[SENSOR_CHANNEL_COUNT])
+{
+	enum { BENCHMARK_ENCODINGS = 3 };
+	static const telemetry_batch_tags_t tags = { .phase = "filling", .accelRange_g = 4 };
+	static const char *const names[1 + BENCHMARK_ENCODINGS] = { "per-sample snprintf", "JSON batch", "CBOR batch",
+		"compressed batch" };
+	static telemetry_batch_t batches[BENCHMARK_ENCODINGS];
+	static uint8_t message[16384];
+	static int32_t raw[TELEMETRY_BATCH_CAPACITY][SENSOR_CHANNEL_COUNT];
+	static uint32_t decodedTimes[TELEMETRY_BATCH_CAPACITY];
+	static int32_t decoded[SENSOR_CHANNEL_COUNT][TELEMETRY_BATCH_CAPACITY];
+	uint64_t nanoseconds[1 + BENCHMARK_ENCODINGS] = { 0 };
+	uint64_t bytes[1 + BENCHMARK_ENCODINGS] = { 0 };
+	uint64_t decodeNanoseconds = 0, floatBits = 0;
+	size_t mismatches = 0, sample = 0;
+	struct timespec start, end;
+	uint32_t seed = 12345;
+
+	for (int e = 0; e < BENCHMARK_ENCODINGS; e++) {
+		telemetry_batch_policy_t policy = { .maxSamples = TELEMETRY_BATCH_CAPACITY, .maxAge_ms = 0,
+			.maxBytes = sizeof(message), .encoding = (telemetry_encoding_t)(TELEMETRY_ENCODING_JSON + e) };
+		TelemetryBatch_Init(&batches[e], &policy, scales);
+	}
+
+	for (size_t done = 0; done < sampleCount; done += TELEMETRY_BATCH_CAPACITY) {
+		size_t n = (sampleCount - done < TELEMETRY_BATCH_CAPACITY) ? sampleCount - done : TELEMETRY_BATCH_CAPACITY;
+
+		// A drum heating up: a level, vibrating board, pressure and temperatures ramping slowly,
+		// a steady LIDAR target, each with sensor noise
+		for (size_t i = 0; i < n; i++, sample++) {
+			const int32_t ramp = (int32_t)(sample / 4);
+			raw[i][SENSOR_CH_ACCEL_X] = benchmarkNoise(&seed, 400);
+			raw[i][SENSOR_CH_ACCEL_Y] = benchmarkNoise(&seed, 400);
+			raw[i][SENSOR_CH_ACCEL_Z] = 16393 * 16 + benchmarkNoise(&seed, 400);
+			for (int axis = 0; axis < 3; axis++) {
+				raw[i][SENSOR_CH_GYRO_X + axis] = benchmarkNoise(&seed, 4);
+			}
+			raw[i][SENSOR_CH_PRESSURE] = 4150000 + 40 * ramp + benchmarkNoise(&seed, 30);
+			raw[i][SENSOR_CH_LSM6DSO_TEMP] = 1280 + ramp + benchmarkNoise(&seed, 3);
+			raw[i][SENSOR_CH_LPS22HH_TEMP] = 2200 + ramp / 2 + benchmarkNoise(&seed, 1);
+			raw[i][SENSOR_CH_STRAIN] = 600 + ramp / 8 + benchmarkNoise(&seed, 5);
+			raw[i][SENSOR_CH_DISTANCE] = 1250 + benchmarkNoise(&seed, 1);
+			raw[i][SENSOR_CH_DISPLACEMENT] = benchmarkNoise(&seed, 150);
+			raw[i][SENSOR_CH_DISPLACEMENT_RATE] = benchmarkNoise(&seed, 500);
+			raw[i][SENSOR_CH_DISTANCE_CONFIDENCE] = 950 + benchmarkNoise(&seed, 10);
+		}
+
+		// The message per read the acquisition loop used to send, quoted floats and all
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < n; i++) {
+			float v[SENSOR_CHANNEL_COUNT];
+			SensorUnits_ConvertRow(raw[i], v, scales);
+			int length = snprintf((char *)message, 256, "{\"gX\":\"%.4lf\", \"gY\":\"%.4lf\", \"gZ\":\"%.4lf\", \"pressure\": \"%.2f\", \"aX\": \"%4.2f\", \"aY\": \"%4.2f\", \"aZ\": \"%4.2f\", \"d1\": \"%4.2f\", \"s1\": \"%4.2f\", \"phase\": \"%s\", \"xlFs\": %d}",
+				v[SENSOR_CH_ACCEL_X], v[SENSOR_CH_ACCEL_Y], v[SENSOR_CH_ACCEL_Z], v[SENSOR_CH_PRESSURE], v[SENSOR_CH_GYRO_X],
+				v[SENSOR_CH_GYRO_Y], v[SENSOR_CH_GYRO_Z], v[SENSOR_CH_DISTANCE], v[SENSOR_CH_STRAIN], tags.phase, tags.accelRange_g);
+			bytes[0] += (length > 0) ? (uint64_t)length : 0u;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		nanoseconds[0] += elapsedNanoseconds(&start, &end);
+
+		int length = 0;
+		for (int e = 0; e < BENCHMARK_ENCODINGS; e++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (size_t i = 0; i < n; i++) {
+				TelemetryBatch_Add(&batches[e], raw[i]);
+			}
+			const uint32_t blockBits = (uint32_t)batches[e].rowBits;
+			length = TelemetryBatch_Flush(&batches[e], &tags, TELEMETRY_FLUSH_FORCED, message, sizeof(message));
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			nanoseconds[1 + e] += elapsedNanoseconds(&start, &end);
+			bytes[1 + e] += (length > 0) ? (uint64_t)length : 0u;
+
+			// The compressed block is the tail of the message, decode it back
+			if (e == TELEMETRY_ENCODING_COMPRESSED && length > 0) {
+				const size_t blockLength = (blockBits + 7) / 8;
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				int result = TsCodec_DecodeBlock(message + length - blockLength, blockLength, decodedTimes, &decoded[0][0],
+					TELEMETRY_BATCH_CAPACITY, SENSOR_CHANNEL_COUNT, (uint16_t)n);
+				clock_gettime(CLOCK_MONOTONIC, &end);
+				decodeNanoseconds += elapsedNanoseconds(&start, &end);
+				for (size_t i = 0; i < n; i++) {
+					for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+						mismatches += (result != 0 || decoded[ch][i] != raw[i][ch]);
+					}
+				}
+			}
+		}
+
+		// The same trace in engineering units through the XOR float coder, for comparison
+		ts_xor_state_t floatCoders[SENSOR_CHANNEL_COUNT];
+		memset(floatCoders, 0, sizeof(floatCoders));
+		for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+			for (size_t i = 0; i < n; i++) {
+				floatBits += TsCodec_PutFloat(&floatCoders[ch], NULL, (float)raw[i][ch] * scales[ch].scale + scales[ch].offset);
+			}
+		}
+	}
+
+	if (sampleCount == 0) {
+		return;
+	}
+	for (int e = 0; e <= BENCHMARK_ENCODINGS; e++) {
+		Log_Debug("[Benchmark] %-19s %6.1f bytes/sample, %7.0f ns/sample\n", names[e], (double)bytes[e] / sampleCount,
+			(double)nanoseconds[e] / sampleCount);
+	}
+	Log_Debug("[Benchmark] (per-sample messages carry 9 of the %d channels, batches carry all of them)\n",
+		SENSOR_CHANNEL_COUNT);
+	Log_Debug("[Benchmark] compressed: %.1f:1 against 32 bit values, decoded in %.0f ns/sample, %u mismatches; "
+		"the channels as XOR coded floats would take %.1f bytes/sample\n",
+		(double)sampleCount * (1 + SENSOR_CHANNEL_COUNT) * sizeof(int32_t) / (double)bytes[1 + TELEMETRY_ENCODING_COMPRESSED],
+		(double)decodeNanoseconds / sampleCount, (unsigned)mismatches, (double)floatBits / 8.0 / sampleCount);
+}
+#endif
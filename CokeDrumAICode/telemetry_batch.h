@@ -0,0 +1,152 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "sensor_stats.h"
+#include "sensor_units.h"
+#include "ts_codec.h"
+
+// Most rows one batch can hold, whatever the policy asks for
+#define TELEMETRY_BATCH_CAPACITY 64
+
+// Room kept in every message for the phase name passed to TelemetryBatch_Flush()
+#define TELEMETRY_BATCH_TAGS_RESERVE 64
+
+// Identify the CBOR batch layouts below, the channel order of sensor_channel_t and the
+// scales the channels are sent at (sensorChannelScales in i2c.c).  Bump them when any of those
+// change so the backend can keep decoding older devices.
+//
+//   map {  0: schema id           1: n
+//          2: t0, ms since epoch  3: [ms since t0, ...]
+//          4: phase name          5: accelerometer range in g
+//          16 + channel: [counts, ...] for every sensor_channel_t }
+//
+// The compressed layout replaces key 3 and the channel arrays with one byte string under key
+// 6, a TsCodec_EncodeBlock() block of the ms offsets and every channel in sensor_channel_t order.
+#define TELEMETRY_CBOR_SCHEMA_ID 1
+#define TELEMETRY_CBOR_COMPRESSED_SCHEMA_ID 2
+#define TELEMETRY_CBOR_CONTENT_TYPE "application/cbor"
+
+typedef enum {
+	TELEMETRY_ENCODING_JSON = 0,
+	TELEMETRY_ENCODING_CBOR,
+	TELEMETRY_ENCODING_COMPRESSED
+} telemetry_encoding_t;
+
+// Why a batch was sent, indexes telemetry_batch_counters_t.flushes
+typedef enum {
+	TELEMETRY_FLUSH_SAMPLES = 0,   // Reached maxSamples
+	TELEMETRY_FLUSH_AGE,           // The oldest row reached maxAge_ms
+	TELEMETRY_FLUSH_SIZE,          // The next row would have gone over maxBytes
+	TELEMETRY_FLUSH_FORCED,        // The caller flushed, e.g. on a phase change
+	TELEMETRY_FLUSH_REASON_COUNT
+} telemetry_flush_reason_t;
+
+/// <summary>
+///     When a batch is sent: whichever limit is reached first.
+/// </summary>
+typedef struct {
+	uint16_t maxSamples;
+	uint32_t maxAge_ms;
+	size_t maxBytes;               // Of the encoded message
+	telemetry_encoding_t encoding;
+} telemetry_batch_policy_t;
+
+/// <summary>
+///     What is sent with every batch besides the samples.
+/// </summary>
+typedef struct {
+	const char *phase;
+	int accelRange_g;
+} telemetry_batch_tags_t;
+
+typedef struct {
+	uint32_t messages;
+	uint32_t samples;
+	uint64_t bytes;
+	uint64_t rawBytes;             // The samples as 32 bit values, for the compression ratio
+	uint64_t encodeNanoseconds;
+	uint32_t flushes[TELEMETRY_FLUSH_REASON_COUNT];
+} telemetry_batch_counters_t;
+
+/// <summary>
+///     Sample rows held column by column in raw counts, so a message carries one header and
+///     then one integer array per channel.
+/// </summary>
+typedef struct {
+	telemetry_batch_policy_t policy;
+	const sensor_scale_t *scales;
+	char scaleHeader[640];         // The JSON scale and offset objects, formatted once
+	size_t fixedBytes;             // Most a message takes before any rows are added
+	uint16_t count;
+	size_t rowBits;                // Size of the rows added so far, once encoded
+	ts_dod_state_t timeCoder;      // Compressed encoding only, tracks rowBits as rows arrive
+	ts_delta_state_t columnCoders[SENSOR_CHANNEL_COUNT];
+	struct timespec firstTime;     // Wall clock of the first row
+	struct timespec firstMonotonic;
+	uint32_t offset_ms[TELEMETRY_BATCH_CAPACITY];
+	int32_t columns[SENSOR_CHANNEL_COUNT][TELEMETRY_BATCH_CAPACITY];
+	telemetry_batch_counters_t counters;
+} telemetry_batch_t;
+
+/// <summary>
+///     Starts an empty batch.
+/// </summary>
+/// <param name="scales">Per-channel scales sent in the header, must stay valid</param>
+void TelemetryBatch_Init(telemetry_batch_t *batch, const telemetry_batch_policy_t *policy,
+	const sensor_scale_t scales[SENSOR_CHANNEL_COUNT]);
+
+/// <summary>
+///     Whether a row can be added without the message going over maxBytes.  An empty batch
+///     always takes a row.
+/// </summary>
+bool TelemetryBatch_Fits(const telemetry_batch_t *batch, const int32_t row[SENSOR_CHANNEL_COUNT]);
+
+/// <summary>
+///     Appends one row of raw counts, timestamped now.
+/// </summary>
+/// <returns>0 on success, or -1 if the batch is full (flush it first)</returns>
+int TelemetryBatch_Add(telemetry_batch_t *batch, const int32_t row[SENSOR_CHANNEL_COUNT]);
+
+/// <summary>
+///     Checks the sample count and age limits.
+/// </summary>
+/// <param name="reason">Set to the limit that was reached</param>
+/// <returns>true if the batch should be sent now</returns>
+bool TelemetryBatch_IsDue(const telemetry_batch_t *batch, telemetry_flush_reason_t *reason);
+
+/// <summary>
+///     Encodes the batch as one message in the policy's encoding and empties it.  JSON is
+///     {"n": N, "t0": epoch seconds, "dt": [ms since t0...], "phase": "...", "xlFs": g,
+///      "scale": {...}, "offset": {...}, "&lt;key&gt;": [counts...], ...}
+///     where value = counts * scale + offset, and NUL terminated.  CBOR and compressed are
+///     the TELEMETRY_CBOR_SCHEMA_ID and TELEMETRY_CBOR_COMPRESSED_SCHEMA_ID layouts.
+/// </summary>
+/// <param name="reason">Recorded in the counters</param>
+/// <returns>The length of the message, 0 if the batch was empty, or -1 if it did not fit</returns>
+int TelemetryBatch_Flush(telemetry_batch_t *batch, const telemetry_batch_tags_t *tags, telemetry_flush_reason_t reason,
+	void *buffer, size_t bufferSize);
+
+/// <summary>
+///     Schema ID of the batch's binary encoding, 0 for JSON.
+/// </summary>
+int TelemetryBatch_GetSchemaId(const telemetry_batch_t *batch);
+
+/// <summary>
+///     Logs the message, byte and samples per message counters.
+/// </summary>
+void TelemetryBatch_LogCounters(const telemetry_batch_t *batch);
+
+/// <summary>
+///     Times the per-sample snprintf message the acquisition loop used to send against the
+///     JSON, CBOR and compressed batches over a synthetic drum trace, and logs the bytes and
+///     encode time per sample of each and the compressed block's decode time.  Only built with
+///     TELEMETRY_ENCODING_BENCHMARK_SAMPLES, its buffers would otherwise sit in RAM for nothing.
+/// </summary>
+void TelemetryBatch_RunBenchmark(size_t sampleCount, const sensor_scale_t scales[SENSOR_CHANNEL_COUNT]);
@@ -0,0 +1,372 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+/************************************************************************************************
+   Store-and-forward log for telemetry the hub couldn't take.  It lives in mutable storage after
+   the calibration slots, TELEMETRY_QUEUE_BYTES split into TELEMETRY_QUEUE_BLOCK_SIZE blocks, and
+   is written front to back as a ring.  Each record starts on a block boundary:
+
+      uint32_t magic         "CDTQ" waiting, "CDTX" once delivered
+      uint32_t sequence      one more than the record before it
+      uint16_t length        payload bytes
+      uint8_t lane           send lane, 0 (telemetry) in records from before there were lanes
+      uint8_t reserved
+      uint32_t committedAt   UTC epoch seconds the message was committed, 0 if unknown
+      char contentType[20]
+      char schema[12]
+      uint32_t crc           CRC-32 of sequence..schema and the payload (not the magic)
+      payload
+
+   A record goes out in a single write followed by fsync.  A torn write fails the CRC, so after
+   a crash the log is rebuilt by checking every block boundary for a good record: the newest one
+   sets where writing continues, the waiting ones are replayed in sequence order, the highest
+   lane first.  Delivery
+   only rewrites the magic.  A record that doesn't fit before the end starts again at block 0;
+   the waiting records it lands on, and any skipped at the end, are the oldest and are given up.
+*************************************************************************************************/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "build_options.h"
+#include "calibration_store.h"
+#include "crc32.h"
+#include "telemetry_queue.h"
+
+#define TELEMETRY_QUEUE_MAGIC 0x51544443u            // "CDTQ"
+#define TELEMETRY_QUEUE_DELIVERED_MAGIC 0x58544443u  // "CDTX"
+
+// The calibration store comes first
+#define TELEMETRY_QUEUE_OFFSET CALIBRATION_STORE_BYTES
+#define TELEMETRY_QUEUE_BLOCK_SIZE 256
+#define TELEMETRY_QUEUE_BLOCKS (TELEMETRY_QUEUE_BYTES / TELEMETRY_QUEUE_BLOCK_SIZE)
+
+_Static_assert(TELEMETRY_QUEUE_BYTES % TELEMETRY_QUEUE_BLOCK_SIZE == 0, "TELEMETRY_QUEUE_BYTES must be whole blocks");
+_Static_assert(TELEMETRY_QUEUE_OFFSET + TELEMETRY_QUEUE_BYTES <= MUTABLE_STORAGE_BYTES,
+	"The telemetry queue must fit in mutable storage after the calibration store");
+
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;
+	uint16_t length;
+	uint8_t lane;
+	uint8_t reserved;
+	uint32_t committedAt;
+	char contentType[20];
+	char schema[12];
+	uint32_t crc;
+} telemetry_queue_header_t;
+
+_Static_assert(sizeof(telemetry_queue_header_t) + TELEMETRY_QUEUE_MAX_PAYLOAD <= TELEMETRY_QUEUE_BYTES, "TELEMETRY_QUEUE_BYTES can't hold a message");
+
+// Where a waiting record is
+typedef struct {
+	uint16_t block;
+	uint8_t blocks;
+	uint8_t lane;
+	uint32_t sequence;
+} telemetry_queue_entry_t;
+
+// Waiting records, oldest first, as a ring over entries[]
+static telemetry_queue_entry_t entries[TELEMETRY_QUEUE_BLOCKS];
+static unsigned oldest = 0;
+static unsigned count = 0;
+
+// Block the next record is written at and its sequence number
+static unsigned head = 0;
+static uint32_t nextSequence = 1;
+
+static bool recovered = false;
+
+// One record as written: the header and payload go out together
+static uint8_t recordBuffer[sizeof(telemetry_queue_header_t) + TELEMETRY_QUEUE_MAX_PAYLOAD];
+
+static uint32_t recordCrc(const telemetry_queue_header_t *header, const uint8_t *payload)
+{
+	const size_t start = offsetof(telemetry_queue_header_t, sequence);
+	uint32_t crc = Crc32_Update(CRC32_INIT, (const uint8_t *)header + start, offsetof(telemetry_queue_header_t, crc) - start);
+	return ~Crc32_Update(crc, payload, header->length);
+}
+
+static unsigned blocksFor(size_t length)
+{
+	return (unsigned)((sizeof(telemetry_queue_header_t) + length + TELEMETRY_QUEUE_BLOCK_SIZE - 1) / TELEMETRY_QUEUE_BLOCK_SIZE);
+}
+
+static off_t blockOffset(unsigned block)
+{
+	return (off_t)TELEMETRY_QUEUE_OFFSET + (off_t)block * TELEMETRY_QUEUE_BLOCK_SIZE;
+}
+
+static int openStorage(void)
+{
+	int fd = Storage_OpenMutableFile();
+	if (fd < 0) {
+		Log_Debug("ERROR: Storage_OpenMutableFile: errno=%d (%s)\n", errno, strerror(errno));
+	}
+	return fd;
+}
+
+/// <summary>
+///     Reads and validates the record starting at a block, leaving its payload in recordBuffer.
+/// </summary>
+/// <returns>0 if the block starts an intact record</returns>
+static int readRecord(int fd, unsigned block, telemetry_queue_header_t *header)
+{
+	if (pread(fd, header, sizeof(*header), blockOffset(block)) != (ssize_t)sizeof(*header) ||
+		(header->magic != TELEMETRY_QUEUE_MAGIC && header->magic != TELEMETRY_QUEUE_DELIVERED_MAGIC) ||
+		header->length > TELEMETRY_QUEUE_MAX_PAYLOAD || block + blocksFor(header->length) > TELEMETRY_QUEUE_BLOCKS) {
+		return -1;
+	}
+
+	uint8_t *payload = recordBuffer + sizeof(*header);
+	if (pread(fd, payload, header->length, blockOffset(block) + (off_t)sizeof(*header)) != (ssize_t)header->length) {
+		return -1;
+	}
+	return (recordCrc(header, payload) == header->crc) ? 0 : -1;
+}
+
+static telemetry_queue_entry_t *entryAt(unsigned index)
+{
+	return &entries[(oldest + index) % TELEMETRY_QUEUE_BLOCKS];
+}
+
+static void dropOldest(void)
+{
+	oldest = (oldest + 1) % TELEMETRY_QUEUE_BLOCKS;
+	count--;
+}
+
+/// <summary>
+///     Removes an entry from anywhere in the ring, keeping the rest in order.
+/// </summary>
+static void dropEntry(unsigned index)
+{
+	for (unsigned i = index; i > 0; i--) {
+		*entryAt(i) = *entryAt(i - 1);
+	}
+	dropOldest();
+}
+
+/// <summary>
+///     Index of the entry to replay next: the oldest in the highest lane.
+/// </summary>
+static unsigned nextEntry(void)
+{
+	unsigned next = 0;
+	for (unsigned i = 1; i < count; i++) {
+		if (entryAt(i)->lane > entryAt(next)->lane) {
+			next = i;
+		}
+	}
+	return next;
+}
+
+static int markDelivered(int fd, unsigned block)
+{
+	const uint32_t magic = TELEMETRY_QUEUE_DELIVERED_MAGIC;
+	if (pwrite(fd, &magic, sizeof(magic), blockOffset(block)) != (ssize_t)sizeof(magic) || fsync(fd) != 0) {
+		Log_Debug("ERROR: marking a stored message delivered: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/// <summary>
+///     Rebuilds the write position and the waiting records from storage.
+/// </summary>
+static void recover(void)
+{
+	recovered = true;
+
+	int fd = openStorage();
+	if (fd < 0) {
+		return;
+	}
+
+	bool haveNewest = false;
+	uint32_t newestSequence = 0;
+	telemetry_queue_header_t header;
+
+	for (unsigned block = 0; block < TELEMETRY_QUEUE_BLOCKS; block++) {
+		if (readRecord(fd, block, &header) != 0) {
+			continue;
+		}
+
+		const unsigned blocks = blocksFor(header.length);
+		// Sequence numbers are compared modulo 2^32
+		if (!haveNewest || (int32_t)(header.sequence - newestSequence) > 0) {
+			haveNewest = true;
+			newestSequence = header.sequence;
+			head = (block + blocks) % TELEMETRY_QUEUE_BLOCKS;
+		}
+
+		if (header.magic == TELEMETRY_QUEUE_MAGIC) {
+			// Insertion sort by sequence, the log holds a few hundred records at most
+			unsigned i = count++;
+			while (i > 0 && (int32_t)(header.sequence - entries[i - 1].sequence) < 0) {
+				entries[i] = entries[i - 1];
+				i--;
+			}
+			entries[i] = (telemetry_queue_entry_t){ .block = (uint16_t)block, .blocks = (uint8_t)blocks,
+				.lane = header.lane, .sequence = header.sequence };
+		}
+		block += blocks - 1;
+	}
+	close(fd);
+
+	if (haveNewest) {
+		nextSequence = newestSequence + 1;
+	}
+	Log_Debug("INFO: telemetry queue holds %u message(s), next sequence %u\n", count, nextSequence);
+}
+
+int TelemetryQueue_Append(uint8_t lane, time_t committedAt, const uint8_t *payload, size_t length, const char *contentType,
+	const char *schema)
+{
+	if (!recovered) {
+		recover();
+	}
+	if (length > TELEMETRY_QUEUE_MAX_PAYLOAD) {
+		Log_Debug("ERROR: %zu byte message is too large to store\n", length);
+		return -1;
+	}
+
+	int fd = openStorage();
+	if (fd < 0) {
+		return -1;
+	}
+
+	const unsigned blocks = blocksFor(length);
+	const unsigned skipFrom = head;
+	const bool wraps = (head + blocks > TELEMETRY_QUEUE_BLOCKS);
+	const unsigned start = wraps ? 0 : head;
+
+	// Give up the oldest records in the way.  When wrapping, those in the unused space at the
+	// end are older still; they aren't overwritten, so they are marked to stay given up.
+	unsigned dropped = 0;
+	while (count > 0) {
+		const telemetry_queue_entry_t *entry = entryAt(0);
+		const bool inSkipped = wraps && entry->block >= skipFrom;
+		const bool inRecord = entry->block >= start && entry->block < start + blocks;
+		if (!inSkipped && !inRecord) {
+			break;
+		}
+		if (inSkipped) {
+			markDelivered(fd, entry->block);
+		}
+		dropOldest();
+		dropped++;
+	}
+	if (dropped > 0) {
+		Log_Debug("WARNING: telemetry queue full, gave up the %u oldest message(s)\n", dropped);
+	}
+
+	telemetry_queue_header_t header = {
+		.magic = TELEMETRY_QUEUE_MAGIC,
+		.sequence = nextSequence,
+		.length = (uint16_t)length,
+		.lane = lane,
+		.committedAt = (committedAt > 0) ? (uint32_t)committedAt : 0
+	};
+	strncpy(header.contentType, contentType, sizeof(header.contentType) - 1);
+	if (schema != NULL) {
+		strncpy(header.schema, schema, sizeof(header.schema) - 1);
+	}
+	header.crc = recordCrc(&header, payload);
+
+	memcpy(recordBuffer, &header, sizeof(header));
+	memcpy(recordBuffer + sizeof(header), payload, length);
+
+	int result = 0;
+	const size_t recordLength = sizeof(header) + length;
+	if (pwrite(fd, recordBuffer, recordLength, blockOffset(start)) != (ssize_t)recordLength || fsync(fd) != 0) {
+		Log_Debug("ERROR: storing a message: errno=%d (%s)\n", errno, strerror(errno));
+		result = -1;
+	}
+	close(fd);
+
+	if (result == 0) {
+		*entryAt(count++) = (telemetry_queue_entry_t){ .block = (uint16_t)start, .blocks = (uint8_t)blocks,
+			.lane = lane, .sequence = nextSequence };
+		head = (start + blocks) % TELEMETRY_QUEUE_BLOCKS;
+		nextSequence++;
+	}
+	return result;
+}
+
+int TelemetryQueue_Peek(telemetry_queue_message_t *message, uint8_t *buffer, size_t size)
+{
+	if (!recovered) {
+		recover();
+	}
+	if (count == 0) {
+		return -1;
+	}
+
+	int fd = openStorage();
+	if (fd < 0) {
+		return -1;
+	}
+
+	int result = -1;
+	telemetry_queue_header_t header;
+	while (count > 0) {
+		const unsigned next = nextEntry();
+		const telemetry_queue_entry_t *entry = entryAt(next);
+		if (readRecord(fd, entry->block, &header) == 0 && header.magic == TELEMETRY_QUEUE_MAGIC &&
+			header.sequence == entry->sequence && header.length <= size) {
+			message->sequence = header.sequence;
+			message->lane = header.lane;
+			message->length = header.length;
+			message->committedAt = (time_t)header.committedAt;
+			memcpy(message->contentType, header.contentType, sizeof(message->contentType));
+			message->contentType[sizeof(message->contentType) - 1] = '\0';
+			memcpy(message->schema, header.schema, sizeof(message->schema));
+			message->schema[sizeof(message->schema) - 1] = '\0';
+			memcpy(buffer, recordBuffer + sizeof(header), header.length);
+			result = 0;
+			break;
+		}
+		Log_Debug("WARNING: stored message %u is unreadable, dropping it\n", entry->sequence);
+		dropEntry(next);
+	}
+	close(fd);
+	return result;
+}
+
+int TelemetryQueue_Consume(uint32_t sequence)
+{
+	unsigned index = 0;
+	while (index < count && entryAt(index)->sequence != sequence) {
+		index++;
+	}
+	if (index == count) {
+		return -1;
+	}
+
+	int fd = openStorage();
+	if (fd < 0) {
+		return -1;
+	}
+	const int result = markDelivered(fd, entryAt(index)->block);
+	close(fd);
+
+	// Drop it either way; if the mark didn't make it the worst case is a duplicate after a restart
+	dropEntry(index);
+	return result;
+}
+
+unsigned TelemetryQueue_Count(void)
+{
+	if (!recovered) {
+		recover();
+	}
+	return count;
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Largest payload the log holds; a telemetry batch or a window record
+#define TELEMETRY_QUEUE_MAX_PAYLOAD 4096
+
+/// <summary>
+///     One stored message as handed back for replay.  The sequence number is unique to the
+///     device and increases by one per stored message, so the backend can drop a replay it
+///     has already seen.
+/// </summary>
+typedef struct {
+	uint32_t sequence;
+	uint8_t lane;                                      // Send lane it was stored from
+	uint16_t length;
+	time_t committedAt;                                // UTC, 0 if the clock wasn't set
+	char contentType[20];
+	char schema[12];                                   // Empty for JSON messages
+} telemetry_queue_message_t;
+
+/// <summary>
+///     Appends a message to the log in mutable storage and syncs it.  When the log is full the
+///     oldest messages are given up to make room.
+/// </summary>
+/// <param name="lane">Send lane, higher lanes are replayed first.</param>
+/// <param name="committedAt">When the message was committed, UTC.</param>
+/// <param name="schema">The "schema" application property, or NULL for none.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TelemetryQueue_Append(uint8_t lane, time_t committedAt, const uint8_t *payload, size_t length, const char *contentType,
+	const char *schema);
+
+/// <summary>
+///     Reads the next message to replay, the oldest not yet delivered in the highest lane.  A
+///     record that no longer reads back intact is dropped and the next one is tried.
+/// </summary>
+/// <param name="buffer">Receives the payload, at least TELEMETRY_QUEUE_MAX_PAYLOAD bytes.</param>
+/// <returns>0 if a message was read, or -1 if the log is empty</returns>
+int TelemetryQueue_Peek(telemetry_queue_message_t *message, uint8_t *buffer, size_t size);
+
+/// <summary>
+///     Marks the waiting message with this sequence number delivered.
+/// </summary>
+/// <returns>0 on success, or -1 if no such message is waiting or the mark couldn't be written</returns>
+int TelemetryQueue_Consume(uint32_t sequence);
+
+/// <summary>
+///     Number of messages waiting for replay.  The first call recovers the log from storage.
+/// </summary>
+unsigned TelemetryQueue_Count(void);
@@ -0,0 +1,350 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "ts_codec.h"
+
+static void putBits(ts_bit_writer_t *writer, uint64_t value, unsigned bitCount)
+{
+	if (writer == NULL || writer->overflow) {
+		return;
+	}
+	if (writer->bits + bitCount > writer->size * 8) {
+		writer->overflow = true;
+		return;
+	}
+
+	// Fill the current byte, then whole bytes, most significant bits first
+	while (bitCount > 0) {
+		const unsigned used = (unsigned)(writer->bits & 7);
+		const unsigned take = (bitCount < 8 - used) ? bitCount : 8 - used;
+		const uint8_t chunk = (uint8_t)((value >> (bitCount - take)) & ((1u << take) - 1));
+		uint8_t *out = &writer->buffer[writer->bits >> 3];
+
+		if (used == 0) {
+			*out = 0;
+		}
+		*out |= (uint8_t)(chunk << (8 - used - take));
+		writer->bits += take;
+		bitCount -= take;
+	}
+}
+
+static uint64_t getBits(ts_bit_reader_t *reader, unsigned bitCount)
+{
+	if (reader->underflow || reader->bits + bitCount > reader->size * 8) {
+		reader->underflow = true;
+		return 0;
+	}
+
+	uint64_t value = 0;
+	while (bitCount > 0) {
+		const unsigned used = (unsigned)(reader->bits & 7);
+		const unsigned take = (bitCount < 8 - used) ? bitCount : 8 - used;
+		const uint8_t byte = reader->buffer[reader->bits >> 3];
+
+		value = (value << take) | ((byte >> (8 - used - take)) & ((1u << take) - 1));
+		reader->bits += take;
+		bitCount -= take;
+	}
+	return value;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static size_t putVarint(ts_bit_writer_t *writer, int64_t value)
+{
+	uint64_t remaining = zigzag(value);
+	size_t bits = 0;
+	do {
+		const uint8_t group = (uint8_t)(remaining & 0x7f);
+		remaining >>= 7;
+		putBits(writer, (remaining != 0) ? (0x80u | group) : group, 8);
+		bits += 8;
+	} while (remaining != 0);
+	return bits;
+}
+
+static int getVarint(ts_bit_reader_t *reader, int64_t *value)
+{
+	uint64_t result = 0;
+	for (unsigned shift = 0; shift < 70; shift += 7) {
+		const uint64_t group = getBits(reader, 8);
+		if (reader->underflow) {
+			return -1;
+		}
+		result |= (group & 0x7f) << shift;
+		if ((group & 0x80) == 0) {
+			*value = unzigzag(result);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void TsCodec_InitWriter(ts_bit_writer_t *writer, uint8_t *buffer, size_t size)
+{
+	writer->buffer = buffer;
+	writer->size = size;
+	writer->bits = 0;
+	writer->overflow = false;
+}
+
+void TsCodec_InitReader(ts_bit_reader_t *reader, const uint8_t *buffer, size_t size)
+{
+	reader->buffer = buffer;
+	reader->size = size;
+	reader->bits = 0;
+	reader->underflow = false;
+}
+
+size_t TsCodec_WriterLength(const ts_bit_writer_t *writer)
+{
+	return (writer->bits + 7) / 8;
+}
+
+// Delta-of-delta buckets: prefix, prefix length, value bits and the lowest value held
+static const struct {
+	uint8_t prefix;
+	uint8_t prefixBits;
+	uint8_t valueBits;
+	int32_t minimum;
+} dodBuckets[] = {
+	{ 0x2, 2, 7, -63 },
+	{ 0x6, 3, 9, -255 },
+	{ 0xe, 4, 12, -2047 }
+};
+
+size_t TsCodec_PutTimestamp(ts_dod_state_t *state, ts_bit_writer_t *writer, int64_t value)
+{
+	const uint32_t index = state->count++;
+	const int64_t delta = value - state->previous;
+	state->previous = value;
+
+	if (index == 0) {
+		return putVarint(writer, value);
+	}
+	if (index == 1) {
+		state->previousDelta = delta;
+		return putVarint(writer, delta);
+	}
+
+	const int64_t dod = delta - state->previousDelta;
+	state->previousDelta = delta;
+	if (dod == 0) {
+		putBits(writer, 0, 1);
+		return 1;
+	}
+	for (size_t b = 0; b < sizeof(dodBuckets) / sizeof(dodBuckets[0]); b++) {
+		const int64_t offset = dod - dodBuckets[b].minimum;
+		if (offset >= 0 && offset < (1 << dodBuckets[b].valueBits)) {
+			putBits(writer, dodBuckets[b].prefix, dodBuckets[b].prefixBits);
+			putBits(writer, (uint64_t)offset, dodBuckets[b].valueBits);
+			return (size_t)dodBuckets[b].prefixBits + dodBuckets[b].valueBits;
+		}
+	}
+	putBits(writer, 0xf, 4);
+	putBits(writer, (uint32_t)(int32_t)dod, 32);
+	return 36;
+}
+
+int TsCodec_GetTimestamp(ts_dod_state_t *state, ts_bit_reader_t *reader, int64_t *value)
+{
+	const uint32_t index = state->count++;
+	int64_t delta;
+
+	if (index == 0) {
+		if (getVarint(reader, &state->previous) != 0) {
+			return -1;
+		}
+		*value = state->previous;
+		return 0;
+	}
+	if (index == 1) {
+		if (getVarint(reader, &delta) != 0) {
+			return -1;
+		}
+	}
+	else {
+		int64_t dod;
+
+		// The prefix is a run of ones ended by a zero (or four ones)
+		unsigned ones = 0;
+		while (ones < 4 && getBits(reader, 1) == 1) {
+			ones++;
+		}
+		if (ones == 0) {
+			dod = 0;
+		}
+		else if (ones < 4) {
+			dod = (int64_t)getBits(reader, dodBuckets[ones - 1].valueBits) + dodBuckets[ones - 1].minimum;
+		}
+		else {
+			dod = (int32_t)(uint32_t)getBits(reader, 32);
+		}
+		if (reader->underflow) {
+			return -1;
+		}
+		delta = state->previousDelta + dod;
+	}
+
+	state->previousDelta = delta;
+	state->previous += delta;
+	*value = state->previous;
+	return 0;
+}
+
+size_t TsCodec_PutFixed(ts_delta_state_t *state, ts_bit_writer_t *writer, int64_t value)
+{
+	const int64_t delta = (state->count++ == 0) ? value : value - state->previous;
+	state->previous = value;
+	return putVarint(writer, delta);
+}
+
+int TsCodec_GetFixed(ts_delta_state_t *state, ts_bit_reader_t *reader, int64_t *value)
+{
+	int64_t delta;
+	if (getVarint(reader, &delta) != 0) {
+		return -1;
+	}
+	state->previous = (state->count++ == 0) ? delta : state->previous + delta;
+	*value = state->previous;
+	return 0;
+}
+
+static unsigned leadingZeros(uint32_t value)
+{
+	return (value == 0) ? 32u : (unsigned)__builtin_clz(value);
+}
+
+static unsigned trailingZeros(uint32_t value)
+{
+	return (value == 0) ? 32u : (unsigned)__builtin_ctz(value);
+}
+
+size_t TsCodec_PutFloat(ts_xor_state_t *state, ts_bit_writer_t *writer, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	if (state->count++ == 0) {
+		state->previous = bits;
+		// No window yet, the first non-zero XOR always writes its own
+		state->leading = 32;
+		state->trailing = 0;
+		putBits(writer, bits, 32);
+		return 32;
+	}
+
+	const uint32_t x = bits ^ state->previous;
+	state->previous = bits;
+	if (x == 0) {
+		putBits(writer, 0, 1);
+		return 1;
+	}
+
+	const unsigned leading = leadingZeros(x);
+	const unsigned trailing = trailingZeros(x);
+
+	if (state->leading < 32 && leading >= state->leading && trailing >= state->trailing) {
+		const unsigned meaningful = 32 - state->leading - state->trailing;
+		putBits(writer, 0x2, 2);
+		putBits(writer, x >> state->trailing, meaningful);
+		return 2 + meaningful;
+	}
+
+	const unsigned meaningful = 32 - leading - trailing;
+	putBits(writer, 0x3, 2);
+	putBits(writer, leading, 5);
+	putBits(writer, meaningful - 1, 5);
+	putBits(writer, x >> trailing, meaningful);
+	state->leading = (uint8_t)leading;
+	state->trailing = (uint8_t)trailing;
+	return 12 + meaningful;
+}
+
+int TsCodec_GetFloat(ts_xor_state_t *state, ts_bit_reader_t *reader, float *value)
+{
+	if (state->count++ == 0) {
+		state->previous = (uint32_t)getBits(reader, 32);
+		state->leading = 32;
+		state->trailing = 0;
+	}
+	else if (getBits(reader, 1) == 1) {
+		uint32_t x;
+		if (getBits(reader, 1) == 0) {
+			const unsigned meaningful = 32u - state->leading - state->trailing;
+			x = (uint32_t)getBits(reader, meaningful) << state->trailing;
+		}
+		else {
+			const unsigned leading = (unsigned)getBits(reader, 5);
+			const unsigned meaningful = (unsigned)getBits(reader, 5) + 1;
+			const unsigned trailing = 32u - leading - meaningful;
+			x = (uint32_t)getBits(reader, meaningful) << trailing;
+			state->leading = (uint8_t)leading;
+			state->trailing = (uint8_t)trailing;
+		}
+		state->previous ^= x;
+	}
+	if (reader->underflow) {
+		return -1;
+	}
+
+	memcpy(value, &state->previous, sizeof(*value));
+	return 0;
+}
+
+int TsCodec_EncodeBlock(uint8_t *buffer, size_t size, const uint32_t *timestamps, const int32_t *columns,
+	size_t stride, int columnCount, uint16_t count)
+{
+	ts_bit_writer_t writer;
+	TsCodec_InitWriter(&writer, buffer, size);
+
+	ts_dod_state_t time = { 0 };
+	for (uint16_t i = 0; i < count; i++) {
+		TsCodec_PutTimestamp(&time, &writer, timestamps[i]);
+	}
+	for (int c = 0; c < columnCount; c++) {
+		ts_delta_state_t column = { 0 };
+		for (uint16_t i = 0; i < count; i++) {
+			TsCodec_PutFixed(&column, &writer, columns[(size_t)c * stride + i]);
+		}
+	}
+
+	return writer.overflow ? -1 : (int)TsCodec_WriterLength(&writer);
+}
+
+int TsCodec_DecodeBlock(const uint8_t *buffer, size_t length, uint32_t *timestamps, int32_t *columns, size_t stride,
+	int columnCount, uint16_t count)
+{
+	ts_bit_reader_t reader;
+	TsCodec_InitReader(&reader, buffer, length);
+	int64_t value;
+
+	ts_dod_state_t time = { 0 };
+	for (uint16_t i = 0; i < count; i++) {
+		if (TsCodec_GetTimestamp(&time, &reader, &value) != 0) {
+			return -1;
+		}
+		timestamps[i] = (uint32_t)value;
+	}
+	for (int c = 0; c < columnCount; c++) {
+		ts_delta_state_t column = { 0 };
+		for (uint16_t i = 0; i < count; i++) {
+			if (TsCodec_GetFixed(&column, &reader, &value) != 0) {
+				return -1;
+			}
+			columns[(size_t)c * stride + i] = (int32_t)value;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/************************************************************************************************
+   Time-series compression for telemetry blocks.  Three streaming coders share one bit stream
+   (most significant bit first):
+
+   Timestamps, delta-of-delta:  the first value and the first delta as zig-zag varints, then
+      each delta-of-delta D as
+         0                      D == 0
+         10   + 7 bits          -63 <= D <= 64
+         110  + 9 bits          -255 <= D <= 256
+         1110 + 12 bits         -2047 <= D <= 2048
+         1111 + 32 bits         anything else
+   Fixed-point values: the first value then each delta as a zig-zag varint, 7 bits per group
+      with a continuation bit in front, least significant group first.
+   Floats, Gorilla XOR: the first value's 32 bits, then the XOR with the previous value as
+         0                      XOR == 0
+         10 + meaningful bits   the XOR fits the previous leading/trailing zero window
+         11 + 5 bits leading zeros + 5 bits (meaningful length - 1) + meaningful bits
+
+   Nothing here depends on the device, so the same file builds into the backend decoder.
+*************************************************************************************************/
+
+typedef struct {
+	uint8_t *buffer;
+	size_t size;
+	size_t bits;
+	bool overflow;
+} ts_bit_writer_t;
+
+typedef struct {
+	const uint8_t *buffer;
+	size_t size;
+	size_t bits;
+	bool underflow;
+} ts_bit_reader_t;
+
+// Coder state, one per column.  Zero it at the start of a block.
+typedef struct {
+	uint32_t count;
+	int64_t previous;
+	int64_t previousDelta;
+} ts_dod_state_t;
+
+typedef struct {
+	uint32_t count;
+	int64_t previous;
+} ts_delta_state_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t previous;
+	uint8_t leading;
+	uint8_t trailing;
+} ts_xor_state_t;
+
+void TsCodec_InitWriter(ts_bit_writer_t *writer, uint8_t *buffer, size_t size);
+
+void TsCodec_InitReader(ts_bit_reader_t *reader, const uint8_t *buffer, size_t size);
+
+/// <summary>
+///     Bytes written so far, the last one padded with zero bits.
+/// </summary>
+size_t TsCodec_WriterLength(const ts_bit_writer_t *writer);
+
+/// <summary>
+///     Encodes the next value of a column.  With a NULL writer only the state is advanced, which
+///     gives the exact size of a block as it is built.
+/// </summary>
+/// <returns>The number of bits the value takes</returns>
+size_t TsCodec_PutTimestamp(ts_dod_state_t *state, ts_bit_writer_t *writer, int64_t value);
+size_t TsCodec_PutFixed(ts_delta_state_t *state, ts_bit_writer_t *writer, int64_t value);
+size_t TsCodec_PutFloat(ts_xor_state_t *state, ts_bit_writer_t *writer, float value);
+
+/// <summary>
+///     Decodes the next value of a column.
+/// </summary>
+/// <returns>0 on success, or -1 if the stream ended early</returns>
+int TsCodec_GetTimestamp(ts_dod_state_t *state, ts_bit_reader_t *reader, int64_t *value);
+int TsCodec_GetFixed(ts_delta_state_t *state, ts_bit_reader_t *reader, int64_t *value);
+int TsCodec_GetFloat(ts_xor_state_t *state, ts_bit_reader_t *reader, float *value);
+
+/// <summary>
+///     Encodes a block: count timestamps, then each of columnCount fixed-point columns, column
+///     by column.  Column c's values are columns[c * stride + i].
+/// </summary>
+/// <returns>The block length in bytes, or -1 if it did not fit</returns>
+int TsCodec_EncodeBlock(uint8_t *buffer, size_t size, const uint32_t *timestamps, const int32_t *columns,
+	size_t stride, int columnCount, uint16_t count);
+
+/// <summary>
+///     Decodes a block written by TsCodec_EncodeBlock() with the same count and column count.
+/// </summary>
+/// <returns>0 on success, or -1 if the block is short</returns>
+int TsCodec_DecodeBlock(const uint8_t *buffer, size_t length, uint32_t *timestamps, int32_t *columns, size_t stride,
+	int columnCount, uint16_t count);
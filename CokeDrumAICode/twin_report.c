@@ -0,0 +1,212 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "twin_report.h"
+
+/// <summary>
+///     One reported property: its latest value, and what the hub has of it.
+/// </summary>
+typedef struct {
+	char key[TWIN_REPORT_KEY_SIZE];
+	char value[TWIN_REPORT_VALUE_SIZE];
+	int8_t large;                  // largeValues[] slot holding the value instead, -1 if none
+	uint32_t hash;                 // Of value
+	uint32_t sentHash;             // Of the value in flight
+	uint32_t ackedHash;            // Of the value last acknowledged
+	bool acked;
+	bool dirty;                    // value hasn't been sent
+	int8_t patch;                  // Patch slot it is in flight in, -1 if none
+} twin_property_t;
+
+typedef struct {
+	bool inFlight;
+	uint32_t id;
+	uint64_t properties;           // A bit per properties[] index
+} twin_patch_t;
+
+_Static_assert(TWIN_REPORT_MAX_PROPERTIES <= 64, "twin_patch_t.properties has a bit per property");
+
+static twin_property_t properties[TWIN_REPORT_MAX_PROPERTIES];
+static unsigned propertyCount = 0;
+static char largeValues[TWIN_REPORT_LARGE_VALUES][TWIN_REPORT_LARGE_VALUE_SIZE];
+static unsigned largeValueCount = 0;
+static twin_patch_t patches[TWIN_REPORT_MAX_PATCHES];
+static uint32_t nextPatchId = 1;
+static twin_report_stats_t stats;
+
+static uint32_t fnv1a(const char *text)
+{
+	uint32_t hash = 2166136261u;
+	for (const char *c = text; *c != '\0'; c++) {
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
+	}
+	return hash;
+}
+
+static char *propertyValue(twin_property_t *property)
+{
+	return (property->large >= 0) ? largeValues[property->large] : property->value;
+}
+
+static twin_property_t *findProperty(const char *key)
+{
+	for (unsigned i = 0; i < propertyCount; i++) {
+		if (strcmp(properties[i].key, key) == 0) {
+			return &properties[i];
+		}
+	}
+	if (propertyCount == TWIN_REPORT_MAX_PROPERTIES || strlen(key) >= TWIN_REPORT_KEY_SIZE) {
+		return NULL;
+	}
+
+	twin_property_t *property = &properties[propertyCount++];
+	memset(property, 0, sizeof(*property));
+	strcpy(property->key, key);
+	property->large = -1;
+	property->patch = -1;
+	return property;
+}
+
+int TwinReport_Set(const char *key, const char *valueJson)
+{
+	stats.set++;
+	const size_t length = strlen(valueJson);
+	if (length >= TWIN_REPORT_LARGE_VALUE_SIZE) {
+		return -1;
+	}
+	twin_property_t *property = findProperty(key);
+	if (property == NULL) {
+		return -1;
+	}
+	if (length >= TWIN_REPORT_VALUE_SIZE && property->large < 0) {
+		if (largeValueCount == TWIN_REPORT_LARGE_VALUES) {
+			return -1;
+		}
+		property->large = (int8_t)largeValueCount++;
+	}
+
+	// Compared with what the hub will have once anything in flight lands
+	const uint32_t hash = fnv1a(valueJson);
+	const bool reported = (property->patch >= 0) || property->acked;
+	const uint32_t reportedHash = (property->patch >= 0) ? property->sentHash : property->ackedHash;
+	if (property->dirty && hash == property->hash) {
+		stats.unchanged++;
+		return 0;
+	}
+
+	strcpy(propertyValue(property), valueJson);
+	property->hash = hash;
+	property->dirty = !(reported && hash == reportedHash);
+	if (!property->dirty) {
+		stats.unchanged++;
+	}
+	return 0;
+}
+
+size_t TwinReport_BuildPatch(char *buffer, size_t size, uint32_t *patchId)
+{
+	twin_patch_t *patch = NULL;
+	for (int i = 0; i < TWIN_REPORT_MAX_PATCHES && patch == NULL; i++) {
+		if (!patches[i].inFlight) {
+			patch = &patches[i];
+		}
+	}
+	if (patch == NULL || size < 3) {
+		return 0;
+	}
+
+	// A property changed while in flight waits for that patch's answer, so patches stay in order
+	size_t length = 1;
+	buffer[0] = '{';
+	patch->properties = 0;
+	for (unsigned i = 0; i < propertyCount; i++) {
+		twin_property_t *property = &properties[i];
+		if (!property->dirty || property->patch >= 0) {
+			continue;
+		}
+		// Leave room for the closing brace
+		int added = snprintf(buffer + length, size - length - 1, "%s\"%s\": %s", (length > 1) ? ", " : "",
+			property->key, propertyValue(property));
+		if (added < 0 || (size_t)added >= size - length - 1) {
+			continue;
+		}
+		length += (size_t)added;
+		property->dirty = false;
+		property->sentHash = property->hash;
+		property->patch = (int8_t)(patch - patches);
+		patch->properties |= 1ull << i;
+		stats.properties++;
+	}
+	if (patch->properties == 0) {
+		return 0;
+	}
+	buffer[length++] = '}';
+	buffer[length] = '\0';
+
+	patch->inFlight = true;
+	patch->id = nextPatchId++;
+	if (nextPatchId == 0) {
+		nextPatchId = 1;
+	}
+	*patchId = patch->id;
+	stats.patches++;
+	return length;
+}
+
+void TwinReport_Confirm(uint32_t patchId, bool accepted)
+{
+	for (int p = 0; p < TWIN_REPORT_MAX_PATCHES; p++) {
+		twin_patch_t *patch = &patches[p];
+		if (!patch->inFlight || patch->id != patchId) {
+			continue;
+		}
+
+		for (unsigned i = 0; i < propertyCount; i++) {
+			if ((patch->properties & (1ull << i)) == 0) {
+				continue;
+			}
+			twin_property_t *property = &properties[i];
+			property->patch = -1;
+			if (accepted) {
+				property->acked = true;
+				property->ackedHash = property->sentHash;
+			}
+			else if (!property->dirty) {
+				// value is still the one that failed
+				property->dirty = true;
+			}
+		}
+		patch->inFlight = false;
+		if (accepted) {
+			stats.acknowledged++;
+		}
+		else {
+			stats.failed++;
+		}
+		return;
+	}
+}
+
+bool TwinReport_HasChanges(void)
+{
+	for (unsigned i = 0; i < propertyCount; i++) {
+		if (properties[i].dirty && properties[i].patch < 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void TwinReport_GetStats(twin_report_stats_t *out)
+{
+	*out = stats;
+	out->inFlight = 0;
+	for (int p = 0; p < TWIN_REPORT_MAX_PATCHES; p++) {
+		if (patches[p].inFlight) {
+			out->inFlight++;
+		}
+	}
+}
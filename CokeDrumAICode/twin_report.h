@@ -0,0 +1,65 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Reported properties tracked, their name and JSON value sizes, and patches in flight at once.
+// Most values are a number or a short IoT Central echo and fit TWIN_REPORT_VALUE_SIZE; a longer
+// one takes one of the large slots and keeps it.
+#define TWIN_REPORT_MAX_PROPERTIES 40
+#define TWIN_REPORT_KEY_SIZE 32
+#define TWIN_REPORT_VALUE_SIZE 96
+#define TWIN_REPORT_MAX_PATCHES 4
+
+// sendWindow, hubQuota and acquisition need hundreds of bytes, and one is left for a long string
+#define TWIN_REPORT_LARGE_VALUES 4
+#define TWIN_REPORT_LARGE_VALUE_SIZE 768
+
+// Reported properties besides the twinArray echoes: ssid, freq, bssid and versionString
+// (main.c), sendWindow and hubQuota (azure_iot_utilities.c) and acquisition (i2c.c).
+// device_twin.c checks that these and twinArray fit TWIN_REPORT_MAX_PROPERTIES.
+#define TWIN_REPORT_FIXED_PROPERTIES 7
+
+typedef struct {
+	uint32_t set;                  // TwinReport_Set() calls
+	uint32_t unchanged;            // Of those, dropped as already reported or pending
+	uint32_t patches;
+	uint32_t properties;           // Sent in the patches
+	uint32_t acknowledged;
+	uint32_t failed;
+	uint8_t inFlight;
+} twin_report_stats_t;
+
+/// <summary>
+///     Records the latest value of a reported property, to go out in the next patch.  A value
+///     the hub has already acknowledged, or that is already waiting or in flight, is dropped.
+/// </summary>
+/// <param name="valueJson">The value as JSON text, e.g. 42, "text" or {"value": 1}</param>
+/// <returns>0 on success, or -1 if the property table or the large slots are full, or the
+/// value is longer than TWIN_REPORT_LARGE_VALUE_SIZE</returns>
+int TwinReport_Set(const char *key, const char *valueJson);
+
+/// <summary>
+///     Merges every changed property into one patch, {"key": value, ...}, and marks them in
+///     flight.  Properties that don't fit wait for the next patch.
+/// </summary>
+/// <param name="patchId">Receives the ID to confirm the patch with, never 0</param>
+/// <returns>The patch length, or 0 if nothing changed or every patch slot is in flight</returns>
+size_t TwinReport_BuildPatch(char *buffer, size_t size, uint32_t *patchId);
+
+/// <summary>
+///     Records the hub's answer to a patch.  A failed patch's properties are sent again unless
+///     they have changed since.
+/// </summary>
+void TwinReport_Confirm(uint32_t patchId, bool accepted);
+
+/// <summary>
+///     Whether any property is waiting to be reported.
+/// </summary>
+bool TwinReport_HasChanges(void);
+
+void TwinReport_GetStats(twin_report_stats_t *stats);
@@ -0,0 +1,141 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "accel_range.h"
+#include "waveform_capture.h"
+
+_Static_assert((WAVEFORM_CAPTURE_FRAMES + WAVEFORM_CHUNK_FRAMES - 1) / WAVEFORM_CHUNK_FRAMES <= 32,
+	"Fetched chunks are tracked in a 32 bit mask");
+
+void WaveformCapture_Init(waveform_capture_t *capture, float streamOdr_hz)
+{
+	capture->state = WAVEFORM_CAPTURE_IDLE;
+	capture->streamOdr_hz = streamOdr_hz;
+	capture->decimation = 1;
+	capture->frameCount = 0;
+	capture->frames = NULL;
+}
+
+int WaveformCapture_Start(waveform_capture_t *capture, float duration_s, float odr_hz, time_t utc)
+{
+	if (capture->state == WAVEFORM_CAPTURE_RUNNING || !(duration_s > 0.0f)) {
+		return -1;
+	}
+
+	uint16_t decimation = 1;
+	while (odr_hz > 0.0f && decimation < WAVEFORM_CAPTURE_MAX_DECIMATION &&
+		capture->streamOdr_hz / (float)(decimation * 2) >= odr_hz) {
+		decimation *= 2;
+	}
+	const float frames = ceilf(duration_s * capture->streamOdr_hz / (float)decimation);
+	const uint32_t targetFrames = (frames >= WAVEFORM_CAPTURE_FRAMES) ? WAVEFORM_CAPTURE_FRAMES : (uint32_t)frames;
+
+	// Only as many frames as this capture takes, and only while it is held
+	WaveformCapture_Release(capture);
+	capture->frames = malloc(targetFrames * sizeof(capture->frames[0]));
+	if (capture->frames == NULL) {
+		return -1;
+	}
+
+	capture->decimation = decimation;
+	capture->accumulated = 0;
+	capture->sum[0] = capture->sum[1] = capture->sum[2] = 0;
+	capture->targetFrames = targetFrames;
+	capture->frameCount = 0;
+	capture->chunksFetched = 0;
+	capture->startedAt = utc;
+	capture->id++;
+	capture->state = WAVEFORM_CAPTURE_RUNNING;
+	return 0;
+}
+
+bool WaveformCapture_Push(waveform_capture_t *capture, const int32_t counts[3])
+{
+	if (capture->state != WAVEFORM_CAPTURE_RUNNING) {
+		return false;
+	}
+
+	// At most 16 samples of 2^18 counts, so the sums can't overflow
+	for (int axis = 0; axis < 3; axis++) {
+		capture->sum[axis] += counts[axis];
+	}
+	if (++capture->accumulated < capture->decimation) {
+		return false;
+	}
+
+	int32_t *frame = capture->frames[capture->frameCount++];
+	for (int axis = 0; axis < 3; axis++) {
+		frame[axis] = capture->sum[axis] / capture->decimation;
+		capture->sum[axis] = 0;
+	}
+	capture->accumulated = 0;
+
+	if (capture->frameCount < capture->targetFrames) {
+		return false;
+	}
+	capture->state = WAVEFORM_CAPTURE_READY;
+	return true;
+}
+
+float WaveformCapture_GetOdr(const waveform_capture_t *capture)
+{
+	return capture->streamOdr_hz / (float)capture->decimation;
+}
+
+uint32_t WaveformCapture_ChunkCount(const waveform_capture_t *capture)
+{
+	return (capture->frameCount + WAVEFORM_CHUNK_FRAMES - 1) / WAVEFORM_CHUNK_FRAMES;
+}
+
+int WaveformCapture_FormatChunk(const waveform_capture_t *capture, uint32_t chunk, char *buffer, size_t size)
+{
+	if (capture->state != WAVEFORM_CAPTURE_READY || chunk >= WaveformCapture_ChunkCount(capture) ||
+		size < WAVEFORM_CHUNK_MAX_BYTES) {
+		return -1;
+	}
+	const uint32_t first = chunk * WAVEFORM_CHUNK_FRAMES;
+	const uint32_t count = (capture->frameCount - first < WAVEFORM_CHUNK_FRAMES) ? capture->frameCount - first : WAVEFORM_CHUNK_FRAMES;
+
+	int length = snprintf(buffer, size,
+		"{\"capture\": %u, \"chunk\": %u, \"chunks\": %u, \"first\": %u, \"n\": %u, \"odr\": %.1f, \"t0\": %lld, \"scale\": %.3f",
+		capture->id, chunk, WaveformCapture_ChunkCount(capture), first, count, WaveformCapture_GetOdr(capture),
+		(long long)capture->startedAt, ACCEL_RANGE_NORMALIZED_MG_PER_LSB);
+
+	// Column by column, like the telemetry batches
+	static const char *const axisNames[3] = { "x", "y", "z" };
+	for (int axis = 0; axis < 3 && length > 0 && (size_t)length < size; axis++) {
+		length += snprintf(buffer + length, size - (size_t)length, ", \"%s\": [", axisNames[axis]);
+		for (uint32_t i = 0; i < count && (size_t)length < size; i++) {
+			length += snprintf(buffer + length, size - (size_t)length, (i > 0) ? ", %ld" : "%ld",
+				(long)capture->frames[first + i][axis]);
+		}
+		if ((size_t)length < size) {
+			length += snprintf(buffer + length, size - (size_t)length, "]");
+		}
+	}
+	if (length > 0 && (size_t)length < size) {
+		length += snprintf(buffer + length, size - (size_t)length, "}");
+	}
+	return (length > 0 && (size_t)length < size) ? length : -1;
+}
+
+bool WaveformCapture_MarkFetched(waveform_capture_t *capture, uint32_t chunk)
+{
+	const uint32_t chunks = WaveformCapture_ChunkCount(capture);
+	if (chunk < chunks) {
+		capture->chunksFetched |= 1u << chunk;
+	}
+	return capture->chunksFetched == ((chunks >= 32) ? ~0u : (1u << chunks) - 1u);
+}
+
+void WaveformCapture_Release(waveform_capture_t *capture)
+{
+	free(capture->frames);
+	capture->frames = NULL;
+	capture->frameCount = 0;
+	capture->state = WAVEFORM_CAPTURE_IDLE;
+}
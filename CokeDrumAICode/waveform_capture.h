@@ -0,0 +1,100 @@
+/* Copyright (c) Sean J. Miller
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Accelerometer frames one capture can hold, about 2.5 seconds of the full rate stream.  They
+// are allocated for a capture and freed once it has been fetched, at 12 bytes a frame.
+#define WAVEFORM_CAPTURE_FRAMES 4096
+
+// A finished capture nobody fetches in full is freed after this long
+#define WAVEFORM_CAPTURE_HOLD_SECONDS 600
+
+// Largest capture rate divider.  Rates in between are rounded up to the next available one.
+#define WAVEFORM_CAPTURE_MAX_DECIMATION 16
+
+// Largest chunk of a capture, as formatted JSON.  Every chunk but the last holds
+// WAVEFORM_CHUNK_FRAMES frames, sized so the widest counts still fit.
+#define WAVEFORM_CHUNK_MAX_BYTES 8192
+#define WAVEFORM_CHUNK_HEADER_BYTES 256
+#define WAVEFORM_CHUNK_FRAMES ((WAVEFORM_CHUNK_MAX_BYTES - WAVEFORM_CHUNK_HEADER_BYTES) / (3 * 9))
+
+typedef enum {
+	WAVEFORM_CAPTURE_IDLE = 0,
+	WAVEFORM_CAPTURE_RUNNING,
+	WAVEFORM_CAPTURE_READY
+} waveform_capture_state_t;
+
+/// <summary>
+///     One on-demand burst of the full rate accelerometer stream, in 2g counts
+///     (ACCEL_RANGE_NORMALIZED_MG_PER_LSB).  The frames are on the heap only from the start of
+///     a capture until it is released.  A slower rate averages each run of stream samples into
+///     one frame.
+/// </summary>
+typedef struct {
+	waveform_capture_state_t state;
+	uint32_t id;                   // Counts captures, so a fetch can tell it got the one it asked for
+	float streamOdr_hz;
+	uint16_t decimation;           // Stream samples averaged into a frame
+	uint16_t accumulated;
+	int32_t sum[3];
+	uint32_t targetFrames;
+	uint32_t frameCount;
+	time_t startedAt;
+	uint32_t chunksFetched;        // A bit per chunk handed out
+	int32_t (*frames)[3];          // targetFrames of them, NULL when idle
+} waveform_capture_t;
+
+void WaveformCapture_Init(waveform_capture_t *capture, float streamOdr_hz);
+
+/// <summary>
+///     Starts a capture, replacing any finished one, and allocates its frames.  The rate is the
+///     stream rate divided by the largest power of two that still gives at least odr_hz, and
+///     the duration is cut to WAVEFORM_CAPTURE_FRAMES at that rate.
+/// </summary>
+/// <param name="odr_hz">Frames per second wanted, 0 or less for the full stream rate</param>
+/// <returns>0 on success, or -1 if a capture is running, the duration isn't positive or
+/// there is no memory for the frames</returns>
+int WaveformCapture_Start(waveform_capture_t *capture, float duration_s, float odr_hz, time_t utc);
+
+/// <summary>
+///     Takes one stream sample.
+/// </summary>
+/// <returns>true when this sample completed the capture</returns>
+bool WaveformCapture_Push(waveform_capture_t *capture, const int32_t counts[3]);
+
+/// <summary>
+///     Frames per second of the capture.
+/// </summary>
+float WaveformCapture_GetOdr(const waveform_capture_t *capture);
+
+/// <summary>
+///     Chunks the finished capture is fetched in.
+/// </summary>
+uint32_t WaveformCapture_ChunkCount(const waveform_capture_t *capture);
+
+/// <summary>
+///     Formats one chunk of the finished capture as
+///     {"capture": id, "chunk": n, "chunks": N, "first": frame, "n": frames, "odr": Hz,
+///      "t0": epoch seconds, "scale": mg per count, "x": [...], "y": [...], "z": [...]}
+/// </summary>
+/// <param name="size">At least WAVEFORM_CHUNK_MAX_BYTES</param>
+/// <returns>The length, or -1 if there is no finished capture, no such chunk or no room</returns>
+int WaveformCapture_FormatChunk(const waveform_capture_t *capture, uint32_t chunk, char *buffer, size_t size);
+
+/// <summary>
+///     Notes that a chunk has been handed out.
+/// </summary>
+/// <returns>true once every chunk of the capture has been</returns>
+bool WaveformCapture_MarkFetched(waveform_capture_t *capture, uint32_t chunk);
+
+/// <summary>
+///     Frees the frames and goes back to idle.  The id stays, so a late fetch can be told the
+///     capture is gone.
+/// </summary>
+void WaveformCapture_Release(waveform_capture_t *capture);